@@ -0,0 +1,585 @@
+#include "actuator.h"
+#include "pca9685.h"
+#include "trace.h"
+#include "metrics.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define ACTUATOR_STACK      3072
+
+#define ALL_CHANNELS_IDLE   ((1u << PCA9685_CHANNELS) - 1)   // one board's worth of bits
+#define RING_MASK           (ACTUATOR_QUEUE_LEN - 1)
+#define FLUSH_TIMEOUT_MS    50
+
+_Static_assert((ACTUATOR_QUEUE_LEN & RING_MASK) == 0, "ACTUATOR_QUEUE_LEN must be a power of two");
+
+static const char *TAG = "ACT";
+
+typedef enum {
+    SLOT_IDLE,
+    SLOT_HOLDING,     // driving cmd.off until deadline
+    SLOT_PULSING,     // driving cmd.off until alarm_us
+    SLOT_SETTLING,    // end action applied, waiting out settle_ms
+    SLOT_MOVING,      // following cmd.motion, one sample per frame
+} slot_state_t;
+
+typedef struct {
+    slot_state_t       state;
+    TickType_t         deadline;
+    int64_t            opened_us;     // when the open write completed
+    int64_t            alarm_us;      // ACT_TIMING_PRECISE: close edge minus the expected write time
+    uint16_t           frame;         // SLOT_MOVING: next sample of cmd.motion
+    actuator_cmd_t     cmd;
+} slot_t;
+
+static slot_t slots[PCA9685_MAX_CHANNELS];
+
+// One group per board: an event group has fewer bits than there are channels
+static StaticEventGroup_t idle_group_buf[PCA9685_MAX_DEVICES];
+static EventGroupHandle_t idle_group[PCA9685_MAX_DEVICES];
+
+// Running average of how long the close write takes; a precise pulse
+// is closed this much early so the output changes on time
+static int32_t close_lead_us;
+
+// Next motion frame, INT64_MAX while nothing moves. Frames run on one
+// grid, so motions started together stay in step.
+static int64_t frame_at_us = INT64_MAX;
+
+// The sequence being played, owned by the task
+static struct {
+    actuator_step_fn_t step;
+    void              *arg;
+    int64_t            at_us;
+} seq;
+
+static StaticTask_t task_buf;
+static StackType_t  task_stack[ACTUATOR_STACK];
+static TaskHandle_t task;
+
+// Wakes the task for microsecond deadlines; tick deadlines are its notify timeout
+static esp_timer_handle_t wake_timer;
+static int64_t            wake_at_us = INT64_MAX;
+
+static bool                   stats_enabled = ACTUATOR_PULSE_STATS_DEFAULT;
+static actuator_pulse_stats_t stats[ACT_PULSE_SOURCES];
+static portMUX_TYPE           stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* ---------------- Command Rings ---------------- */
+// One single-producer / single-consumer ring per submitting task, so
+// nothing on either side takes a lock. A task claims the first free
+// ring on its first submit and keeps it, even after it exits. Tasks
+// that find none free share one more ring, pushing under a mutex. The
+// actuator task drains them all.
+typedef struct {
+    bool               is_seq;
+    actuator_cmd_t     cmd;
+    actuator_step_fn_t step;
+    void              *arg;
+} ring_item_t;
+
+typedef struct {
+    atomic_uintptr_t owner;     // producer's TaskHandle_t, 0 while free
+    atomic_uint      head;      // next slot to fill, written by the producer
+    atomic_uint      tail;      // next slot to drain, written by the task
+    ring_item_t      items[ACTUATOR_QUEUE_LEN];
+} ring_t;
+
+static ring_t rings[ACTUATOR_PRODUCERS + 1];          // the last one is shared
+static StaticSemaphore_t shared_lock_buf;
+static SemaphoreHandle_t shared_lock;
+static atomic_bool       shared_warned;
+
+// The calling task's ring, NULL once every ring belongs to another task.
+// A task reusing a deleted owner's handle inherits its ring, which is
+// safe: the old producer can no longer push.
+// Rings are never given back, so a task's own ring comes before any
+// free one and the scan finds it first.
+static ring_t *own_ring(void)
+{
+    uintptr_t me = (uintptr_t)xTaskGetCurrentTaskHandle();
+
+    for (int i = 0; i < ACTUATOR_PRODUCERS; i++) {
+        uintptr_t owner = atomic_load_explicit(&rings[i].owner, memory_order_acquire);
+        if (owner == me) return &rings[i];
+        if (owner == 0 && atomic_compare_exchange_strong(&rings[i].owner, &owner, me)) {
+            return &rings[i];
+        }
+    }
+    return NULL;
+}
+
+static bool ring_push(ring_t *r, const ring_item_t *item)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == ACTUATOR_QUEUE_LEN) return false;
+
+    r->items[head & RING_MASK] = *item;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+static bool ring_pop(ring_t *r, ring_item_t *item)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == head) return false;
+
+    *item = r->items[tail & RING_MASK];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static esp_err_t submit(const ring_item_t *item)
+{
+    ring_t *r = own_ring();
+    bool pushed;
+    if (r) {
+        pushed = ring_push(r, item);
+    } else {
+        if (!atomic_exchange(&shared_warned, true)) {
+            ESP_LOGW(TAG, "More than %d tasks submit, sharing a locked ring", ACTUATOR_PRODUCERS);
+        }
+        xSemaphoreTake(shared_lock, portMAX_DELAY);
+        pushed = ring_push(&rings[ACTUATOR_PRODUCERS], item);
+        xSemaphoreGive(shared_lock);
+    }
+    if (!pushed) return ESP_ERR_NO_MEM;
+
+    xTaskNotifyGive(task);
+    return ESP_OK;
+}
+
+/* ---------------- Pulse Statistics ---------------- */
+static void record(int source, int64_t actual_us, uint32_t commanded_us)
+{
+    int32_t err = (int32_t)(actual_us - commanded_us);
+    uint32_t mag = (err < 0) ? -err : err;
+
+    int bin = 0;
+    while (bin < ACTUATOR_HIST_BINS - 1 && mag >= ((uint32_t)ACTUATOR_HIST_BASE_US << bin)) bin++;
+
+    portENTER_CRITICAL(&stats_lock);
+    actuator_pulse_stats_t *st = &stats[source];
+    if (st->count == 0 || err < st->min_err_us) st->min_err_us = err;
+    if (st->count == 0 || err > st->max_err_us) st->max_err_us = err;
+    st->count++;
+    st->sum_err_us += err;
+    if (err < 0) st->early[bin]++;
+    else st->late[bin]++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// Called right after the end action was written
+static void record_pulse(actuator_timing_t timing, const slot_t *s)
+{
+    if (!stats_enabled || s->cmd.hold_ms == 0 || s->cmd.end == ACT_END_HOLD) return;
+
+    int64_t actual_us = esp_timer_get_time() - s->opened_us;
+    record(timing, actual_us, s->cmd.hold_ms * 1000);
+
+    ESP_LOGD(TAG, "Pulse ch=%u: commanded %lu us, actual %lld us",
+             s->cmd.channel, (unsigned long)s->cmd.hold_ms * 1000, (long long)actual_us);
+}
+
+/* ---------------- Internal Helpers ---------------- */
+#define ch_board(ch)  ((ch) / PCA9685_CHANNELS)
+#define ch_bit(ch)    BIT((ch) % PCA9685_CHANNELS)
+
+static void finish(uint8_t ch, bool mark_idle)
+{
+    slot_t *s = &slots[ch];
+    s->state = SLOT_IDLE;
+    if (s->cmd.done_cb) s->cmd.done_cb(ch, s->cmd.done_arg);
+    if (mark_idle) xEventGroupSetBits(idle_group[ch_board(ch)], ch_bit(ch));
+}
+
+// OFF value the end action writes; the motion's end point for ACT_END_HOLD
+static uint16_t end_value(const slot_t *s)
+{
+    switch (s->cmd.end) {
+    case ACT_END_FULL_OFF: return PCA9685_FULL_OFF;
+    case ACT_END_ZERO:     return 0;
+    default:               return trajectory_at(&s->cmd.motion, s->cmd.motion.frames);
+    }
+}
+
+static void write_end(uint8_t ch)
+{
+    switch (slots[ch].cmd.end) {
+    case ACT_END_FULL_OFF: pca9685_stop_channel(ch);     break;
+    case ACT_END_ZERO:     pca9685_set_pwm(ch, 0, 0);    break;
+    case ACT_END_HOLD:     break;
+    }
+}
+
+static void after_end(uint8_t ch)
+{
+    slot_t *s = &slots[ch];
+
+    if (s->cmd.settle_ms > 0) {
+        s->state = SLOT_SETTLING;
+        s->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(s->cmd.settle_ms);
+    } else {
+        finish(ch, true);
+    }
+}
+
+static void apply_end(uint8_t ch)
+{
+    write_end(ch);
+    record_pulse(ACT_TIMING_TICK, &slots[ch]);
+    after_end(ch);
+}
+
+static void close_pulse(uint8_t ch)
+{
+    int64_t now = esp_timer_get_time();
+    write_end(ch);
+    pca9685_flush(FLUSH_TIMEOUT_MS);    // the edge, not the enqueue
+    TRACE_INSTANT("pulse_close", ch);
+    int32_t took = (int32_t)(esp_timer_get_time() - now);
+    close_lead_us = (close_lead_us * 3 + took) / 4;
+    record_pulse(ACT_TIMING_PRECISE, &slots[ch]);
+    after_end(ch);
+}
+
+static void start(const actuator_cmd_t *cmd)
+{
+    uint8_t ch = cmd->channel;
+    slot_t *s = &slots[ch];
+
+    // Superseded: report the old command done but keep the channel busy
+    if (s->state != SLOT_IDLE) finish(ch, false);
+    xEventGroupClearBits(idle_group[ch_board(ch)], ch_bit(ch));
+
+    s->cmd = *cmd;
+    if (cmd->motion.frames > 0) {
+        s->state = SLOT_MOVING;
+        s->frame = 0;
+        if (frame_at_us == INT64_MAX) frame_at_us = esp_timer_get_time();
+        return;
+    }
+
+    pca9685_set_pwm(ch, 0, cmd->off);
+    // Writes are queued; a precise pulse is timed from when the open lands
+    if (cmd->hold_ms > 0 && cmd->timing == ACT_TIMING_PRECISE) pca9685_flush(FLUSH_TIMEOUT_MS);
+    s->opened_us = esp_timer_get_time();
+
+    if (cmd->hold_ms == 0) {
+        apply_end(ch);
+    } else if (cmd->timing == ACT_TIMING_PRECISE) {
+        // Against the measured open edge, not the tick
+        s->state = SLOT_PULSING;
+        s->alarm_us = s->opened_us + (int64_t)cmd->hold_ms * 1000 - close_lead_us;
+    } else {
+        s->state = SLOT_HOLDING;
+        s->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(cmd->hold_ms);
+    }
+}
+
+// One sample of every moving channel, in a single batched write;
+// the last sample of a motion is its end action
+static void play_frame(void)
+{
+    pca9685_update_t batch[PCA9685_MAX_CHANNELS];
+    uint8_t ended[PCA9685_MAX_CHANNELS];
+    int n = 0, n_ended = 0;
+
+    for (int ch = 0; ch < PCA9685_MAX_CHANNELS; ch++) {
+        slot_t *s = &slots[ch];
+        if (s->state != SLOT_MOVING) continue;
+
+        uint16_t off;
+        if (s->frame < s->cmd.motion.frames) {
+            off = trajectory_at(&s->cmd.motion, s->frame++);
+        } else {
+            off = end_value(s);
+            ended[n_ended++] = ch;
+        }
+        batch[n++] = (pca9685_update_t) { .channel = ch, .on = 0, .off = off };
+    }
+
+    if (n) pca9685_set_pwm_multi(batch, n);
+    TRACE_INSTANT("motion_frame", n);
+    for (int i = 0; i < n_ended; i++) after_end(ended[i]);
+
+    if (n == n_ended) {
+        frame_at_us = INT64_MAX;
+        return;
+    }
+    // Stay on the grid: after a stall the motions resume from their next sample
+    int64_t now = esp_timer_get_time();
+    do frame_at_us += TRAJ_FRAME_US; while (frame_at_us <= now);
+}
+
+// Run the sequence step, the motion frame and close the precise pulses
+// that are due; returns the next such deadline, INT64_MAX if there is none
+static int64_t run_due(void)
+{
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = INT64_MAX;
+        bool ran = false;
+
+        if (seq.step && seq.at_us <= now) {
+            seq.at_us = seq.step(seq.arg);
+            if (seq.at_us == ACTUATOR_SEQ_DONE) seq.step = NULL;
+            ran = true;
+        } else if (seq.step) {
+            next = seq.at_us;
+        }
+
+        if (frame_at_us <= now) {
+            play_frame();
+            ran = true;
+        } else if (frame_at_us < next) {
+            next = frame_at_us;
+        }
+
+        for (int ch = 0; ch < PCA9685_MAX_CHANNELS; ch++) {
+            if (slots[ch].state != SLOT_PULSING) continue;
+            if (slots[ch].alarm_us <= now) {
+                close_pulse(ch);
+                ran = true;
+            } else if (slots[ch].alarm_us < next) {
+                next = slots[ch].alarm_us;
+            }
+        }
+        // Writes take time: whatever fell due meanwhile goes now
+        if (!ran) return next;
+    }
+}
+
+static void arm_wake(int64_t at_us)
+{
+    if (at_us == wake_at_us && (at_us == INT64_MAX || esp_timer_is_active(wake_timer))) return;
+    wake_at_us = at_us;
+    esp_timer_stop(wake_timer);
+    if (at_us == INT64_MAX) return;
+
+    int64_t left = at_us - esp_timer_get_time();
+    esp_timer_start_once(wake_timer, left > 0 ? left : 0);
+}
+
+static void IRAM_ATTR wake_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &woken);
+    if (woken) esp_timer_isr_dispatch_need_yield();
+}
+
+// Ticks until the nearest deadline, or portMAX_DELAY when nothing is timed
+static TickType_t next_wait(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+
+    for (int ch = 0; ch < PCA9685_MAX_CHANNELS; ch++) {
+        slot_state_t st = slots[ch].state;
+        if (st != SLOT_HOLDING && st != SLOT_SETTLING) continue;
+        int32_t left = (int32_t)(slots[ch].deadline - now);
+        if (left <= 0) return 0;
+        if ((TickType_t)left < wait) wait = left;
+    }
+    return wait;
+}
+
+static void expire(void)
+{
+    TickType_t now = xTaskGetTickCount();
+
+    for (int ch = 0; ch < PCA9685_MAX_CHANNELS; ch++) {
+        slot_t *s = &slots[ch];
+        if (s->state != SLOT_HOLDING && s->state != SLOT_SETTLING) continue;
+        if ((int32_t)(s->deadline - now) > 0) continue;
+
+        if (s->state == SLOT_HOLDING) apply_end(ch);
+        else finish(ch, true);
+    }
+}
+
+static void actuator_task(void *arg)
+{
+    ring_item_t item;
+
+    metrics_heap_watch_task();
+    while (1) {
+        for (int i = 0; i <= ACTUATOR_PRODUCERS; i++) {
+            while (ring_pop(&rings[i], &item)) {
+                if (item.is_seq) {
+                    seq.step  = item.step;
+                    seq.arg   = item.arg;
+                    seq.at_us = 0;
+                } else {
+                    start(&item.cmd);
+                }
+            }
+        }
+        arm_wake(run_due());
+        expire();
+        ulTaskNotifyTake(pdTRUE, next_wait());
+    }
+}
+
+/* ---------------- Public API ---------------- */
+esp_err_t actuator_init(void)
+{
+    if (task) return ESP_OK;
+
+    shared_lock = xSemaphoreCreateMutexStatic(&shared_lock_buf);
+    for (int b = 0; b < PCA9685_MAX_DEVICES; b++) {
+        idle_group[b] = xEventGroupCreateStatic(&idle_group_buf[b]);
+        xEventGroupSetBits(idle_group[b], ALL_CHANNELS_IDLE);
+    }
+
+    const esp_timer_create_args_t args = {
+        .callback        = wake_isr,
+        .dispatch_method = ESP_TIMER_ISR,
+        .name            = "actuator",
+    };
+    esp_err_t err = esp_timer_create(&args, &wake_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create wake timer: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    task = xTaskCreateStaticPinnedToCore(actuator_task, "actuator", ACTUATOR_STACK, NULL,
+                                         ACTUATOR_PRIORITY, task_stack, &task_buf, ACTUATOR_CORE);
+    if (!task) {
+        ESP_LOGE(TAG, "Failed to start actuator task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t actuator_submit(const actuator_cmd_t *cmd)
+{
+    if (!task) return ESP_ERR_INVALID_STATE;
+    if (cmd->channel >= PCA9685_MAX_CHANNELS) return ESP_ERR_INVALID_ARG;
+
+    ring_item_t item = { .cmd = *cmd };
+    if (submit(&item) != ESP_OK) {
+        ESP_LOGW(TAG, "Command ring full, dropping ch=%u", cmd->channel);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// actuator_run()'s completion: the caller's own callback, then its wake-up
+typedef struct {
+    actuator_done_cb_t done_cb;
+    void              *done_arg;
+    SemaphoreHandle_t  done;
+} run_wait_t;
+
+static void run_done(uint8_t ch, void *arg)
+{
+    run_wait_t *w = arg;
+    if (w->done_cb) w->done_cb(ch, w->done_arg);
+    xSemaphoreGive(w->done);
+}
+
+esp_err_t actuator_run(const actuator_cmd_t *cmd)
+{
+    // The actuator task would wait on itself
+    assert(xTaskGetCurrentTaskHandle() != task);
+
+    // Woken by this command's completion, not the channel's idle bit:
+    // until the task dequeues it, the bit still tells of the one before
+    StaticSemaphore_t done_buf;
+    run_wait_t w = {
+        .done_cb  = cmd->done_cb,
+        .done_arg = cmd->done_arg,
+        .done     = xSemaphoreCreateBinaryStatic(&done_buf),
+    };
+    actuator_cmd_t own = *cmd;
+    own.done_cb  = run_done;
+    own.done_arg = &w;
+
+    esp_err_t err = actuator_submit(&own);
+    if (err == ESP_OK) xSemaphoreTake(w.done, portMAX_DELAY);
+    vSemaphoreDelete(w.done);
+    return err;
+}
+
+esp_err_t actuator_sequence_start(actuator_step_fn_t step, void *arg)
+{
+    if (!task) return ESP_ERR_INVALID_STATE;
+
+    ring_item_t item = { .is_seq = true, .step = step, .arg = arg };
+    esp_err_t err = submit(&item);
+    if (err != ESP_OK) ESP_LOGW(TAG, "Command ring full, sequence not started");
+    return err;
+}
+
+EventGroupHandle_t actuator_event_group(uint8_t channel)
+{
+    return channel < PCA9685_MAX_CHANNELS ? idle_group[ch_board(channel)] : NULL;
+}
+
+void actuator_pulse_stats_enable(bool enable)
+{
+    stats_enabled = enable;
+}
+
+void actuator_pulse_stats_add(int source, int64_t actual_us, uint32_t commanded_us)
+{
+    if (!stats_enabled || source < 0 || source >= ACT_PULSE_SOURCES) return;
+    record(source, actual_us, commanded_us);
+}
+
+void actuator_pulse_stats_get(int source, actuator_pulse_stats_t *out)
+{
+    if (source < 0 || source >= ACT_PULSE_SOURCES) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats[source];
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void actuator_pulse_stats_reset(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memset(stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void actuator_pulse_stats_log(void)
+{
+    static const char *names[ACT_PULSE_SOURCES] = { "tick", "precise", "timeline" };
+
+    if (!stats_enabled) return;
+
+    for (int t = 0; t < ACT_PULSE_SOURCES; t++) {
+        actuator_pulse_stats_t st;
+        actuator_pulse_stats_get(t, &st);
+        if (st.count == 0) continue;
+
+        ESP_LOGI(TAG, "Pulses [%s]: n=%lu, error mean %+lld us, min %+ld us, max %+ld us",
+                 names[t], (unsigned long)st.count, (long long)(st.sum_err_us / st.count),
+                 (long)st.min_err_us, (long)st.max_err_us);
+
+        for (int b = 0; b < ACTUATOR_HIST_BINS; b++) {
+            if (!st.early[b] && !st.late[b]) continue;
+            if (b < ACTUATOR_HIST_BINS - 1) {
+                ESP_LOGI(TAG, "  |err| < %6lu us: %5lu early, %5lu late",
+                         (unsigned long)ACTUATOR_HIST_BASE_US << b,
+                         (unsigned long)st.early[b], (unsigned long)st.late[b]);
+            } else {
+                ESP_LOGI(TAG, "  |err| >= %5lu us: %5lu early, %5lu late",
+                         (unsigned long)ACTUATOR_HIST_BASE_US << (b - 1),
+                         (unsigned long)st.early[b], (unsigned long)st.late[b]);
+            }
+        }
+    }
+}
@@ -0,0 +1,205 @@
+#ifndef ACTUATOR_H
+#define ACTUATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "pca9685.h"
+#include "trajectory.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+// =============================================================
+// Actuator motion engine
+// A dedicated task, pinned to its own core, does every PCA9685
+// write after init. Callers post "drive channel X at P for T ms,
+// then stop" commands, or a whole sequence such as a pour
+// timeline, through a lock-free ring of their own (one per
+// submitting task, up to ACTUATOR_PRODUCERS; any more share a
+// locked one) and return at once;
+// completion is reported through a callback and/or the channel's
+// bit in actuator_event_group(). Wi-Fi, lwIP, HTTP, JSON and
+// logging stay on the other core, so network load cannot delay
+// an edge. Channels use the global PCA9685 numbering, so one task
+// drives every board.
+// =============================================================
+
+// Command ring slots, a power of two
+#define ACTUATOR_QUEUE_LEN   32
+
+// Tasks that submit lock-free: each gets its own ring on first use and
+// keeps it; any more share one ring behind a mutex
+#ifndef ACTUATOR_PRODUCERS
+#define ACTUATOR_PRODUCERS   4
+#endif
+
+// The network stack is pinned to core 0 (sdkconfig, NETWORK_CORE)
+#ifndef ACTUATOR_CORE
+#define ACTUATOR_CORE        1
+#endif
+// Above lwIP (18), below the esp_timer task (22) and Wi-Fi (23), which
+// only matters if ACTUATOR_CORE is the network core
+#ifndef ACTUATOR_PRIORITY
+#define ACTUATOR_PRIORITY    20
+#endif
+
+// Pulse timing histogram: bin k counts |actual - commanded| below
+// ACTUATOR_HIST_BASE_US << k, the last bin everything beyond
+#define ACTUATOR_HIST_BINS      12
+#define ACTUATOR_HIST_BASE_US   32
+
+#ifndef ACTUATOR_PULSE_STATS_DEFAULT
+#define ACTUATOR_PULSE_STATS_DEFAULT  0
+#endif
+
+// What the channel does once the hold time has elapsed
+typedef enum {
+    ACT_END_HOLD,       // keep driving the commanded value
+    ACT_END_FULL_OFF,   // full-off bit (servo stop)
+    ACT_END_ZERO,       // 0% duty (solenoid close)
+} actuator_end_t;
+
+// What clock times hold_ms
+typedef enum {
+    ACT_TIMING_TICK,      // actuator task deadline, rounded to the RTOS tick
+    ACT_TIMING_PRECISE,   // microsecond deadline; an ISR timer wakes the task to write the end action
+    ACT_TIMING_COUNT,
+} actuator_timing_t;
+
+// Pulse statistics are kept per timing, plus one set for the solenoid
+// pulses of pour timelines (pour_timeline.h)
+#define ACT_PULSES_TIMELINE  ACT_TIMING_COUNT
+#define ACT_PULSE_SOURCES    (ACT_TIMING_COUNT + 1)
+
+typedef void (*actuator_done_cb_t)(uint8_t channel, void *arg);
+
+typedef struct {
+    uint8_t            channel;
+    uint16_t           off;        // OFF count while active (ON is 0)
+    uint32_t           hold_ms;    // how long to drive before the end action
+    actuator_end_t     end;
+    actuator_timing_t  timing;
+    uint32_t           settle_ms;  // extra wait after the end action before completion
+    actuator_done_cb_t done_cb;    // optional, runs in the actuator task: must not block
+    void              *done_arg;
+    trajectory_t       motion;     // frames > 0: follow it, then the end action; off and hold_ms unused
+} actuator_cmd_t;
+
+/**
+ * @brief Start the actuator task on ACTUATOR_CORE. Call after pca9685_init().
+ */
+esp_err_t actuator_init(void);
+
+/**
+ * @brief Queue a command and return immediately.
+ *
+ * A new command on a channel that is still busy replaces the old one;
+ * the old one is reported complete at that point. Motions start on the
+ * next frame, and every moving channel is written in one batch per frame.
+ *
+ * @return ESP_OK if queued,
+ *         ESP_ERR_INVALID_STATE if actuator_init() has not run,
+ *         ESP_ERR_INVALID_ARG on a bad channel,
+ *         ESP_ERR_NO_MEM if the ring is full.
+ */
+esp_err_t actuator_submit(const actuator_cmd_t *cmd);
+
+/**
+ * @brief Queue a command and block until it completes.
+ *
+ * Waits for this command, not the channel: it returns when the command
+ * ends, settle time included, or is replaced by a newer one. A done_cb
+ * in cmd still runs first. Used by the legacy blocking helpers
+ * (servo_rotate_cw, solenoid_pulse, ...).
+ *
+ * Never call it from the actuator task (a done_cb or a sequence step):
+ * the command could only complete in the task that is waiting for it.
+ * That is asserted.
+ */
+esp_err_t actuator_run(const actuator_cmd_t *cmd);
+
+// Returned by a sequence step that has nothing more to do
+#define ACTUATOR_SEQ_DONE  (-1LL)
+
+/**
+ * @brief One step of a sequence, run in the actuator task.
+ *
+ * @return When to run the next step (esp_timer_get_time() clock), or
+ *         ACTUATOR_SEQ_DONE.
+ */
+typedef int64_t (*actuator_step_fn_t)(void *arg);
+
+/**
+ * @brief Run step(arg) in the actuator task now, then again at every time
+ *        it returns, until it returns ACTUATOR_SEQ_DONE.
+ *
+ * One sequence runs at a time; starting another replaces it. Commands
+ * keep running alongside.
+ *
+ * @return ESP_OK if queued,
+ *         ESP_ERR_INVALID_STATE if actuator_init() has not run,
+ *         ESP_ERR_NO_MEM if the ring is full.
+ */
+esp_err_t actuator_sequence_start(actuator_step_fn_t step, void *arg);
+
+// Bit of a channel in its actuator_event_group()
+#define ACTUATOR_IDLE_BIT(channel)  BIT((channel) % PCA9685_CHANNELS)
+
+/**
+ * @brief Idle event group of the board that owns a channel.
+ *
+ * ACTUATOR_IDLE_BIT(channel) is cleared when the task starts a command
+ * on the channel and set when the channel goes idle, so it can still be
+ * set just after actuator_submit(): wait on a command through its done_cb
+ * or actuator_run(). Each board has its own group, since 64 channels do
+ * not fit in one.
+ *
+ * @return NULL on a bad channel.
+ */
+EventGroupHandle_t actuator_event_group(uint8_t channel);
+
+typedef struct {
+    uint32_t count;
+    int32_t  min_err_us;                    // actual - commanded
+    int32_t  max_err_us;
+    int64_t  sum_err_us;
+    uint32_t early[ACTUATOR_HIST_BINS];     // closed before the commanded time
+    uint32_t late[ACTUATOR_HIST_BINS];      // closed on time or after
+} actuator_pulse_stats_t;
+
+/**
+ * @brief Record the open duration of every timed pulse.
+ *
+ * Covers commands with hold_ms > 0 that end in ACT_END_ZERO or
+ * ACT_END_FULL_OFF. For ACT_TIMING_PRECISE the duration runs from the
+ * completed open write to the completed close write, i.e. what the output
+ * pin actually saw; tick-timed pulses are measured between the queued
+ * writes, which land a constant bus time later.
+ * Defaults to ACTUATOR_PULSE_STATS_DEFAULT.
+ */
+void actuator_pulse_stats_enable(bool enable);
+
+/**
+ * @brief Record a pulse timed outside the actuator commands.
+ *
+ * @param source ACT_PULSES_TIMELINE, or an actuator_timing_t.
+ */
+void actuator_pulse_stats_add(int source, int64_t actual_us, uint32_t commanded_us);
+
+/**
+ * @brief Copy the histogram for one source (an actuator_timing_t or
+ *        ACT_PULSES_TIMELINE).
+ */
+void actuator_pulse_stats_get(int source, actuator_pulse_stats_t *out);
+
+/**
+ * @brief Clear all histograms.
+ */
+void actuator_pulse_stats_reset(void);
+
+/**
+ * @brief Log the histograms that have samples. No-op while disabled.
+ */
+void actuator_pulse_stats_log(void);
+
+#endif // ACTUATOR_H
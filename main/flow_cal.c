@@ -0,0 +1,268 @@
+#include "flow_cal.h"
+#include "pour_scheduler.h"
+#include "servo_control.h"
+#include "http_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CAL_NAMESPACE   "flow"
+#define CAL_VERSION     1
+
+static const char *TAG = "FLOW";
+
+// As stored in NVS. Zeroed before filling so unused points compare equal.
+typedef struct {
+    uint8_t      version;
+    flow_curve_t curve;
+} flow_blob_t;
+
+static flow_curve_t curves[POUR_MAX_PORTS];
+
+/* ---------------- Storage ---------------- */
+static void port_key(uint8_t port, char key[8])
+{
+    snprintf(key, 8, "port%u", port);
+}
+
+static bool curve_valid(const flow_curve_t *c)
+{
+    if (c->n_points < 1 || c->n_points > FLOW_CAL_MAX_POINTS) return false;
+    for (int i = 0; i < c->n_points; i++) {
+        if (c->points[i].volume_dml == 0) return false;
+        if (i > 0 && (c->points[i].volume_dml <= c->points[i - 1].volume_dml ||
+                      c->points[i].flow_ms < c->points[i - 1].flow_ms)) return false;
+    }
+    return true;
+}
+
+esp_err_t flow_cal_init(void)
+{
+    memset(curves, 0, sizeof(curves));
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(CAL_NAMESPACE, NVS_READONLY, &h);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "No ports calibrated, using %d ms/ml", POUR_MS_PER_ML);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) return err;
+
+    int loaded = 0;
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        char key[8];
+        port_key(p, key);
+        flow_blob_t blob;
+        size_t len = sizeof(blob);
+        if (nvs_get_blob(h, key, &blob, &len) != ESP_OK) continue;
+        if (len != sizeof(blob) || blob.version != CAL_VERSION || !curve_valid(&blob.curve)) {
+            ESP_LOGW(TAG, "Port %d: stored calibration unusable, ignoring it", p);
+            continue;
+        }
+        curves[p] = blob.curve;
+        loaded++;
+    }
+    nvs_close(h);
+
+    ESP_LOGI(TAG, "%d port(s) calibrated, others at %d ms/ml", loaded, POUR_MS_PER_ML);
+    return ESP_OK;
+}
+
+esp_err_t flow_cal_set(uint8_t port, const flow_curve_t *curve)
+{
+    if (port >= POUR_MAX_PORTS || !curve_valid(curve)) return ESP_ERR_INVALID_ARG;
+
+    flow_blob_t blob;
+    memset(&blob, 0, sizeof(blob));
+    blob.version = CAL_VERSION;
+    blob.curve.dead_ms = curve->dead_ms;
+    blob.curve.n_points = curve->n_points;
+    memcpy(blob.curve.points, curve->points, curve->n_points * sizeof(flow_point_t));
+
+    char key[8];
+    port_key(port, key);
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(CAL_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, key, &blob, sizeof(blob));
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Port %u: storing calibration failed: %s", port, esp_err_to_name(err));
+        return err;
+    }
+    curves[port] = blob.curve;
+    return ESP_OK;
+}
+
+void flow_cal_get(uint8_t port, flow_curve_t *out)
+{
+    if (port < POUR_MAX_PORTS) *out = curves[port];
+    else memset(out, 0, sizeof(*out));
+}
+
+esp_err_t flow_cal_reset(uint8_t port)
+{
+    if (port >= POUR_MAX_PORTS) return ESP_ERR_INVALID_ARG;
+    memset(&curves[port], 0, sizeof(curves[port]));
+
+    char key[8];
+    port_key(port, key);
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(CAL_NAMESPACE, NVS_READWRITE, &h);
+    if (err != ESP_OK) return err;
+    err = nvs_erase_key(h, key);
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+/* ---------------- Model ---------------- */
+uint32_t flow_cal_ms(uint8_t port, uint32_t volume_ml)
+{
+    if (port >= POUR_MAX_PORTS || curves[port].n_points == 0) return volume_ml * POUR_MS_PER_ML;
+    if (volume_ml == 0) return 0;
+
+    const flow_curve_t *c = &curves[port];
+    uint32_t v = volume_ml * 10;
+
+    // Segment that holds v, or the last one to extrapolate along
+    uint32_t v0 = 0, t0 = 0;
+    int i = 0;
+    while (i < c->n_points - 1 && v > c->points[i].volume_dml) {
+        v0 = c->points[i].volume_dml;
+        t0 = c->points[i].flow_ms;
+        i++;
+    }
+    uint32_t v1 = c->points[i].volume_dml, t1 = c->points[i].flow_ms;
+
+    // Rounded to the nearest millisecond
+    uint64_t flow = t0 + ((uint64_t)(v - v0) * (t1 - t0) + (v1 - v0) / 2) / (v1 - v0);
+    return c->dead_ms + (uint32_t)flow;
+}
+
+esp_err_t flow_cal_fit(const uint32_t *open_ms, const uint16_t *volume_dml, int n,
+                       flow_curve_t *out)
+{
+    if (n < 2 || n > FLOW_CAL_MAX_POINTS) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < n; i++) {
+        if (volume_dml[i] == 0) return ESP_ERR_INVALID_ARG;
+        if (i > 0 && (open_ms[i] <= open_ms[i - 1] || volume_dml[i] <= volume_dml[i - 1])) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // Zero-volume intercept of the line through the two shortest pulses
+    int32_t dt = (int32_t)(open_ms[1] - open_ms[0]);
+    int32_t dv = volume_dml[1] - volume_dml[0];
+    int32_t dead = (int32_t)open_ms[0] - (volume_dml[0] * dt + dv / 2) / dv;
+    if (dead < 0) dead = 0;
+    if (dead >= (int32_t)open_ms[0]) dead = open_ms[0] - 1;
+
+    memset(out, 0, sizeof(*out));
+    out->dead_ms = (uint16_t)dead;
+    out->n_points = n;
+    for (int i = 0; i < n; i++) {
+        out->points[i].volume_dml = volume_dml[i];
+        out->points[i].flow_ms = (uint16_t)(open_ms[i] - dead);
+    }
+    return ESP_OK;
+}
+
+/* ---------------- Calibration Utility ---------------- */
+// Read "12.5" + Enter as tenths of a millilitre; returns 's' or 'q' if typed instead
+static int read_volume_dml(uint32_t *out)
+{
+    uint32_t whole = 0, tenths = 0;
+    bool point = false, digits = false;
+
+    while (1) {
+        int c = getchar(); // serial input
+        if (c == EOF) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        if (c == 's' || c == 'q') return c;
+        if (c == '\r' || c == '\n') {
+            if (!digits) continue;
+            *out = whole * 10 + tenths;
+            return 0;
+        }
+        if (c == '.') {
+            point = true;
+        } else if (c >= '0' && c <= '9') {
+            digits = true;
+            if (!point) whole = whole * 10 + (c - '0');
+            else if (tenths == 0) tenths = c - '0';     // one decimal is plenty
+        }
+    }
+}
+
+static void wait_enter(void)
+{
+    int c;
+    while ((c = getchar()) != '\n' && c != '\r') {
+        if (c == EOF) vTaskDelay(pdMS_TO_TICKS(50));
+    }
+}
+
+esp_err_t flow_cal_run(uint8_t port)
+{
+    static const uint32_t pulses[] = FLOW_CAL_PULSES_MS;
+    _Static_assert(sizeof(pulses) / sizeof(pulses[0]) <= FLOW_CAL_MAX_POINTS, "too many pulses");
+
+    if (port >= POUR_MAX_PORTS) return ESP_ERR_INVALID_ARG;
+
+    uint32_t open_ms[FLOW_CAL_MAX_POINTS];
+    uint16_t volume[FLOW_CAL_MAX_POINTS];
+    int n = 0;
+    esp_err_t err = ESP_OK;
+
+    printf("Calibrating port %u: Enter pours, then type the measured ml + Enter "
+           "('s' to finish early, 'q' to abort)\n", port);
+    servo_rotate_cw(port, POUR_EXTEND_MS / 1000.0f);
+
+    for (int i = 0; i < (int)(sizeof(pulses) / sizeof(pulses[0])); i++) {
+        printf("Empty cup under port %u, Enter to pour %lu ms\n", port, (unsigned long)pulses[i]);
+        wait_enter();
+        solenoid_pulse(port + POUR_SOLENOID_OFFSET, pulses[i]);
+
+        printf("ml poured: ");
+        uint32_t dml;
+        int c = read_volume_dml(&dml);
+        if (c == 'q') {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        if (c == 's') break;
+        open_ms[n] = pulses[i];
+        volume[n] = dml > UINT16_MAX ? UINT16_MAX : (uint16_t)dml;
+        n++;
+    }
+
+    servo_rotate_ccw(port, POUR_RETRACT_MS / 1000.0f);
+    if (err != ESP_OK) {
+        printf("Aborted, port %u unchanged\n", port);
+        return err;
+    }
+
+    flow_curve_t curve;
+    err = flow_cal_fit(open_ms, volume, n, &curve);
+    if (err != ESP_OK) {
+        printf("Need at least two pours with volume growing with time, port %u unchanged\n", port);
+        return err;
+    }
+    err = flow_cal_set(port, &curve);
+    if (err != ESP_OK) return err;
+
+    printf("Port %u: dead time %u ms\n", port, curve.dead_ms);
+    for (int i = 0; i < curve.n_points; i++) {
+        printf("  %u.%u ml -> %u ms\n", curve.points[i].volume_dml / 10,
+               curve.points[i].volume_dml % 10, curve.dead_ms + curve.points[i].flow_ms);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,87 @@
+#ifndef FLOW_CAL_H
+#define FLOW_CAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// =============================================================
+// Per-port flow calibration
+// Each port maps a volume to a solenoid open time with its own
+// curve: a dead time (the valve opening before liquid flows)
+// plus a piecewise-linear volume → flow-time table. Curves live
+// in NVS (namespace "flow", one blob per port) and are loaded at
+// boot; uncalibrated ports fall back to POUR_MS_PER_ML.
+// =============================================================
+
+#define FLOW_CAL_MAX_POINTS   8
+
+// Open times the interactive routine pours at, shortest first.
+// The two shortest must sit on the same linear stretch: the dead
+// time is where the line through them reaches zero volume.
+#define FLOW_CAL_PULSES_MS    { 250, 500, 1000, 2000, 4000, 8000 }
+
+typedef struct {
+    uint16_t volume_dml;    // tenths of a millilitre
+    uint16_t flow_ms;       // open time past the dead time
+} flow_point_t;
+
+typedef struct {
+    uint16_t     dead_ms;
+    uint8_t      n_points;  // 0: uncalibrated
+    flow_point_t points[FLOW_CAL_MAX_POINTS];   // volume strictly increasing
+} flow_curve_t;
+
+/**
+ * @brief Load every port's curve from NVS. Requires nvs_flash_init().
+ *
+ * Ports without a valid stored curve stay uncalibrated; that is not an error.
+ */
+esp_err_t flow_cal_init(void);
+
+/**
+ * @brief Solenoid open time for a volume on a port.
+ *
+ * dead_ms plus the table interpolated at volume (from an implied 0/0
+ * point, extrapolated past the last point along the last segment).
+ * Integer-only.
+ */
+uint32_t flow_cal_ms(uint8_t port, uint32_t volume_ml);
+
+/**
+ * @brief Fit a curve to measured pulses.
+ *
+ * @param open_ms    Pulse lengths, strictly increasing.
+ * @param volume_dml Measured volumes in tenths of a millilitre.
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG if there are fewer than two
+ *         points, too many, or the volumes do not increase with time.
+ */
+esp_err_t flow_cal_fit(const uint32_t *open_ms, const uint16_t *volume_dml, int n,
+                       flow_curve_t *out);
+
+/**
+ * @brief Install a curve for a port and store it in NVS.
+ */
+esp_err_t flow_cal_set(uint8_t port, const flow_curve_t *curve);
+
+/**
+ * @brief Copy a port's curve (n_points == 0 if uncalibrated).
+ */
+void flow_cal_get(uint8_t port, flow_curve_t *out);
+
+/**
+ * @brief Drop a port's curve (back to POUR_MS_PER_ML) and erase it from NVS.
+ */
+esp_err_t flow_cal_reset(uint8_t port);
+
+/**
+ * @brief Calibrate a port interactively via serial input.
+ *
+ * Extends the nozzle, then for each FLOW_CAL_PULSES_MS pulse waits for
+ * Enter, pours, and reads the measured volume in ml ("12.5" + Enter;
+ * 's' ends early, 'q' aborts). Fits and stores the curve, then retracts.
+ * Call with the order pipeline stopped; it drives the port directly.
+ */
+esp_err_t flow_cal_run(uint8_t port);
+
+#endif // FLOW_CAL_H
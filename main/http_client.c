@@ -2,98 +2,51 @@
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_err.h"
-#include "esp_wifi.h"
-#include "esp_netif.h"
-#include "esp_event.h"
-#include "nvs_flash.h"
-#include "cJSON.h"
 #include "esp_http_client.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
+#include "http_client.h"
 #include "pca9685.h"
 #include "servo_control.h"
+#include "pour_scheduler.h"
+#include "actuator.h"
+#include "recipe_parser.h"
+#include "flow_cal.h"
+#include "trace.h"
+#include "metrics.h"
+#include "wifi_sta.h"
+#include "mix_mqtt.h"
 
-#define WIFI_SSID "DukeVisitor"
-#define WIFI_PASS ""
-
-static const char *TAG = "MAIN";
 
 /* ---------------------- Servo Logic ---------------------- */
 
 void solenoid_pulse(uint8_t channel, uint32_t ms)
 {
-    pca9685_set_duty(channel, 100);
-    vTaskDelay(pdMS_TO_TICKS(ms));
-    pca9685_set_duty(channel, 0);
-    vTaskDelay(pdMS_TO_TICKS(200));
+    actuator_cmd_t cmd = {
+        .channel   = channel,
+        .off       = PCA9685_STEPS - 1,   // 100% duty
+        .hold_ms   = ms,
+        .end       = ACT_END_ZERO,
+        .timing    = ACT_TIMING_PRECISE,  // pour volume follows the open time
+        .settle_ms = POUR_SETTLE_MS,
+    };
+    TRACE_BEGIN("solenoid_pulse", channel);
+    actuator_run(&cmd);
+    TRACE_END("solenoid_pulse");
 }
 
 void extend_nozzle(uint16_t channel, uint32_t ms)
 {
-    servo_rotate_cw(channel, 0.9f);
-    solenoid_pulse(channel + 8, ms);
-    servo_rotate_ccw(channel, 0.75f);
-}
-
-/* ---------------------- Wi-Fi ---------------------- */
-
-static EventGroupHandle_t wifi_event_group;
-#define WIFI_CONNECTED_BIT BIT0
-
-static void wifi_event_handler(void* arg, esp_event_base_t event_base,
-                               int32_t event_id, void* event_data)
-{
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-
-    } else if (event_base == WIFI_EVENT &&
-               event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(TAG, "WiFi disconnected, retrying...");
-        esp_wifi_connect();
-
-    } else if (event_base == IP_EVENT &&
-               event_id == IP_EVENT_STA_GOT_IP) {
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
-    }
-}
-
-esp_err_t wifi_init_sta(void)
-{
-    wifi_event_group = xEventGroupCreate();
-
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    ESP_ERROR_CHECK(
-        esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
-                                   &wifi_event_handler, NULL)
-    );
-    ESP_ERROR_CHECK(
-        esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
-                                   &wifi_event_handler, NULL)
-    );
-
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-            .threshold.authmode = WIFI_AUTH_OPEN,
-        },
-    };
-
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-
-    EventBits_t bits = xEventGroupWaitBits(
-        wifi_event_group, WIFI_CONNECTED_BIT,
-        pdFALSE, pdFALSE, pdMS_TO_TICKS(15000)
-    );
-
-    return (bits & WIFI_CONNECTED_BIT) ? ESP_OK : ESP_FAIL;
+    TRACE_BEGIN("extend_nozzle", channel);
+    servo_rotate_cw(channel, POUR_EXTEND_MS / 1000.0f);
+    solenoid_pulse(channel + POUR_SOLENOID_OFFSET, ms);
+    servo_rotate_ccw(channel, POUR_RETRACT_MS / 1000.0f);
+    TRACE_END("extend_nozzle");
 }
 
 /* ---------------------- HTTP Client ---------------------- */
@@ -101,42 +54,43 @@ esp_err_t wifi_init_sta(void)
 #define TAG "MAIN"
 #endif
  
-typedef struct {
-    char *buffer;
-    int   buffer_len;
-    int   data_len;
-} http_resp_ctx_t;
- 
+static bool mix_acks_known;     // the server takes completions on /mix
+
+#if MIX_TRANSPORT == MIX_TRANSPORT_HTTP
+static int  mix_acks_taken;     // X-Acks of the last /mix response, -1 if none
+
 /**
- * HTTP event handler: accumulate response body into user_data buffer.
+ * HTTP event handler: stream the response body straight into the recipe parser.
+ * Works for chunked and non-chunked bodies of any length.
  */
 static esp_err_t http_event_handler(esp_http_client_event_t *evt)
 {
-    http_resp_ctx_t *ctx = (http_resp_ctx_t *)evt->user_data;
+    recipe_parser_t *parser = (recipe_parser_t *)evt->user_data;
  
     switch (evt->event_id) {
-    case HTTP_EVENT_ON_DATA:
-        // For non-chunked responses, just copy into our buffer
-        if (!esp_http_client_is_chunked_response(evt->client)) {
-            if (ctx && ctx->buffer) {
-                int copy_len = evt->data_len;
- 
-                // Clamp to remaining space (leave room for '\0')
-                if (ctx->data_len + copy_len >= ctx->buffer_len) {
-                    copy_len = ctx->buffer_len - 1 - ctx->data_len;
-                }
- 
-                if (copy_len > 0) {
-                    memcpy(ctx->buffer + ctx->data_len, evt->data, copy_len);
-                    ctx->data_len += copy_len;
-                }
-            }
+    case HTTP_EVENT_ON_CONNECTED:
+        TRACE_INSTANT("http_connected", 0);
+        break;
+ 
+    case HTTP_EVENT_HEADERS_SENT:
+        TRACE_INSTANT("http_request_sent", 0);
+        break;
+
+    case HTTP_EVENT_ON_HEADER:
+        // Headers precede the body, so the parser switches before its first byte
+        if (parser && strcasecmp(evt->header_key, "Content-Type") == 0 &&
+            strncmp(evt->header_value, RECIPE_BIN_CONTENT_TYPE,
+                    strlen(RECIPE_BIN_CONTENT_TYPE)) == 0) {
+            recipe_parser_set_format(parser, RECIPE_FORMAT_BINARY);
         }
+        if (strcasecmp(evt->header_key, "X-Acks") == 0) mix_acks_taken = atoi(evt->header_value);
         break;
  
-    case HTTP_EVENT_ON_FINISH:
-        if (ctx && ctx->buffer && ctx->data_len < ctx->buffer_len) {
-            ctx->buffer[ctx->data_len] = '\0';  // null-terminate
+    case HTTP_EVENT_ON_DATA:
+        if (parser) {
+            TRACE_BEGIN("parse", evt->data_len);
+            recipe_parser_feed(parser, evt->data, evt->data_len);
+            TRACE_END("parse");
         }
         break;
  
@@ -146,116 +100,583 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
  
     return ESP_OK;
 }
+#endif
  
-/**
- * Call /mix endpoint, parse JSON, and run extend_nozzle() on recipe when status==1.
- */
-esp_err_t call_mix_endpoint(void)
+#define MIX_SERVER            "http://3.140.199.217:8081"   // same as your curl, but with :8081
+#define MIX_URL               MIX_SERVER "/mix"
+#define MIX_LONG_POLL_QUERY   "?wait=25"   // server may hold the request up to 25 s
+#define MIX_LONG_POLL_HELD_MS 1000         // a reply slower than this means the server held it
+#define MIX_TIMEOUT_MS        100000
+#define MIX_PROBE_TIMEOUT_MS  3000         // first request on a cached IP lease
+#define MIX_PUSH_WAIT_MS      25000        // MQTT: one mix_fetch() waits this long for an order
+#define MIX_ETA_URL           MIX_SERVER "/eta"
+#define MIX_LEASE_URL         MIX_SERVER "/lease"
+#define MIX_ACK_URL           MIX_SERVER "/ack"
+#define MIX_ACKS_URL          MIX_SERVER "/acks"
+#define MIX_CTL_TIMEOUT_MS    3000         // /eta, /lease and /ack(s)
+#define MIX_ACK_JSON_MAX      28           // ,{"id":-2147483648,"ok":1}
+ 
+// Adaptive poll interval (used when long-poll is off or unsupported)
+#define MIX_POLL_MIN_MS       250
+#define MIX_POLL_MAX_MS       2000
+#define MIX_POLL_ERROR_MAX_MS 8000
+ 
+#ifndef MIX_LONG_POLL_DEFAULT
+#define MIX_LONG_POLL_DEFAULT 0
+#endif
+
+// Offer the binary recipe layout; servers that do not know it answer JSON
+#ifndef MIX_ACCEPT_BINARY
+#define MIX_ACCEPT_BINARY     1
+#endif
+
+#ifndef MIX_REPORT_ETA_DEFAULT
+#define MIX_REPORT_ETA_DEFAULT 1
+#endif
+ 
+static recipe_parser_t mix_parser;
+ 
+// One handle for the life of the app so the TCP connection is kept alive
+static esp_http_client_handle_t mix_client;
+static bool     long_poll = MIX_LONG_POLL_DEFAULT;
+static uint32_t poll_delay_ms;
+static char     mix_body[96 + MIX_ACKS_MAX * MIX_ACK_JSON_MAX];
+
+static char     station_id[24];
+static uint8_t  station_held;
+static uint32_t station_busy_ms;
+
+// Second keep-alive client for /eta, /lease and /ack
+#if MIX_TRANSPORT == MIX_TRANSPORT_HTTP
+static esp_http_client_handle_t ctl_client;
+#endif
+static bool     eta_enabled = MIX_REPORT_ETA_DEFAULT;
+static bool     lease_enabled = true;
+static bool     ack_enabled = true;
+static bool     acks_enabled = true;
+ 
+static const char *mix_url(void)
 {
-    const char *url       = "http://3.140.199.217:8081/mix";   // same as your curl, but with :8081
-    const char *post_body = "{}";
- 
-    static char resp_buffer[256];  // plenty for {"status":2} or a small recipe
-    http_resp_ctx_t resp_ctx = {
-        .buffer     = resp_buffer,
-        .buffer_len = sizeof(resp_buffer),
-        .data_len   = 0,
-    };
+    return long_poll ? MIX_URL MIX_LONG_POLL_QUERY : MIX_URL;
+}
+ 
+const char *mix_station_id(void)
+{
+    if (station_id[0]) return station_id;
+#ifdef MIX_STATION_ID
+    snprintf(station_id, sizeof(station_id), "%s", MIX_STATION_ID);
+#else
+    uint8_t mac[6] = { 0 };
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(station_id, sizeof(station_id), "pour-%02x%02x%02x", mac[3], mac[4], mac[5]);
+#endif
+    return station_id;
+}
+
+void mix_set_station_load(uint8_t held, uint32_t busy_ms)
+{
+    station_held = held;
+    station_busy_ms = busy_ms;
+}
+
+#if MIX_TRANSPORT == MIX_TRANSPORT_HTTP
+static esp_http_client_handle_t mix_client_get(void)
+{
+    if (mix_client) return mix_client;
  
     esp_http_client_config_t cfg = {
-        .url           = url,
-        .method        = HTTP_METHOD_POST,
-        .timeout_ms    = 100000,
-        .event_handler = http_event_handler,
-        .user_data     = &resp_ctx,
+        .url               = mix_url(),
+        .method            = HTTP_METHOD_POST,
+        .timeout_ms        = MIX_TIMEOUT_MS,
+        .event_handler     = http_event_handler,
+        .user_data         = &mix_parser,
+        .keep_alive_enable = true,
     };
  
-    esp_http_client_handle_t client = esp_http_client_init(&cfg);
-    if (!client) {
+    mix_client = esp_http_client_init(&cfg);
+    if (!mix_client) {
         ESP_LOGE(TAG, "Failed to init HTTP client");
-        return ESP_FAIL;
+        return NULL;
     }
  
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, post_body, strlen(post_body));
- 
-    ESP_LOGI(TAG, "Calling /mix endpoint...");
+    esp_http_client_set_header(mix_client, "Content-Type", "application/json");
+#if MIX_ACCEPT_BINARY
+    esp_http_client_set_header(mix_client, "Accept", RECIPE_BIN_CONTENT_TYPE ", application/json;q=0.5");
+#endif
+    return mix_client;
+}
+#endif
  
-    esp_err_t err = esp_http_client_perform(client);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "POST failed: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        return err;
-    }
+void mix_set_long_poll(bool enable)
+{
+    long_poll = enable;
+    if (mix_client) esp_http_client_set_url(mix_client, mix_url());
+}
  
-    int status_code = esp_http_client_get_status_code(client);
-    int content_len = esp_http_client_get_content_length(client);
-    ESP_LOGI(TAG, "HTTP status=%d, content_len=%d", status_code, content_len);
+uint32_t mix_poll_delay_ms(void)
+{
+    return poll_delay_ms;
+}
  
-    esp_http_client_cleanup(client);
+static void update_poll_delay(esp_err_t err, bool poured, uint32_t held_ms)
+{
+    uint32_t backoff = poll_delay_ms ? poll_delay_ms * 2 : MIX_POLL_MIN_MS;
  
-    // Body should now be in resp_ctx.buffer (filled by http_event_handler)
-    ESP_LOGI(TAG, "Response (len=%d): '%s'",
-             resp_ctx.data_len,
-             (resp_ctx.data_len > 0) ? resp_ctx.buffer : "");
+    if (err != ESP_OK) {
+        poll_delay_ms = backoff > MIX_POLL_ERROR_MAX_MS ? MIX_POLL_ERROR_MAX_MS : backoff;
+    } else if (poured) {
+        poll_delay_ms = 0;              // more orders are likely queued
+    } else if ((long_poll || MIX_TRANSPORT == MIX_TRANSPORT_MQTT) &&
+               held_ms >= MIX_LONG_POLL_HELD_MS) {
+        poll_delay_ms = 0;              // server already waited for us
+    } else {
+        poll_delay_ms = backoff > MIX_POLL_MAX_MS ? MIX_POLL_MAX_MS : backoff;
+    }
+}
  
-    if (resp_ctx.data_len == 0) {
-        ESP_LOGE(TAG, "Empty response body, cannot parse JSON");
+/**
+ * POST a small JSON body on the control client.
+ * Returns the HTTP status, or -1 when the request itself failed.
+ *
+ * With MIX_TRANSPORT_MQTT the body is published on topic instead, and
+ * answered as the server would: 200 once the broker has it (PUBACK where
+ * confirmed), 409 when the dispatcher has revoked order id.
+ */
+static int ctl_post(const char *url, mix_mqtt_topic_t topic, int id, const char *body, int len)
+{
+#if MIX_TRANSPORT == MIX_TRANSPORT_MQTT
+    if (id && mix_mqtt_revoked(id)) return 409;
+    return mix_mqtt_publish(topic, body, len) == ESP_OK ? 200 : -1;
+#else
+    if (!ctl_client) {
+        esp_http_client_config_t cfg = {
+            .url               = url,
+            .method            = HTTP_METHOD_POST,
+            .timeout_ms        = MIX_CTL_TIMEOUT_MS,
+            .keep_alive_enable = true,
+        };
+        ctl_client = esp_http_client_init(&cfg);
+        if (!ctl_client) {
+            ESP_LOGE(TAG, "Failed to init control client");
+            return -1;
+        }
+        esp_http_client_set_header(ctl_client, "Content-Type", "application/json");
+    }
+
+    esp_http_client_set_url(ctl_client, url);
+    esp_http_client_set_post_field(ctl_client, body, len);
+    esp_err_t err = esp_http_client_perform(ctl_client);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "POST %s failed: %s", url, esp_err_to_name(err));
+        esp_http_client_close(ctl_client);
+        return -1;
+    }
+    return esp_http_client_get_status_code(ctl_client);
+#endif
+}
+
+esp_err_t mix_report_eta(int id, uint32_t eta_ms)
+{
+    static char body[80];
+
+    if (!eta_enabled) return ESP_ERR_NOT_SUPPORTED;
+
+    int len = snprintf(body, sizeof(body), "{\"station\":\"%s\",\"id\":%d,\"eta_ms\":%lu}",
+                       mix_station_id(), id, (unsigned long)eta_ms);
+
+    TRACE_BEGIN("eta_report", id);
+    int status_code = ctl_post(MIX_ETA_URL, MIX_MQTT_ETA, 0, body, len);
+    TRACE_END("eta_report");
+    if (status_code == 404) {
+        ESP_LOGW(TAG, "Server has no /eta, not reporting ETAs");
+        eta_enabled = false;
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (status_code != 200) {
+        if (status_code > 0) ESP_LOGW(TAG, "ETA report: HTTP %d", status_code);
         return ESP_FAIL;
     }
- 
-    // ---- Parse JSON ----
-    cJSON *root = cJSON_Parse(resp_ctx.buffer);
-    if (!root) {
-        ESP_LOGE(TAG, "JSON parse failed");
+    return ESP_OK;
+}
+
+esp_err_t mix_renew_lease(int id)
+{
+    static char body[64];
+
+    if (!lease_enabled) return ESP_ERR_NOT_SUPPORTED;
+
+    int len = snprintf(body, sizeof(body), "{\"station\":\"%s\",\"id\":%d}", mix_station_id(), id);
+
+    TRACE_BEGIN("lease_renew", id);
+    int status_code = ctl_post(MIX_LEASE_URL, MIX_MQTT_LEASE, id, body, len);
+    TRACE_END("lease_renew");
+    switch (status_code) {
+    case 200:
+        metrics_inc(METRIC_LEASES_RENEWED);
+        return ESP_OK;
+    case 404:
+        ESP_LOGW(TAG, "Server has no /lease, not renewing leases");
+        lease_enabled = false;
+        return ESP_ERR_NOT_SUPPORTED;
+    case 409:
+    case 410:
+        ESP_LOGW(TAG, "Order %d: lease lost", id);
+        metrics_inc(METRIC_LEASES_LOST);
+        return ESP_ERR_INVALID_STATE;
+    default:
+        if (status_code > 0) ESP_LOGW(TAG, "Lease renewal: HTTP %d", status_code);
         return ESP_FAIL;
     }
- 
-    cJSON *status = cJSON_GetObjectItem(root, "status");
-    if (!cJSON_IsNumber(status)) {
+}
+
+esp_err_t mix_ack(int id, bool poured)
+{
+    static char body[72];
+
+    if (!ack_enabled) return ESP_ERR_NOT_SUPPORTED;
+
+    int len = snprintf(body, sizeof(body), "{\"station\":\"%s\",\"id\":%d,\"ok\":%d}",
+                       mix_station_id(), id, poured ? 1 : 0);
+
+    TRACE_BEGIN("ack", id);
+    int status_code = ctl_post(MIX_ACK_URL, MIX_MQTT_ACKS, id, body, len);
+    TRACE_END("ack");
+    switch (status_code) {
+    case 200:
+        return ESP_OK;
+    case 404:
+        ESP_LOGW(TAG, "Server has no /ack, not acknowledging orders");
+        ack_enabled = false;
+        return ESP_ERR_NOT_SUPPORTED;
+    case 409:
+    case 410:
+        ESP_LOGW(TAG, "Order %d: acknowledged after the server gave it away", id);
+        return ESP_ERR_INVALID_STATE;
+    default:
+        if (status_code > 0) ESP_LOGW(TAG, "Ack: HTTP %d", status_code);
+        return ESP_FAIL;
+    }
+}
+
+// ,"acks":[{"id":N,"ok":1},...] appended at buf + len; returns the new length
+static int format_acks(char *buf, int cap, int len, const journal_ack_t *acks, int n)
+{
+    len += snprintf(buf + len, cap - len, ",\"acks\":[");
+    for (int i = 0; i < n; i++) {
+        len += snprintf(buf + len, cap - len, "%s{\"id\":%d,\"ok\":%d}",
+                        i ? "," : "", acks[i].id, acks[i].poured ? 1 : 0);
+    }
+    return len + snprintf(buf + len, cap - len, "]");
+}
+
+int mix_ack_batch(const journal_ack_t *acks, int n)
+{
+    static char body[64 + MIX_ACKS_MAX * MIX_ACK_JSON_MAX];
+
+    if (n > MIX_ACKS_MAX) n = MIX_ACKS_MAX;
+    if (n <= 0) return 0;
+
+    // One /ack each where the server has no /acks; once it has neither, nothing is owed
+    if (!acks_enabled) {
+        int sent = 0;
+        while (sent < n) {
+            esp_err_t err = mix_ack(acks[sent].id, acks[sent].poured);
+            if (err == ESP_FAIL) break;
+            if (err == ESP_OK) metrics_inc(METRIC_ACKS_DELIVERED);
+            if (err != ESP_ERR_NOT_SUPPORTED) metrics_inc(METRIC_ACK_REQUESTS);
+            sent++;
+        }
+        return sent;
+    }
+
+    int len = snprintf(body, sizeof(body), "{\"station\":\"%s\"", mix_station_id());
+    len = format_acks(body, sizeof(body), len, acks, n);
+    len += snprintf(body + len, sizeof(body) - len, "}");
+
+    TRACE_BEGIN("acks", n);
+    int status_code = ctl_post(MIX_ACKS_URL, MIX_MQTT_ACKS, 0, body, len);
+    TRACE_END("acks");
+    switch (status_code) {
+    case 200:
+        metrics_inc(METRIC_ACK_REQUESTS);
+        metrics_add(METRIC_ACKS_DELIVERED, n);
+        return n;
+    case 404:
+        ESP_LOGW(TAG, "Server has no /acks, acknowledging orders one by one");
+        acks_enabled = false;
+        return mix_ack_batch(acks, n);
+    default:
+        if (status_code > 0) ESP_LOGW(TAG, "Acks: HTTP %d", status_code);
+        return 0;
+    }
+}
+
+bool mix_takes_acks(void)
+{
+    return mix_acks_known;
+}
+
+/**
+ * Check a finished /mix body (or pushed order) and convert its recipe.
+ * Leaves *has_order false when status != 1.
+ */
+static esp_err_t mix_order_from(const recipe_parser_t *resp, mix_order_t *order, bool *has_order)
+{
+    if (!resp->has_status) {
         ESP_LOGE(TAG, "No numeric 'status' in response");
-        cJSON_Delete(root);
         return ESP_FAIL;
     }
  
-    ESP_LOGI(TAG, "Parsed status=%d", status->valueint);
+    ESP_LOGI(TAG, "Parsed status=%d (%u bytes, %s)", resp->status, (unsigned)resp->bytes,
+             resp->format == RECIPE_FORMAT_BINARY ? "binary" : "JSON");
  
     // Only mix when status == 1 (your logic)
-    if (status->valueint != 1) {
-        ESP_LOGW(TAG, "Skipping: status != 1 (got %d)", status->valueint);
-        cJSON_Delete(root);
+    if (resp->status != 1) {
+        ESP_LOGW(TAG, "Skipping: status != 1 (got %d)", resp->status);
         return ESP_OK;
     }
  
-    cJSON *recipe = cJSON_GetObjectItem(root, "recipe");
-    if (!cJSON_IsArray(recipe)) {
+    if (!resp->has_recipe) {
         ESP_LOGE(TAG, "Missing 'recipe'");
-        cJSON_Delete(root);\
         return ESP_FAIL;
     }
+    if (resp->invalid_items) {
+        ESP_LOGW(TAG, "Skipped %d invalid recipe item(s)", resp->invalid_items);
+    }
+    if (resp->dropped_items) {
+        ESP_LOGW(TAG, "Recipe has more than %d items, %d dropped",
+                 RECIPE_MAX_ITEMS, resp->dropped_items);
+    }
+ 
+    order->n_items = 0;
+    for (int i = 0; i < resp->n_items; i++) {
+        int port      = resp->items[i].port;
+        int volume_ml = resp->items[i].volume_ml;
+        ESP_LOGI(TAG, "Recipe item: port=%d, volume_ml=%d", port, volume_ml);
  
-    int count = cJSON_GetArraySize(recipe);
-    for (int i = 0; i < count; i++) {
-        cJSON *item = cJSON_GetArrayItem(recipe, i);
-        if (!cJSON_IsObject(item)) {
-            ESP_LOGW(TAG, "Skipping non-object item in recipe");
+        if (port < 0 || port >= POUR_MAX_PORTS) {
+            ESP_LOGW(TAG, "Skipping recipe item with out-of-range port %d", port);
             continue;
         }
+        if (order->n_items == POUR_MAX_ITEMS) {
+            ESP_LOGW(TAG, "Recipe has more than %d items, ignoring the rest", POUR_MAX_ITEMS);
+            break;
+        }
+        order->items[order->n_items].port    = port;
+        order->items[order->n_items].pour_ms = flow_cal_ms(port, volume_ml > 0 ? volume_ml : 0);
+        order->n_items++;
+    }
  
-        cJSON *port_json   = cJSON_GetObjectItem(item, "port");
-        cJSON *volume_json = cJSON_GetObjectItem(item, "volume_ml");
-        if (!cJSON_IsNumber(port_json) || !cJSON_IsNumber(volume_json)) {
-            ESP_LOGW(TAG, "Invalid recipe item (missing port/volume_ml)");
-            continue;
+    // Optional: how long the order sat in the server queue before dispatch
+    order->id            = resp->id;
+    order->lease_ms      = resp->lease_ms > 0 ? resp->lease_ms : 0;
+    order->age_ms        = resp->age_ms;
+    *has_order = true;
+    return ESP_OK;
+}
+
+#if MIX_TRANSPORT == MIX_TRANSPORT_HTTP
+/**
+ * One /mix round trip on the persistent client; fills *order when status==1.
+ */
+static esp_err_t mix_poll_once(mix_order_t *order, bool *has_order, uint32_t *held_ms,
+                               const journal_ack_t *acks, int *n_acks)
+{
+    *has_order = false;
+    int carried = n_acks ? (*n_acks > MIX_ACKS_MAX ? MIX_ACKS_MAX : *n_acks) : 0;
+    if (n_acks) *n_acks = 0;
+
+    esp_http_client_handle_t client = mix_client_get();
+    if (!client) {
+        return ESP_FAIL;
+    }
+ 
+    recipe_parser_init(&mix_parser);
+    int body_len = snprintf(mix_body, sizeof(mix_body), "{\"station\":\"%s\",\"load\":%u,\"eta_ms\":%lu",
+                            mix_station_id(), station_held, (unsigned long)station_busy_ms);
+    if (carried) body_len = format_acks(mix_body, sizeof(mix_body), body_len, acks, carried);
+    body_len += snprintf(mix_body + body_len, sizeof(mix_body) - body_len, "}");
+    esp_http_client_set_post_field(client, mix_body, body_len);
+    mix_acks_taken = -1;
+ 
+    ESP_LOGI(TAG, "Calling /mix endpoint%s...", long_poll ? " (long-poll)" : "");
+ 
+    // A stale cached lease only shows up as a hung request: find out quickly
+    bool probe = wifi_sta_lease_unverified();
+    if (probe) {
+        esp_http_client_set_url(client, MIX_URL);
+        esp_http_client_set_timeout_ms(client, MIX_PROBE_TIMEOUT_MS);
+    }
+
+    int64_t t_req = esp_timer_get_time();
+    TRACE_BEGIN("http_perform", 0);
+    esp_err_t err = esp_http_client_perform(client);
+    TRACE_END("http_perform");
+    int64_t t_resp = esp_timer_get_time();
+    *held_ms = (uint32_t)((t_resp - t_req) / 1000);
+
+    if (probe) {
+        esp_http_client_set_url(client, mix_url());
+        esp_http_client_set_timeout_ms(client, MIX_TIMEOUT_MS);
+    }
+ 
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "POST failed: %s", esp_err_to_name(err));
+        // Drop the connection; the next perform reconnects
+        esp_http_client_close(client);
+        return err;
+    }
+ 
+    int status_code = esp_http_client_get_status_code(client);
+    int content_len = esp_http_client_get_content_length(client);
+
+    // A server that does not know "acks" ignores them; they go to /acks later
+    if (status_code == 200) {
+        mix_acks_known = mix_acks_taken >= 0;
+        if (carried && mix_acks_taken > 0) {
+            *n_acks = mix_acks_taken > carried ? carried : mix_acks_taken;
+            metrics_add(METRIC_ACKS_DELIVERED, *n_acks);
         }
+    }
+    ESP_LOGI(TAG, "HTTP status=%d, content_len=%d, %lu ms", status_code, content_len,
+             (unsigned long)*held_ms);
  
-        int port      = port_json->valueint;
-        int volume_ml = volume_json->valueint;
-        ESP_LOGI(TAG, "Recipe item: port=%d, volume_ml=%d", port, volume_ml);
+    // Body has already been parsed as it arrived (see http_event_handler)
+    const recipe_parser_t *resp = &mix_parser;
+    if (resp->bytes == 0) {
+        ESP_LOGE(TAG, "Empty response body, cannot parse it");
+        return ESP_FAIL;
+    }
+ 
+    if (recipe_parser_finish(&mix_parser) != RECIPE_PARSE_DONE) {
+        ESP_LOGE(TAG, "%s parse failed (%u bytes)",
+                 resp->format == RECIPE_FORMAT_BINARY ? "Binary" : "JSON", (unsigned)resp->bytes);
+        return ESP_FAIL;
+    }
+ 
+    err = mix_order_from(resp, order, has_order);
+    if (err != ESP_OK || !*has_order) return err;
+    order->t_request_us  = t_req;
+    order->t_response_us = t_resp;
+    order->t_ready_us    = esp_timer_get_time();
+    TRACE_COMPLETE("server_queue", t_resp - (int64_t)order->age_ms * 1000,
+                   (int64_t)order->age_ms * 1000);
+    return ESP_OK;
+}
+#else
+/**
+ * Offer the dispatcher room for one order, then wait for it to be pushed.
+ * The offer stands until an order comes or the session drops, so an idle
+ * station sends nothing between calls.
+ */
+static esp_err_t mix_push_once(mix_order_t *order, bool *has_order, uint32_t *held_ms,
+                               int *n_acks)
+{
+    static uint32_t offered;        // session the standing offer was made in, 0 if none
+
+    *has_order = false;
+    if (n_acks) *n_acks = 0;
+
+    // A stale cached lease only shows up as a broker that never answers
+    uint32_t session = mix_mqtt_session(mix_station_id(), wifi_sta_lease_unverified()
+                                        ? MIX_PROBE_TIMEOUT_MS : MIX_PUSH_WAIT_MS);
+    if (!session) {
+        ESP_LOGE(TAG, "MQTT broker not reachable");
+        return ESP_FAIL;
+    }
+
+    int64_t t_wait = esp_timer_get_time();
+    if (offered != session) {
+        int len = snprintf(mix_body, sizeof(mix_body), "{\"station\":\"%s\",\"load\":%u,\"eta_ms\":%lu}",
+                           mix_station_id(), station_held, (unsigned long)station_busy_ms);
+        if (mix_mqtt_publish(MIX_MQTT_READY, mix_body, len) != ESP_OK) return ESP_FAIL;
+        offered = session;
+        ESP_LOGI(TAG, "Offered room for an order (load %u)", station_held);
+    }
+
+    int64_t t_resp;
+    esp_err_t err = mix_mqtt_wait_order(&mix_parser, &t_resp, MIX_PUSH_WAIT_MS);
+    *held_ms = (uint32_t)((esp_timer_get_time() - t_wait) / 1000);
+    if (err == ESP_ERR_TIMEOUT) return ESP_OK;      // the offer still stands
+    offered = 0;                                    // the dispatcher spent it
+    if (err != ESP_OK) return err;
+
+    err = mix_order_from(&mix_parser, order, has_order);
+    if (err != ESP_OK || !*has_order) return err;
+    // The dispatcher starts the lease as it pushes, not when we offered:
+    // an offer may stand for minutes. Half a round trip early is well
+    // inside the margin completions keep before a lease runs out.
+    order->t_request_us  = t_resp;
+    order->t_response_us = t_resp;
+    order->t_ready_us    = esp_timer_get_time();
+    TRACE_COMPLETE("server_queue", t_resp - (int64_t)order->age_ms * 1000,
+                   (int64_t)order->age_ms * 1000);
+    return ESP_OK;
+}
+#endif
+ 
+esp_err_t mix_fetch(mix_order_t *order, bool *has_order, const journal_ack_t *acks, int *n_acks)
+{
+    uint32_t held_ms = 0;
+ 
+    TRACE_BEGIN("mix_fetch", 0);
+#if MIX_TRANSPORT == MIX_TRANSPORT_MQTT
+    esp_err_t err = mix_push_once(order, has_order, &held_ms, n_acks);
+#else
+    esp_err_t err = mix_poll_once(order, has_order, &held_ms, acks, n_acks);
+#endif
+    TRACE_END("mix_fetch");
+    metrics_inc(err == ESP_OK ? METRIC_POLLS_OK : METRIC_POLLS_FAILED);
+    wifi_sta_note_request(err == ESP_OK);
+    if (*has_order) metrics_inc(METRIC_ORDERS_FETCHED);
+    update_poll_delay(err, *has_order, held_ms);
+    return err;
+}
  
-        extend_nozzle(port, (volume_ml*20/50)*1000);
+esp_err_t mix_pour(const mix_order_t *order, pour_report_t *report)
+{
+    // Pour with ports overlapping instead of one extend_nozzle() at a time
+    int64_t t_run = esp_timer_get_time();
+    TRACE_COMPLETE("local_queue", order->t_ready_us, t_run - order->t_ready_us);
+    TRACE_BEGIN("pour", order->n_items);
+    esp_err_t err = pour_sched_run(order->items, order->n_items, report);
+    TRACE_END("pour");
+    TRACE_DUMP();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Pour failed: %s", esp_err_to_name(err));
+        metrics_inc(METRIC_DRINKS_FAILED);
+        return err;
     }
+    ESP_LOGI(TAG, "Makespan: predicted=%lu ms actual=%lu ms (serial would be %lu ms)",
+             (unsigned long)report->predicted_ms, (unsigned long)report->actual_ms,
+             (unsigned long)report->serial_ms);
  
-    cJSON_Delete(root);
+    // Device share includes any time the order waited in the local queue
+    uint32_t device_ms = (uint32_t)((t_run - order->t_response_us) / 1000) + report->first_pour_ms;
+    ESP_LOGI(TAG, "Order-to-first-pour: %lu ms (server queue %d ms + device %lu ms, %s)",
+             (unsigned long)(order->age_ms + device_ms), order->age_ms, (unsigned long)device_ms,
+             MIX_TRANSPORT == MIX_TRANSPORT_MQTT ? "push" : long_poll ? "long-poll" : "poll");
+    metrics_record_drink(order->age_ms + device_ms);
     return ESP_OK;
+}
+ 
+/**
+ * Poll /mix once, pour any order inline and pick the delay before the next poll.
+ */
+esp_err_t call_mix_endpoint(void)
+{
+    static mix_order_t order;
+    bool has_order = false;
+ 
+    esp_err_t err = mix_fetch(&order, &has_order, NULL, NULL);
+    if (err != ESP_OK || !has_order) return err;
+ 
+    // Poured straight away, well inside any lease: only the ack matters
+    pour_report_t report;
+    err = mix_pour(&order, &report);
+    if (order.id) {
+        journal_ack_t ack = { .id = order.id, .poured = err == ESP_OK };
+        mix_ack_batch(&ack, 1);
+    }
+    return err;
 }
\ No newline at end of file
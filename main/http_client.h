@@ -1,41 +1,195 @@
 #ifndef HTTP_CLIENT_H
 #define HTTP_CLIENT_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
-
-/**
- * @brief Initialize Wi-Fi in STA mode.
- *
- * Connects using the SSID/PASS configured in the implementation file.
- *
- * @return ESP_OK on success, ESP_FAIL on timeout or connection failure.
- */
-esp_err_t wifi_init_sta(void);
+#include "pour_scheduler.h"
+#include "journal.h"
 
 void extend_nozzle(uint16_t channel, uint32_t ms);
 
 void solenoid_pulse(uint8_t channel, uint32_t ms);
 
+// Completions carried by one /mix or /acks request
+#define MIX_ACKS_MAX    32
+
+// Order transport, chosen at build time: poll /mix (below), or offer room
+// for orders over MQTT and have the dispatcher push them (mix_mqtt.h).
+// Either way orders come through mix_fetch(), and completions, renewals
+// and ETAs go out through the functions here with the same bodies.
+#define MIX_TRANSPORT_HTTP  0
+#define MIX_TRANSPORT_MQTT  1
+#ifndef MIX_TRANSPORT
+#define MIX_TRANSPORT       MIX_TRANSPORT_HTTP
+#endif
+
+// A validated order, ready for mix_pour()
+typedef struct {
+    pour_item_t items[POUR_MAX_ITEMS];
+    int         n_items;
+    int         id;              // server order id, 0 if the server sent none
+    uint32_t    lease_ms;        // claim lease to renew with mix_renew_lease(), 0 if none
+    int         age_ms;          // time spent queued on the server
+    int64_t     t_request_us;    // /mix request sent (MQTT: order pushed)
+    int64_t     t_response_us;   // response received
+    int64_t     t_ready_us;      // parsed and validated
+} mix_order_t;
+
 /**
  * @brief Send POST request to remote /mix endpoint.
  *
- * - Sends "{}" as body
+ * - Sends the station's identity and load as body:
+ *      {"station":"pour-a1b2c3","load":1,"eta_ms":8400}
+ *   (see mix_set_station_load())
  * - Receives JSON like:
  *      {
  *        "status":1,
+ *        "id":7,
+ *        "lease_ms":30000,
  *        "recipe":[
  *          {"port":1,"volume_ml":250},
  *          {"port":2,"volume_ml":50}
  *        ]
  *      }
  *
+ * - Body is parsed as it streams in (recipe_parser), so chunked and
+ *   large responses work without a receive buffer or heap allocation
  * - Only proceeds if status == 1
- * - Converts volume_ml → milliseconds
- * - Calls extend_nozzle() for each recipe item
+ * - Converts volume_ml → milliseconds with the port's flow_cal_ms() curve
+ * - Pours the recipe through pour_sched_run()
+ * - Optional "age_ms" (time the order spent queued on the server) is
+ *   used to log order-to-first-pour latency
+ * - Optional "lease_ms": the order is claimed by this station only for
+ *   that long unless renewed; call_mix_endpoint() pours at once and only
+ *   acknowledges it
+ *
+ * Reuses one keep-alive HTTP client across calls. Updates the delay
+ * returned by mix_poll_delay_ms().
  *
  * @return ESP_OK if successfully processed,
  *         ESP_FAIL on request or JSON parse error.
  */
 esp_err_t call_mix_endpoint(void);
 
+/**
+ * @brief Fetch and validate one order without pouring it.
+ *
+ * Same request, parsing and checks as call_mix_endpoint(); updates
+ * mix_poll_delay_ms() the same way. Finished orders can ride along in
+ * the body as "acks":[{"id":N,"ok":1|0},...], saving their own request;
+ * a server that took them answers with an "X-Acks: <count>" header.
+ *
+ * With MIX_TRANSPORT_MQTT, offers the dispatcher room for one order
+ * instead (the offer stands until an order comes or the session drops)
+ * and waits up to 25 s for it to be pushed; completions do not ride
+ * along, so *n_acks comes back 0.
+ *
+ * @param has_order Set to true when *order was filled (status == 1).
+ * @param acks      Completions to carry (up to MIX_ACKS_MAX), or NULL.
+ * @param n_acks    In: how many to carry. Out: how many the server took,
+ *                  0 if it ignored them. May be NULL.
+ * @return ESP_OK (with or without an order),
+ *         ESP_FAIL on request or JSON parse error.
+ */
+esp_err_t mix_fetch(mix_order_t *order, bool *has_order, const journal_ack_t *acks, int *n_acks);
+
+/**
+ * @brief Whether the last /mix response carried X-Acks, so completions
+ *        given to mix_fetch() reach the server even if it holds the
+ *        request (long-poll). Until then, send them with mix_ack_batch().
+ */
+bool mix_takes_acks(void);
+
+/**
+ * @brief Pour a fetched order and log its makespan and order-to-first-pour.
+ */
+esp_err_t mix_pour(const mix_order_t *order, pour_report_t *report);
+
+/**
+ * @brief Enable or disable long-poll mode.
+ *
+ * When enabled, /mix is called with ?wait=25 and the server may hold the
+ * request until an order exists. Servers that ignore the parameter are
+ * detected by their fast empty replies and fall back to adaptive polling.
+ */
+void mix_set_long_poll(bool enable);
+
+/**
+ * @brief Tell the server how long a drink will take.
+ *
+ * POSTs {"station":..,"id":N,"eta_ms":M} to /eta on its own keep-alive
+ * client, so it never waits behind a held long-poll. A server without
+ * /eta answers 404 once and reporting is switched off. The same client
+ * carries mix_renew_lease() and mix_ack(): call all three from one task.
+ *
+ * @return ESP_OK if the server accepted it,
+ *         ESP_ERR_NOT_SUPPORTED once reporting is off,
+ *         ESP_FAIL on a request error.
+ */
+esp_err_t mix_report_eta(int id, uint32_t eta_ms);
+
+/**
+ * @brief Name this station sends with every request.
+ *
+ * MIX_STATION_ID if defined at build time, otherwise "pour-" and the
+ * last three bytes of the Wi-Fi station MAC.
+ */
+const char *mix_station_id(void);
+
+/**
+ * @brief Load reported with the next /mix request.
+ *
+ * @param held    Orders queued or pouring on this station.
+ * @param busy_ms Time until they are all poured.
+ */
+void mix_set_station_load(uint8_t held, uint32_t busy_ms);
+
+/**
+ * @brief Extend the lease on a claimed order.
+ *
+ * POSTs {"station":..,"id":N} to /lease on the same client as
+ * mix_report_eta(). A server without /lease answers 404 once and
+ * renewals are switched off.
+ *
+ * @return ESP_OK if the lease was extended by the order's lease_ms,
+ *         ESP_ERR_INVALID_STATE if the server no longer holds the order
+ *         for this station (it expired and went elsewhere),
+ *         ESP_ERR_NOT_SUPPORTED once renewals are off,
+ *         ESP_FAIL on a request error.
+ */
+esp_err_t mix_renew_lease(int id);
+
+/**
+ * @brief Tell the server a claimed order is finished.
+ *
+ * POSTs {"station":..,"id":N,"ok":1|0} to /ack; ok == 0 hands the
+ * order back. Same client and 404 handling as mix_renew_lease().
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the order was no longer
+ *         ours, ESP_ERR_NOT_SUPPORTED or ESP_FAIL.
+ */
+esp_err_t mix_ack(int id, bool poured);
+
+/**
+ * @brief Tell the server several orders are finished in one request.
+ *
+ * POSTs {"station":..,"acks":[{"id":N,"ok":1|0},...]} to /acks on the
+ * mix_report_eta() client. The server takes them all, counting any for
+ * orders that already went elsewhere as late. A server without /acks
+ * answers 404 once; from then on each completion goes to mix_ack().
+ *
+ * @return How many of the first n (at most MIX_ACKS_MAX) the server now
+ *         has, 0 on a request error.
+ */
+int mix_ack_batch(const journal_ack_t *acks, int n);
+
+/**
+ * @brief Delay to wait before the next call_mix_endpoint().
+ *
+ * 0 right after an order or a held long-poll; otherwise backs off from
+ * 250 ms to 2 s while idle, and up to 8 s on errors.
+ */
+uint32_t mix_poll_delay_ms(void);
+
 #endif /* HTTP_CLIENT_H */
@@ -0,0 +1,441 @@
+#include "journal.h"
+#include "metrics.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SECTOR_SIZE     4096
+#define REC_MAGIC       0xA5
+
+static const char *TAG = "JOURNAL";
+
+typedef enum {
+    STATE_NONE,         // no record yet
+    STATE_HELD,         // claimed, not finished here
+    STATE_POURED,       // finished; completion owed to the server
+    STATE_FAILED,       // finished without pouring; completion owed
+    STATE_SETTLED,      // nothing owed
+} order_state_t;
+
+// As stored. An erased slot reads all 0xFF; a torn write fails the CRC.
+typedef struct {
+    uint32_t seq;
+    int32_t  id;
+    uint8_t  magic;
+    uint8_t  state;         // order_state_t
+    uint16_t crc;           // CRC-16/CCITT of the fields above
+    uint32_t reserved;      // left erased
+} journal_rec_t;
+
+_Static_assert(SECTOR_SIZE % sizeof(journal_rec_t) == 0, "records must tile a sector");
+
+#define REC_PER_SECTOR  (SECTOR_SIZE / sizeof(journal_rec_t))
+
+_Static_assert(REC_PER_SECTOR % JOURNAL_BATCH_RECORDS == 0, "batches must not straddle sectors");
+
+typedef struct {
+    int      id;            // 0: free
+    uint8_t  state;         // order_state_t
+    uint8_t  written;       // state of its newest record on flash
+    int32_t  slot;          // where that record is, -1 if none
+    uint32_t finish_seq;    // orders finished earlier are delivered first
+    int64_t  changed_us;    // oldest change not yet written, 0 if none
+    bool     sending;       // completion in flight to the server
+} entry_t;
+
+static const esp_partition_t *part;     // NULL: RAM only
+static uint32_t n_slots;
+static uint32_t head;                   // next slot to write
+static uint32_t erased_sector = UINT32_MAX;   // sector head is filling
+static uint32_t next_seq = 1;
+static uint32_t next_finish = 1;
+
+static entry_t entries[JOURNAL_MAX_ORDERS];
+static journal_stats_t stats;
+
+// Records on their way to flash, contiguous from batch_slot
+static journal_rec_t batch[JOURNAL_BATCH_RECORDS];
+static int      n_batch;
+static uint32_t batch_slot;
+
+static StaticSemaphore_t lock_buf;
+static SemaphoreHandle_t lock;
+
+/* ---------------- Records ---------------- */
+static uint16_t crc16(const uint8_t *p, size_t n)
+{
+    uint16_t crc = 0xFFFF;
+    while (n--) {
+        crc ^= (uint16_t)*p++ << 8;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static uint16_t rec_crc(const journal_rec_t *r)
+{
+    return crc16((const uint8_t *)r, offsetof(journal_rec_t, crc));
+}
+
+static bool rec_valid(const journal_rec_t *r)
+{
+    return r->magic == REC_MAGIC && r->seq != UINT32_MAX && r->crc == rec_crc(r) &&
+           r->state >= STATE_HELD && r->state <= STATE_SETTLED;
+}
+
+static bool rec_erased(const journal_rec_t *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    for (size_t i = 0; i < sizeof(*r); i++) {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+/* ---------------- Entries ---------------- */
+// Call with lock held
+static entry_t *entry_find(int id)
+{
+    for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+        if (entries[i].id == id) return &entries[i];
+    }
+    return NULL;
+}
+
+static entry_t *entry_add(int id)
+{
+    entry_t *e = entry_find(0);
+    if (!e) return NULL;
+    *e = (entry_t) { .id = id, .slot = -1 };
+    return e;
+}
+
+static bool finished(const entry_t *e)
+{
+    return e->state == STATE_POURED || e->state == STATE_FAILED;
+}
+
+// Call with lock held
+static void set_state(entry_t *e, order_state_t state)
+{
+    if (e->state == state) return;
+    if (state == STATE_POURED || state == STATE_FAILED) e->finish_seq = next_finish++;
+
+    // A change that is replaced before it reaches flash costs nothing
+    if (e->changed_us) stats.coalesced++;
+    else e->changed_us = esp_timer_get_time();
+    e->state = state;
+
+    if (state == STATE_SETTLED && e->written == STATE_NONE) {
+        stats.coalesced++;
+        e->id = 0;
+    }
+}
+
+/* ---------------- Flash ---------------- */
+// Call with lock held
+static void batch_write(void)
+{
+    if (!n_batch) return;
+
+    esp_err_t err = esp_partition_write(part, batch_slot * sizeof(journal_rec_t), batch,
+                                        n_batch * sizeof(journal_rec_t));
+    if (err != ESP_OK) ESP_LOGE(TAG, "Write at slot %lu failed: %s",
+                                (unsigned long)batch_slot, esp_err_to_name(err));
+    stats.batches++;
+    n_batch = 0;
+}
+
+static void write_record(entry_t *e);
+
+// Erase the sector head is entering, moving forward the orders whose
+// newest record is in it
+static void recycle_sector(void)
+{
+    uint32_t sector = head / REC_PER_SECTOR;
+
+    batch_write();
+    esp_err_t err = esp_partition_erase_range(part, sector * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK) ESP_LOGE(TAG, "Erasing sector %lu failed: %s",
+                                (unsigned long)sector, esp_err_to_name(err));
+    erased_sector = sector;
+    stats.erases++;
+    metrics_inc(METRIC_JOURNAL_ERASES);
+
+    // Live orders never outnumber a sector's slots, so the copies fit
+    for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+        entry_t *e = &entries[i];
+        if (!e->id || e->slot < 0 || (uint32_t)e->slot / REC_PER_SECTOR != sector) continue;
+        // Its older records were in this sector or before it, so once
+        // settled there is nothing left to replay and nothing to write
+        if (e->state == STATE_SETTLED) {
+            e->id = 0;
+            stats.coalesced++;
+            continue;
+        }
+        // A pending change goes along now rather than leave the order
+        // with no record at all until the next batch
+        stats.copies++;
+        write_record(e);
+    }
+}
+
+// Call with lock held: append e's current state, and free the entry
+// once that state is settled
+static void write_record(entry_t *e)
+{
+    if (part && head % REC_PER_SECTOR == 0 && head / REC_PER_SECTOR != erased_sector) {
+        recycle_sector();
+        // It may have gone out with the sector's copies, or been freed
+        if (!e->id || e->written == e->state) return;
+    }
+
+    e->written = e->state;
+    e->changed_us = 0;
+    if (part) {
+        if (!n_batch) batch_slot = head;
+        journal_rec_t *r = &batch[n_batch++];
+        *r = (journal_rec_t) {
+            .seq      = next_seq++,
+            .id       = e->id,
+            .magic    = REC_MAGIC,
+            .state    = e->state,
+            .reserved = UINT32_MAX,
+        };
+        r->crc = rec_crc(r);
+        e->slot = head;
+        head = (head + 1) % n_slots;
+        stats.records++;
+        metrics_inc(METRIC_JOURNAL_RECORDS);
+
+        if (n_batch == JOURNAL_BATCH_RECORDS || head % REC_PER_SECTOR == 0) batch_write();
+    }
+    if (e->state == STATE_SETTLED) e->id = 0;
+}
+
+/* ---------------- Recovery ---------------- */
+// Call with lock held: fold one record into the entries, oldest first
+static void replay(const journal_rec_t *r, uint32_t slot)
+{
+    entry_t *e = entry_find(r->id);
+    if (!e) {
+        if (r->state == STATE_SETTLED) return;
+        e = entry_add(r->id);
+        if (!e) {
+            ESP_LOGW(TAG, "Too many open orders, order %ld dropped", (long)r->id);
+            return;
+        }
+    }
+    if ((r->state == STATE_POURED || r->state == STATE_FAILED) && !finished(e)) {
+        e->finish_seq = next_finish++;
+    }
+    e->state = e->written = r->state;
+    e->slot = slot;
+    if (r->state == STATE_SETTLED) e->id = 0;
+}
+
+// Visit every valid record in slot order from first_slot, n_slots in all
+static void scan(uint32_t first_slot, void (*visit)(const journal_rec_t *, uint32_t))
+{
+    for (uint32_t done = 0; done < n_slots; done += JOURNAL_BATCH_RECORDS) {
+        uint32_t slot = (first_slot + done) % n_slots;
+        if (esp_partition_read(part, slot * sizeof(journal_rec_t), batch,
+                               sizeof(batch)) != ESP_OK) continue;
+        for (int i = 0; i < JOURNAL_BATCH_RECORDS; i++) {
+            if (rec_valid(&batch[i])) visit(&batch[i], slot + i);
+        }
+    }
+}
+
+static uint32_t newest_seq, newest_slot;
+
+static void find_newest(const journal_rec_t *r, uint32_t slot)
+{
+    if (r->seq > newest_seq) {
+        newest_seq = r->seq;
+        newest_slot = slot;
+    }
+}
+
+/* ---------------- Public API ---------------- */
+esp_err_t journal_init(void)
+{
+    if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                    (esp_partition_subtype_t)JOURNAL_PARTITION_SUBTYPE,
+                                    JOURNAL_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGW(TAG, "No \"%s\" partition, journal kept in RAM only", JOURNAL_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    n_slots = part->size / SECTOR_SIZE * REC_PER_SECTOR;
+    if (n_slots < 2 * REC_PER_SECTOR) {
+        ESP_LOGW(TAG, "Partition too small, journal kept in RAM only");
+        part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Sectors are erased before reuse, so the one after the newest
+    // record's sector holds the oldest records: replay from there
+    newest_seq = 0;
+    scan(0, find_newest);
+    if (newest_seq) {
+        uint32_t sector = newest_slot / REC_PER_SECTOR;
+        uint32_t n_sectors = n_slots / REC_PER_SECTOR;
+        scan((sector + 1) % n_sectors * REC_PER_SECTOR, replay);
+
+        next_seq = newest_seq + 1;
+        head = (newest_slot + 1) % n_slots;
+        erased_sector = sector;
+        // A torn write past the newest record: start on a fresh sector
+        journal_rec_t r;
+        if (head % REC_PER_SECTOR != 0 &&
+            (esp_partition_read(part, head * sizeof(r), &r, sizeof(r)) != ESP_OK || !rec_erased(&r))) {
+            head = (sector + 1) % n_sectors * REC_PER_SECTOR;
+        }
+    }
+
+    // Held when the station went down, so never finished here
+    int undelivered = 0;
+    for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+        entry_t *e = &entries[i];
+        if (!e->id) continue;
+        if (e->state == STATE_HELD) {
+            set_state(e, STATE_FAILED);
+            stats.recovered++;
+        }
+        undelivered++;
+    }
+    xSemaphoreGive(lock);
+
+    ESP_LOGI(TAG, "%lu KB at 0x%lx, resuming at slot %lu: %d completion(s) undelivered, "
+             "%lu order(s) interrupted",
+             (unsigned long)part->size / 1024, (unsigned long)part->address,
+             (unsigned long)head, undelivered, (unsigned long)stats.recovered);
+    return ESP_OK;
+}
+
+void journal_accepted(int id)
+{
+    if (!lock || !id) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    entry_t *e = entry_find(id);
+    if (!e) e = entry_add(id);
+    if (e) set_state(e, STATE_HELD);
+    xSemaphoreGive(lock);
+
+    if (!e) ESP_LOGW(TAG, "Journal full, order %d not recorded", id);
+}
+
+void journal_finished(int id, bool poured)
+{
+    if (!lock || !id) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    entry_t *e = entry_find(id);
+    if (!e) e = entry_add(id);
+    if (e) set_state(e, poured ? STATE_POURED : STATE_FAILED);
+    xSemaphoreGive(lock);
+
+    if (!e) ESP_LOGW(TAG, "Journal full, completion of order %d not recorded", id);
+}
+
+void journal_settled(int id)
+{
+    if (!lock || !id) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    entry_t *e = entry_find(id);
+    if (e) set_state(e, STATE_SETTLED);
+    xSemaphoreGive(lock);
+}
+
+int journal_acks_begin(journal_ack_t *acks, int max)
+{
+    if (!lock) return 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int n = 0;
+    uint32_t after = 0;
+    while (n < max) {
+        const entry_t *next = NULL;
+        for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+            const entry_t *e = &entries[i];
+            if (!e->id || !finished(e) || e->sending || e->finish_seq <= after) continue;
+            if (!next || e->finish_seq < next->finish_seq) next = e;
+        }
+        if (!next) break;
+        acks[n++] = (journal_ack_t) { .id = next->id, .poured = next->state == STATE_POURED };
+        after = next->finish_seq;
+    }
+    for (int i = 0; i < n; i++) entry_find(acks[i].id)->sending = true;
+    xSemaphoreGive(lock);
+    return n;
+}
+
+void journal_acks_end(const journal_ack_t *acks, int n, int delivered)
+{
+    if (!lock) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < n; i++) {
+        entry_t *e = entry_find(acks[i].id);
+        if (!e || !finished(e)) continue;
+        e->sending = false;
+        if (i < delivered) set_state(e, STATE_SETTLED);
+    }
+    xSemaphoreGive(lock);
+}
+
+uint32_t journal_flush(bool force)
+{
+    if (!lock) return UINT32_MAX;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    int64_t oldest = INT64_MAX;
+    int due = 0;
+    for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+        const entry_t *e = &entries[i];
+        if (!e->id || e->state == e->written) continue;
+        due++;
+        if (e->changed_us < oldest) oldest = e->changed_us;
+    }
+
+    uint32_t wait_ms = UINT32_MAX;
+    int64_t due_us = oldest == INT64_MAX ? INT64_MAX : oldest + JOURNAL_FLUSH_MS * 1000LL;
+    if (due && (force || due >= JOURNAL_BATCH_RECORDS || now >= due_us)) {
+        for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+            entry_t *e = &entries[i];
+            if (!e->id || e->state == e->written) continue;
+            write_record(e);
+        }
+        if (part) batch_write();
+    } else if (due) {
+        wait_ms = (uint32_t)((due_us - now + 999) / 1000);
+    }
+    xSemaphoreGive(lock);
+    return wait_ms;
+}
+
+void journal_get_stats(journal_stats_t *out)
+{
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    out->tracked = out->undelivered = out->leaked = 0;
+    for (int i = 0; i < JOURNAL_MAX_ORDERS; i++) {
+        if (!entries[i].id) continue;
+        out->tracked++;
+        if (finished(&entries[i])) out->undelivered++;
+        if (entries[i].written == STATE_SETTLED) out->leaked++;
+    }
+    if (lock) xSemaphoreGive(lock);
+}
@@ -0,0 +1,118 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// =============================================================
+// Order journal
+// Append-only log of order state in a raw flash partition
+// ("journal" in partitions.csv), so completions survive Wi-Fi
+// outages and reboots until the server has them. Every record
+// holds an order's whole state; the newest record per order wins.
+// The partition is a ring of 4 KB sectors: before a sector is
+// reused, the orders whose newest record lives in it are copied
+// forward. State changes collect in RAM and go to flash in
+// batches, where several changes to one order cost one record.
+// =============================================================
+
+#define JOURNAL_PARTITION_LABEL    "journal"
+#define JOURNAL_PARTITION_SUBTYPE  0x40
+
+// Orders tracked at once: held ones plus completions not yet delivered
+#ifndef JOURNAL_MAX_ORDERS
+#define JOURNAL_MAX_ORDERS         64
+#endif
+
+// A batch is written once this many records are due...
+#ifndef JOURNAL_BATCH_RECORDS
+#define JOURNAL_BATCH_RECORDS      16
+#endif
+// ...or once the oldest unwritten change is this old. Most orders are
+// finished and acknowledged sooner and never reach flash; changes
+// younger than this are lost on power failure.
+#ifndef JOURNAL_FLUSH_MS
+#define JOURNAL_FLUSH_MS           10000
+#endif
+
+// A finished order as the server should hear about it
+typedef struct {
+    int  id;
+    bool poured;
+} journal_ack_t;
+
+typedef struct {
+    uint32_t records;        // written since boot, copies included
+    uint32_t copies;         // ... moved forward out of a sector being erased
+    uint32_t batches;        // flash writes
+    uint32_t erases;         // sectors erased
+    uint32_t coalesced;      // state changes that never needed a record
+    uint32_t recovered;      // orders open at boot, reported as not poured
+    uint16_t tracked;        // orders in RAM now
+    uint16_t undelivered;    // ... finished and waiting for the server
+    uint16_t leaked;         // ... settled on flash yet never freed (always 0)
+} journal_stats_t;
+
+/**
+ * @brief Find the partition and rebuild state from it.
+ *
+ * Orders still held when the station went down were never finished
+ * here: they come back as undelivered "not poured" completions, so the
+ * server can hand them out again without waiting for their leases.
+ * Without the partition the journal keeps working in RAM only.
+ */
+esp_err_t journal_init(void);
+
+/**
+ * @brief Record a claimed order.
+ */
+void journal_accepted(int id);
+
+/**
+ * @brief Record that an order finished here, poured or not. The
+ *        completion is owed to the server until journal_acks_end()
+ *        reports it delivered.
+ */
+void journal_finished(int id, bool poured);
+
+/**
+ * @brief Record that nothing is owed for an order (say, its lease went
+ *        to another station).
+ */
+void journal_settled(int id);
+
+/**
+ * @brief Take completions to send, oldest first.
+ *
+ * They count as in flight, and are not handed out again, until
+ * journal_acks_end(); so two tasks never send the same one.
+ *
+ * @return Number written to acks (at most max).
+ */
+int journal_acks_begin(journal_ack_t *acks, int max);
+
+/**
+ * @brief Finish a journal_acks_begin(): the first delivered of the n
+ *        completions reached the server, the rest are owed again.
+ */
+void journal_acks_end(const journal_ack_t *acks, int n, int delivered);
+
+/**
+ * @brief Write pending changes to flash if a batch is due, or all of them
+ *        with force.
+ *
+ * Flash writes and erases stall the caches, so call this from a task
+ * that is not timing a pour, at a moment no pour is running.
+ *
+ * @return Milliseconds until the next batch falls due, UINT32_MAX if
+ *         nothing is pending.
+ */
+uint32_t journal_flush(bool force);
+
+/**
+ * @brief Journal counters since boot.
+ */
+void journal_get_stats(journal_stats_t *out);
+
+#endif // JOURNAL_H
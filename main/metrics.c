@@ -0,0 +1,333 @@
+#include "metrics.h"
+#include "wifi_sta.h"
+#include "pca9685.h"
+#include "esp_http_server.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define METRICS_BUF_LEN   6144
+#define RATE_WINDOW_US    (3600LL * 1000000)
+
+static const char *TAG = "METRICS";
+
+atomic_uint metrics_counters[METRIC_COUNT];
+
+// Single writer (the pouring task); a scrape may see one sample mid-update
+static uint32_t    latency_ms[METRICS_LATENCY_SAMPLES];
+static int64_t     drink_us[METRICS_RATE_SAMPLES];
+static atomic_uint drinks_recorded;
+
+static httpd_handle_t server;
+
+// Heap hooks may run on either core at once
+static atomic_uint  heap_allocs;
+static atomic_uint  heap_frees;
+static atomic_uint  heap_peak_blocks;
+static atomic_uint  heap_task_allocs;
+static TaskHandle_t heap_tasks[METRICS_HEAP_MAX_TASKS];
+static atomic_int   n_heap_tasks;
+
+// Written by the pouring task at each drink
+static uint32_t heap_drink_mark;
+static uint32_t heap_steady_allocs;
+static uint32_t heap_steady_drinks;
+static uint32_t heap_dirty_drinks;
+
+/* ---------------- Heap ---------------- */
+static bool IRAM_ATTR heap_watched(void)
+{
+    if (xPortInIsrContext()) return false;
+
+    TaskHandle_t me = xTaskGetCurrentTaskHandle();
+    int n = atomic_load_explicit(&n_heap_tasks, memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        if (heap_tasks[i] == me) return true;
+    }
+    return false;
+}
+
+// CONFIG_HEAP_USE_HOOKS: heap_caps calls these on every allocation and free
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    uint32_t allocs = atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed) + 1;
+    uint32_t live = allocs - atomic_load_explicit(&heap_frees, memory_order_relaxed);
+    uint32_t peak = atomic_load_explicit(&heap_peak_blocks, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&heap_peak_blocks, &peak, live,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    if (heap_watched()) atomic_fetch_add_explicit(&heap_task_allocs, 1, memory_order_relaxed);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+    atomic_fetch_add_explicit(&heap_frees, 1, memory_order_relaxed);
+}
+
+void metrics_heap_watch_task(void)
+{
+    TaskHandle_t me = xTaskGetCurrentTaskHandle();
+    int n = atomic_load_explicit(&n_heap_tasks, memory_order_relaxed);
+
+    for (int i = 0; i < n; i++) {
+        if (heap_tasks[i] == me) return;
+    }
+    if (n == METRICS_HEAP_MAX_TASKS) {
+        ESP_LOGW(TAG, "Heap watch full, %s not watched", pcTaskGetName(NULL));
+        return;
+    }
+    // Tasks register at start-up, one after the other
+    heap_tasks[n] = me;
+    atomic_store_explicit(&n_heap_tasks, n + 1, memory_order_release);
+}
+
+// Allocations by the watched tasks since the previous drink
+static void heap_drink_done(uint32_t drink)
+{
+    uint32_t allocs = atomic_load_explicit(&heap_task_allocs, memory_order_relaxed);
+    uint32_t during = allocs - heap_drink_mark;
+    heap_drink_mark = allocs;
+    if (drink < METRICS_HEAP_WARMUP_DRINKS) return;
+
+    heap_steady_drinks++;
+    if (during) {
+        heap_steady_allocs += during;
+        heap_dirty_drinks++;
+        ESP_LOGW(TAG, "Drink %lu: %lu heap allocations past warm-up",
+                 (unsigned long)drink, (unsigned long)during);
+    }
+}
+
+void metrics_get_heap(metrics_heap_t *out)
+{
+    *out = (metrics_heap_t) {
+        .allocs        = atomic_load_explicit(&heap_allocs, memory_order_relaxed),
+        .frees         = atomic_load_explicit(&heap_frees, memory_order_relaxed),
+        .peak_blocks   = atomic_load_explicit(&heap_peak_blocks, memory_order_relaxed),
+        .task_allocs   = atomic_load_explicit(&heap_task_allocs, memory_order_relaxed),
+        .steady_allocs = heap_steady_allocs,
+        .steady_drinks = heap_steady_drinks,
+        .dirty_drinks  = heap_dirty_drinks,
+    };
+}
+
+/* ---------------- Recording ---------------- */
+void metrics_record_drink(uint32_t order_to_pour_ms)
+{
+    uint32_t n = atomic_load_explicit(&drinks_recorded, memory_order_relaxed);
+    heap_drink_done(n);
+    latency_ms[n % METRICS_LATENCY_SAMPLES] = order_to_pour_ms;
+    drink_us[n % METRICS_RATE_SAMPLES] = esp_timer_get_time();
+    atomic_store_explicit(&drinks_recorded, n + 1, memory_order_release);
+    metrics_inc(METRIC_DRINKS_SERVED);
+}
+
+/* ---------------- Derived Values ---------------- */
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Drinks per hour over the last hour (or since boot, if shorter)
+static double drinks_per_hour(int64_t now, uint32_t recorded)
+{
+    int n = recorded < METRICS_RATE_SAMPLES ? recorded : METRICS_RATE_SAMPLES;
+    int64_t window = now < RATE_WINDOW_US ? now : RATE_WINDOW_US;
+    int in_window = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (now - drink_us[i] <= RATE_WINDOW_US) in_window++;
+    }
+    // Ring full and all of it inside the hour: the window is what the ring covers
+    if (in_window == METRICS_RATE_SAMPLES) {
+        window = now - drink_us[recorded % METRICS_RATE_SAMPLES];
+    }
+    return window > 0 ? in_window * 3600e6 / window : 0;
+}
+
+/* ---------------- Formatting ---------------- */
+typedef struct {
+    char *buf;
+    int   size;
+    int   len;
+} out_t;
+
+static void emit(out_t *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(out_t *o, const char *fmt, ...)
+{
+    if (o->len >= o->size - 1) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+    va_end(ap);
+    o->len += n;
+    if (o->len > o->size - 1) o->len = o->size - 1;
+}
+
+static void counter_value(out_t *o, const char *name, const char *help, uint32_t value)
+{
+    emit(o, "# HELP %s %s\n# TYPE %s counter\n%s %u\n", name, help, name, name, value);
+}
+
+static void counter(out_t *o, const char *name, const char *help, metric_id_t id)
+{
+    counter_value(o, name, help, atomic_load_explicit(&metrics_counters[id], memory_order_relaxed));
+}
+
+static void gauge(out_t *o, const char *name, const char *help, double value)
+{
+    emit(o, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, value);
+}
+
+int metrics_format(char *buf, int size)
+{
+    // Rates are computed against the previous scrape (boot for the first one)
+    static int64_t  prev_us;
+    static uint32_t prev_i2c[3];
+
+    out_t o = { .buf = buf, .size = size, .len = 0 };
+    buf[0] = '\0';
+
+    int64_t now = esp_timer_get_time();
+    uint32_t recorded = atomic_load_explicit(&drinks_recorded, memory_order_acquire);
+
+    counter(&o, "pour_drinks_served_total", "Drinks poured", METRIC_DRINKS_SERVED);
+    counter(&o, "pour_drinks_failed_total", "Drinks whose pour returned an error", METRIC_DRINKS_FAILED);
+    gauge(&o, "pour_drinks_per_hour", "Drinks served over the last hour", drinks_per_hour(now, recorded));
+
+    // Order-to-first-pour summary over the most recent drinks
+    static uint32_t sorted[METRICS_LATENCY_SAMPLES];
+    int n = recorded < METRICS_LATENCY_SAMPLES ? recorded : METRICS_LATENCY_SAMPLES;
+    uint64_t sum = 0;
+    memcpy(sorted, latency_ms, n * sizeof(uint32_t));
+    for (int i = 0; i < n; i++) sum += sorted[i];
+    qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+
+    emit(&o, "# HELP pour_order_to_first_pour_ms Server order creation to first solenoid opening\n"
+             "# TYPE pour_order_to_first_pour_ms summary\n");
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+    for (int q = 0; q < 3 && n > 0; q++) {
+        emit(&o, "pour_order_to_first_pour_ms{quantile=\"%g\"} %u\n",
+             quantiles[q], sorted[(int)(quantiles[q] * (n - 1) + 0.5)]);
+    }
+    emit(&o, "pour_order_to_first_pour_ms_sum %llu\npour_order_to_first_pour_ms_count %d\n",
+         (unsigned long long)sum, n);
+
+    counter(&o, "pour_polls_ok_total", "/mix requests that completed", METRIC_POLLS_OK);
+    counter(&o, "pour_polls_failed_total", "/mix requests that failed", METRIC_POLLS_FAILED);
+    counter(&o, "pour_orders_fetched_total", "Orders received from /mix", METRIC_ORDERS_FETCHED);
+    counter(&o, "pour_leases_renewed_total", "Order leases renewed while queued or pouring",
+            METRIC_LEASES_RENEWED);
+    counter(&o, "pour_leases_lost_total", "Orders whose lease the server gave to another station",
+            METRIC_LEASES_LOST);
+    counter(&o, "pour_acks_delivered_total", "Order completions the server confirmed",
+            METRIC_ACKS_DELIVERED);
+    counter(&o, "pour_ack_requests_total", "Requests that carried completions", METRIC_ACK_REQUESTS);
+    counter(&o, "pour_journal_records_total", "Records written to the order journal",
+            METRIC_JOURNAL_RECORDS);
+    counter(&o, "pour_journal_erases_total", "Order journal sectors erased", METRIC_JOURNAL_ERASES);
+
+    static const struct {
+        metric_id_t id;
+        const char *name;
+        const char *help;
+    } i2c[3] = {
+        { METRIC_I2C_TRANSACTIONS, "pour_i2c_transactions", "I2C write transactions" },
+        { METRIC_I2C_BYTES,        "pour_i2c_bytes",        "I2C bytes on the wire" },
+        { METRIC_I2C_ERRORS,       "pour_i2c_errors",       "I2C writes that failed" },
+    };
+    for (int i = 0; i < 3; i++) {
+        uint32_t v = atomic_load_explicit(&metrics_counters[i2c[i].id], memory_order_relaxed);
+        double per_s = (now > prev_us) ? (v - prev_i2c[i]) * 1e6 / (now - prev_us) : 0;
+        emit(&o, "# HELP %s_total %s\n# TYPE %s_total counter\n%s_total %u\n",
+             i2c[i].name, i2c[i].help, i2c[i].name, i2c[i].name, v);
+        emit(&o, "# HELP %s_per_second %s per second since the previous scrape\n"
+                 "# TYPE %s_per_second gauge\n%s_per_second %.3f\n",
+             i2c[i].name, i2c[i].help, i2c[i].name, i2c[i].name, per_s);
+        prev_i2c[i] = v;
+    }
+    prev_us = now;
+
+    counter(&o, "pour_i2c_retries_total", "Channels rewritten after a failed I2C write",
+            METRIC_I2C_RETRIES);
+    counter(&o, "pour_i2c_recoveries_total", "I2C bus clears followed by a board reprogram",
+            METRIC_I2C_RECOVERIES);
+    pca9685_stats_t bus;
+    pca9685_get_stats(&bus);
+    gauge(&o, "pour_pwm_outputs_high", "Most PWM outputs high at once in a period, boards summed",
+          bus.concurrent);
+    gauge(&o, "pour_pwm_outputs_high_peak", "Highest pour_pwm_outputs_high since boot",
+          bus.concurrent_peak);
+    gauge(&o, "pour_pwm_outputs_high_aligned_peak",
+          "The same peak had every pulse started at step 0", bus.aligned_peak);
+
+    // Only channels that have failed are listed
+    emit(&o, "# HELP pour_i2c_channel_errors_total Failed I2C writes that carried the channel\n"
+             "# TYPE pour_i2c_channel_errors_total counter\n");
+    for (int ch = 0; ch < PCA9685_MAX_CHANNELS && pca9685_get(ch / PCA9685_CHANNELS); ch++) {
+        uint32_t errors = pca9685_channel_errors(ch);
+        if (errors) emit(&o, "pour_i2c_channel_errors_total{channel=\"%d\"} %u\n", ch, errors);
+    }
+
+    gauge(&o, "pour_heap_free_bytes", "Free heap", esp_get_free_heap_size());
+    gauge(&o, "pour_heap_min_free_bytes", "Lowest free heap since boot", esp_get_minimum_free_heap_size());
+
+    metrics_heap_t heap;
+    metrics_get_heap(&heap);
+    counter_value(&o, "pour_heap_allocs_total", "Heap allocations since boot", heap.allocs);
+    gauge(&o, "pour_heap_blocks", "Heap blocks allocated now", heap.allocs - heap.frees);
+    gauge(&o, "pour_heap_peak_blocks", "Most heap blocks allocated at once", heap.peak_blocks);
+    counter_value(&o, "pour_heap_steady_allocs_total", "Allocations by the order path after warm-up",
+                  heap.steady_allocs);
+    counter_value(&o, "pour_heap_dirty_drinks_total",
+                  "Drinks after warm-up during which the order path allocated", heap.dirty_drinks);
+    gauge(&o, "pour_uptime_seconds", "Time since boot", now / 1e6);
+
+    return o.len;
+}
+
+/* ---------------- HTTP Server ---------------- */
+static esp_err_t metrics_get(httpd_req_t *req)
+{
+    static char buf[METRICS_BUF_LEN];
+
+    int len = metrics_format(buf, sizeof(buf));
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    return httpd_resp_send(req, buf, len);
+}
+
+esp_err_t metrics_start(void)
+{
+    if (server) return ESP_OK;
+
+    httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+    cfg.task_priority = 2;   // scrapes must never delay pouring
+    cfg.core_id = NETWORK_CORE;
+
+    esp_err_t err = httpd_start(&server, &cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start HTTP server: %s", esp_err_to_name(err));
+        server = NULL;
+        return err;
+    }
+
+    static const httpd_uri_t uri = {
+        .uri     = "/metrics",
+        .method  = HTTP_GET,
+        .handler = metrics_get,
+    };
+    httpd_register_uri_handler(server, &uri);
+    ESP_LOGI(TAG, "Serving /metrics on port %d", cfg.server_port);
+    return ESP_OK;
+}
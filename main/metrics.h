@@ -0,0 +1,102 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// =============================================================
+// Runtime metrics
+// Hot paths bump counters with one relaxed atomic add; all the
+// formatting happens when /metrics is scraped (Prometheus text
+// format, served by esp_http_server on port 80).
+// =============================================================
+
+// Samples kept for latency percentiles and the drinks/hour window
+#define METRICS_LATENCY_SAMPLES  256
+#define METRICS_RATE_SAMPLES     256
+
+// Drinks served before heap use counts against the steady state
+#ifndef METRICS_HEAP_WARMUP_DRINKS
+#define METRICS_HEAP_WARMUP_DRINKS  8
+#endif
+// Tasks whose allocations are charged to the drinks
+#define METRICS_HEAP_MAX_TASKS      8
+
+typedef enum {
+    METRIC_POLLS_OK,
+    METRIC_POLLS_FAILED,
+    METRIC_ORDERS_FETCHED,
+    METRIC_LEASES_RENEWED,
+    METRIC_LEASES_LOST,
+    METRIC_ACKS_DELIVERED,
+    METRIC_ACK_REQUESTS,
+    METRIC_JOURNAL_RECORDS,
+    METRIC_JOURNAL_ERASES,
+    METRIC_DRINKS_SERVED,
+    METRIC_DRINKS_FAILED,
+    METRIC_I2C_TRANSACTIONS,
+    METRIC_I2C_BYTES,
+    METRIC_I2C_ERRORS,
+    METRIC_I2C_RETRIES,
+    METRIC_I2C_RECOVERIES,
+    METRIC_COUNT,
+} metric_id_t;
+
+extern atomic_uint metrics_counters[METRIC_COUNT];
+
+static inline void metrics_add(metric_id_t id, uint32_t n)
+{
+    atomic_fetch_add_explicit(&metrics_counters[id], n, memory_order_relaxed);
+}
+
+static inline void metrics_inc(metric_id_t id)
+{
+    metrics_add(id, 1);
+}
+
+/**
+ * @brief Record a served drink and its order-to-first-pour latency.
+ *
+ * Call from a single task (the one pouring).
+ */
+void metrics_record_drink(uint32_t order_to_pour_ms);
+
+typedef struct {
+    uint32_t allocs;          // every heap allocation since boot
+    uint32_t frees;
+    uint32_t peak_blocks;     // most blocks allocated at once
+    uint32_t task_allocs;     // allocations by the watched tasks
+    uint32_t steady_allocs;   // ... after warm-up
+    uint32_t steady_drinks;   // drinks served after warm-up
+    uint32_t dirty_drinks;    // ... during which a watched task allocated
+} metrics_heap_t;
+
+/**
+ * @brief Charge the calling task's heap allocations to the drinks.
+ *
+ * The order path (fetch, report, pouring and actuator tasks) calls this
+ * once at start. Counting needs CONFIG_HEAP_USE_HOOKS. The network stack
+ * allocates its packet buffers on its own tasks, which are not watched.
+ */
+void metrics_heap_watch_task(void);
+
+/**
+ * @brief Heap counters. Past warm-up every drink should leave
+ *        steady_allocs and dirty_drinks at 0.
+ */
+void metrics_get_heap(metrics_heap_t *out);
+
+/**
+ * @brief Start the HTTP server with GET /metrics. Call after Wi-Fi is up.
+ */
+esp_err_t metrics_start(void);
+
+/**
+ * @brief Render the current metrics in Prometheus text format.
+ *
+ * @return Bytes written (excluding the terminator), truncated to size - 1.
+ */
+int metrics_format(char *buf, int size);
+
+#endif // METRICS_H
@@ -0,0 +1,361 @@
+#include "mix_mqtt.h"
+#include "http_client.h"
+
+#if MIX_TRANSPORT == MIX_TRANSPORT_MQTT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "wifi_sta.h"
+#include "trace.h"
+
+#define PUB_STACK          3072
+#define PUB_PRIORITY       4           // same as the tasks that hand it work
+#define PUB_QUEUE_LEN      4
+#define PUB_BODY_MAX       (64 + MIX_ACKS_MAX * 28)   // an "acks" body
+#define PUB_TOPICS         4
+#define ORDER_QUEUE_LEN    2           // one offer out at a time, plus a redelivery
+#define RECENT_IDS         8           // pushed orders remembered, to drop redeliveries
+#define REVOKED_IDS        8
+#define TOPIC_LEN          48
+#define RX_BUFFER          1024        // longer orders arrive in pieces
+
+#define CONNECTED_BIT      BIT0
+#define CONFIRMED_BIT      BIT1
+#define FAILED_BIT         BIT2
+
+static const char *TAG = "MQTT";
+
+typedef struct {
+    uint8_t  topic;                 // mix_mqtt_topic_t
+    uint16_t len;
+    char     body[PUB_BODY_MAX];
+} pub_msg_t;
+
+// A pushed order on its way from the MQTT task to mix_mqtt_wait_order()
+typedef struct {
+    recipe_parser_t parser;
+    int64_t         t_received_us;
+    bool            ok;             // parsed to the end
+} pushed_t;
+
+static const char *const pub_names[PUB_TOPICS]   = { "ready", "acks", "lease", "eta" };
+static const uint8_t     pub_qos[PUB_TOPICS]     = { 1, 1, 1, 0 };
+static const bool        pub_confirm[PUB_TOPICS] = { false, true, true, false };
+
+static char pub_topics[PUB_TOPICS][TOPIC_LEN];
+static char orders_topic[TOPIC_LEN];
+static char revoked_topic[TOPIC_LEN];
+static char online_topic[TOPIC_LEN];
+
+static esp_mqtt_client_handle_t client;
+static volatile uint32_t        session;
+
+static StaticEventGroup_t group_buf;
+static EventGroupHandle_t group;
+
+static StaticQueue_t pub_queue_buf;
+static uint8_t       pub_queue_storage[PUB_QUEUE_LEN * sizeof(pub_msg_t)];
+static QueueHandle_t pub_queue;
+
+static StaticQueue_t order_queue_buf;
+static uint8_t       order_queue_storage[ORDER_QUEUE_LEN * sizeof(pushed_t)];
+static QueueHandle_t order_queue;
+
+// The confirmed publish in flight, matched against PUBACKs as they come
+static StaticSemaphore_t confirm_lock_buf;
+static SemaphoreHandle_t confirm_lock;
+static int               awaited_id = -1;
+static int               last_puback = -1;
+
+static int          recent[RECENT_IDS];
+static int          recent_next;
+static volatile int revoked[REVOKED_IDS];
+static int          revoked_next;
+
+/* ---------------- Publishing ---------------- */
+static void note_puback(int msg_id)
+{
+    xSemaphoreTake(confirm_lock, portMAX_DELAY);
+    last_puback = msg_id;
+    if (msg_id == awaited_id) {
+        awaited_id = -1;
+        xEventGroupSetBits(group, CONFIRMED_BIT);
+    }
+    xSemaphoreGive(confirm_lock);
+}
+
+static void fail_confirm(void)
+{
+    xSemaphoreTake(confirm_lock, portMAX_DELAY);
+    if (awaited_id >= 0) {
+        awaited_id = -1;
+        xEventGroupSetBits(group, FAILED_BIT);
+    }
+    xSemaphoreGive(confirm_lock);
+}
+
+static void publish_task(void *arg)
+{
+    static pub_msg_t msg;
+
+    while (1) {
+        xQueueReceive(pub_queue, &msg, portMAX_DELAY);
+        int id = esp_mqtt_client_publish(client, pub_topics[msg.topic], msg.body, msg.len,
+                                         pub_qos[msg.topic], 0);
+        if (id < 0) ESP_LOGW(TAG, "Publish to %s failed", pub_topics[msg.topic]);
+        if (!pub_confirm[msg.topic]) continue;
+
+        xSemaphoreTake(confirm_lock, portMAX_DELAY);
+        if (id < 0) {
+            xEventGroupSetBits(group, FAILED_BIT);
+        } else if (id == last_puback) {
+            xEventGroupSetBits(group, CONFIRMED_BIT);     // the PUBACK beat us here
+        } else {
+            awaited_id = id;
+        }
+        xSemaphoreGive(confirm_lock);
+    }
+}
+
+/* ---------------- Receiving ---------------- */
+static bool topic_is(const esp_mqtt_event_t *ev, const char *topic)
+{
+    return ev->topic_len == (int)strlen(topic) && memcmp(ev->topic, topic, ev->topic_len) == 0;
+}
+
+// QoS 1 delivers at least once: a DUP of an order seen lately is a
+// redelivery. Without DUP it is a fresh push (the dispatcher gave the
+// order out again after its lease ran out) and has taken our offer.
+static bool seen(int id, bool dup)
+{
+    for (int i = 0; i < RECENT_IDS; i++) {
+        if (recent[i] == id) return dup;
+    }
+    recent[recent_next++ % RECENT_IDS] = id;
+    return false;
+}
+
+static void on_data(const esp_mqtt_event_t *ev)
+{
+    static pushed_t rx;
+    static enum { RX_OTHER, RX_ORDER, RX_REVOKED } kind;
+    static bool     dup;
+    static char     note[32];
+    static int      note_len;
+
+    // Only a message's first piece names its topic
+    if (ev->current_data_offset == 0) {
+        kind = topic_is(ev, orders_topic) ? RX_ORDER : topic_is(ev, revoked_topic) ? RX_REVOKED
+             : RX_OTHER;
+        dup = ev->dup;
+        recipe_parser_init(&rx.parser);
+        note_len = 0;
+    }
+    if (kind == RX_ORDER) {
+        TRACE_BEGIN("parse", ev->data_len);
+        recipe_parser_feed(&rx.parser, ev->data, ev->data_len);
+        TRACE_END("parse");
+    } else if (kind == RX_REVOKED) {
+        int n = ev->data_len < (int)sizeof(note) - 1 - note_len ? ev->data_len
+              : (int)sizeof(note) - 1 - note_len;
+        memcpy(note + note_len, ev->data, n);
+        note_len += n;
+    }
+    if (ev->current_data_offset + ev->data_len < ev->total_data_len) return;
+
+    if (kind == RX_REVOKED) {
+        note[note_len] = '\0';
+        const char *q = strstr(note, "\"id\":");
+        int id = q ? atoi(q + strlen("\"id\":")) : 0;
+        if (id) {
+            revoked[revoked_next++ % REVOKED_IDS] = id;
+            ESP_LOGW(TAG, "Order %d revoked by the dispatcher", id);
+        }
+        return;
+    }
+    if (kind != RX_ORDER) return;
+
+    rx.t_received_us = esp_timer_get_time();
+    rx.ok = recipe_parser_finish(&rx.parser) == RECIPE_PARSE_DONE;
+    int id = rx.parser.id;
+    if (rx.ok && id) {
+        if (seen(id, dup)) {
+            ESP_LOGW(TAG, "Order %d delivered again, dropped", id);
+            return;
+        }
+        // Pushed to us again after a revocation: the new lease is ours
+        for (int i = 0; i < REVOKED_IDS; i++) {
+            if (revoked[i] == id) revoked[i] = 0;
+        }
+    }
+    TRACE_INSTANT("order_pushed", id);
+    if (xQueueSend(order_queue, &rx, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Order %d pushed without an offer, dropped", id);
+    }
+}
+
+static void on_event(void *arg, esp_event_base_t base, int32_t event_id, void *data)
+{
+    esp_mqtt_event_handle_t ev = data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        // A persistent session keeps the subscriptions, and any order pushed meanwhile
+        if (!ev->session_present) {
+            esp_mqtt_client_subscribe(client, orders_topic, 1);
+            esp_mqtt_client_subscribe(client, revoked_topic, 1);
+        }
+        esp_mqtt_client_publish(client, online_topic, "1", 1, 1, 1);
+        session++;
+        ESP_LOGI(TAG, "Connected to %s (session %lu%s)", MIX_MQTT_URI, (unsigned long)session,
+                 ev->session_present ? ", resumed" : "");
+        TRACE_INSTANT("mqtt_connected", session);
+        xEventGroupSetBits(group, CONNECTED_BIT);
+        break;
+
+    case MQTT_EVENT_DISCONNECTED:
+        xEventGroupClearBits(group, CONNECTED_BIT);
+        fail_confirm();
+        ESP_LOGW(TAG, "Disconnected from %s", MIX_MQTT_URI);
+        break;
+
+    case MQTT_EVENT_PUBLISHED:
+        note_puback(ev->msg_id);
+        break;
+
+    case MQTT_EVENT_DATA:
+        on_data(ev);
+        break;
+
+    case MQTT_EVENT_ERROR:
+        ESP_LOGW(TAG, "MQTT client error");
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* ---------------- Public API ---------------- */
+static esp_err_t start(const char *station)
+{
+    group = xEventGroupCreateStatic(&group_buf);
+    confirm_lock = xSemaphoreCreateMutexStatic(&confirm_lock_buf);
+    pub_queue = xQueueCreateStatic(PUB_QUEUE_LEN, sizeof(pub_msg_t), pub_queue_storage,
+                                   &pub_queue_buf);
+    order_queue = xQueueCreateStatic(ORDER_QUEUE_LEN, sizeof(pushed_t), order_queue_storage,
+                                     &order_queue_buf);
+
+    for (int t = 0; t < PUB_TOPICS; t++) {
+        snprintf(pub_topics[t], TOPIC_LEN, MIX_MQTT_PREFIX "/%s/%s", station, pub_names[t]);
+    }
+    snprintf(orders_topic, TOPIC_LEN, MIX_MQTT_PREFIX "/%s/orders", station);
+    snprintf(revoked_topic, TOPIC_LEN, MIX_MQTT_PREFIX "/%s/revoked", station);
+    snprintf(online_topic, TOPIC_LEN, MIX_MQTT_PREFIX "/%s/online", station);
+
+    esp_mqtt_client_config_t cfg = {
+        .broker.address.uri     = MIX_MQTT_URI,
+        .credentials.client_id  = station,
+        .session = {
+            .keepalive             = MIX_MQTT_KEEPALIVE_S,
+            .disable_clean_session = true,
+            .last_will = {
+                .topic   = online_topic,
+                .msg     = "0",
+                .msg_len = 1,
+                .qos     = 1,
+                .retain  = 1,
+            },
+        },
+        .network.reconnect_timeout_ms = MIX_MQTT_RECONNECT_MS,
+        .buffer.size                  = RX_BUFFER,
+    };
+    client = esp_mqtt_client_init(&cfg);
+    if (!client) {
+        ESP_LOGE(TAG, "Failed to init MQTT client");
+        return ESP_FAIL;
+    }
+    esp_mqtt_client_register_event(client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, on_event, NULL);
+
+    static StaticTask_t pub_buf;
+    static StackType_t  pub_stack[PUB_STACK];
+    if (!xTaskCreateStaticPinnedToCore(publish_task, "mqtt_pub", PUB_STACK, NULL, PUB_PRIORITY,
+                                       pub_stack, &pub_buf, NETWORK_CORE)) {
+        ESP_LOGE(TAG, "Failed to start publish task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Orders from %s on %s", MIX_MQTT_URI, orders_topic);
+    return esp_mqtt_client_start(client);
+}
+
+uint32_t mix_mqtt_session(const char *station, uint32_t wait_ms)
+{
+    if (!client && start(station) != ESP_OK) return 0;
+
+    EventBits_t bits = xEventGroupWaitBits(group, CONNECTED_BIT, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(wait_ms));
+    return (bits & CONNECTED_BIT) ? session : 0;
+}
+
+esp_err_t mix_mqtt_publish(mix_mqtt_topic_t topic, const char *body, int len)
+{
+    pub_msg_t msg = { .topic = topic, .len = len };
+
+    // Not queued in the outbox while offline: the caller keeps what it owes
+    if (!client || !(xEventGroupGetBits(group) & CONNECTED_BIT)) return ESP_FAIL;
+    if (len > PUB_BODY_MAX) return ESP_ERR_INVALID_SIZE;
+    memcpy(msg.body, body, len);
+
+    bool confirm = pub_confirm[topic];
+    if (confirm) xEventGroupClearBits(group, CONFIRMED_BIT | FAILED_BIT);
+    if (xQueueSend(pub_queue, &msg, pdMS_TO_TICKS(MIX_MQTT_ACK_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Publish queue full, %s not sent", pub_names[topic]);
+        return ESP_FAIL;
+    }
+    if (!confirm) return ESP_OK;
+
+    EventBits_t bits = xEventGroupWaitBits(group, CONFIRMED_BIT | FAILED_BIT, pdTRUE, pdFALSE,
+                                           pdMS_TO_TICKS(MIX_MQTT_ACK_TIMEOUT_MS));
+    if (bits & CONFIRMED_BIT) return ESP_OK;
+
+    xSemaphoreTake(confirm_lock, portMAX_DELAY);
+    awaited_id = -1;
+    xSemaphoreGive(confirm_lock);
+    if (!(bits & FAILED_BIT)) ESP_LOGW(TAG, "No PUBACK for %s", pub_names[topic]);
+    return ESP_FAIL;
+}
+
+esp_err_t mix_mqtt_wait_order(recipe_parser_t *parser, int64_t *t_received_us, uint32_t wait_ms)
+{
+    static pushed_t rx;
+
+    if (!order_queue) return ESP_FAIL;
+    if (xQueueReceive(order_queue, &rx, pdMS_TO_TICKS(wait_ms)) != pdTRUE) return ESP_ERR_TIMEOUT;
+
+    *parser = rx.parser;
+    *t_received_us = rx.t_received_us;
+    if (!rx.ok) {
+        ESP_LOGE(TAG, "Pushed order did not parse (%u bytes)", (unsigned)rx.parser.bytes);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+bool mix_mqtt_revoked(int id)
+{
+    for (int i = 0; i < REVOKED_IDS; i++) {
+        if (revoked[i] == id) return true;
+    }
+    return false;
+}
+
+#endif // MIX_TRANSPORT == MIX_TRANSPORT_MQTT
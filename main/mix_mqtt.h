@@ -0,0 +1,80 @@
+#ifndef MIX_MQTT_H
+#define MIX_MQTT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "recipe_parser.h"
+
+// =============================================================
+// MQTT order transport (MIX_TRANSPORT_MQTT, see http_client.h)
+// Instead of polling /mix, the station offers room for an order on
+// <prefix>/<station>/ready and the dispatcher pushes it to
+// <prefix>/<station>/orders, both at QoS 1. Completions, renewals and
+// ETAs are published with the same bodies the HTTP endpoints take;
+// an order the dispatcher takes back is named on .../revoked. An
+// idle station sends nothing but MQTT pings.
+// =============================================================
+
+#ifndef MIX_MQTT_URI
+#define MIX_MQTT_URI           "mqtt://3.140.199.217:1883"
+#endif
+#define MIX_MQTT_PREFIX        "pour"
+
+// An idle connection pings at half this; the broker drops it after 1.5x
+#ifndef MIX_MQTT_KEEPALIVE_S
+#define MIX_MQTT_KEEPALIVE_S   120
+#endif
+#define MIX_MQTT_RECONNECT_MS  1000
+#define MIX_MQTT_ACK_TIMEOUT_MS 3000       // PUBACK for a confirmed publish
+
+// Published topics under <prefix>/<station>/
+typedef enum {
+    MIX_MQTT_READY,     // {"station","load","eta_ms"}: room for one order, QoS 1
+    MIX_MQTT_ACKS,      // {"station","acks":[...]}, QoS 1, waits for PUBACK
+    MIX_MQTT_LEASE,     // {"station","id"}, QoS 1, waits for PUBACK
+    MIX_MQTT_ETA,       // {"station","id","eta_ms"}, QoS 0
+} mix_mqtt_topic_t;
+
+/**
+ * @brief Connect on first use and wait for the broker.
+ *
+ * Subscribes to the station's orders and revoked topics (QoS 1, kept
+ * in a persistent session) and marks it online with a retained
+ * message; the last will marks it offline, which voids its offer.
+ *
+ * @return The session: counts up on every (re)connect, so an offer
+ *         made in an earlier one is known to be void. 0 if the broker
+ *         was not reached within wait_ms.
+ */
+uint32_t mix_mqtt_session(const char *station, uint32_t wait_ms);
+
+/**
+ * @brief Publish a body on one of the station's topics.
+ *
+ * Publishing happens on the transport's own task, where esp-mqtt keeps
+ * QoS 1 messages in its outbox until the broker acknowledges them, so
+ * the caller's path stays allocation-free. Confirmed topics block until
+ * the PUBACK; call those from one task.
+ *
+ * @return ESP_OK once published (acknowledged where confirmed),
+ *         ESP_FAIL when not connected or the broker did not answer.
+ */
+esp_err_t mix_mqtt_publish(mix_mqtt_topic_t topic, const char *body, int len);
+
+/**
+ * @brief Wait for the dispatcher to push an order.
+ *
+ * @param parser        Filled with the parsed (and finished) message.
+ * @param t_received_us When its last byte arrived.
+ * @return ESP_OK, ESP_ERR_TIMEOUT if none arrived within wait_ms, or
+ *         ESP_FAIL if the message did not parse.
+ */
+esp_err_t mix_mqtt_wait_order(recipe_parser_t *parser, int64_t *t_received_us, uint32_t wait_ms);
+
+/**
+ * @brief Whether the dispatcher took this order back (its lease ran out).
+ */
+bool mix_mqtt_revoked(int id);
+
+#endif /* MIX_MQTT_H */
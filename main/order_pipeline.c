@@ -0,0 +1,541 @@
+#include "order_pipeline.h"
+#include "http_client.h"
+#include "pour_scheduler.h"
+#include "pour_timeline.h"
+#include "journal.h"
+#include "wifi_sta.h"
+#include "metrics.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define FETCH_STACK       6144
+#define FETCH_PRIORITY    4      // below the pour task and the actuator task
+#define REPORT_STACK      4096
+#define REPORT_PRIORITY   4
+#define REPORT_QUEUE_LEN  8
+
+#define LEASE_RENEW_DIV   3      // renew three times per lease
+#define LEASE_RETRY_MS    1000   // after a failed renewal or ack, or while offline
+
+// A completion waits this long for others to share its /acks request,
+// unless its lease runs out sooner
+#ifndef ACK_DELAY_MS
+#define ACK_DELAY_MS      2000
+#endif
+
+#define HELD_SLOTS        (ORDER_QUEUE_MAX_DEPTH + 1)
+
+#define SPACE_BIT         BIT0
+
+static const char *TAG = "ORDERS";
+
+// One extra slot so the fetch task never blocks on a full queue
+static StaticQueue_t  queue_buf;
+static uint8_t        queue_storage[(ORDER_QUEUE_MAX_DEPTH + 1) * sizeof(mix_order_t)];
+static QueueHandle_t  queue;
+
+typedef enum {
+    REPORT_ETA,
+    REPORT_WAKE,        // a renewal, ack or journal write became due
+} report_kind_t;
+
+typedef struct {
+    uint8_t  kind;      // report_kind_t
+    int      id;
+    uint32_t eta_ms;
+} report_msg_t;
+
+// ETAs on their way to the server, sent by their own task (which also
+// renews leases, delivers acks and writes the journal) so neither the
+// pour nor a held long-poll waits for the round trip
+static StaticQueue_t  report_queue_buf;
+static uint8_t        report_queue_storage[REPORT_QUEUE_LEN * sizeof(report_msg_t)];
+static QueueHandle_t  report_queue;
+static int            pouring_id;
+
+// Orders this station holds (queued or pouring) with their claim leases.
+// Once poured, an order's completion waits in the journal.
+typedef struct {
+    int      id;            // 0: free slot
+    uint32_t lease_ms;      // 0: nothing to renew
+    int64_t  due_us;        // next renewal
+    int64_t  expires_us;    // end of the lease as last confirmed by the server
+    uint32_t eta_ms;        // predicted makespan; the compiled one once pouring
+    int64_t  start_us;      // pour started, 0 while queued
+    bool     lost;          // the server gave the order to another station
+    bool     unconfirmed;   // the last renewal did not reach the server
+} held_order_t;
+
+static held_order_t held_orders[HELD_SLOTS];
+static int64_t      acks_due_us = INT64_MAX;    // journal completions go out
+
+static StaticEventGroup_t space_group_buf;
+static EventGroupHandle_t space_group;
+
+static StaticSemaphore_t lock_buf;
+static SemaphoreHandle_t lock;
+
+static uint8_t depth = ORDER_QUEUE_DEPTH;
+static order_pipeline_stats_t stats;
+static int64_t last_done_us;
+
+// Queued orders using each port, for nozzle residency
+static uint8_t port_orders[POUR_MAX_PORTS];
+
+/* ---------------- Internal Helpers ---------------- */
+static void stage_add(order_stage_t *st, int64_t us)
+{
+    uint32_t ms = us > 0 ? (uint32_t)(us / 1000) : 0;
+    st->count++;
+    st->last_ms = ms;
+    st->total_ms += ms;
+    if (ms > st->max_ms) st->max_ms = ms;
+}
+
+static uint32_t stage_mean(const order_stage_t *st)
+{
+    return st->count ? (uint32_t)(st->total_ms / st->count) : 0;
+}
+
+// Call with lock held; delta is +1 when an order is queued, -1 when it is taken
+static void track_ports(const mix_order_t *order, int delta)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < order->n_items; i++) mask |= BIT(order->items[i].port);
+
+    uint32_t upcoming = 0;
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        if (mask & BIT(p)) port_orders[p] += delta;
+        if (port_orders[p]) upcoming |= BIT(p);
+    }
+    pour_sched_set_upcoming(upcoming);
+}
+
+// Call with lock held
+static held_order_t *held_find(int id)
+{
+    if (!id) return NULL;
+    for (int i = 0; i < HELD_SLOTS; i++) {
+        if (held_orders[i].id == id) return &held_orders[i];
+    }
+    return NULL;
+}
+
+// Call with lock held; orders without a server id are not tracked
+static void held_add(const mix_order_t *order)
+{
+    if (!order->id) return;
+
+    held_order_t *h = NULL;
+    for (int i = 0; !h && i < HELD_SLOTS; i++) {
+        if (!held_orders[i].id) h = &held_orders[i];
+    }
+    if (!h) return;
+
+    // The server started the lease between our request and its response
+    *h = (held_order_t) {
+        .id         = order->id,
+        .lease_ms   = order->lease_ms,
+        .due_us     = order->t_response_us + (int64_t)order->lease_ms * 1000 / LEASE_RENEW_DIV,
+        .expires_us = order->t_request_us + (int64_t)order->lease_ms * 1000,
+        .eta_ms     = pour_sched_predict(order->items, order->n_items,
+                                         POUR_DEFAULT_MAX_SERVOS, POUR_DEFAULT_MAX_SOLENOIDS),
+    };
+}
+
+// Call with lock held: time until every held order is poured
+static uint32_t held_busy_ms(int64_t now)
+{
+    uint64_t ms = 0;
+    for (int i = 0; i < HELD_SLOTS; i++) {
+        const held_order_t *h = &held_orders[i];
+        if (!h->id) continue;
+        if (!h->start_us) {
+            ms += h->eta_ms;
+            continue;
+        }
+        int64_t elapsed_ms = (now - h->start_us) / 1000;
+        if (elapsed_ms < h->eta_ms) ms += h->eta_ms - elapsed_ms;
+    }
+    return ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+// A renewal, ack or journal write became due sooner than the report task expects
+static void wake_report_task(void)
+{
+    report_msg_t wake = { .kind = REPORT_WAKE };
+    xQueueSend(report_queue, &wake, 0);
+}
+
+// Block until fewer than depth + 1 orders are queued or pouring
+static void wait_for_space(void)
+{
+    while (1) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool room = stats.held <= depth;
+        if (!room) xEventGroupClearBits(space_group, SPACE_BIT);
+        xSemaphoreGive(lock);
+        if (room) return;
+
+        xEventGroupWaitBits(space_group, SPACE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+static void fetch_task(void *arg)
+{
+    static mix_order_t order;
+    static journal_ack_t acks[MIX_ACKS_MAX];
+
+    metrics_heap_watch_task();
+
+    while (1) {
+        wait_for_space();
+
+        // Nothing to fetch without a link: wait for it rather than fail every poll
+        while (wifi_sta_wait(LEASE_RETRY_MS * 10) != ESP_OK) {}
+
+        // The server sees how busy this station is when it picks who gets an order
+        xSemaphoreTake(lock, portMAX_DELAY);
+        mix_set_station_load(stats.held, held_busy_ms(esp_timer_get_time()));
+        xSemaphoreGive(lock);
+
+        // Completions ride along when the server takes them, saving their own request
+        int n_acks = mix_takes_acks() ? journal_acks_begin(acks, MIX_ACKS_MAX) : 0;
+        int taken = n_acks;
+
+        bool has_order = false;
+        esp_err_t err = mix_fetch(&order, &has_order, acks, &taken);
+        journal_acks_end(acks, n_acks, taken);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        uint8_t held = stats.held;
+        stats.polls++;
+        if (err != ESP_OK) stats.errors++;
+        if (taken < n_acks) acks_due_us = 0;      // the report task sends them
+        if (has_order) {
+            stage_add(&stats.fetch, order.t_ready_us - order.t_request_us);
+            held = ++stats.held;
+            if (held > stats.max_held) stats.max_held = held;
+            track_ports(&order, +1);
+            held_add(&order);
+        }
+        xSemaphoreGive(lock);
+
+        if (taken < n_acks) wake_report_task();
+        if (has_order) {
+            journal_accepted(order.id);
+            if (order.lease_ms) wake_report_task();
+            xQueueSend(queue, &order, portMAX_DELAY);
+            ESP_LOGI(TAG, "Order queued (%u held, depth %u)", held, depth);
+        }
+
+        uint32_t delay_ms = mix_poll_delay_ms();
+        if (delay_ms) vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+}
+
+// Runs in the pour task between compile and playback: must not wait on the network
+static void on_plan(const pour_timeline_t *tl, void *arg)
+{
+    if (!pouring_id) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    held_order_t *h = held_find(pouring_id);
+    if (h) h->eta_ms = tl->makespan_ms;
+    xSemaphoreGive(lock);
+
+    report_msg_t msg = { .kind = REPORT_ETA, .id = pouring_id, .eta_ms = tl->makespan_ms };
+    if (xQueueSend(report_queue, &msg, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Report queue full, ETA of order %d not sent", pouring_id);
+    }
+}
+
+// Runs in the actuator task when a nozzle kept out brings the end of the
+// pour forward: must not block. If the queue is full the first ETA stands.
+static void on_eta(uint32_t makespan_ms, void *arg)
+{
+    if (!pouring_id) return;
+
+    report_msg_t msg = { .kind = REPORT_ETA, .id = pouring_id, .eta_ms = makespan_ms };
+    xQueueSend(report_queue, &msg, 0);
+}
+
+// Call with lock held: renewal still owed for this order
+static bool held_pending(const held_order_t *h)
+{
+    return h->id && h->lease_ms && !h->lost;
+}
+
+// Send every renewal that is due; returns when the next one is
+static int64_t send_renewals(void)
+{
+    while (1) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = INT64_MAX;
+        held_order_t due = { 0 };
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        for (int i = 0; i < HELD_SLOTS; i++) {
+            const held_order_t *h = &held_orders[i];
+            if (!held_pending(h)) continue;
+            if (!due.id && h->due_us <= now) due = *h;
+            else if (h->due_us < next) next = h->due_us;
+        }
+        xSemaphoreGive(lock);
+
+        if (!due.id) return next;
+
+        esp_err_t err = mix_renew_lease(due.id);
+
+        // Poured while the renewal was out: nothing to update
+        xSemaphoreTake(lock, portMAX_DELAY);
+        held_order_t *h = held_find(due.id);
+        if (h) {
+            switch (err) {
+            case ESP_OK:
+                h->due_us = esp_timer_get_time() + (int64_t)h->lease_ms * 1000 / LEASE_RENEW_DIV;
+                h->expires_us = now + (int64_t)h->lease_ms * 1000;
+                h->unconfirmed = false;
+                break;
+            case ESP_ERR_INVALID_STATE:
+                h->lost = true;
+                if (h->start_us) ESP_LOGW(TAG, "Order %d: lease lost mid-pour, it may be poured twice", due.id);
+                break;
+            case ESP_ERR_NOT_SUPPORTED:
+                h->lease_ms = 0;
+                break;
+            default:
+                h->due_us = esp_timer_get_time() + LEASE_RETRY_MS * 1000LL;
+                h->unconfirmed = true;
+                break;
+            }
+        }
+        xSemaphoreGive(lock);
+    }
+}
+
+// Deliver the journal's completions in bulk once due; returns when to try next
+static int64_t send_acks(void)
+{
+    static journal_ack_t acks[MIX_ACKS_MAX];
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int64_t due = acks_due_us;
+    xSemaphoreGive(lock);
+
+    int64_t now = esp_timer_get_time();
+    if (due > now) return due;
+
+    // Offline: look again shortly, so the backlog goes out right after reconnecting
+    int64_t next = now + LEASE_RETRY_MS * 1000LL;
+    if (wifi_sta_wait(0) == ESP_OK) {
+        int n = journal_acks_begin(acks, MIX_ACKS_MAX);
+        int sent = mix_ack_batch(acks, n);
+        journal_acks_end(acks, n, sent);
+        if (sent < n) {
+            // retry the rest
+        } else if (n == MIX_ACKS_MAX) {
+            next = now;                 // more behind these
+        } else {
+            next = INT64_MAX;
+            if (n > 1) ESP_LOGI(TAG, "%d completions delivered in one request", n);
+        }
+    }
+
+    // A completion that arrived meanwhile may have moved the deadline
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (acks_due_us == due || next < acks_due_us) acks_due_us = next;
+    next = acks_due_us;
+    xSemaphoreGive(lock);
+    return next;
+}
+
+static void report_task(void *arg)
+{
+    report_msg_t msg;
+    TickType_t wait = 0;
+
+    metrics_heap_watch_task();
+    while (1) {
+        if (xQueueReceive(report_queue, &msg, wait) == pdTRUE && msg.kind == REPORT_ETA) {
+            // A correction from on_eta() has not been applied yet
+            xSemaphoreTake(lock, portMAX_DELAY);
+            held_order_t *h = held_find(msg.id);
+            if (h) h->eta_ms = msg.eta_ms;
+            xSemaphoreGive(lock);
+
+            if (mix_report_eta(msg.id, msg.eta_ms) == ESP_OK) {
+                ESP_LOGI(TAG, "Order %d: ETA %lu ms reported", msg.id, (unsigned long)msg.eta_ms);
+            }
+        }
+        int64_t next = send_renewals();
+        int64_t acks_next = send_acks();
+        if (acks_next < next) next = acks_next;
+
+        // Flash writes stall the caches: keep them out of pours. A batch
+        // that falls due mid-pour is written when the pour wakes us.
+        // Offline, completions may wait a long time: write them at once.
+        if (!pouring_id) {
+            uint32_t flush_ms = journal_flush(wifi_sta_wait(0) != ESP_OK);
+            int64_t flush_at = esp_timer_get_time() + flush_ms * 1000LL;
+            if (flush_ms != UINT32_MAX && flush_at < next) next = flush_at;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (next == INT64_MAX) wait = portMAX_DELAY;
+        else wait = next <= now ? 0 : pdMS_TO_TICKS((next - now + 999) / 1000) + 1;
+    }
+}
+
+/* ---------------- Public API ---------------- */
+esp_err_t order_pipeline_start(void)
+{
+    if (queue) return ESP_OK;
+
+    lock = xSemaphoreCreateMutexStatic(&lock_buf);
+    space_group = xEventGroupCreateStatic(&space_group_buf);
+    queue = xQueueCreateStatic(ORDER_QUEUE_MAX_DEPTH + 1, sizeof(mix_order_t),
+                               queue_storage, &queue_buf);
+    report_queue = xQueueCreateStatic(REPORT_QUEUE_LEN, sizeof(report_msg_t),
+                                      report_queue_storage, &report_queue_buf);
+    stats.depth = depth;
+
+    // Completions left over from before a reboot go out first
+    journal_stats_t js;
+    journal_get_stats(&js);
+    if (js.undelivered) acks_due_us = 0;
+
+    // The caller goes on to pour
+    metrics_heap_watch_task();
+
+    static StaticTask_t fetch_buf, report_buf;
+    static StackType_t  fetch_stack[FETCH_STACK], report_stack[REPORT_STACK];
+    if (!xTaskCreateStaticPinnedToCore(fetch_task, "mix_fetch", FETCH_STACK, NULL, FETCH_PRIORITY,
+                                       fetch_stack, &fetch_buf, NETWORK_CORE)) {
+        ESP_LOGE(TAG, "Failed to start fetch task");
+        return ESP_ERR_NO_MEM;
+    }
+    if (!xTaskCreateStaticPinnedToCore(report_task, "mix_report", REPORT_STACK, NULL, REPORT_PRIORITY,
+                                       report_stack, &report_buf, NETWORK_CORE)) {
+        ESP_LOGE(TAG, "Failed to start report task");
+        return ESP_ERR_NO_MEM;
+    }
+    pour_sched_on_plan(on_plan, NULL);
+    pour_sched_on_eta(on_eta, NULL);
+    ESP_LOGI(TAG, "Prefetch depth %u, station %s", depth, mix_station_id());
+    return ESP_OK;
+}
+
+void order_pipeline_set_depth(uint8_t new_depth)
+{
+    if (new_depth > ORDER_QUEUE_MAX_DEPTH) new_depth = ORDER_QUEUE_MAX_DEPTH;
+
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+    depth = new_depth;
+    stats.depth = new_depth;
+    if (lock) xSemaphoreGive(lock);
+
+    if (space_group) xEventGroupSetBits(space_group, SPACE_BIT);
+}
+
+esp_err_t order_pipeline_pour_next(TickType_t wait)
+{
+    static mix_order_t order;
+
+    if (!queue) return ESP_ERR_INVALID_STATE;
+
+    // Park nozzles whose residency expires while waiting for the next order
+    while (1) {
+        TickType_t slice = wait;
+        uint32_t park_ms = pour_sched_park(false);
+        if (park_ms != UINT32_MAX && pdMS_TO_TICKS(park_ms) + 1 < slice) {
+            slice = pdMS_TO_TICKS(park_ms) + 1;
+        }
+        if (xQueueReceive(queue, &order, slice) == pdTRUE) break;
+        if (slice == wait) return ESP_ERR_TIMEOUT;
+        if (wait != portMAX_DELAY) wait -= slice;
+    }
+
+    int64_t t_start = esp_timer_get_time();
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    track_ports(&order, -1);
+    // Past its lease, or due to lapse mid-drink with renewals failing (say,
+    // Wi-Fi is down): the server hands it out again either way
+    held_order_t *h = held_find(order.id);
+    bool lost = h && (h->lost || (h->lease_ms && t_start >= h->expires_us) ||
+                      (h->lease_ms && h->unconfirmed &&
+                       t_start + (int64_t)h->eta_ms * 1000 >= h->expires_us));
+    if (lost) {
+        h->id = 0;
+        stats.held--;
+        stats.lost++;
+    } else if (h) {
+        h->start_us = t_start;
+    }
+    xSemaphoreGive(lock);
+
+    // Another station has it by now: pouring it here would serve it twice
+    if (lost) {
+        journal_settled(order.id);
+        xEventGroupSetBits(space_group, SPACE_BIT);
+        ESP_LOGW(TAG, "Order %d: lease lost while queued, not pouring it", order.id);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pour_report_t report = { 0 };
+    pouring_id = order.id;
+    esp_err_t err = mix_pour(&order, &report);
+    pouring_id = 0;
+    int64_t t_done = esp_timer_get_time();
+    journal_finished(order.id, err == ESP_OK);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stage_add(&stats.queued, t_start - order.t_ready_us);
+    stage_add(&stats.pour, t_done - t_start);
+    // Only back-to-back drinks say anything about the gap
+    if (last_done_us && order.t_ready_us <= last_done_us) {
+        stage_add(&stats.gap, t_start - last_done_us);
+    }
+    last_done_us = t_done;
+    stats.held--;
+    // Its completion waits for company, but must reach the server before the lease lapses
+    h = held_find(order.id);
+    if (order.id) {
+        int64_t ack_us = t_done + ACK_DELAY_MS * 1000LL;
+        if (h && h->lease_ms && h->expires_us - LEASE_RETRY_MS * 1000LL < ack_us) {
+            ack_us = h->expires_us - LEASE_RETRY_MS * 1000LL;
+        }
+        if (ack_us < acks_due_us) acks_due_us = ack_us;
+    }
+    if (h) h->id = 0;
+    order_pipeline_stats_t st = stats;
+    xSemaphoreGive(lock);
+
+    xEventGroupSetBits(space_group, SPACE_BIT);
+    if (order.id) wake_report_task();
+
+    ESP_LOGI(TAG, "Stages (last/mean ms): fetch %lu/%lu, queued %lu/%lu, pour %lu/%lu, gap %lu/%lu; "
+             "held %u/%u, max %u",
+             (unsigned long)st.fetch.last_ms, (unsigned long)stage_mean(&st.fetch),
+             (unsigned long)st.queued.last_ms, (unsigned long)stage_mean(&st.queued),
+             (unsigned long)st.pour.last_ms, (unsigned long)stage_mean(&st.pour),
+             (unsigned long)st.gap.last_ms, (unsigned long)stage_mean(&st.gap),
+             st.held, st.depth + 1, st.max_held);
+    return err;
+}
+
+void order_pipeline_get_stats(order_pipeline_stats_t *out)
+{
+    if (!lock) {
+        *out = stats;
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
+}
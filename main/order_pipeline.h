@@ -0,0 +1,83 @@
+#ifndef ORDER_PIPELINE_H
+#define ORDER_PIPELINE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// =============================================================
+// Order prefetch pipeline
+// A network task fetches and validates orders from /mix into a
+// bounded local queue while the caller pours the previous drink,
+// so back-to-back drinks start without a network round trip.
+//
+// Several stations can share one server queue: each /mix request
+// carries this station's load, and an order comes with a lease
+// that a report task renews while the order is queued or pouring.
+// An order whose lease was lost while queued has gone to another
+// station and is dropped.
+//
+// Claims and completions go to the order journal, which survives
+// outages and reboots; the report task delivers completions in
+// bulk (/acks), right after reconnecting when the link was down.
+// =============================================================
+
+// Orders held locally in addition to the one being poured.
+// 0 keeps the old fetch → pour → fetch alternation.
+#ifndef ORDER_QUEUE_DEPTH
+#define ORDER_QUEUE_DEPTH       1
+#endif
+#define ORDER_QUEUE_MAX_DEPTH   4
+
+typedef struct {
+    uint32_t count;
+    uint32_t last_ms;
+    uint32_t max_ms;
+    uint64_t total_ms;
+} order_stage_t;
+
+typedef struct {
+    order_stage_t fetch;      // request sent → order validated
+    order_stage_t queued;     // validated → pour started
+    order_stage_t pour;       // pour_sched_run() makespan
+    order_stage_t gap;        // previous drink done → next pour started, when already queued
+    uint32_t      polls;      // /mix requests, with or without an order
+    uint32_t      errors;
+    uint32_t      lost;       // dropped unpoured: lease lost while queued
+    uint8_t       depth;      // configured prefetch depth
+    uint8_t       held;       // orders queued or pouring right now
+    uint8_t       max_held;   // high-water mark of held
+} order_pipeline_stats_t;
+
+/**
+ * @brief Start the network task. Call after Wi-Fi is up.
+ */
+esp_err_t order_pipeline_start(void);
+
+/**
+ * @brief Change how many orders may be prefetched (clamped to ORDER_QUEUE_MAX_DEPTH).
+ *
+ * Takes effect before the next fetch; orders already held are kept.
+ */
+void order_pipeline_set_depth(uint8_t depth);
+
+/**
+ * @brief Pour the next queued order.
+ *
+ * Keeps pour_sched_set_upcoming() in step with the queue, and parks
+ * nozzles whose residency window runs out while waiting.
+ *
+ * @param wait Ticks to wait for an order.
+ * @return ESP_OK after a drink,
+ *         ESP_ERR_TIMEOUT if no order arrived in time,
+ *         ESP_ERR_INVALID_STATE if the order's lease was lost (not poured),
+ *         otherwise the mix_pour() error.
+ */
+esp_err_t order_pipeline_pour_next(TickType_t wait);
+
+/**
+ * @brief Snapshot of per-stage timings and queue occupancy.
+ */
+void order_pipeline_get_stats(order_pipeline_stats_t *out);
+
+#endif // ORDER_PIPELINE_H
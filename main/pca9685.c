@@ -1,78 +1,685 @@
-#include "driver/i2c.h"
+#include "pca9685.h"
+#include "trace.h"
+#include "metrics.h"
+#include "driver/i2c_master.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
 
 #define I2C_MASTER_SCL_IO 9
 #define I2C_MASTER_SDA_IO 21
-#define I2C_MASTER_FREQ_HZ 400000
 #define I2C_MASTER_NUM I2C_NUM_0
+#define I2C_TIMEOUT_MS 100      // bring-up only; see PCA9685_I2C_TIMEOUT_MS
 
-#define PCA9685_ADDR 0x40
-#define PCA9685_STEPS 4096
+#define RECOVERY_STACK 3072
 
-// Servo pulse range (ms)
-#define SERVO_MIN_PULSE 0.55f
-#define SERVO_MAX_PULSE 2.45f
+static const char *TAG = "PCA9685";
+
+#define REG_MODE1        0x00
+#define REG_LED0_ON_L    0x06
+#define REG_ALL_LED_ON_L 0xFA
+#define REG_PRESCALE     0xFE
+
+#define LED_FULL_OFF     0x10   // bit 4 of LEDn_OFF_H
+#define COUNT_FULL       0x1000 // the same bit in a 13-bit ON/OFF count
+#define COUNT_MASK       0x0FFF
+#define OSC_HZ           25000000.0f
+
+// Address byte + register byte that every write transaction carries
+#define TXN_OVERHEAD     2
+
+// Longest write: register byte + all 16 channels in one burst
+#define TXN_MAX_LEN      (1 + 4 * PCA9685_CHANNELS)
+
+// What a write touched: a bit per channel, plus one for MODE1/PRESCALE
+#define TXN_CONFIG       (1u << PCA9685_CHANNELS)
+#define TXN_CHANNELS     ((1u << PCA9685_CHANNELS) - 1)
+
+struct pca9685_dev {
+    uint8_t  addr;
+    uint8_t  prescale;
+    i2c_master_dev_handle_t handle;
+
+    //---------------------------------------------
+    // Shadow of LEDn_ON_L/ON_H/OFF_L/OFF_H
+    // Writes that would not change a register are skipped.
+    //---------------------------------------------
+    uint8_t  shadow[PCA9685_CHANNELS][4];
+    uint16_t shadow_valid;              // bit per channel
+
+    StaticSemaphore_t lock_buf;         // guards shadow and stats
+    SemaphoreHandle_t lock;
+
+    pca9685_stats_t stats;
+    atomic_uint     async_errors;       // failed completions, counted in the ISR
+
+    //---------------------------------------------
+    // Failed writes
+    // Set wherever a write fails, ISR included; the
+    // recovery task takes the bits and rewrites those
+    // registers from the shadow. A stale channel is
+    // never skipped as unchanged.
+    //---------------------------------------------
+    atomic_uint       stale;            // TXN_* bits
+    atomic_uint       channel_errors[PCA9685_CHANNELS];
+    bool              failing;          // the last repair gave up, under lock
+
+    //---------------------------------------------
+    // Phase staggering, under lock
+    //---------------------------------------------
+    uint16_t phase[PCA9685_CHANNELS];   // ON step of a staggered channel
+    uint16_t phased;                    // bit per channel holding a phase
+};
+
+static struct pca9685_dev devices[PCA9685_MAX_DEVICES];
+static uint8_t            n_devices;
+
+//---------------------------------------------
+// Bus arbitration
+// Taken per transaction, not per update, so a long
+// burst sequence to one device cannot starve another.
+// A releasing task yields when someone is waiting, so
+// equal-priority writers alternate instead of the
+// releaser re-taking the bus straight away.
+//---------------------------------------------
+static StaticSemaphore_t bus_lock_buf;
+static SemaphoreHandle_t bus_lock;
+static atomic_int        bus_waiters;
+
+static i2c_master_bus_handle_t bus;
+static uint32_t                bus_clk_hz;
+
+//---------------------------------------------
+// Transaction buffers
+// The driver reads a queued buffer when the transfer
+// runs, so each write is copied into a ring slot that
+// stays untouched until its completion callback. The
+// bus completes transfers in queue order, so slots free
+// up in ring order too.
+//---------------------------------------------
+static uint8_t           txn_buf[PCA9685_TXN_QUEUE_DEPTH][TXN_MAX_LEN];
+static struct {
+    struct pca9685_dev *dev;
+    uint32_t            touched;            // TXN_* bits
+} txn_meta[PCA9685_TXN_QUEUE_DEPTH];
+static uint32_t          txn_head;          // next slot, under bus_lock
+static atomic_uint       txn_tail;          // next slot to complete, advanced by the ISR
+static StaticSemaphore_t txn_free_buf;
+static SemaphoreHandle_t txn_free;          // counts idle slots
+static atomic_llong      flush_us;          // time spent in pca9685_flush()
+
+static StaticTask_t      recovery_buf;
+static StackType_t       recovery_stack[RECOVERY_STACK];
+static TaskHandle_t      recovery_task;
+static atomic_bool       bus_timed_out;     // a transfer timed out: SDA or SCL held
+
+static void bus_take(void)
+{
+    atomic_fetch_add(&bus_waiters, 1);
+    xSemaphoreTake(bus_lock, portMAX_DELAY);
+    atomic_fetch_sub(&bus_waiters, 1);
+}
+
+static void bus_give(void)
+{
+    xSemaphoreGive(bus_lock);
+    if (atomic_load(&bus_waiters) > 0) taskYIELD();
+}
+
+//---------------------------------------------
+// Which registers a write starting at reg touches
+//---------------------------------------------
+static uint32_t txn_touched(const uint8_t *data, size_t len)
+{
+    uint8_t reg = data[0];
+    if (reg >= REG_ALL_LED_ON_L) return reg == REG_PRESCALE ? TXN_CONFIG : TXN_CHANNELS;
+
+    int first = (reg - REG_LED0_ON_L) / 4;
+    if (reg < REG_LED0_ON_L || first >= PCA9685_CHANNELS) return TXN_CONFIG;
+    int last = (reg + (int)len - 2 - REG_LED0_ON_L) / 4;
+    if (last >= PCA9685_CHANNELS) last = PCA9685_CHANNELS - 1;
+    return ((2u << last) - 1) & ~((1u << first) - 1);
+}
+
+// Any context; the caller wakes the recovery task
+static void IRAM_ATTR txn_failed(struct pca9685_dev *dev, uint32_t touched)
+{
+    for (int ch = 0; ch < PCA9685_CHANNELS; ch++) {
+        if (touched & (1u << ch)) atomic_fetch_add(&dev->channel_errors[ch], 1);
+    }
+    atomic_fetch_or(&dev->stale, touched);
+    metrics_inc(METRIC_I2C_ERRORS);
+}
+
+//---------------------------------------------
+// Completion callback, ISR context
+// Completions arrive in queue order, so the next
+// slot in the ring is the one that just finished.
+//---------------------------------------------
+static bool IRAM_ATTR on_trans_done(i2c_master_dev_handle_t handle,
+                                    const i2c_master_event_data_t *ev, void *arg)
+{
+    struct pca9685_dev *dev = arg;
+    BaseType_t woken = pdFALSE;
+    uint32_t slot = atomic_fetch_add(&txn_tail, 1) % PCA9685_TXN_QUEUE_DEPTH;
+
+    if (ev->event != I2C_EVENT_DONE) {
+        atomic_fetch_add(&dev->async_errors, 1);
+        if (ev->event == I2C_EVENT_TIMEOUT) atomic_store(&bus_timed_out, true);
+        txn_failed(dev, txn_meta[slot].touched);
+        vTaskNotifyGiveFromISR(recovery_task, &woken);
+    }
+    xSemaphoreGiveFromISR(txn_free, &woken);
+    return woken == pdTRUE;
+}
+
+//---------------------------------------------
+// Low-level: queue a burst write starting at reg
+// The address byte is prepended by the driver.
+// Returns once the write is queued; only blocks when
+// PCA9685_TXN_QUEUE_DEPTH writes are still in flight,
+// and for no more than PCA9685_I2C_TIMEOUT_MS.
+// Failures are left to the recovery task.
+// Called with dev->lock held.
+//---------------------------------------------
+static void pca9685_write(struct pca9685_dev *dev, const uint8_t *data, size_t len)
+{
+    int64_t t0 = esp_timer_get_time();
+    TRACE_BEGIN("i2c_write", data[0]);
+
+    // Held across slot pick and submit so ring order is queue order
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    bus_take();
+    if (xSemaphoreTake(txn_free, pdMS_TO_TICKS(PCA9685_I2C_TIMEOUT_MS)) == pdTRUE) {
+        uint32_t slot = txn_head % PCA9685_TXN_QUEUE_DEPTH;
+        memcpy(txn_buf[slot], data, len);
+        txn_meta[slot].dev = dev;
+        txn_meta[slot].touched = txn_touched(data, len);
+        err = i2c_master_transmit(dev->handle, txn_buf[slot], len, PCA9685_I2C_TIMEOUT_MS);
+        if (err == ESP_OK) {
+            txn_head++;
+        } else {
+            xSemaphoreGive(txn_free);   // never queued, no callback
+        }
+    }
+    bus_give();
+
+    TRACE_END("i2c_write");
+    dev->stats.transactions++;
+    dev->stats.bytes += 1 + len;
+    dev->stats.call_us += esp_timer_get_time() - t0;
+    metrics_inc(METRIC_I2C_TRANSACTIONS);
+    metrics_add(METRIC_I2C_BYTES, 1 + len);
+    if (err != ESP_OK) {
+        dev->stats.errors++;
+        txn_failed(dev, txn_touched(data, len));
+        if (recovery_task) xTaskNotifyGive(recovery_task);
+    }
+}
 
 //---------------------------------------------
 // Low-level: write 8-bit register
 //---------------------------------------------
-static void pca9685_write8(uint8_t reg, uint8_t data)
+static void pca9685_write8(struct pca9685_dev *dev, uint8_t reg, uint8_t data)
 {
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (PCA9685_ADDR << 1) | I2C_MASTER_WRITE, true);
-    i2c_master_write_byte(cmd, reg, true);
-    i2c_master_write_byte(cmd, data, true);
-    i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, pdMS_TO_TICKS(100));
-    i2c_cmd_link_delete(cmd);
+    uint8_t buf[2] = { reg, data };
+    TRACE_BEGIN("pca9685_write8", reg);
+    pca9685_write(dev, buf, sizeof(buf));
+    TRACE_END("pca9685_write8");
 }
 
 //---------------------------------------------
-// Initialize PCA9685 at any frequency
+// Global channel → device
 //---------------------------------------------
-void pca9685_init(uint16_t freq_hz)
+static struct pca9685_dev *channel_dev(uint8_t channel)
+{
+    uint8_t index = channel / PCA9685_CHANNELS;
+    return index < n_devices ? &devices[index] : NULL;
+}
+
+static void repair(struct pca9685_dev *dev);
+static void recovery_loop(void *arg);
+
+//---------------------------------------------
+// I2C bus
+//---------------------------------------------
+esp_err_t pca9685_bus_init(uint32_t clk_hz)
 {
-    // --- I2C init ---
-    i2c_config_t conf = {
-        .mode = I2C_MODE_MASTER,
+    if (bus) return ESP_OK;
+    if (clk_hz > PCA9685_I2C_FMP_HZ) clk_hz = PCA9685_I2C_FMP_HZ;
+
+    i2c_master_bus_config_t conf = {
+        .i2c_port = I2C_MASTER_NUM,
         .sda_io_num = I2C_MASTER_SDA_IO,
         .scl_io_num = I2C_MASTER_SCL_IO,
-        .master.clk_speed = I2C_MASTER_FREQ_HZ,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .trans_queue_depth = PCA9685_TXN_QUEUE_DEPTH,   // non-zero: asynchronous transmit
+        .flags.enable_internal_pullup = true,
     };
-    i2c_param_config(I2C_MASTER_NUM, &conf);
-    i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
+    esp_err_t err = i2c_new_master_bus(&conf, &bus);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "I2C init failed: %s", esp_err_to_name(err));
+        bus = NULL;
+        return err;
+    }
 
-    // --- Setup prescale ---
-    pca9685_write8(0x00, 0x10);   // MODE1 sleep
+    bus_clk_hz = clk_hz;
+    bus_lock = xSemaphoreCreateMutexStatic(&bus_lock_buf);
+    txn_free = xSemaphoreCreateCountingStatic(PCA9685_TXN_QUEUE_DEPTH, PCA9685_TXN_QUEUE_DEPTH,
+                                              &txn_free_buf);
+    recovery_task = xTaskCreateStatic(recovery_loop, "i2c_recovery", RECOVERY_STACK, NULL,
+                                      PCA9685_RECOVERY_PRIORITY, recovery_stack, &recovery_buf);
+    ESP_LOGI(TAG, "I2C at %lu kHz, %d queued writes", (unsigned long)clk_hz / 1000,
+             PCA9685_TXN_QUEUE_DEPTH);
+    return ESP_OK;
+}
+
+esp_err_t pca9685_flush(uint32_t timeout_ms)
+{
+    if (!bus) return ESP_ERR_INVALID_STATE;
 
-    uint8_t prescale = (uint8_t)(25000000.0f / (PCA9685_STEPS * freq_hz) - 1.0f);
-    pca9685_write8(0xFE, prescale);   // PRESCALE register
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = i2c_master_bus_wait_all_done(bus, timeout_ms);
+    atomic_fetch_add(&flush_us, esp_timer_get_time() - t0);
+    return err;
+}
+
+//---------------------------------------------
+// Prescaler: 25 MHz / (4096 * (prescale + 1))
+//---------------------------------------------
+static uint8_t prescale_for(uint16_t freq_hz)
+{
+    float p = roundf(OSC_HZ / (PCA9685_STEPS * (float)freq_hz)) - 1.0f;
+    if (p < 3) p = 3;        // hardware minimum, ~1526 Hz
+    if (p > 255) p = 255;    // ~24 Hz
+    return (uint8_t)p;
+}
+
+// MODE1 and PRESCALE from dev->prescale
+static void program_mode(struct pca9685_dev *dev)
+{
+    pca9685_write8(dev, REG_MODE1, 0x10);              // MODE1 sleep
+    pca9685_write8(dev, REG_PRESCALE, dev->prescale);  // PRESCALE register
 
     // --- Wake up ---
-    pca9685_write8(0x00, 0x00);  // wake
+    pca9685_write8(dev, REG_MODE1, 0x00);      // wake
+    pca9685_flush(PCA9685_I2C_TIMEOUT_MS);     // the oscillator delay starts once it lands
     vTaskDelay(pdMS_TO_TICKS(5));
 
-    pca9685_write8(0x00, 0xA1);  // restart + auto-increment
+    pca9685_write8(dev, REG_MODE1, 0xA1);  // restart + auto-increment
+}
+
+static void program_freq(struct pca9685_dev *dev, uint16_t freq_hz)
+{
+    dev->prescale = prescale_for(freq_hz);
+    program_mode(dev);
+}
+
+esp_err_t pca9685_set_freq(pca9685_handle_t dev, uint16_t freq_hz)
+{
+    if (!dev || freq_hz == 0) return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+    program_freq(dev, freq_hz);
+    xSemaphoreGive(dev->lock);
+    return ESP_OK;
+}
+
+float pca9685_get_freq(pca9685_handle_t dev)
+{
+    return OSC_HZ / (PCA9685_STEPS * (dev->prescale + 1.0f));
+}
+
+//---------------------------------------------
+// Add a device at any frequency
+//---------------------------------------------
+esp_err_t pca9685_add(const pca9685_config_t *config, pca9685_handle_t *out)
+{
+    if (config->freq_hz == 0) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < n_devices; i++) {
+        if (devices[i].addr == config->addr) return ESP_ERR_INVALID_STATE;
+    }
+    if (n_devices == PCA9685_MAX_DEVICES) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = pca9685_bus_init(PCA9685_I2C_FREQ_HZ);
+    if (err != ESP_OK) return err;
+
+    err = i2c_master_probe(bus, config->addr, I2C_TIMEOUT_MS);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "No PCA9685 answering at 0x%02x", config->addr);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    struct pca9685_dev *dev = &devices[n_devices];
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = config->addr;
+    dev->lock = xSemaphoreCreateMutexStatic(&dev->lock_buf);
+
+    i2c_device_config_t dev_conf = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address = config->addr,
+        .scl_speed_hz = bus_clk_hz,
+    };
+    err = i2c_master_bus_add_device(bus, &dev_conf, &dev->handle);
+    if (err == ESP_OK) {
+        const i2c_master_event_callbacks_t cbs = { .on_trans_done = on_trans_done };
+        err = i2c_master_register_event_callbacks(dev->handle, &cbs, dev);
+        if (err != ESP_OK) i2c_master_bus_rm_device(dev->handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Adding 0x%02x failed: %s", config->addr, esp_err_to_name(err));
+        return err;
+    }
+
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+    program_freq(dev, config->freq_hz);
+
+    // --- All outputs full-off so the shadow starts in sync ---
+    uint8_t all_off[5] = { REG_ALL_LED_ON_L, 0, 0, 0, LED_FULL_OFF };
+    pca9685_write(dev, all_off, sizeof(all_off));
+    for (int ch = 0; ch < PCA9685_CHANNELS; ch++) {
+        memcpy(dev->shadow[ch], &all_off[1], 4);
+    }
+    dev->shadow_valid = 0xFFFF;
+    err = pca9685_flush(I2C_TIMEOUT_MS);
+    xSemaphoreGive(dev->lock);
+
+    // Not yet visible to the recovery task
+    if (err == ESP_OK && atomic_load(&dev->stale)) repair(dev);
+    bool ok = err == ESP_OK && atomic_load(&dev->stale) == 0;
+
+    if (!ok) {
+        ESP_LOGE(TAG, "PCA9685 at 0x%02x failed to configure", config->addr);
+        i2c_master_bus_rm_device(dev->handle);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "PCA9685 #%u at 0x%02x: %.1f Hz (prescale %u), channels %u-%u",
+             n_devices, dev->addr, pca9685_get_freq(dev), dev->prescale,
+             n_devices * PCA9685_CHANNELS, n_devices * PCA9685_CHANNELS + PCA9685_CHANNELS - 1);
+    n_devices++;
+    if (out) *out = dev;
+    return ESP_OK;
+}
+
+pca9685_handle_t pca9685_get(uint8_t index)
+{
+    return index < n_devices ? &devices[index] : NULL;
+}
+
+//---------------------------------------------
+// Single-device bring-up, kept for existing callers
+//---------------------------------------------
+void pca9685_init(uint16_t freq_hz)
+{
+    for (int i = 0; i < n_devices; i++) {
+        if (devices[i].addr == PCA9685_BASE_ADDR) {
+            pca9685_set_freq(&devices[i], freq_hz);
+            return;
+        }
+    }
+    pca9685_config_t cfg = { .addr = PCA9685_BASE_ADDR, .freq_hz = freq_hz };
+    pca9685_add(&cfg, NULL);
 }
 
 //---------------------------------------------
 // Set PWM using raw registers
 //---------------------------------------------
+void pca9685_dev_set_pwm(pca9685_handle_t dev, uint8_t channel, uint16_t on, uint16_t off)
+{
+    pca9685_update_t u = { .channel = channel, .on = on, .off = off };
+    TRACE_BEGIN("pca9685_set_pwm", channel);
+    pca9685_dev_set_pwm_multi(dev, &u, 1);
+    TRACE_END("pca9685_set_pwm");
+}
+
 void pca9685_set_pwm(uint8_t channel, uint16_t on, uint16_t off)
 {
-    uint8_t reg = 0x06 + 4 * channel;
-    uint8_t data[5] = {
-        reg,
-        on & 0xFF,
-        on >> 8,
-        off & 0xFF,
-        off >> 8
-    };
-    i2c_master_write_to_device(I2C_MASTER_NUM, PCA9685_ADDR, data, 5, pdMS_TO_TICKS(100));
+    struct pca9685_dev *dev = channel_dev(channel);
+    if (dev) pca9685_dev_set_pwm(dev, channel % PCA9685_CHANNELS, on, off);
+}
+
+//---------------------------------------------
+// Phase staggering
+// Pulses are circular intervals of the 4096-step
+// period: [ON, ON + width). How many outputs are high
+// at once only rises at a pulse start, so the busiest
+// step of any stretch is its first step or a start
+// inside it.
+//---------------------------------------------
+static uint16_t count_get(const uint8_t *r)
+{
+    return r[0] | r[1] << 8;
+}
+
+static void count_set(uint8_t *r, uint16_t v)
+{
+    r[0] = v & 0xFF;
+    r[1] = v >> 8;
+}
+
+// Channels not in skip that are high at some step: start and length
+static int pulses(const uint8_t regs[][4], uint16_t skip, bool aligned,
+                  uint16_t *start, uint16_t *len)
+{
+    int n = 0;
+    for (int ch = 0; ch < PCA9685_CHANNELS; ch++) {
+        if (skip & (1u << ch)) continue;
+        uint16_t on = count_get(&regs[ch][0]), off = count_get(&regs[ch][2]);
+        if (off & COUNT_FULL) continue;
+        if (on & COUNT_FULL) {
+            start[n] = 0;
+            len[n] = PCA9685_STEPS;
+        } else {
+            start[n] = aligned ? 0 : on & COUNT_MASK;
+            len[n] = (off - on) & COUNT_MASK;
+        }
+        if (len[n]) n++;
+    }
+    return n;
+}
+
+static int high_at(uint16_t step, const uint16_t *start, const uint16_t *len, int n)
+{
+    int high = 0;
+    for (int i = 0; i < n; i++) {
+        if (((step - start[i]) & COUNT_MASK) < len[i]) high++;
+    }
+    return high;
+}
+
+// Most outputs high at any one step; aligned as if every pulse started at 0
+static uint8_t most_high(const uint8_t regs[][4], bool aligned)
+{
+    uint16_t start[PCA9685_CHANNELS], len[PCA9685_CHANNELS];
+    int n = pulses(regs, 0, aligned, start, len);
+    int most = 0;
+    for (int i = 0; i < n; i++) {
+        int high = high_at(start[i], start, len, n);
+        if (high > most) most = high;
+    }
+    return most;
+}
+
+// ON step for a new pulse: step 0 or the end of a placed pulse,
+// whichever window of width steps meets the fewest pulses at once
+static uint16_t place(const uint8_t regs[][4], uint16_t skip, uint16_t width)
+{
+    uint16_t start[PCA9685_CHANNELS], len[PCA9685_CHANNELS];
+    int n = pulses(regs, skip, false, start, len);
+    uint16_t best = 0;
+    int best_high = PCA9685_CHANNELS + 1;
+
+    for (int c = -1; c < n; c++) {
+        uint16_t at = c < 0 ? 0 : (start[c] + len[c]) & COUNT_MASK;
+        int high = high_at(at, start, len, n);
+        for (int i = 0; i < n; i++) {
+            if (((start[i] - at) & COUNT_MASK) >= width) continue;
+            int h = high_at(start[i], start, len, n);
+            if (h > high) high = h;
+        }
+        if (high < best_high) {
+            best_high = high;
+            best = at;
+        }
+    }
+    return best;
+}
+
+// Move ON = 0 pulses to their channel's phase. A channel keeps its
+// phase while it drives, so a running pulse never jumps; new ones
+// are placed in channel order, each seeing those before it.
+static void stagger(struct pca9685_dev *dev, uint8_t next[][4], uint16_t dirty)
+{
+    uint8_t  view[PCA9685_CHANNELS][4];   // registers once this batch lands
+    uint16_t unplaced = 0;
+
+    memcpy(view, dev->shadow, sizeof(view));
+    for (int ch = 0; ch < PCA9685_CHANNELS; ch++) {
+        if (!(dirty & (1u << ch))) continue;
+        uint16_t on = count_get(&next[ch][0]), off = count_get(&next[ch][2]);
+
+        if (!PCA9685_STAGGER || on != 0 || (off & COUNT_FULL) || (off & COUNT_MASK) == 0) {
+            dev->phased &= ~(1u << ch);
+        } else if (dev->phased & (1u << ch)) {
+            count_set(&next[ch][0], dev->phase[ch]);
+            count_set(&next[ch][2], (dev->phase[ch] + off) & COUNT_MASK);
+        } else {
+            unplaced |= 1u << ch;
+            continue;
+        }
+        memcpy(view[ch], next[ch], 4);
+    }
+
+    for (int ch = 0; ch < PCA9685_CHANNELS && unplaced; ch++) {
+        if (!(unplaced & (1u << ch))) continue;
+        uint16_t width = count_get(&next[ch][2]) & COUNT_MASK;
+
+        unplaced &= ~(1u << ch);
+        dev->phase[ch] = place(view, unplaced | (1u << ch), width);
+        dev->phased |= 1u << ch;
+        count_set(&next[ch][0], dev->phase[ch]);
+        count_set(&next[ch][2], (dev->phase[ch] + width) & COUNT_MASK);
+        memcpy(view[ch], next[ch], 4);
+    }
+}
+
+// After the shadow changed. Called with dev->lock held.
+static void count_concurrent(struct pca9685_dev *dev)
+{
+    uint8_t now = most_high(dev->shadow, false);
+    uint8_t aligned = most_high(dev->shadow, true);
+
+    dev->stats.concurrent = now;
+    if (now > dev->stats.concurrent_peak) dev->stats.concurrent_peak = now;
+    if (aligned > dev->stats.aligned_peak) dev->stats.aligned_peak = aligned;
+}
+
+//---------------------------------------------
+// Send the shadow of the given channels, each run
+// of contiguous channels as one auto-increment
+// burst. Returns the transactions used.
+// Called with dev->lock held.
+//---------------------------------------------
+static int write_shadow(struct pca9685_dev *dev, uint16_t channels)
+{
+    uint8_t buf[TXN_MAX_LEN];
+    int txns = 0;
+    int ch = 0;
+    while (ch < PCA9685_CHANNELS) {
+        if (!(channels & (1u << ch))) { ch++; continue; }
+
+        size_t len = 0;
+        buf[len++] = REG_LED0_ON_L + 4 * ch;
+        while (ch < PCA9685_CHANNELS && (channels & (1u << ch))) {
+            memcpy(&buf[len], dev->shadow[ch], 4);
+            len += 4;
+            ch++;
+        }
+        pca9685_write(dev, buf, len);
+        txns++;
+    }
+    return txns;
+}
+
+//---------------------------------------------
+// Commit several channels of one device at once
+// Unchanged channels are dropped; each run of
+// contiguous changed channels goes out as one
+// auto-increment burst.
+//---------------------------------------------
+void pca9685_dev_set_pwm_multi(pca9685_handle_t dev, const pca9685_update_t *updates, int count)
+{
+    uint8_t  next[PCA9685_CHANNELS][4];
+    uint16_t dirty = 0;
+    int      requested = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint8_t ch = updates[i].channel;
+        if (ch >= PCA9685_CHANNELS) continue;
+        next[ch][0] = updates[i].on & 0xFF;
+        next[ch][1] = updates[i].on >> 8;
+        next[ch][2] = updates[i].off & 0xFF;
+        next[ch][3] = updates[i].off >> 8;
+        dirty |= 1u << ch;
+        requested++;
+    }
+
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+
+    stagger(dev, next, dirty);
+
+    uint32_t stale = atomic_load(&dev->stale);
+    int written = 0;
+    for (int ch = 0; ch < PCA9685_CHANNELS; ch++) {
+        if (!(dirty & (1u << ch))) continue;
+        if ((dev->shadow_valid & (1u << ch)) && !(stale & (1u << ch)) &&
+            memcmp(next[ch], dev->shadow[ch], 4) == 0) {
+            dirty &= ~(1u << ch);
+            continue;
+        }
+        memcpy(dev->shadow[ch], next[ch], 4);
+        written++;
+    }
+    dev->shadow_valid |= dirty;
+    int txns = write_shadow(dev, dirty);
+    if (dirty) count_concurrent(dev);
+
+    // Baseline is one 6-byte transaction per requested channel
+    dev->stats.transactions_saved += requested - txns;
+    dev->stats.bytes_saved += requested * (TXN_OVERHEAD + 4) - (txns * TXN_OVERHEAD + written * 4);
+
+    xSemaphoreGive(dev->lock);
+}
+
+//---------------------------------------------
+// Global channels: split per device, one
+// batched commit each. A channel listed twice
+// keeps its place and takes the later value.
+//---------------------------------------------
+void pca9685_set_pwm_multi(const pca9685_update_t *updates, int count)
+{
+    pca9685_update_t local[PCA9685_CHANNELS];
+    int8_t           at[PCA9685_CHANNELS];
+
+    for (int d = 0; d < n_devices; d++) {
+        int n = 0;
+        memset(at, -1, sizeof(at));
+        for (int i = 0; i < count; i++) {
+            if (updates[i].channel / PCA9685_CHANNELS != d) continue;
+            uint8_t ch = updates[i].channel % PCA9685_CHANNELS;
+            if (at[ch] < 0) at[ch] = n++;
+            local[at[ch]] = updates[i];
+            local[at[ch]].channel = ch;
+        }
+        if (n) pca9685_dev_set_pwm_multi(&devices[d], local, n);
+    }
 }
 
 //---------------------------------------------
@@ -90,49 +697,206 @@ void pca9685_set_duty(uint8_t channel, float duty_percent)
 
 //---------------------------------------------
 // Set servo angle 0–180° (requires 50 Hz init)
+// Fixed point from here on: tenths of a degree
 //---------------------------------------------
 void pca9685_set_servo_angle(uint8_t channel, float angle_deg)
 {
-    if (angle_deg < 0) angle_deg = 0;
-    if (angle_deg > 180) angle_deg = 180;
+    int32_t deci = (int32_t)(angle_deg * 10.0f);
+    if (deci < 0) deci = 0;
+    if (deci > 1800) deci = 1800;
 
-    float pulse_ms = SERVO_MIN_PULSE +
-                     (angle_deg / 180.0f) * (SERVO_MAX_PULSE - SERVO_MIN_PULSE);
+    uint32_t pulse_us = SERVO_MIN_PULSE_US +
+                        deci * (SERVO_MAX_PULSE_US - SERVO_MIN_PULSE_US) / 1800;
 
-    // 20 ms period at 50 Hz
-    uint16_t off = (uint16_t)((pulse_ms / 20.0f) * PCA9685_STEPS);
-
-    pca9685_set_pwm(channel, 0, off);
+    pca9685_set_pwm(channel, 0, PCA9685_US_TO_COUNTS(pulse_us));
 }
 
 // ---------------------------------------------
 // Continuous-rotation servo control
 // speed = -1.0 (full CCW)  to  +1.0 (full CW)
+// Fixed point from here on: per mille of full speed
 // ---------------------------------------------
 void pca9685_set_servo_speed(uint8_t channel, float speed)
 {
-    if (speed > 1.0f) speed = 1.0f;
-    if (speed < -1.0f) speed = -1.0f;
+    int32_t permille = (int32_t)(speed * 1000.0f);
+    if (permille > 1000) permille = 1000;
+    if (permille < -1000) permille = -1000;
 
-    // 1.5 ms = stop
-    float pulse_ms = 1.5f;
+    // 1.5 ms = stop; CW towards SERVO_MAX_PULSE_US, CCW towards SERVO_MIN_PULSE_US
+    int32_t span = permille > 0 ? SERVO_MAX_PULSE_US - SERVO_MID_PULSE_US
+                                : SERVO_MID_PULSE_US - SERVO_MIN_PULSE_US;
+    uint32_t pulse_us = SERVO_MID_PULSE_US + permille * span / 1000;
 
-    if (speed > 0) {
-        // CW: 1.5 → SERVO_MAX_PULSE
-        pulse_ms = 1.5f + speed * (SERVO_MAX_PULSE - 1.5f);
-    } else if (speed < 0) {
-        // CCW: 1.5 → SERVO_MIN_PULSE
-        pulse_ms = 1.5f + speed * (1.5f - SERVO_MIN_PULSE);
-    }
+    pca9685_set_pwm(channel, 0, PCA9685_US_TO_COUNTS(pulse_us));
+}
 
-    // convert ms → PCA9685 counts
-    uint16_t off = (uint16_t)((pulse_ms / 20.0f) * PCA9685_STEPS);
+void pca9685_dev_stop_channel(pca9685_handle_t dev, uint8_t channel)
+{
+    if (channel >= PCA9685_CHANNELS) return;
 
-    pca9685_set_pwm(channel, 0, off);
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+    if ((dev->shadow_valid & (1u << channel)) && !(atomic_load(&dev->stale) & (1u << channel)) &&
+        dev->shadow[channel][3] == LED_FULL_OFF) {
+        dev->stats.transactions_saved++;
+        dev->stats.bytes_saved += 1 + TXN_OVERHEAD;
+    } else {
+        uint8_t reg = REG_LED0_ON_L + 4 * channel + 3;  // LEDx_OFF_H register
+        pca9685_write8(dev, reg, LED_FULL_OFF);         // FULL OFF bit
+        dev->shadow[channel][3] = LED_FULL_OFF;
+        count_concurrent(dev);
+    }
+    dev->phased &= ~(1u << channel);
+    xSemaphoreGive(dev->lock);
 }
 
 void pca9685_stop_channel(uint8_t channel)
 {
-    uint8_t reg = 0x06 + 4 * channel + 3;  // LEDx_OFF_H register
-    pca9685_write8(reg, 0x10);             // FULL OFF bit
-}
\ No newline at end of file
+    struct pca9685_dev *dev = channel_dev(channel);
+    if (dev) pca9685_dev_stop_channel(dev, channel % PCA9685_CHANNELS);
+}
+
+//---------------------------------------------
+// Failure recovery
+//---------------------------------------------
+
+// Clear a stuck bus: the driver clocks SCL until a slave holding SDA
+// lets go, then sends STOP. Writes still queued drain after it, each
+// through on_trans_done(), which frees its slot and marks a failure
+// stale. None is written off here: the driver still owes it a
+// callback, and a late one would free the slot twice.
+static void bus_recover(void)
+{
+    bus_take();
+    esp_err_t err = i2c_master_bus_reset(bus);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "I2C bus reset failed: %s", esp_err_to_name(err));
+    } else if (i2c_master_bus_wait_all_done(bus, PCA9685_I2C_TIMEOUT_MS) != ESP_OK) {
+        // Their slots stay taken; writes meanwhile time out and go stale
+        ESP_LOGW(TAG, "I2C writes still queued after bus reset: %lu",
+                 (unsigned long)(txn_head - atomic_load(&txn_tail)));
+    }
+    bus_give();
+}
+
+// Rewrite what failed from the shadow, up to PCA9685_I2C_RETRIES
+// times; then clear the bus and reprogram the whole board, once.
+// A timed-out bus skips the rewrites: nothing gets through until
+// it is cleared. Every round waits for its writes to land.
+static void repair(struct pca9685_dev *dev)
+{
+    int64_t t0 = esp_timer_get_time();
+    bool recovered = false;
+
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+    for (int round = 0; ; round++) {
+        bool hung = pca9685_flush(PCA9685_I2C_TIMEOUT_MS) != ESP_OK;
+        hung |= atomic_exchange(&bus_timed_out, false);
+        uint32_t stale = atomic_exchange(&dev->stale, 0);
+        if (!stale && !hung) break;
+
+        if (recovered) {
+            // Left stale for the next attempt
+            atomic_fetch_or(&dev->stale, stale);
+            dev->stats.unrecovered++;
+            if (!dev->failing) {
+                ESP_LOGE(TAG, "PCA9685 at 0x%02x still failing after bus recovery (0x%05lx)",
+                         dev->addr, (unsigned long)stale);
+            }
+            dev->failing = true;
+            break;
+        }
+        if (round < PCA9685_I2C_RETRIES && !hung && !(stale & TXN_CONFIG)) {
+            dev->stats.retries += __builtin_popcount(stale);
+            metrics_add(METRIC_I2C_RETRIES, __builtin_popcount(stale));
+            write_shadow(dev, stale);
+        } else {
+            dev->stats.recoveries++;
+            metrics_inc(METRIC_I2C_RECOVERIES);
+            bus_recover();
+            atomic_exchange(&dev->stale, 0);    // everything goes out again
+            program_mode(dev);
+            write_shadow(dev, TXN_CHANNELS);
+            recovered = true;
+        }
+    }
+
+    if (dev->failing && atomic_load(&dev->stale) == 0) {
+        ESP_LOGI(TAG, "PCA9685 at 0x%02x back in sync", dev->addr);
+        dev->failing = false;
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - t0);
+    if (us > dev->stats.repair_max_us) dev->stats.repair_max_us = us;
+    xSemaphoreGive(dev->lock);
+}
+
+// Woken by failures; a board a repair gave up on is tried
+// again every PCA9685_I2C_TIMEOUT_MS until it answers
+static void recovery_loop(void *arg)
+{
+    TickType_t wait = portMAX_DELAY;
+
+    metrics_heap_watch_task();
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = portMAX_DELAY;
+        for (int d = 0; d < n_devices; d++) {
+            if (!atomic_load(&devices[d].stale)) continue;
+            repair(&devices[d]);
+            if (atomic_load(&devices[d].stale)) wait = pdMS_TO_TICKS(PCA9685_I2C_TIMEOUT_MS);
+        }
+    }
+}
+
+uint32_t pca9685_channel_errors(uint8_t channel)
+{
+    struct pca9685_dev *dev = channel_dev(channel);
+    return dev ? atomic_load(&dev->channel_errors[channel % PCA9685_CHANNELS]) : 0;
+}
+
+//---------------------------------------------
+// Bus statistics
+//---------------------------------------------
+void pca9685_dev_get_stats(pca9685_handle_t dev, pca9685_stats_t *out)
+{
+    xSemaphoreTake(dev->lock, portMAX_DELAY);
+    *out = dev->stats;
+    out->errors += atomic_load(&dev->async_errors);
+    xSemaphoreGive(dev->lock);
+}
+
+void pca9685_get_stats(pca9685_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (int d = 0; d < n_devices; d++) {
+        pca9685_stats_t st;
+        pca9685_dev_get_stats(&devices[d], &st);
+        out->transactions       += st.transactions;
+        out->bytes              += st.bytes;
+        out->errors             += st.errors;
+        out->transactions_saved += st.transactions_saved;
+        out->bytes_saved        += st.bytes_saved;
+        out->call_us            += st.call_us;
+        out->retries            += st.retries;
+        out->recoveries         += st.recoveries;
+        out->unrecovered        += st.unrecovered;
+        if (st.repair_max_us > out->repair_max_us) out->repair_max_us = st.repair_max_us;
+        out->concurrent         += st.concurrent;
+        out->concurrent_peak    += st.concurrent_peak;
+        out->aligned_peak       += st.aligned_peak;
+    }
+    out->call_us += atomic_load(&flush_us);
+}
+
+void pca9685_reset_stats(void)
+{
+    for (int d = 0; d < n_devices; d++) {
+        xSemaphoreTake(devices[d].lock, portMAX_DELAY);
+        memset(&devices[d].stats, 0, sizeof(devices[d].stats));
+        count_concurrent(&devices[d]);
+        atomic_store(&devices[d].async_errors, 0);
+        for (int ch = 0; ch < PCA9685_CHANNELS; ch++) atomic_store(&devices[d].channel_errors[ch], 0);
+        xSemaphoreGive(devices[d].lock);
+    }
+    atomic_store(&flush_us, 0);
+}
@@ -2,6 +2,7 @@
 #define PCA9685_H
 
 #include <stdint.h>
+#include "esp_err.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,21 +11,112 @@ extern "C" {
 // =============================================================
 // PCA9685 Unified Driver Header
 // Supports: 
-//   • Arbitrary PWM frequency (up to ~1600 Hz)
+//   • Several PCA9685s on one I2C bus, each with its own address
+//     and PWM frequency (up to ~1600 Hz)
 //   • High-frequency PWM for solenoids
 //   • Standard 50 Hz servo control
 //   • Continuous-rotation servo speed control
+// Channel-number functions use one global numbering: device i
+// (in pca9685_add() order) owns channels 16*i .. 16*i + 15.
 // =============================================================
 
 // PCA9685 resolution
 #define PCA9685_STEPS 4096
+#define PCA9685_CHANNELS 16
+
+// OFF value with the full-off bit set (LEDn_OFF_H bit 4)
+#define PCA9685_FULL_OFF 0x1000
+
+// Pulses written with ON = 0 are staggered: each channel gets an ON
+// offset when it starts driving, where the fewest other pulses on its
+// board are high, and keeps it until it is switched off. 0 starts
+// every pulse at step 0, as callers wrote them.
+#ifndef PCA9685_STAGGER
+#define PCA9685_STAGGER 1
+#endif
+
+// Pulse width in microseconds → OFF count at 50 Hz, rounded.
+// Integer-only, so constant arguments fold at compile time.
+#define PCA9685_SERVO_PERIOD_US      20000u
+#define PCA9685_US_TO_COUNTS(us) \
+    ((uint16_t)(((uint32_t)(us) * PCA9685_STEPS + PCA9685_SERVO_PERIOD_US / 2) / PCA9685_SERVO_PERIOD_US))
+
+#define PCA9685_MAX_DEVICES   4
+#define PCA9685_MAX_CHANNELS  (PCA9685_MAX_DEVICES * PCA9685_CHANNELS)
+#define PCA9685_BASE_ADDR     0x40      // A5..A0 strapped low
+
+// I2C clock: 400 kHz Fast-mode, or 1 MHz Fast-mode Plus (the PCA9685
+// supports it; the bus needs FM+ strength pull-ups)
+#define PCA9685_I2C_FM_HZ      400000
+#define PCA9685_I2C_FMP_HZ     1000000
+#ifndef PCA9685_I2C_FREQ_HZ
+#define PCA9685_I2C_FREQ_HZ    PCA9685_I2C_FM_HZ
+#endif
+
+// Writes are queued to the i2c_master driver and return without waiting
+// for the bus; a writer only blocks once this many are in flight.
+#ifndef PCA9685_TXN_QUEUE_DEPTH
+#define PCA9685_TXN_QUEUE_DEPTH 8
+#endif
+
+// Failed writes are repaired by a recovery task: the channels they
+// touched are rewritten from the shadow up to PCA9685_I2C_RETRIES
+// times, then the bus is cleared (SCL pulses) and the board is
+// reprogrammed from the shadow. Bus waits on that path give up after
+// PCA9685_I2C_TIMEOUT_MS; a full queue of 16-channel bursts takes
+// about 12 ms at 400 kHz.
+#ifndef PCA9685_I2C_RETRIES
+#define PCA9685_I2C_RETRIES     2
+#endif
+#ifndef PCA9685_I2C_TIMEOUT_MS
+#define PCA9685_I2C_TIMEOUT_MS  20
+#endif
+#ifndef PCA9685_RECOVERY_PRIORITY
+#define PCA9685_RECOVERY_PRIORITY 21   // above the actuator task
+#endif
 
 // Servo pulse limits (typical)
-#define SERVO_MIN_PULSE 0.55f   // ms
-#define SERVO_MAX_PULSE 2.45f   // ms
+#define SERVO_MIN_PULSE_US  550
+#define SERVO_MID_PULSE_US  1500
+#define SERVO_MAX_PULSE_US  2450
 
 // -------------------------------------------------------------
-// Initialize PCA9685 at given PWM frequency
+// Bus and devices
+// -------------------------------------------------------------
+typedef struct pca9685_dev *pca9685_handle_t;
+
+typedef struct {
+    uint8_t  addr;       // 7-bit I2C address
+    uint16_t freq_hz;    // PWM frequency, 24–1526 Hz
+} pca9685_config_t;
+
+// Create the I2C master bus; devices run at clk_hz (clamped to
+// PCA9685_I2C_FMP_HZ). Called by pca9685_add() with
+// PCA9685_I2C_FREQ_HZ if not called first.
+esp_err_t pca9685_bus_init(uint32_t clk_hz);
+
+// Bring up one device: prescaler, wake, auto-increment, all outputs off.
+// ESP_ERR_NOT_FOUND if nothing ACKs the address,
+// ESP_ERR_INVALID_STATE if the address is already added,
+// ESP_ERR_NO_MEM beyond PCA9685_MAX_DEVICES.
+esp_err_t pca9685_add(const pca9685_config_t *config, pca9685_handle_t *out);
+
+// Device by pca9685_add() order, NULL if none
+pca9685_handle_t pca9685_get(uint8_t index);
+
+// Reprogram the prescaler (the device sleeps briefly)
+esp_err_t pca9685_set_freq(pca9685_handle_t dev, uint16_t freq_hz);
+
+// PWM frequency the prescaler actually gives
+float pca9685_get_freq(pca9685_handle_t dev);
+
+// Per-device versions of the channel functions below (channel 0–15)
+void pca9685_dev_set_pwm(pca9685_handle_t dev, uint8_t channel, uint16_t on, uint16_t off);
+void pca9685_dev_stop_channel(pca9685_handle_t dev, uint8_t channel);
+
+// -------------------------------------------------------------
+// Initialize a single PCA9685 at PCA9685_BASE_ADDR
+// (or change its frequency if it is already up)
 // freq_hz examples:
 //     50    – Standard RC servos
 //     200–1500 – Solenoids, motors, LEDs
@@ -33,10 +125,28 @@ void pca9685_init(uint16_t freq_hz);
 
 // -------------------------------------------------------------
 // Set raw PWM values for a channel
-// "on" and "off" are 12-bit (0–4095)
+// "on" and "off" are 12-bit (0–4095). With on = 0 the driver
+// picks the ON step (PCA9685_STAGGER) and keeps the width off;
+// any other on is written as given.
 // -------------------------------------------------------------
 void pca9685_set_pwm(uint8_t channel, uint16_t on, uint16_t off);
 
+// -------------------------------------------------------------
+// Batched update of several channels
+// Channels whose registers already hold the requested values
+// are skipped; runs of contiguous channels are sent as one
+// auto-increment burst per device. A channel listed more than
+// once gets its last update.
+// -------------------------------------------------------------
+typedef struct {
+    uint8_t  channel;
+    uint16_t on;
+    uint16_t off;
+} pca9685_update_t;
+
+void pca9685_set_pwm_multi(const pca9685_update_t *updates, int count);
+void pca9685_dev_set_pwm_multi(pca9685_handle_t dev, const pca9685_update_t *updates, int count);
+
 // -------------------------------------------------------------
 // Set duty cycle (0–100%) for a channel
 // -------------------------------------------------------------
@@ -57,6 +167,46 @@ void pca9685_set_servo_speed(uint8_t channel, float speed);
 
 void pca9685_stop_channel(uint8_t channel);
 
+// -------------------------------------------------------------
+// Wait until every queued write is on the wire
+// The channel functions above return once the write is queued;
+// call this where the output edge itself must be timed.
+// -------------------------------------------------------------
+esp_err_t pca9685_flush(uint32_t timeout_ms);
+
+// -------------------------------------------------------------
+// Bus statistics
+// "saved" counts are relative to one transaction per channel
+// update, which is what the driver did before shadowing.
+// pca9685_get_stats() sums every device.
+// -------------------------------------------------------------
+typedef struct {
+    uint32_t transactions;        // I2C write transactions issued
+    uint32_t bytes;               // bytes on the wire, incl. address byte
+    uint32_t errors;              // transactions that failed (NACK, timeout, queue error)
+    uint32_t transactions_saved;  // skipped or merged into a burst
+    uint32_t bytes_saved;
+    uint64_t call_us;             // time callers spent in bus writes and pca9685_flush()
+    uint32_t retries;             // failed channels rewritten from the shadow
+    uint32_t recoveries;          // bus clears followed by a full reprogram
+    uint32_t unrecovered;         // repairs that gave up with writes still failing
+    uint32_t repair_max_us;       // longest repair, failure seen to board back in sync
+    // Outputs high at the same step of the PWM period, from the registers
+    // as written. Boards run unsynchronized, so the sums over boards are
+    // the worst case on a shared rail.
+    uint8_t  concurrent;          // now
+    uint8_t  concurrent_peak;     // most since boot or pca9685_reset_stats()
+    uint8_t  aligned_peak;        // ... had every pulse started at step 0
+} pca9685_stats_t;
+
+void pca9685_get_stats(pca9685_stats_t *out);
+void pca9685_dev_get_stats(pca9685_handle_t dev, pca9685_stats_t *out);
+void pca9685_reset_stats(void);
+
+// Failed transactions that touched a channel (global numbering); a
+// burst counts against every channel it carried
+uint32_t pca9685_channel_errors(uint8_t channel);
+
 #ifdef __cplusplus
 }
 #endif
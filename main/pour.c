@@ -4,13 +4,21 @@
 #include "esp_err.h"
 #include "pca9685.h"
 #include "servo_control.h"
+#include "actuator.h"
 #include "http_client.h"  // Your HTTP server functions
+#include "wifi_sta.h"
+#include "order_pipeline.h"
+#include "pour_scheduler.h"
+#include "metrics.h"
+#include "flow_cal.h"
+#include "journal.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_wifi.h"
+#include "esp_timer.h"
 
-#define PCA_FREQ_HZ 50   // Standard servo frequency
+#define WIFI_WAIT_MS 15000
 
 static const char *TAG = "MAIN";
 
@@ -19,16 +27,57 @@ void app_main(void)
     //Init NVS
     ESP_ERROR_CHECK(nvs_flash_init());
 
-    // Wi-Fi
+    // Not fatal: uncalibrated ports pour at POUR_MS_PER_ML
+    if (flow_cal_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Flow calibration unavailable");
+    }
+
+    // Not fatal: without its partition the journal lives in RAM
+    if (journal_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Order journal not persistent");
+    }
+
+    // Wi-Fi associates in the background while the hardware comes up
     ESP_LOGI(TAG, "Connecting to WiFi...");
-    ESP_ERROR_CHECK(wifi_init_sta());
-    ESP_LOGI(TAG, "WiFi connected!");
+    ESP_ERROR_CHECK(wifi_sta_start());
+
+    ESP_LOGI(TAG, "Init %d PCA9685 board(s)...", POUR_BOARDS);
+    for (int i = 0; i < POUR_BOARDS; i++) {
+        // Boards past the servo channels only switch solenoids
+        pca9685_config_t board = {
+            .addr    = PCA9685_BASE_ADDR + i,
+            .freq_hz = i * PCA9685_CHANNELS < POUR_SOLENOID_OFFSET ? POUR_SERVO_FREQ_HZ
+                                                                   : POUR_SOLENOID_FREQ_HZ,
+        };
+        ESP_ERROR_CHECK(pca9685_add(&board, NULL));
+    }
+    ESP_ERROR_CHECK(actuator_init());
+    int64_t t_hw = esp_timer_get_time();
+
+    // Not fatal: the station keeps retrying and the fetch task backs off
+    if (wifi_sta_wait(WIFI_WAIT_MS) == ESP_OK) {
+        ESP_LOGI(TAG, "WiFi connected!");
+    } else {
+        ESP_LOGW(TAG, "WiFi not up after %d ms, starting anyway", WIFI_WAIT_MS);
+    }
+
+    // Diagnostics only: pour even if the server cannot start
+    if (metrics_start() != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics endpoint unavailable");
+    }
+
+    // Network task prefetches orders; this task only pours
+    ESP_ERROR_CHECK(order_pipeline_start());
+
+    wifi_sta_stats_t wifi;
+    wifi_sta_get_stats(&wifi);
+    ESP_LOGI(TAG, "Boot-to-ready %lld ms (hardware %lld ms, WiFi %lld ms, %s AP, %s)",
+             (long long)esp_timer_get_time() / 1000, (long long)t_hw / 1000,
+             wifi.connected_us ? (long long)(wifi.connected_us - wifi.start_us) / 1000 : -1LL,
+             wifi.cached_ap ? "cached" : "scanned", wifi.cached_ip ? "cached lease" : "DHCP");
 
-    ESP_LOGI(TAG, "Init PCA9685...");
-    pca9685_init(50);
     while (1) {
-        call_mix_endpoint();
-        vTaskDelay(pdMS_TO_TICKS(2000));
+        order_pipeline_pour_next(portMAX_DELAY);
     }
 
     //Loop forever running remote mix requests
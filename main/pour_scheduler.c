@@ -0,0 +1,230 @@
+#include "pour_scheduler.h"
+#include "pour_timeline.h"
+#include "servo_control.h"
+#include "pca9685.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "SCHED";
+
+static uint8_t max_servos    = POUR_DEFAULT_MAX_SERVOS;
+static uint8_t max_solenoids = POUR_DEFAULT_MAX_SOLENOIDS;
+
+static pour_plan_cb_t plan_cb;
+static void          *plan_arg;
+static pour_eta_cb_t  eta_cb;
+static void          *eta_arg;
+
+static uint8_t clamp_limit(uint8_t n)
+{
+    if (n < 1) n = 1;
+    if (n > POUR_MAX_PORTS) n = POUR_MAX_PORTS;
+    return n;
+}
+
+void pour_sched_set_limits(uint8_t servos, uint8_t solenoids)
+{
+    max_servos    = clamp_limit(servos);
+    max_solenoids = clamp_limit(solenoids);
+}
+
+uint32_t pour_sched_predict(const pour_item_t *items, int count,
+                            uint8_t servos, uint8_t solenoids)
+{
+    return pour_timeline_compile(items, count, servos, solenoids, 0, 0, NULL);
+}
+
+void pour_sched_on_plan(pour_plan_cb_t cb, void *arg)
+{
+    plan_cb  = cb;
+    plan_arg = arg;
+}
+
+void pour_sched_on_eta(pour_eta_cb_t cb, void *arg)
+{
+    eta_cb  = cb;
+    eta_arg = arg;
+}
+
+/* ---------------- Nozzle Residency ---------------- */
+typedef struct {
+    bool     extended;
+    int64_t  park_at_us;    // when a resident nozzle is retracted, 0 if in use
+} nozzle_t;
+
+static nozzle_t nozzles[POUR_MAX_PORTS];
+static uint32_t residency_ms = POUR_RESIDENCY_MS;
+static volatile uint32_t upcoming;
+static pour_nozzle_stats_t nozzle_stats;
+
+void pour_sched_set_residency(uint32_t window_ms)
+{
+    residency_ms = window_ms;
+}
+
+void pour_sched_set_upcoming(uint32_t port_mask)
+{
+    upcoming = port_mask;
+}
+
+static uint32_t extended_mask(void)
+{
+    uint32_t mask = 0;
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        if (nozzles[p].extended) mask |= BIT(p);
+    }
+    return mask;
+}
+
+uint32_t pour_sched_park(bool all)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t next = INT64_MAX;
+
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        nozzle_t *nz = &nozzles[p];
+        if (!nz->extended) continue;
+        if (!all && nz->park_at_us > now) {
+            if (nz->park_at_us < next) next = nz->park_at_us;
+            continue;
+        }
+        ESP_LOGI(TAG, "Parking nozzle %d", p);
+        servo_rotate_ccw(p, POUR_RETRACT_MS / 1000.0f);
+        nz->extended = false;
+        nozzle_stats.retracts++;
+        nozzle_stats.travel_ms += POUR_RETRACT_MS;
+    }
+    return next == INT64_MAX ? UINT32_MAX : (uint32_t)((next - now + 999) / 1000);
+}
+
+void pour_sched_get_nozzle_stats(pour_nozzle_stats_t *out)
+{
+    *out = nozzle_stats;
+}
+
+/* ---------------- Executor ---------------- */
+// Decided when the retract falls due, so an order fetched during this pour still counts
+static bool keep_port(uint8_t port)
+{
+    return residency_ms > 0 && (upcoming & BIT(port));
+}
+
+// The retract was in the compiled ETA: pass on the earlier end
+static void eta_changed(uint32_t makespan_ms)
+{
+    if (eta_cb) eta_cb(makespan_ms, eta_arg);
+}
+
+esp_err_t pour_sched_run(const pour_item_t *items, int count, pour_report_t *report)
+{
+    static pour_timeline_t tl;
+
+    if (count < 0 || count > POUR_MAX_ITEMS) return ESP_ERR_INVALID_ARG;
+    for (int i = 0; i < count; i++) {
+        if (items[i].port >= POUR_MAX_PORTS) return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t serial_ms = 0;
+    for (int i = 0; i < count; i++) {
+        serial_ms += POUR_EXTEND_MS + items[i].pour_ms + POUR_SETTLE_MS + POUR_RETRACT_MS;
+    }
+
+    // Resident nozzles this drink does not use: keep the ones still expected
+    uint32_t used = 0;
+    for (int i = 0; i < count; i++) used |= BIT(items[i].port);
+    uint32_t extended = extended_mask();
+    uint32_t keep = residency_ms > 0 ? upcoming : 0;
+    int64_t now = esp_timer_get_time();
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        if ((extended & ~used & BIT(p)) && nozzles[p].park_at_us <= now) keep &= ~BIT(p);
+    }
+
+    int64_t t_compile = esp_timer_get_time();
+    uint32_t predicted_ms = pour_timeline_compile(items, count, max_servos, max_solenoids,
+                                                  extended, keep, &tl);
+    uint32_t compile_us = (uint32_t)(esp_timer_get_time() - t_compile);
+
+    ESP_LOGI(TAG, "Drink: %d items, %d events compiled in %lu us, ETA %lu ms (serial %lu ms), "
+             "limits servo=%u solenoid=%u, nozzles out 0x%06lx",
+             count, tl.n_events, (unsigned long)compile_us, (unsigned long)predicted_ms,
+             (unsigned long)serial_ms, max_servos, max_solenoids, (unsigned long)extended);
+    if (plan_cb) plan_cb(&tl, plan_arg);
+
+    pca9685_stats_t bus_before;
+    pca9685_get_stats(&bus_before);
+
+    int64_t start = esp_timer_get_time();
+    pour_playback_t pb;
+    esp_err_t err = pour_timeline_play(&tl, keep_port, eta_changed, &pb);
+    if (err != ESP_OK) return err;
+    int64_t end = esp_timer_get_time();
+    uint32_t actual_ms = (uint32_t)((end - start) / 1000);
+
+    // Nozzle bookkeeping from what was actually written
+    pour_nozzle_stats_t motion = { 0 };
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        uint32_t bit = BIT(p);
+        nozzle_t *nz = &nozzles[p];
+        int items_on_port = 0;
+        for (int i = 0; i < count; i++) items_on_port += items[i].port == p;
+
+        if (used & bit) {
+            // Every item after the first would have cost its own extend and retract
+            motion.extends_saved  += items_on_port - 1;
+            motion.retracts_saved += items_on_port - 1;
+            if (extended & bit) {
+                motion.extends_saved++;
+            } else {
+                motion.extends++;
+            }
+        }
+        bool was_out = (extended | used) & bit;
+        bool out = (pb.extended & bit) != 0;
+        if (was_out && !out) motion.retracts++;
+        if ((used & bit) && out) motion.retracts_saved++;
+
+        nz->extended = out;
+        if (!out) {
+            nz->park_at_us = 0;
+        } else if (used & bit) {
+            // Compiled as kept but no longer expected: park at the next chance
+            nz->park_at_us = keep_port(p) ? end + (int64_t)residency_ms * 1000 : end;
+        }
+    }
+    motion.travel_ms = (uint64_t)motion.extends * POUR_EXTEND_MS +
+                       (uint64_t)motion.retracts * POUR_RETRACT_MS;
+
+    nozzle_stats.extends        += motion.extends;
+    nozzle_stats.retracts       += motion.retracts;
+    nozzle_stats.extends_saved  += motion.extends_saved;
+    nozzle_stats.retracts_saved += motion.retracts_saved;
+    nozzle_stats.travel_ms      += motion.travel_ms;
+
+    ESP_LOGI(TAG, "Drink done: ETA %lu ms, actual %lu ms, %lu events, worst write %lu us late",
+             (unsigned long)pb.makespan_ms, (unsigned long)actual_ms,
+             (unsigned long)pb.events, (unsigned long)pb.late_max_us);
+    ESP_LOGI(TAG, "Nozzles: %lu extends, %lu retracts (%lu / %lu saved), servo travel %lu ms, out 0x%06lx",
+             (unsigned long)motion.extends, (unsigned long)motion.retracts,
+             (unsigned long)motion.extends_saved, (unsigned long)motion.retracts_saved,
+             (unsigned long)motion.travel_ms, (unsigned long)extended_mask());
+
+    pca9685_stats_t bus;
+    pca9685_get_stats(&bus);
+    ESP_LOGI(TAG, "I2C: %lu txns / %lu bytes, saved %lu txns / %lu bytes, %lu us in bus calls",
+             (unsigned long)(bus.transactions - bus_before.transactions),
+             (unsigned long)(bus.bytes - bus_before.bytes),
+             (unsigned long)(bus.transactions_saved - bus_before.transactions_saved),
+             (unsigned long)(bus.bytes_saved - bus_before.bytes_saved),
+             (unsigned long)(bus.call_us - bus_before.call_us));
+
+    if (report) {
+        report->predicted_ms  = pb.makespan_ms;
+        report->actual_ms     = actual_ms;
+        report->serial_ms     = serial_ms;
+        report->first_pour_ms = pb.first_pour_us ? (uint32_t)((pb.first_pour_us - start) / 1000) : 0;
+        report->servo_ms      = (uint32_t)motion.travel_ms;
+        report->late_max_us   = pb.late_max_us;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,171 @@
+#ifndef POUR_SCHEDULER_H
+#define POUR_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* ---------------- Layout ---------------- */
+// Port N uses servo channel N for the nozzle and channel N + POUR_SOLENOID_OFFSET
+// for its solenoid, in the global PCA9685 channel numbering.
+//   1 board:  8 ports, servos and solenoids share 0x40 at 50 Hz
+//   2 boards: 16 ports, servos on 0x40 at 50 Hz, solenoids on 0x41
+//   4 boards: 32 ports, servos on 0x40-0x41, solenoids on 0x42-0x43
+// Servo boards run at POUR_SERVO_FREQ_HZ; boards that only carry solenoids
+// run at POUR_SOLENOID_FREQ_HZ, above the audible whine of 50 Hz hold PWM.
+#ifndef POUR_BOARDS
+#define POUR_BOARDS             1
+#endif
+
+#define POUR_SERVO_FREQ_HZ      50
+#ifndef POUR_SOLENOID_FREQ_HZ
+#define POUR_SOLENOID_FREQ_HZ   1000
+#endif
+
+#if POUR_BOARDS == 1
+#define POUR_MAX_PORTS          8
+#define POUR_SOLENOID_OFFSET    8
+#elif POUR_BOARDS == 2
+#define POUR_MAX_PORTS          16
+#define POUR_SOLENOID_OFFSET    16
+#elif POUR_BOARDS == 4
+#define POUR_MAX_PORTS          32      // one bit per port in the uint32_t masks
+#define POUR_SOLENOID_OFFSET    32
+#else
+#error "POUR_BOARDS must be 1, 2 or 4"
+#endif
+
+// Maximum recipe items accepted for a single drink
+#define POUR_MAX_ITEMS          16
+
+// Solenoid open time per millilitre (gravity feed, 2.5 ml/s)
+#define POUR_MS_PER_ML          400
+
+/* ---------------- Timing Model ---------------- */
+// Fixed motion times used by extend_nozzle() and the scheduler
+#define POUR_EXTEND_MS          900
+#define POUR_RETRACT_MS         750
+#define POUR_SETTLE_MS          200     // drip delay after solenoid_pulse() closes
+
+/* ---------------- Concurrency Limits ---------------- */
+// How many servos / solenoids may be driven at the same time.
+// Bounded by the 5 V rail; override at runtime with pour_sched_set_limits().
+#define POUR_DEFAULT_MAX_SERVOS     2
+#define POUR_DEFAULT_MAX_SOLENOIDS  2
+
+/* ---------------- Nozzle Residency ---------------- */
+// A nozzle whose port is used again by a queued order stays extended
+// after the drink; it is parked if no pour claims it within this window.
+// 0 retracts every nozzle at the end of each drink.
+#ifndef POUR_RESIDENCY_MS
+#define POUR_RESIDENCY_MS           10000
+#endif
+
+typedef struct {
+    uint8_t  port;       // 0 .. POUR_MAX_PORTS-1
+    uint32_t pour_ms;    // solenoid open time
+} pour_item_t;
+
+typedef struct {
+    uint32_t predicted_ms;   // makespan from the scheduling model
+    uint32_t actual_ms;      // measured wall-clock makespan
+    uint32_t serial_ms;      // makespan of the old one-item-at-a-time loop
+    uint32_t first_pour_ms;  // from start of the run to the first solenoid opening
+    uint32_t servo_ms;       // nozzle travel (extend + retract) during the run
+    uint32_t late_max_us;    // worst timeline write behind its compiled time
+} pour_report_t;
+
+typedef struct {
+    uint32_t extends;
+    uint32_t retracts;
+    uint32_t extends_saved;    // the nozzle was already out
+    uint32_t retracts_saved;   // left out for the next item or order
+    uint64_t travel_ms;        // total extend + retract time, parking included
+} pour_nozzle_stats_t;
+
+/**
+ * @brief Set the number of servos and solenoids that may be active at once.
+ *
+ * Takes effect on the next pour_sched_run(). Values are clamped to
+ * 1 .. POUR_MAX_PORTS.
+ */
+void pour_sched_set_limits(uint8_t max_servos, uint8_t max_solenoids);
+
+/**
+ * @brief Predict the makespan of a drink under the given limits.
+ *
+ * Pure model with no hardware or RTOS calls: items on the same port run in
+ * order under one extend/retract, items on different ports overlap as far
+ * as the limits allow. Every nozzle starts and ends retracted.
+ *
+ * @return Predicted makespan in milliseconds.
+ */
+uint32_t pour_sched_predict(const pour_item_t *items, int count,
+                            uint8_t max_servos, uint8_t max_solenoids);
+
+/**
+ * @brief Pour all recipe items, running different ports concurrently.
+ *
+ * Compiles the drink into a pour_timeline_t with the same model as
+ * pour_sched_predict() (starting from the nozzles still out and keeping
+ * the upcoming ports out), hands it to the plan callback, then plays it.
+ * A used port that becomes upcoming during the drink skips its retract,
+ * and the ETA callback hears the earlier end. Blocks until the drink is
+ * finished.
+ *
+ * @param report Optional; receives predicted (as last corrected) and
+ *               actual makespan.
+ * @return ESP_OK on success,
+ *         ESP_ERR_INVALID_ARG on a bad port or too many items,
+ *         the pour_timeline_play() error otherwise.
+ */
+esp_err_t pour_sched_run(const pour_item_t *items, int count, pour_report_t *report);
+
+typedef struct pour_timeline pour_timeline_t;
+typedef void (*pour_plan_cb_t)(const pour_timeline_t *timeline, void *arg);
+
+/**
+ * @brief Call cb with every compiled drink before it starts playing.
+ *
+ * Runs in the task that called pour_sched_run() and delays the first
+ * event, so it should only copy what it needs (makespan_ms is the ETA).
+ */
+void pour_sched_on_plan(pour_plan_cb_t cb, void *arg);
+
+typedef void (*pour_eta_cb_t)(uint32_t makespan_ms, void *arg);
+
+/**
+ * @brief Call cb when a nozzle kept out mid-drink brings the end of the
+ *        drink forward, with the new makespan.
+ *
+ * Runs in the actuator task: must not block.
+ */
+void pour_sched_on_eta(pour_eta_cb_t cb, void *arg);
+
+/**
+ * @brief Set the residency window (0 disables residency).
+ */
+void pour_sched_set_residency(uint32_t window_ms);
+
+/**
+ * @brief Ports used by orders queued behind the current one.
+ *
+ * May be called from any task; read when a port finishes its last item.
+ */
+void pour_sched_set_upcoming(uint32_t port_mask);
+
+/**
+ * @brief Retract nozzles whose residency window has expired (or all of them).
+ *
+ * Call between drinks from the task that runs pour_sched_run().
+ *
+ * @return Milliseconds until the next nozzle expires, UINT32_MAX if none is out.
+ */
+uint32_t pour_sched_park(bool all);
+
+/**
+ * @brief Nozzle motion counters since boot.
+ */
+void pour_sched_get_nozzle_stats(pour_nozzle_stats_t *out);
+
+#endif // POUR_SCHEDULER_H
@@ -0,0 +1,335 @@
+#include "pour_timeline.h"
+#include "servo_control.h"
+#include "pca9685.h"
+#include "actuator.h"
+#include "trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define FLUSH_TIMEOUT_MS  50
+
+static const char *TAG = "TIMELINE";
+
+// Port masks are uint32_t
+_Static_assert(POUR_MAX_PORTS <= 32, "more ports than mask bits");
+
+/* ---------------- Compiler ---------------- */
+// A port extends once, pours its items back to back, then retracts;
+// servo phases hold a servo slot, the pour phase holds a solenoid slot.
+enum { PHASE_EXTEND, PHASE_POUR, PHASE_RETRACT, PHASE_DONE };
+
+static uint32_t phase_ms(int phase, uint32_t pour_ms)
+{
+    switch (phase) {
+    case PHASE_EXTEND:  return POUR_EXTEND_MS;
+    case PHASE_POUR:    return pour_ms + POUR_SETTLE_MS;
+    default:            return POUR_RETRACT_MS;
+    }
+}
+
+static uint8_t clamp_limit(uint8_t n)
+{
+    if (n < 1) n = 1;
+    if (n > POUR_MAX_PORTS) n = POUR_MAX_PORTS;
+    return n;
+}
+
+static int next_item(const pour_item_t *items, int count, int from, int p)
+{
+    for (int i = from; i < count; i++) {
+        if (items[i].port == p) return i;
+    }
+    return -1;
+}
+
+// Stable insert by time: events at the same instant keep emission order
+static void emit(pour_timeline_t *tl, uint32_t t_ms, pour_event_kind_t kind, uint8_t port)
+{
+    if (!tl) return;
+
+    pour_event_t ev = { .t_us = t_ms * 1000, .port = port, .kind = kind };
+    switch (kind) {
+    case POUR_EV_EXTEND:  ev.channel = port; ev.off = SERVO_FORWARD_COUNTS;               break;
+    case POUR_EV_RETRACT: ev.channel = port; ev.off = SERVO_REVERSE_COUNTS;               break;
+    case POUR_EV_STOP:    ev.channel = port; ev.off = PCA9685_FULL_OFF;                   break;
+    case POUR_EV_OPEN:    ev.channel = port + POUR_SOLENOID_OFFSET; ev.off = PCA9685_STEPS - 1; break;
+    case POUR_EV_CLOSE:   ev.channel = port + POUR_SOLENOID_OFFSET; ev.off = 0;           break;
+    }
+
+    int i = tl->n_events++;
+    for (; i > 0 && tl->events[i - 1].t_us > ev.t_us; i--) tl->events[i] = tl->events[i - 1];
+    tl->events[i] = ev;
+}
+
+static void emit_phase(pour_timeline_t *tl, int phase, uint8_t port, uint32_t now, uint32_t pour_ms)
+{
+    switch (phase) {
+    case PHASE_EXTEND:
+        emit(tl, now, POUR_EV_EXTEND, port);
+        emit(tl, now + POUR_EXTEND_MS, POUR_EV_STOP, port);
+        break;
+    case PHASE_POUR:
+        emit(tl, now, POUR_EV_OPEN, port);
+        emit(tl, now + pour_ms, POUR_EV_CLOSE, port);
+        if (tl && tl->first_pour_ms == UINT32_MAX) tl->first_pour_ms = now;
+        break;
+    default:
+        emit(tl, now, POUR_EV_RETRACT, port);
+        emit(tl, now + POUR_RETRACT_MS, POUR_EV_STOP, port);
+        break;
+    }
+}
+
+uint32_t pour_timeline_compile(const pour_item_t *items, int count,
+                               uint8_t servos, uint8_t solenoids,
+                               uint32_t extended, uint32_t keep, pour_timeline_t *out)
+{
+    // Per-port progress through its own items, in recipe order
+    struct {
+        int      item;      // index into items[] of the current item
+        int      phase;
+        int      running;
+        uint32_t end;
+    } port[POUR_MAX_PORTS];
+
+    servos    = clamp_limit(servos);
+    solenoids = clamp_limit(solenoids);
+
+    if (out) {
+        out->n_events      = 0;
+        out->first_pour_ms = UINT32_MAX;
+        out->used          = 0;
+        out->extended      = extended;
+        out->keep          = keep;
+        for (int i = 0; i < count; i++) out->used |= BIT(items[i].port);
+    }
+
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        port[p].item = next_item(items, count, 0, p);
+        port[p].running = 0;
+        if (port[p].item >= 0) {
+            port[p].phase = (extended & BIT(p)) ? PHASE_POUR : PHASE_EXTEND;
+        } else {
+            port[p].phase = ((extended & ~keep) & BIT(p)) ? PHASE_RETRACT : PHASE_DONE;
+        }
+    }
+
+    int free_servos = servos;
+    int free_solenoids = solenoids;
+    uint32_t now = 0;
+
+    while (1) {
+        // Retire phases that have finished by now
+        for (int p = 0; p < POUR_MAX_PORTS; p++) {
+            if (!port[p].running || port[p].end > now) continue;
+            port[p].running = 0;
+
+            switch (port[p].phase) {
+            case PHASE_EXTEND:
+                free_servos++;
+                port[p].phase = PHASE_POUR;
+                break;
+            case PHASE_POUR:
+                free_solenoids++;
+                port[p].item = next_item(items, count, port[p].item + 1, p);
+                if (port[p].item < 0) {
+                    port[p].phase = (keep & BIT(p)) ? PHASE_DONE : PHASE_RETRACT;
+                }
+                break;
+            default:
+                free_servos++;
+                port[p].phase = PHASE_DONE;
+                break;
+            }
+        }
+
+        // Start whatever can start, lowest port first
+        int active = 0;
+        for (int p = 0; p < POUR_MAX_PORTS; p++) {
+            if (port[p].phase == PHASE_DONE) continue;
+            active = 1;
+            if (port[p].running) continue;
+
+            int *slots = (port[p].phase == PHASE_POUR) ? &free_solenoids : &free_servos;
+            if (*slots == 0) continue;
+            (*slots)--;
+            port[p].running = 1;
+            uint32_t pour_ms = port[p].item >= 0 ? items[port[p].item].pour_ms : 0;
+            port[p].end = now + phase_ms(port[p].phase, pour_ms);
+            emit_phase(out, port[p].phase, p, now, pour_ms);
+        }
+        if (!active) break;
+
+        // Advance to the next phase completion
+        uint32_t next = UINT32_MAX;
+        for (int p = 0; p < POUR_MAX_PORTS; p++) {
+            if (port[p].running && port[p].end < next) next = port[p].end;
+        }
+        now = next;
+    }
+
+    if (out) {
+        out->makespan_ms = now;
+        if (out->first_pour_ms == UINT32_MAX) out->first_pour_ms = 0;
+    }
+    return now;
+}
+
+/* ---------------- Player ---------------- */
+static const pour_timeline_t *play_tl;
+static pour_keep_fn_t         play_keep;
+static pour_eta_fn_t          play_eta;
+static pour_playback_t        play_out;
+static int                    play_next;       // first event not yet written or skipped
+static int64_t                play_start_us;
+static uint32_t               play_end_us;     // latest write time, settle included
+static uint32_t               skip_stop;       // ports whose pending STOP belongs to a kept retract
+static int64_t                opened_us[POUR_MAX_PORTS];   // when the OPEN write completed
+static uint32_t               open_for_us[POUR_MAX_PORTS]; // compiled CLOSE - OPEN
+static pca9685_update_t       play_batch[POUR_TIMELINE_MAX_EVENTS];   // off the actuator stack
+
+static StaticSemaphore_t      done_sem_buf;
+static SemaphoreHandle_t      done_sem;
+
+// Drop STOPs of kept retracts at the head, so they never cost a wake-up
+static void skip_kept(void)
+{
+    while (play_next < play_tl->n_events) {
+        const pour_event_t *ev = &play_tl->events[play_next];
+        if (ev->kind != POUR_EV_STOP || !(skip_stop & BIT(ev->port))) break;
+        skip_stop &= ~BIT(ev->port);
+        play_next++;
+    }
+}
+
+// Compiled end of what is left to play, settle included, without the
+// retracts keep_fn would drop as things stand, so one drop usually
+// settles the drink's ETA for good
+static uint32_t remaining_end_us(void)
+{
+    uint32_t end = play_end_us;
+    uint32_t stops = skip_stop;
+
+    for (int i = play_next; i < play_tl->n_events; i++) {
+        const pour_event_t *ev = &play_tl->events[i];
+        uint32_t bit = BIT(ev->port);
+        if (ev->kind == POUR_EV_RETRACT && (play_tl->used & bit) && play_keep(ev->port)) {
+            stops |= bit;
+            continue;
+        }
+        if (ev->kind == POUR_EV_STOP && (stops & bit)) {
+            stops &= ~bit;
+            continue;
+        }
+        uint32_t t = ev->t_us + (ev->kind == POUR_EV_CLOSE ? POUR_SETTLE_MS * 1000 : 0);
+        if (t > end) end = t;
+    }
+    return end;
+}
+
+// Runs in the actuator task
+static int64_t play_step(void *arg)
+{
+    int n = 0;
+    uint32_t opening = 0, closing = 0, dropped = 0;
+    uint32_t due_us = 0;
+    int64_t now = esp_timer_get_time() - play_start_us;
+
+    while (play_next < play_tl->n_events && play_tl->events[play_next].t_us <= now) {
+        const pour_event_t *ev = &play_tl->events[play_next++];
+        uint32_t bit = BIT(ev->port);
+
+        if (ev->kind == POUR_EV_RETRACT && (play_tl->used & bit) && play_keep && play_keep(ev->port)) {
+            play_out.kept |= bit;
+            skip_stop |= bit;
+            dropped |= bit;
+            continue;
+        }
+        if (ev->kind == POUR_EV_STOP && (skip_stop & bit)) {
+            skip_stop &= ~bit;
+            continue;
+        }
+
+        if (n == 0) due_us = ev->t_us;
+        play_batch[n++] = (pca9685_update_t) { .channel = ev->channel, .on = 0, .off = ev->off };
+
+        uint32_t end = ev->t_us + (ev->kind == POUR_EV_CLOSE ? POUR_SETTLE_MS * 1000 : 0);
+        if (end > play_end_us) play_end_us = end;
+
+        if (ev->kind == POUR_EV_EXTEND) play_out.extended |= bit;
+        if (ev->kind == POUR_EV_RETRACT) play_out.extended &= ~bit;
+        if (ev->kind == POUR_EV_OPEN) {
+            opening |= bit;
+            open_for_us[ev->port] = ev->t_us;
+        }
+        if (ev->kind == POUR_EV_CLOSE) {
+            closing |= bit;
+            open_for_us[ev->port] = ev->t_us - open_for_us[ev->port];
+        }
+        TRACE_INSTANT("timeline_event", ev->channel);
+    }
+
+    if (n) {
+        pca9685_set_pwm_multi(play_batch, n);
+        // Pour volume follows the solenoid edges: time those, not the enqueue
+        if (opening | closing) pca9685_flush(FLUSH_TIMEOUT_MS);
+        now = esp_timer_get_time() - play_start_us;
+        if (now - due_us > play_out.late_max_us) play_out.late_max_us = (uint32_t)(now - due_us);
+        if (opening && play_out.first_pour_us == 0) play_out.first_pour_us = play_start_us + now;
+        play_out.events += n;
+
+        for (int p = 0; p < POUR_MAX_PORTS; p++) {
+            if (closing & BIT(p)) {
+                actuator_pulse_stats_add(ACT_PULSES_TIMELINE, play_start_us + now - opened_us[p],
+                                         open_for_us[p]);
+            }
+            if (opening & BIT(p)) opened_us[p] = play_start_us + now;
+        }
+    }
+
+    skip_kept();
+
+    if (dropped) {
+        uint32_t makespan_ms = remaining_end_us() / 1000;
+        if (makespan_ms != play_out.makespan_ms && play_eta) play_eta(makespan_ms);
+        play_out.makespan_ms = makespan_ms;
+    }
+
+    int64_t wake;
+    if (play_next < play_tl->n_events) {
+        wake = play_tl->events[play_next].t_us;
+    } else if (now < play_end_us) {
+        wake = play_end_us;     // last solenoid still settling
+    } else {
+        xSemaphoreGive(done_sem);
+        return ACTUATOR_SEQ_DONE;
+    }
+    return play_start_us + wake;
+}
+
+esp_err_t pour_timeline_play(const pour_timeline_t *tl, pour_keep_fn_t keep_fn,
+                             pour_eta_fn_t eta_fn, pour_playback_t *out)
+{
+    if (!done_sem) done_sem = xSemaphoreCreateBinaryStatic(&done_sem_buf);
+
+    play_tl   = tl;
+    play_keep = keep_fn;
+    play_eta  = eta_fn;
+    play_out  = (pour_playback_t) { .extended = tl->extended, .makespan_ms = tl->makespan_ms };
+    play_next = 0;
+    play_end_us = 0;
+    skip_stop = 0;
+
+    play_start_us = esp_timer_get_time();
+    esp_err_t err = actuator_sequence_start(play_step, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Sequence start failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    xSemaphoreTake(done_sem, portMAX_DELAY);
+
+    if (out) *out = play_out;
+    return ESP_OK;
+}
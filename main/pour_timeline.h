@@ -0,0 +1,101 @@
+#ifndef POUR_TIMELINE_H
+#define POUR_TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "pour_scheduler.h"
+
+// =============================================================
+// Compiled pour timeline
+// A recipe is compiled once, before the drink, into a flat array
+// of (time, channel, OFF count) events sorted by time. Pulse
+// widths are converted to register counts at compile time, so
+// the player only batches due events into PCA9685 writes. The
+// compiled makespan is the drink ETA.
+// =============================================================
+
+// Every port: extend + stop + retract + stop; every item: open + close
+#define POUR_TIMELINE_MAX_EVENTS  (4 * POUR_MAX_PORTS + 2 * POUR_MAX_ITEMS)
+
+typedef enum {
+    POUR_EV_EXTEND,     // servo forward
+    POUR_EV_RETRACT,    // servo reverse
+    POUR_EV_STOP,       // servo full-off, ends an extend or retract
+    POUR_EV_OPEN,       // solenoid 100% duty
+    POUR_EV_CLOSE,      // solenoid 0% duty, followed by POUR_SETTLE_MS
+} pour_event_kind_t;
+
+typedef struct {
+    uint32_t t_us;      // from the start of the drink
+    uint16_t off;       // OFF count written with ON = 0
+    uint8_t  channel;   // global PCA9685 channel
+    uint8_t  port;
+    uint8_t  kind;      // pour_event_kind_t
+} pour_event_t;
+
+struct pour_timeline {
+    pour_event_t events[POUR_TIMELINE_MAX_EVENTS];
+    int          n_events;
+    uint32_t     makespan_ms;     // ETA: last event, settle included
+    uint32_t     first_pour_ms;   // first solenoid opening
+    uint32_t     used;            // ports with items
+    uint32_t     extended;        // nozzles out at the start
+    uint32_t     keep;            // nozzles left out at the end
+};
+
+typedef struct {
+    uint32_t extended;          // nozzles out once the drink is done
+    uint32_t kept;              // used ports whose retract was dropped at run time
+    uint32_t makespan_ms;       // compiled makespan less the dropped retracts
+    int64_t  first_pour_us;     // when the first OPEN was written, 0 if none
+    uint32_t late_max_us;       // worst write delay behind the compiled time
+    uint32_t events;            // events written
+} pour_playback_t;
+
+/**
+ * @brief Compile a drink into a timeline.
+ *
+ * List-schedules the items under the servo/solenoid limits: a port
+ * extends once (unless it is in extended), pours its items back to
+ * back, then retracts (unless it is in keep). Nozzles in extended
+ * that the drink does not use and keep does not hold are retracted
+ * alongside. Pure function, no hardware or RTOS calls.
+ *
+ * @param out Receives the events; NULL only computes the makespan.
+ * @return Makespan in milliseconds.
+ */
+uint32_t pour_timeline_compile(const pour_item_t *items, int count,
+                               uint8_t max_servos, uint8_t max_solenoids,
+                               uint32_t extended, uint32_t keep, pour_timeline_t *out);
+
+/**
+ * @brief Decides at run time whether a used port keeps its nozzle out.
+ *
+ * Asked when the port's RETRACT falls due, so an order fetched during
+ * the drink still counts. Runs in the actuator task: must not block.
+ */
+typedef bool (*pour_keep_fn_t)(uint8_t port);
+
+/**
+ * @brief Told the drink's makespan again when a dropped retract brings
+ *        its end forward. Runs in the actuator task: must not block.
+ */
+typedef void (*pour_eta_fn_t)(uint32_t makespan_ms);
+
+/**
+ * @brief Play a compiled timeline and block until its makespan.
+ *
+ * Events are written from the actuator task (actuator_sequence_start());
+ * every event due at the same time goes out in one pca9685_set_pwm_multi().
+ * A RETRACT that keep_fn (optional) holds back is skipped together
+ * with its STOP. That can only end the drink earlier: eta_fn (optional)
+ * then gets the compiled end of what is left to play, so the ETA given
+ * out for the drink stays true. Not reentrant: one drink plays at a time.
+ *
+ * @return ESP_OK, or the actuator_sequence_start() error.
+ */
+esp_err_t pour_timeline_play(const pour_timeline_t *tl, pour_keep_fn_t keep_fn,
+                             pour_eta_fn_t eta_fn, pour_playback_t *out);
+
+#endif // POUR_TIMELINE_H
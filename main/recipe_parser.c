@@ -0,0 +1,464 @@
+#include "recipe_parser.h"
+#include <string.h>
+
+/* ---------------- Lexer States ---------------- */
+enum {
+    ST_VALUE,          // expecting a value
+    ST_FIRST_VALUE,    // just after '[': a value or ']'
+    ST_FIRST_KEY,      // just after '{': a key or '}'
+    ST_KEY,            // after ',' in an object
+    ST_COLON,
+    ST_AFTER,          // after a value: ',' or a closer
+    ST_STRING,
+    ST_ESCAPE,
+    ST_NUMBER,
+    ST_LITERAL,        // true / false / null
+    ST_DONE,
+    ST_ERROR,
+    ST_BIN_HEADER,     // binary: fixed header
+    ST_BIN_ITEM,       // binary: item records
+};
+
+/* ---------------- Number Phases ---------------- */
+// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+enum {
+    NUM_SIGN,          // after '-': a digit
+    NUM_ZERO,          // a leading 0: '.', 'e' or the end
+    NUM_INT,
+    NUM_POINT,         // after '.': a digit
+    NUM_FRAC,
+    NUM_E,             // after 'e': a sign or a digit
+    NUM_EXP_SIGN,      // after the exponent's sign: a digit
+    NUM_EXP,
+};
+
+// Digits past 17 significant ones only scale the value: it is either
+// saturated by then or they are all below the point
+#define NUM_MANT_MAX   100000000000000000ULL
+#define NUM_EXP_MAX    1000
+
+/* ---------------- Value Targets ---------------- */
+enum {
+    T_NONE,
+    T_STATUS,
+    T_AGE,
+    T_ID,
+    T_LEASE,
+    T_RECIPE,
+    T_PORT,
+    T_VOLUME,
+};
+
+/* ---------------- Internal Helpers ---------------- */
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool in_object(const recipe_parser_t *p)
+{
+    return p->containers & (1u << p->depth);
+}
+
+static bool key_is(const recipe_parser_t *p, const char *name)
+{
+    size_t n = strlen(name);
+    return p->key_len == n && memcmp(p->key, name, n) == 0;
+}
+
+// Items are the objects directly inside the recipe array
+static bool at_item_level(const recipe_parser_t *p)
+{
+    return p->recipe_depth && p->depth == p->recipe_depth + 1;
+}
+
+static void end_value(recipe_parser_t *p)
+{
+    p->state = (p->depth == 0) ? ST_DONE : ST_AFTER;
+}
+
+static bool push(recipe_parser_t *p, bool object)
+{
+    if (p->depth + 1 >= RECIPE_MAX_DEPTH) return false;
+    p->depth++;
+    if (object) p->containers |= 1u << p->depth;
+    else p->containers &= ~(1u << p->depth);
+    return true;
+}
+
+static void key_done(recipe_parser_t *p)
+{
+    p->target = T_NONE;
+    if (p->depth == 1) {
+        if (key_is(p, "status"))         p->target = T_STATUS;
+        else if (key_is(p, "age_ms"))    p->target = T_AGE;
+        else if (key_is(p, "id"))        p->target = T_ID;
+        else if (key_is(p, "lease_ms"))  p->target = T_LEASE;
+        else if (key_is(p, "recipe"))    p->target = T_RECIPE;
+    } else if (at_item_level(p)) {
+        if (key_is(p, "port"))           p->target = T_PORT;
+        else if (key_is(p, "volume_ml")) p->target = T_VOLUME;
+    }
+    p->state = ST_COLON;
+}
+
+static void add_digit(recipe_parser_t *p, int d, bool fraction)
+{
+    if (p->num_mant < NUM_MANT_MAX) {
+        p->num_mant = p->num_mant * 10 + d;
+        if (fraction) p->num_scale--;
+    } else if (!fraction && p->num_scale < NUM_EXP_MAX) {
+        p->num_scale++;
+    }
+}
+
+// Take c as the number's next character; false if it cannot continue
+// the number, which may or may not be complete by then
+static bool number_char(recipe_parser_t *p, char c)
+{
+    bool digit = c >= '0' && c <= '9';
+
+    switch (p->num_phase) {
+    case NUM_SIGN:
+        if (!digit) return false;
+        add_digit(p, c - '0', false);
+        p->num_phase = (c == '0') ? NUM_ZERO : NUM_INT;
+        return true;
+
+    case NUM_INT:
+        if (digit) {
+            add_digit(p, c - '0', false);
+            return true;
+        }
+        /* fall through */
+    case NUM_ZERO:
+        if (c == '.') p->num_phase = NUM_POINT;
+        else if (c == 'e' || c == 'E') p->num_phase = NUM_E;
+        else return false;
+        return true;
+
+    case NUM_FRAC:
+        if (c == 'e' || c == 'E') {
+            p->num_phase = NUM_E;
+            return true;
+        }
+        /* fall through */
+    case NUM_POINT:
+        if (!digit) return false;
+        add_digit(p, c - '0', true);
+        p->num_phase = NUM_FRAC;
+        return true;
+
+    case NUM_E:
+        if (c == '+' || c == '-') {
+            p->num_exp_neg = (c == '-');
+            p->num_phase = NUM_EXP_SIGN;
+            return true;
+        }
+        /* fall through */
+    default:            // NUM_EXP_SIGN, NUM_EXP
+        if (!digit) return false;
+        if (p->num_exp < NUM_EXP_MAX) p->num_exp = p->num_exp * 10 + (c - '0');
+        p->num_phase = NUM_EXP;
+        return true;
+    }
+}
+
+static bool number_complete(const recipe_parser_t *p)
+{
+    return p->num_phase == NUM_ZERO || p->num_phase == NUM_INT ||
+           p->num_phase == NUM_FRAC || p->num_phase == NUM_EXP;
+}
+
+// What cJSON's valueint holds: truncated toward zero, saturated to int
+static int number_value(const recipe_parser_t *p)
+{
+    uint64_t limit = p->num_neg ? (uint64_t)INT32_MAX + 1 : INT32_MAX;
+    uint64_t v = p->num_mant;
+    int e = p->num_scale + (p->num_exp_neg ? -p->num_exp : p->num_exp);
+
+    for (; e < 0 && v; e++) v /= 10;
+    for (; e > 0 && v && v <= limit; e--) v *= 10;
+    if (v > limit) v = limit;
+    return p->num_neg ? (int)-(int64_t)v : (int)v;
+}
+
+static void number_done(recipe_parser_t *p)
+{
+    int v = number_value(p);
+
+    switch (p->target) {
+    case T_STATUS: p->status = v; p->has_status = true;                break;
+    case T_AGE:    p->age_ms = v;                                      break;
+    case T_ID:     p->id = v;                                          break;
+    case T_LEASE:  p->lease_ms = v;                                    break;
+    case T_PORT:   p->item.port = v; p->item_has_port = true;          break;
+    case T_VOLUME: p->item.volume_ml = v; p->item_has_volume = true;   break;
+    default:                                                           break;
+    }
+    p->target = T_NONE;
+    end_value(p);
+}
+
+static void item_done(recipe_parser_t *p)
+{
+    if (!p->item_has_port || !p->item_has_volume) {
+        p->invalid_items++;
+    } else if (p->n_items < RECIPE_MAX_ITEMS) {
+        p->items[p->n_items++] = p->item;
+    } else {
+        p->dropped_items++;
+    }
+}
+
+static bool begin_value(recipe_parser_t *p, char c)
+{
+    uint8_t target = p->target;
+    p->target = T_NONE;
+
+    if (p->recipe_depth && p->depth == p->recipe_depth && c != '{') {
+        p->invalid_items++;
+    }
+
+    switch (c) {
+    case '{':
+        if (p->recipe_depth && p->depth == p->recipe_depth) {
+            p->item_has_port = p->item_has_volume = false;
+        }
+        if (!push(p, true)) return false;
+        p->state = ST_FIRST_KEY;
+        return true;
+
+    case '[':
+        if (!push(p, false)) return false;
+        if (target == T_RECIPE) {
+            p->has_recipe = true;
+            p->recipe_depth = p->depth;
+        }
+        p->state = ST_FIRST_VALUE;
+        return true;
+
+    case '"':
+        p->str_is_key = false;
+        p->esc_hex = 0;
+        p->state = ST_STRING;
+        return true;
+
+    case 't': p->lit = "rue";  p->state = ST_LITERAL; return true;
+    case 'f': p->lit = "alse"; p->state = ST_LITERAL; return true;
+    case 'n': p->lit = "ull";  p->state = ST_LITERAL; return true;
+
+    default:
+        if (c != '-' && (c < '0' || c > '9')) return false;
+        p->target = target;
+        p->num_phase = NUM_SIGN;
+        p->num_neg = (c == '-');
+        p->num_exp_neg = false;
+        p->num_scale = 0;
+        p->num_exp = 0;
+        p->num_mant = 0;
+        if (c != '-') number_char(p, c);    // as if after a '-'
+        p->state = ST_NUMBER;
+        return true;
+    }
+}
+
+static bool close_container(recipe_parser_t *p, char c)
+{
+    if (p->depth == 0 || in_object(p) != (c == '}')) return false;
+
+    if (c == '}' && at_item_level(p)) item_done(p);
+    if (c == ']' && p->depth == p->recipe_depth) p->recipe_depth = 0;
+
+    p->depth--;
+    end_value(p);
+    return true;
+}
+
+/* ---------------- Binary Layout ---------------- */
+static uint16_t le16(const uint8_t *b)
+{
+    return b[0] | (uint16_t)b[1] << 8;
+}
+
+static uint32_t le32(const uint8_t *b)
+{
+    return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static void bin_header(recipe_parser_t *p, const uint8_t *b)
+{
+    if (b[0] != RECIPE_BIN_VERSION) {
+        p->state = ST_ERROR;
+        return;
+    }
+    p->status         = b[1];
+    p->has_status     = true;
+    p->has_recipe     = true;
+    p->bin_items_left = b[2];
+    p->lease_ms       = b[3] * 1000;
+    p->id             = (int)le32(b + 4);
+    p->age_ms         = (int)le32(b + 8);
+    p->state = p->bin_items_left ? ST_BIN_ITEM : ST_DONE;
+}
+
+static void bin_item(recipe_parser_t *p, const uint8_t *b)
+{
+    if (p->n_items < RECIPE_MAX_ITEMS) {
+        p->items[p->n_items++] = (recipe_item_t) { .port = b[0], .volume_ml = le16(b + 2) };
+    } else {
+        p->dropped_items++;
+    }
+    if (--p->bin_items_left == 0) p->state = ST_DONE;
+}
+
+static recipe_parse_result_t feed_binary(recipe_parser_t *p, const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len && (p->state == ST_BIN_HEADER || p->state == ST_BIN_ITEM)) {
+        size_t need = (p->state == ST_BIN_HEADER) ? RECIPE_BIN_HEADER_LEN : RECIPE_BIN_ITEM_LEN;
+        const uint8_t *rec;
+
+        if (p->rec_len == 0 && len - i >= need) {
+            rec = data + i;             // whole record in this fragment
+            i += need;
+        } else {
+            size_t n = need - p->rec_len;
+            if (n > len - i) n = len - i;
+            memcpy(p->rec + p->rec_len, data + i, n);
+            p->rec_len += n;
+            i += n;
+            if (p->rec_len < need) break;
+            rec = p->rec;
+            p->rec_len = 0;
+        }
+
+        if (p->state == ST_BIN_HEADER) bin_header(p, rec);
+        else bin_item(p, rec);
+    }
+
+    // Nothing may follow the last item
+    if (i < len && p->state == ST_DONE) p->state = ST_ERROR;
+    p->bytes += len;
+
+    if (p->state == ST_ERROR) return RECIPE_PARSE_ERROR;
+    return (p->state == ST_DONE) ? RECIPE_PARSE_DONE : RECIPE_PARSE_MORE;
+}
+
+/* ---------------- Public API ---------------- */
+void recipe_parser_init(recipe_parser_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->state = ST_VALUE;
+}
+
+void recipe_parser_set_format(recipe_parser_t *p, recipe_format_t format)
+{
+    p->format = format;
+    p->state = (format == RECIPE_FORMAT_BINARY) ? ST_BIN_HEADER : ST_VALUE;
+}
+
+recipe_parse_result_t recipe_parser_feed(recipe_parser_t *p, const char *data, size_t len)
+{
+    size_t i = 0;
+
+    if (p->format == RECIPE_FORMAT_BINARY) return feed_binary(p, (const uint8_t *)data, len);
+
+    while (i < len && p->state != ST_ERROR) {
+        char c = data[i];
+        bool ok = true;
+
+        switch (p->state) {
+        case ST_STRING:
+            if (p->esc_hex) {
+                p->esc_hex--;
+            } else if (c == '\\') {
+                p->state = ST_ESCAPE;
+            } else if (c == '"') {
+                if (p->str_is_key) key_done(p);
+                else end_value(p);
+            } else if (p->str_is_key) {
+                if (p->key_len < RECIPE_KEY_LEN) p->key[p->key_len] = c;
+                if (p->key_len <= RECIPE_KEY_LEN) p->key_len++;
+            }
+            break;
+
+        case ST_ESCAPE:
+            if (c == 'u') p->esc_hex = 4;
+            if (p->str_is_key && p->key_len <= RECIPE_KEY_LEN) {
+                p->key_len = RECIPE_KEY_LEN + 1;   // escaped keys never match
+            }
+            p->state = ST_STRING;
+            break;
+
+        case ST_NUMBER:
+            if (number_char(p, c)) break;
+            if (!number_complete(p)) {
+                ok = false;
+                break;
+            }
+            number_done(p);
+            continue;                   // re-examine c in the new state
+
+        case ST_LITERAL:
+            if (c != *p->lit) ok = false;
+            else if (*++p->lit == '\0') end_value(p);
+            break;
+
+        default:
+            if (is_space(c)) break;
+
+            switch (p->state) {
+            case ST_FIRST_VALUE:
+                if (c == ']') { ok = close_container(p, c); break; }
+                /* fall through */
+            case ST_VALUE:
+                ok = begin_value(p, c);
+                break;
+
+            case ST_FIRST_KEY:
+                if (c == '}') { ok = close_container(p, c); break; }
+                /* fall through */
+            case ST_KEY:
+                if (c != '"') { ok = false; break; }
+                p->str_is_key = true;
+                p->esc_hex = 0;
+                p->key_len = 0;
+                p->state = ST_STRING;
+                break;
+
+            case ST_COLON:
+                if (c == ':') p->state = ST_VALUE;
+                else ok = false;
+                break;
+
+            case ST_AFTER:
+                if (c == ',') p->state = in_object(p) ? ST_KEY : ST_VALUE;
+                else ok = close_container(p, c);
+                break;
+
+            default:    // ST_DONE: only whitespace may follow the root
+                ok = false;
+                break;
+            }
+            break;
+        }
+
+        if (!ok) p->state = ST_ERROR;
+        i++;
+    }
+
+    p->bytes += i;
+
+    if (p->state == ST_ERROR) return RECIPE_PARSE_ERROR;
+    return (p->state == ST_DONE) ? RECIPE_PARSE_DONE : RECIPE_PARSE_MORE;
+}
+
+recipe_parse_result_t recipe_parser_finish(recipe_parser_t *p)
+{
+    // A bare top-level number has no terminator of its own
+    if (p->state == ST_NUMBER && p->depth == 0 && number_complete(p)) number_done(p);
+
+    return (p->state == ST_DONE) ? RECIPE_PARSE_DONE : RECIPE_PARSE_ERROR;
+}
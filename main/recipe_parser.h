@@ -0,0 +1,111 @@
+#ifndef RECIPE_PARSER_H
+#define RECIPE_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// =============================================================
+// Streaming /mix response parser
+// Consumes the JSON body in arbitrary fragments (as delivered by
+// HTTP_EVENT_ON_DATA, chunked or not) with no heap allocation and
+// no limit on body size. Recognised fields:
+//
+//   { "status": 1, "id": 7, "age_ms": 12, "lease_ms": 30000,
+//     "recipe": [ {"port": 1, "volume_ml": 250}, ... ] }
+//
+// Everything else is skipped. Numbers follow the JSON grammar,
+// exponent included, and come out as cJSON's valueint would:
+// truncated toward zero and saturated to the int range. A malformed
+// number fails the body, as it does cJSON_Parse().
+//
+// The same results can come from a fixed little-endian binary
+// layout, which the server sends when the request's Accept header
+// names RECIPE_BIN_CONTENT_TYPE:
+//
+//   u8 version, u8 status, u8 n_items, u8 lease_s,
+//   u32 id, u32 age_ms,
+//   n_items x { u8 port, u8 reserved, u16 volume_ml }
+//
+// Whole records are decoded in place from the fragment being fed;
+// only a record split across two fragments is staged.
+// =============================================================
+
+#define RECIPE_MAX_ITEMS   64
+#define RECIPE_MAX_DEPTH   16
+#define RECIPE_KEY_LEN     16
+
+#define RECIPE_BIN_CONTENT_TYPE  "application/x-pour-recipe"
+#define RECIPE_BIN_VERSION       1
+#define RECIPE_BIN_HEADER_LEN    12
+#define RECIPE_BIN_ITEM_LEN      4
+
+typedef enum {
+    RECIPE_FORMAT_JSON,
+    RECIPE_FORMAT_BINARY,
+} recipe_format_t;
+
+typedef enum {
+    RECIPE_PARSE_MORE,    // body incomplete, feed more
+    RECIPE_PARSE_DONE,    // root value complete
+    RECIPE_PARSE_ERROR,   // malformed JSON or nesting too deep
+} recipe_parse_result_t;
+
+typedef struct {
+    int port;
+    int volume_ml;
+} recipe_item_t;
+
+typedef struct {
+    /* ---- Results ---- */
+    bool          has_status;
+    int           status;
+    int           age_ms;
+    int           id;              // server order id, 0 if absent
+    int           lease_ms;        // claim lease to renew, 0 if none
+    bool          has_recipe;
+    recipe_item_t items[RECIPE_MAX_ITEMS];
+    int           n_items;
+    int           invalid_items;   // non-objects or missing port/volume_ml
+    int           dropped_items;   // valid, but past RECIPE_MAX_ITEMS
+    size_t        bytes;           // total bytes consumed
+    recipe_format_t format;
+
+    /* ---- Internal state ---- */
+    uint8_t  state;
+    uint8_t  depth;
+    uint32_t containers;           // bit per depth: 1 = object, 0 = array
+    uint8_t  recipe_depth;         // depth of the recipe array, 0 if not inside
+    uint8_t  target;               // where the current value goes
+    bool     str_is_key;
+    uint8_t  esc_hex;              // \uXXXX digits left
+    char     key[RECIPE_KEY_LEN];
+    uint8_t  key_len;              // > RECIPE_KEY_LEN means truncated
+    uint8_t  num_phase;            // where the number is in the grammar
+    bool     num_neg;
+    bool     num_exp_neg;
+    int16_t  num_scale;            // power of ten num_mant is short by
+    uint16_t num_exp;
+    uint64_t num_mant;             // leading significant digits
+    const char *lit;               // rest of true/false/null still to come
+    bool     item_has_port;
+    bool     item_has_volume;
+    recipe_item_t item;
+    uint8_t  rec[RECIPE_BIN_HEADER_LEN];   // binary record split across fragments
+    uint8_t  rec_len;
+    uint8_t  bin_items_left;
+} recipe_parser_t;
+
+// Reset the parser for a new response body
+void recipe_parser_init(recipe_parser_t *p);
+
+// Select the wire format; call after init, before the first feed
+void recipe_parser_set_format(recipe_parser_t *p, recipe_format_t format);
+
+// Feed the next fragment of the body
+recipe_parse_result_t recipe_parser_feed(recipe_parser_t *p, const char *data, size_t len);
+
+// Call once the body has ended; a trailing bare number is completed here
+recipe_parse_result_t recipe_parser_finish(recipe_parser_t *p);
+
+#endif // RECIPE_PARSER_H
@@ -1,94 +1,141 @@
 #include "servo_control.h"
 #include "pca9685.h"
+#include "actuator.h"
+#include "trace.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include <math.h>
 #include <stdio.h>
 
-#define SERVO_PERIOD_MS   20.0f      // 50 Hz
-#define PCA9685_STEPS     4096.0f
-
-// Continuous rotation servo tuning
-#define SERVO_NEUTRAL_MS  1.5f       // stop
-#define SERVO_FORWARD_MS  1.8f       // CW
-#define SERVO_REVERSE_MS  1.2f       // CCW
-
 // Standard positional servo range
-#define SERVO_MIN_MS      1.0f
-#define SERVO_MAX_MS      2.0f
+#define SERVO_MIN_US      1000
+#define SERVO_MAX_US      2000
+
+// OFF count each channel was last sent to by these helpers, 0 if unknown
+static uint16_t servo_pos[PCA9685_MAX_CHANNELS];
 
 /* ---------------- Internal Helper ---------------- */
-// Convert pulse width (ms) → PCA9685 counts
-static uint16_t pulse_to_counts(float pulse_ms) {
-    if (pulse_ms < 0.5f) pulse_ms = 0.5f;
-    if (pulse_ms > 2.5f) pulse_ms = 2.5f;
-    return (uint16_t)((pulse_ms / SERVO_PERIOD_MS) * PCA9685_STEPS + 0.5f);
+// Convert pulse width (us) → PCA9685 counts, clamped to 0.5–2.5 ms
+static uint16_t pulse_to_counts(uint32_t pulse_us) {
+    if (pulse_us < 500) pulse_us = 500;
+    if (pulse_us > 2500) pulse_us = 2500;
+    return PCA9685_US_TO_COUNTS(pulse_us);
+}
+
+// Write a count from the actuator task, which owns every PCA9685 write
+static void servo_write(uint8_t channel, uint16_t off) {
+    if (channel < PCA9685_MAX_CHANNELS) servo_pos[channel] = off == PCA9685_FULL_OFF ? 0 : off;
+    actuator_cmd_t cmd = {
+        .channel = channel,
+        .off     = off,
+        .end     = ACT_END_HOLD,
+    };
+    actuator_submit(&cmd);
 }
 
 // Set raw pulse width for a servo channel
-static void servo_set_pulse(uint8_t channel, float pulse_ms) {
-    uint16_t off = pulse_to_counts(pulse_ms);
-    pca9685_set_pwm(channel, 0, off);
+static void servo_set_pulse(uint8_t channel, uint32_t pulse_us) {
+    servo_write(channel, pulse_to_counts(pulse_us));
+}
+
+// Drive a precomputed count for ms through the actuator task and wait for it
+static void servo_timed(uint8_t channel, uint16_t off, uint32_t ms, actuator_end_t end) {
+    actuator_cmd_t cmd = {
+        .channel = channel,
+        .off     = off,
+        .hold_ms = ms,
+        .end     = end,
+    };
+    TRACE_BEGIN("servo_move", channel);
+    actuator_run(&cmd);
+    TRACE_END("servo_move");
+}
+
+// Follow a trajectory through the actuator task and wait for its end
+static void servo_follow(uint8_t channel, const trajectory_t *traj, actuator_end_t end) {
+    actuator_cmd_t cmd = {
+        .channel = channel,
+        .end     = end,
+        .motion  = *traj,
+    };
+    TRACE_BEGIN("servo_move", channel);
+    actuator_run(&cmd);
+    TRACE_END("servo_move");
+    if (channel < PCA9685_MAX_CHANNELS) {
+        servo_pos[channel] = end == ACT_END_HOLD ? trajectory_at(traj, traj->frames) : 0;
+    }
 }
 
 /* ---------------- Continuous Rotation ---------------- */
 void servo_stop(uint8_t channel) {
-    //servo_set_pulse(channel, SERVO_NEUTRAL_MS);
-    pca9685_stop_channel(channel);
+    //servo_set_pulse(channel, SERVO_NEUTRAL_US);
+    servo_write(channel, PCA9685_FULL_OFF);
 }
 
 void servo_rotate_cw(uint8_t channel, float seconds) {
-    servo_set_pulse(channel, SERVO_FORWARD_MS);
-    vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
-    servo_stop(channel);
+    servo_timed(channel, SERVO_FORWARD_COUNTS, seconds * 1000, ACT_END_FULL_OFF);
 }
 
 void servo_rotate_ccw(uint8_t channel, float seconds) {
-    servo_set_pulse(channel, SERVO_REVERSE_MS);
-    vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
-    servo_stop(channel);
+    servo_timed(channel, SERVO_REVERSE_COUNTS, seconds * 1000, ACT_END_FULL_OFF);
+}
+
+// Each ramp covers half its time at speed, so two ramps lose one TRAJ_RAMP_MS
+void servo_rotate_smooth(uint8_t channel, bool cw, float seconds) {
+    trajectory_t traj;
+    trajectory_plan(&traj, TRAJ_VELOCITY, SERVO_ROTATE_PROFILE, SERVO_NEUTRAL_COUNTS,
+                    cw ? SERVO_FORWARD_COUNTS : SERVO_REVERSE_COUNTS, seconds * 1000 + TRAJ_RAMP_MS);
+    servo_follow(channel, &traj, ACT_END_FULL_OFF);
 }
 
 /* ---------------- Positional Servo ---------------- */
-// Convert angle (0–180°) → pulse width (ms)
-static float angle_to_pulse(float angle_deg) {
-    if (angle_deg < 0.0f) angle_deg = 0.0f;
-    if (angle_deg > 180.0f) angle_deg = 180.0f;
-    return SERVO_MIN_MS + (angle_deg / 180.0f) * (SERVO_MAX_MS - SERVO_MIN_MS);
+// Convert angle (0–180°) → pulse width (us), in tenths of a degree
+static uint32_t angle_to_pulse(float angle_deg) {
+    int32_t deci = (int32_t)(angle_deg * 10.0f);
+    if (deci < 0) deci = 0;
+    if (deci > 1800) deci = 1800;
+    return SERVO_MIN_US + deci * (SERVO_MAX_US - SERVO_MIN_US) / 1800;
 }
 
 // Move a standard servo to a specific angle
 void servo_set_angle(uint8_t channel, float angle_deg) {
-    float pulse = angle_to_pulse(angle_deg);
-    servo_set_pulse(channel, pulse);
+    servo_set_pulse(channel, angle_to_pulse(angle_deg));
 }
 
-// Sweep a servo between two angles
+// Move from the last known position to an angle along a profile
+void servo_move_to(uint8_t channel, float angle_deg, uint32_t ms, traj_profile_t profile) {
+    uint16_t to = pulse_to_counts(angle_to_pulse(angle_deg));
+    uint16_t from = (channel < PCA9685_MAX_CHANNELS && servo_pos[channel]) ? servo_pos[channel] : to;
+
+    trajectory_t traj;
+    trajectory_plan(&traj, TRAJ_POSITION, profile, from, to, ms);
+    servo_follow(channel, &traj, ACT_END_HOLD);
+}
+
+// Sweep a servo between two angles: the speed the steps asked for, as one move
 void servo_sweep(uint8_t channel, float start_angle, float end_angle, float step_deg, int delay_ms) {
-    if (start_angle < end_angle) {
-        for (float a = start_angle; a <= end_angle; a += step_deg) {
-            servo_set_angle(channel, a);
-            vTaskDelay(pdMS_TO_TICKS(delay_ms));
-        }
-    } else {
-        for (float a = start_angle; a >= end_angle; a -= step_deg) {
-            servo_set_angle(channel, a);
-            vTaskDelay(pdMS_TO_TICKS(delay_ms));
-        }
-    }
+    float steps = step_deg > 0 ? fabsf(end_angle - start_angle) / step_deg : 0;
+
+    trajectory_t traj;
+    trajectory_plan(&traj, TRAJ_POSITION, SERVO_SWEEP_PROFILE,
+                    pulse_to_counts(angle_to_pulse(start_angle)),
+                    pulse_to_counts(angle_to_pulse(end_angle)),
+                    delay_ms > 0 ? (uint32_t)(steps * delay_ms) : 0);
+    servo_follow(channel, &traj, ACT_END_HOLD);
 }
 
 /* ---------------- Calibration Utility ---------------- */
 void servo_calibrate(uint8_t channel) {
-    float pulse = SERVO_NEUTRAL_MS;
+    uint32_t pulse = SERVO_NEUTRAL_US;
     while (1) {
         servo_set_pulse(channel, pulse);
         int c = getchar(); // serial input
-        if (c == '+') pulse += 0.01f;
-        else if (c == '-') pulse -= 0.01f;
+        if (c == '+') pulse += 10;
+        else if (c == '-') pulse -= 10;
         else if (c == 's') break;
 
-        if (pulse < 1.0f) pulse = 1.0f;
-        if (pulse > 2.0f) pulse = 2.0f;
+        if (pulse < 1000) pulse = 1000;
+        if (pulse > 2000) pulse = 2000;
         vTaskDelay(pdMS_TO_TICKS(300));
     }
     servo_set_pulse(channel, pulse);
@@ -1,7 +1,27 @@
 #ifndef SERVO_CONTROL_H
 #define SERVO_CONTROL_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include "pca9685.h"
+#include "trajectory.h"
+
+/* ---------------- Pulse Table ---------------- */
+// Continuous rotation servo tuning, and the OFF counts they give at 50 Hz
+#define SERVO_NEUTRAL_US      1500   // stop
+#define SERVO_FORWARD_US      1800   // CW
+#define SERVO_REVERSE_US      1200   // CCW
+#define SERVO_FORWARD_COUNTS  PCA9685_US_TO_COUNTS(SERVO_FORWARD_US)
+#define SERVO_REVERSE_COUNTS  PCA9685_US_TO_COUNTS(SERVO_REVERSE_US)
+#define SERVO_NEUTRAL_COUNTS  PCA9685_US_TO_COUNTS(SERVO_NEUTRAL_US)
+
+// Profiles of servo_sweep() and servo_rotate_smooth()
+#ifndef SERVO_SWEEP_PROFILE
+#define SERVO_SWEEP_PROFILE   TRAJ_TRAPEZOID
+#endif
+#ifndef SERVO_ROTATE_PROFILE
+#define SERVO_ROTATE_PROFILE  TRAJ_SCURVE
+#endif
 
 /* ---------------- Continuous Rotation ---------------- */
 // Stop the servo (neutral position)
@@ -13,12 +33,21 @@ void servo_rotate_cw(uint8_t channel, float seconds);
 // Rotate continuously counter-clockwise for given seconds
 void servo_rotate_ccw(uint8_t channel, float seconds);
 
+// Rotate with the speed ramped in and out over TRAJ_RAMP_MS each; covers
+// the distance of servo_rotate_cw/ccw(seconds) and takes TRAJ_RAMP_MS longer
+void servo_rotate_smooth(uint8_t channel, bool cw, float seconds);
+
 /* ---------------- Positional Servo ---------------- */
 // Move a standard servo to a specific angle (0–180°)
 void servo_set_angle(uint8_t channel, float angle_deg);
 
-// Sweep a servo from start_angle → end_angle with step increments
-// delay_ms specifies the delay between steps in milliseconds
+// Move a standard servo from where the last call left it to angle_deg in ms
+// along a profile, one write per PWM frame; blocks until it arrives.
+// Jumps if its position is unknown.
+void servo_move_to(uint8_t channel, float angle_deg, uint32_t ms, traj_profile_t profile);
+
+// Sweep a servo from start_angle → end_angle at step_deg per delay_ms,
+// as one SERVO_SWEEP_PROFILE move sampled once per PWM frame
 void servo_sweep(uint8_t channel, float start_angle, float end_angle, float step_deg, int delay_ms);
 
 /* ---------------- Calibration Utility ---------------- */
@@ -0,0 +1,161 @@
+#include "trace.h"
+
+#if TRACE_ENABLED
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define TRACE_MASK          (TRACE_RING_LEN - 1)
+#define TRACE_TASK_NAME_LEN 10
+#define TRACE_MAX_THREADS   16
+
+#define TRACE_STACK         3072
+#define TRACE_PRIORITY      1
+
+_Static_assert((TRACE_RING_LEN & TRACE_MASK) == 0, "TRACE_RING_LEN must be a power of two");
+
+typedef struct {
+    atomic_uint  seq;       // index + 1 once the slot is complete, 0 while being written
+    int64_t      ts_us;
+    const char  *name;
+    int32_t      arg;       // 'X' events: duration in µs
+    char         phase;     // 'B', 'E', 'i' or 'X'
+    uint8_t      core;
+    char         task[TRACE_TASK_NAME_LEN];
+} trace_event_t;
+
+static trace_event_t ring[TRACE_RING_LEN];
+static atomic_uint   head;              // next index to claim
+static uint32_t      dumped;            // first index not yet dumped
+
+static bool autodump = TRACE_AUTODUMP_DEFAULT;
+static TaskHandle_t dump_task;
+
+/* ---------------- Recording ---------------- */
+static void record(char phase, const char *name, int64_t ts_us, int32_t arg)
+{
+    // Claim a slot; concurrent writers never share one
+    uint32_t idx = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    trace_event_t *ev = &ring[idx & TRACE_MASK];
+
+    atomic_store_explicit(&ev->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    ev->ts_us = ts_us;
+    ev->name  = name;
+    ev->arg   = arg;
+    ev->phase = phase;
+    ev->core  = (uint8_t)xPortGetCoreID();
+    // Unterminated when the name fills the field
+    const char *task = pcTaskGetName(NULL);
+    size_t len = strnlen(task, TRACE_TASK_NAME_LEN);
+    memcpy(ev->task, task, len);
+    memset(ev->task + len, 0, TRACE_TASK_NAME_LEN - len);
+
+    atomic_store_explicit(&ev->seq, idx + 1, memory_order_release);
+}
+
+void trace_record(char phase, const char *name, int32_t arg)
+{
+    record(phase, name, esp_timer_get_time(), arg);
+}
+
+void trace_record_complete(const char *name, int64_t start_us, int64_t dur_us)
+{
+    record('X', name, start_us, (int32_t)dur_us);
+}
+
+/* ---------------- Export ---------------- */
+static int thread_id(char names[][TRACE_TASK_NAME_LEN + 1], int *n, const char *task)
+{
+    for (int i = 0; i < *n; i++) {
+        if (strcmp(names[i], task) == 0) return i + 1;
+    }
+    if (*n == TRACE_MAX_THREADS) return TRACE_MAX_THREADS;
+    size_t len = strnlen(task, TRACE_TASK_NAME_LEN);
+    memcpy(names[*n], task, len);
+    names[*n][len] = '\0';
+    return ++*n;
+}
+
+void trace_dump(FILE *out)
+{
+    static char names[TRACE_MAX_THREADS][TRACE_TASK_NAME_LEN + 1];
+    int n_names = 0;
+
+    uint32_t end = atomic_load(&head);
+    uint32_t start = dumped;
+    if (end - start > TRACE_RING_LEN) start = end - TRACE_RING_LEN;   // older ones were overwritten
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+    for (uint32_t idx = start; idx != end; idx++) {
+        const trace_event_t *src = &ring[idx & TRACE_MASK];
+        if (atomic_load_explicit(&src->seq, memory_order_acquire) != idx + 1) continue;
+
+        trace_event_t ev;
+        memcpy(&ev, src, sizeof(ev));
+        // Overwritten by a writer that lapped us while copying
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&src->seq, memory_order_relaxed) != idx + 1) continue;
+        char task[TRACE_TASK_NAME_LEN + 1];
+        memcpy(task, ev.task, TRACE_TASK_NAME_LEN);
+        task[TRACE_TASK_NAME_LEN] = '\0';
+
+        fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":1,\"tid\":%d",
+                first ? "" : ",\n", ev.name, ev.phase, (long long)ev.ts_us,
+                thread_id(names, &n_names, task));
+        if (ev.phase == 'X') fprintf(out, ",\"dur\":%ld", (long)ev.arg);
+        else if (ev.phase == 'i') fprintf(out, ",\"s\":\"t\",\"args\":{\"v\":%ld}", (long)ev.arg);
+        else if (ev.phase == 'B') fprintf(out, ",\"args\":{\"v\":%ld,\"core\":%u}", (long)ev.arg, ev.core);
+        fputc('}', out);
+        first = false;
+    }
+
+    for (int i = 0; i < n_names; i++) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", i + 1, names[i]);
+        first = false;
+    }
+    fprintf(out, "\n]}\n");
+    fflush(out);
+
+    dumped = end;
+}
+
+static void trace_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Framed so the JSON can be cut out of a monitor log
+        printf("=== TRACE BEGIN ===\n");
+        trace_dump(stdout);
+        printf("=== TRACE END ===\n");
+    }
+}
+
+void trace_request_dump(void)
+{
+    if (!autodump) return;
+
+    static StaticTask_t task_buf;
+    static StackType_t  task_stack[TRACE_STACK];
+    if (!dump_task) {
+        dump_task = xTaskCreateStatic(trace_task, "trace", TRACE_STACK, NULL, TRACE_PRIORITY,
+                                      task_stack, &task_buf);
+        if (!dump_task) return;
+    }
+    xTaskNotifyGive(dump_task);
+}
+
+void trace_set_autodump(bool enable)
+{
+    autodump = enable;
+}
+
+#endif // TRACE_ENABLED
@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// =============================================================
+// Latency tracing
+// Trace points record begin/end/instant events into a lock-free
+// ring buffer that is dumped over serial as Chrome trace JSON
+// (load it in chrome://tracing or ui.perfetto.dev).
+//
+// Build with TRACE_ENABLED=1 to turn it on. When 0 (default)
+// every TRACE_* macro expands to nothing and its arguments are
+// not evaluated, so trace points cost nothing.
+//
+// Event names must be string literals: only the pointer is stored.
+// =============================================================
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED       0
+#endif
+
+// Events kept; must be a power of two
+#ifndef TRACE_RING_LEN
+#define TRACE_RING_LEN      512
+#endif
+
+// Dump new events after every drink from a low-priority task
+#ifndef TRACE_AUTODUMP_DEFAULT
+#define TRACE_AUTODUMP_DEFAULT  1
+#endif
+
+#if TRACE_ENABLED
+
+void trace_record(char phase, const char *name, int32_t arg);
+void trace_record_complete(const char *name, int64_t start_us, int64_t dur_us);
+
+/**
+ * @brief Write events recorded since the previous dump as one Chrome trace JSON document.
+ *
+ * Recording carries on meanwhile; events overwritten before they are
+ * printed are skipped.
+ */
+void trace_dump(FILE *out);
+
+/**
+ * @brief Ask the trace task to dump to stdout if autodump is on.
+ *
+ * Each dump is framed by "=== TRACE BEGIN ===" / "=== TRACE END ===" lines.
+ */
+void trace_request_dump(void);
+
+void trace_set_autodump(bool enable);
+
+#define TRACE_BEGIN(name, arg)      trace_record('B', (name), (arg))
+#define TRACE_END(name)             trace_record('E', (name), 0)
+#define TRACE_INSTANT(name, arg)    trace_record('i', (name), (arg))
+// A span whose start is already in the past (e.g. time spent queued on the server)
+#define TRACE_COMPLETE(name, start_us, dur_us)  trace_record_complete((name), (start_us), (dur_us))
+#define TRACE_DUMP()                trace_request_dump()
+
+#else
+
+#define TRACE_BEGIN(name, arg)      ((void)0)
+#define TRACE_END(name)             ((void)0)
+#define TRACE_INSTANT(name, arg)    ((void)0)
+#define TRACE_COMPLETE(name, start_us, dur_us)  ((void)0)
+#define TRACE_DUMP()                ((void)0)
+
+#endif // TRACE_ENABLED
+
+#endif // TRACE_H
@@ -0,0 +1,118 @@
+#include "trajectory.h"
+
+#define Q15_ONE     32768
+#define TABLE_SEGS  (TRAJ_TABLE_LEN - 1)
+
+/* ---------------- Profile Tables ---------------- */
+// Position against time, both 0..1 in Q15, sampled at i / 64.
+// Trapezoid: a quarter accelerating, half cruising, a quarter braking.
+// S-curve: minimum jerk, 10u^3 - 15u^4 + 6u^5.
+static const uint16_t position_table[TRAJ_PROFILES][TRAJ_TABLE_LEN] = {
+    [TRAJ_TRAPEZOID] = {
+            0,    21,    85,   192,   341,   533,   768,  1045,
+         1365,  1728,  2133,  2581,  3072,  3605,  4181,  4800,
+         5461,  6144,  6827,  7509,  8192,  8875,  9557, 10240,
+        10923, 11605, 12288, 12971, 13653, 14336, 15019, 15701,
+        16384, 17067, 17749, 18432, 19115, 19797, 20480, 21163,
+        21845, 22528, 23211, 23893, 24576, 25259, 25941, 26624,
+        27307, 27968, 28587, 29163, 29696, 30187, 30635, 31040,
+        31403, 31723, 32000, 32235, 32427, 32576, 32683, 32747,
+        32768,
+    },
+    [TRAJ_SCURVE] = {
+            0,     1,    10,    31,    73,   139,   233,   361,
+          526,   730,   975,  1264,  1598,  1977,  2403,  2875,
+         3392,  3954,  4561,  5209,  5898,  6626,  7391,  8189,
+         9018,  9875, 10758, 11662, 12584, 13521, 14469, 15425,
+        16384, 17343, 18299, 19247, 20184, 21106, 22010, 22893,
+        23750, 24579, 25377, 26142, 26870, 27559, 28207, 28814,
+        29376, 29893, 30365, 30791, 31170, 31504, 31793, 32038,
+        32242, 32407, 32535, 32629, 32695, 32737, 32758, 32767,
+        32768,
+    },
+};
+
+// Speed against time across one ramp, both 0..1 in Q15.
+// Trapezoid: linear. S-curve: smoothstep, 3x^2 - 2x^3.
+// Either way a ramp covers half the distance of the same time at speed.
+static const uint16_t ramp_table[TRAJ_PROFILES][TRAJ_TABLE_LEN] = {
+    [TRAJ_TRAPEZOID] = {
+            0,   512,  1024,  1536,  2048,  2560,  3072,  3584,
+         4096,  4608,  5120,  5632,  6144,  6656,  7168,  7680,
+         8192,  8704,  9216,  9728, 10240, 10752, 11264, 11776,
+        12288, 12800, 13312, 13824, 14336, 14848, 15360, 15872,
+        16384, 16896, 17408, 17920, 18432, 18944, 19456, 19968,
+        20480, 20992, 21504, 22016, 22528, 23040, 23552, 24064,
+        24576, 25088, 25600, 26112, 26624, 27136, 27648, 28160,
+        28672, 29184, 29696, 30208, 30720, 31232, 31744, 32256,
+        32768,
+    },
+    [TRAJ_SCURVE] = {
+            0,    24,    94,   209,   368,   569,   810,  1090,
+         1408,  1762,  2150,  2571,  3024,  3507,  4018,  4556,
+         5120,  5708,  6318,  6949,  7600,  8269,  8954,  9654,
+        10368, 11094, 11830, 12575, 13328, 14087, 14850, 15616,
+        16384, 17152, 17918, 18681, 19440, 20193, 20938, 21674,
+        22400, 23114, 23814, 24499, 25168, 25819, 26450, 27060,
+        27648, 28212, 28750, 29261, 29744, 30197, 30618, 31006,
+        31360, 31678, 31958, 32199, 32400, 32559, 32674, 32744,
+        32768,
+    },
+};
+
+/* ---------------- Internal Helpers ---------------- */
+// Table at num / den (0..1), linearly interpolated between samples
+static int32_t lookup(const uint16_t *table, uint32_t num, uint32_t den)
+{
+    if (num >= den) return table[TABLE_SEGS];
+
+    uint32_t pos = (uint32_t)(((uint64_t)num * TABLE_SEGS << 16) / den);   // Q16 index
+    uint32_t i = pos >> 16;
+    int32_t frac = (int32_t)(pos & 0xFFFF);
+    int32_t a = table[i], b = table[i + 1];
+    return a + (int32_t)(((int64_t)(b - a) * frac) >> 16);
+}
+
+static uint16_t scale(const trajectory_t *t, int32_t q15)
+{
+    int32_t span = (int32_t)t->to - (int32_t)t->from;
+    return (uint16_t)(t->from + (span * q15 + (span >= 0 ? Q15_ONE / 2 : -Q15_ONE / 2)) / Q15_ONE);
+}
+
+/* ---------------- Public API ---------------- */
+void trajectory_plan(trajectory_t *t, traj_kind_t kind, traj_profile_t profile,
+                     uint16_t from, uint16_t to, uint32_t duration_ms)
+{
+    uint32_t frames = (duration_ms * 1000 + TRAJ_FRAME_US / 2) / TRAJ_FRAME_US;
+    if (frames < 1) frames = 1;
+    if (frames > UINT16_MAX) frames = UINT16_MAX;
+
+    uint32_t ramp = 0;
+    if (kind == TRAJ_VELOCITY) {
+        ramp = (TRAJ_RAMP_MS * 1000 + TRAJ_FRAME_US / 2) / TRAJ_FRAME_US;
+        if (ramp > frames / 2) ramp = frames / 2;
+    }
+
+    *t = (trajectory_t) {
+        .from    = from,
+        .to      = to,
+        .frames  = (uint16_t)frames,
+        .ramp    = (uint16_t)ramp,
+        .profile = profile < TRAJ_PROFILES ? profile : TRAJ_TRAPEZOID,
+        .kind    = kind,
+    };
+}
+
+uint16_t trajectory_at(const trajectory_t *t, uint32_t frame)
+{
+    if (frame >= t->frames) return t->kind == TRAJ_VELOCITY ? t->from : t->to;
+
+    if (t->kind == TRAJ_POSITION) {
+        return scale(t, lookup(position_table[t->profile], frame, t->frames));
+    }
+
+    const uint16_t *ramp = ramp_table[t->profile];
+    if (frame < t->ramp) return scale(t, lookup(ramp, frame, t->ramp));
+    if (t->frames - frame < t->ramp) return scale(t, lookup(ramp, t->frames - frame, t->ramp));
+    return t->to;
+}
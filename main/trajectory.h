@@ -0,0 +1,63 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdint.h>
+#include "pca9685.h"
+
+// =============================================================
+// Servo trajectories
+// A move is sampled once per 50 Hz PWM frame from precomputed
+// Q15 profile tables, so its speed depends only on its length
+// and duration, and a servo never gets more than one write per
+// frame. Positional moves go from one OFF count to another;
+// velocity moves drive a continuous servo from rest up to a
+// speed and back. Integer-only: the actuator task evaluates them.
+// =============================================================
+
+// One servo PWM frame; the actuator writes every moving channel once per frame
+#define TRAJ_FRAME_US      PCA9685_SERVO_PERIOD_US
+
+// Samples per profile table, a power of two (+1 for the end point)
+#define TRAJ_TABLE_BITS    6
+#define TRAJ_TABLE_LEN     ((1 << TRAJ_TABLE_BITS) + 1)
+
+// Velocity moves ramp in and out over this long each
+#ifndef TRAJ_RAMP_MS
+#define TRAJ_RAMP_MS       100
+#endif
+
+typedef enum {
+    TRAJ_TRAPEZOID,     // constant acceleration, cruise, constant deceleration
+    TRAJ_SCURVE,        // jerk-limited: acceleration ramps in and out as well
+    TRAJ_PROFILES,
+} traj_profile_t;
+
+typedef enum {
+    TRAJ_POSITION,      // from → to; positional servos
+    TRAJ_VELOCITY,      // from (rest) → to (speed) → from; continuous servos
+} traj_kind_t;
+
+typedef struct {
+    uint16_t from;      // OFF count at frame 0 (and at the end of a velocity move)
+    uint16_t to;        // OFF count at the last frame, or the cruise speed
+    uint16_t frames;    // frames to the end point; 0 for no move
+    uint16_t ramp;      // velocity moves: frames per ramp
+    uint8_t  profile;   // traj_profile_t
+    uint8_t  kind;      // traj_kind_t
+} trajectory_t;
+
+/**
+ * @brief Plan a move lasting duration_ms, rounded to whole frames (at
+ *        least one).
+ *
+ * A velocity move shorter than two ramps ramps halfway up and back.
+ */
+void trajectory_plan(trajectory_t *t, traj_kind_t kind, traj_profile_t profile,
+                     uint16_t from, uint16_t to, uint32_t duration_ms);
+
+/**
+ * @brief OFF count at a frame, 0 .. t->frames; later frames give the end point.
+ */
+uint16_t trajectory_at(const trajectory_t *t, uint32_t frame);
+
+#endif // TRAJECTORY_H
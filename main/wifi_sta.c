@@ -0,0 +1,269 @@
+#include "wifi_sta.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "trace.h"
+
+#define WIFI_SSID          "DukeVisitor"
+#define WIFI_PASS          ""
+
+#define CONNECTED_BIT      BIT0
+
+#define CACHE_NAMESPACE    "wifi"
+#define CACHE_KEY          "last"
+#define CACHE_VERSION      1
+
+static const char *TAG = "WIFI";
+
+// Last good link, as stored in NVS. Zeroed before filling so memcmp() is exact.
+typedef struct {
+    uint8_t             version;
+    uint8_t             channel;
+    uint8_t             bssid[6];
+    char                ssid[32];
+    esp_netif_ip_info_t ip;
+} wifi_cache_t;
+
+static StaticEventGroup_t group_buf;
+static EventGroupHandle_t group;
+
+static esp_netif_t        *netif;
+static esp_timer_handle_t  retry_timer;
+
+static wifi_cache_t  cache;          // what NVS holds
+static wifi_cache_t  cur;            // AP and lease of the current/last link
+static bool          hint_valid;     // cur.bssid/channel usable as a connect hint
+static bool          connected;
+static uint32_t      attempts;       // failed attempts since the last association
+static uint32_t      retry_ms = WIFI_RETRY_MIN_MS;
+static bool          hinted;         // the pending attempt used the hint
+
+static volatile bool cached_ip;      // static IP from the cache is in use
+static bool          cached_ip_ok;   // ... and has carried a successful request
+static uint32_t      cached_ip_fails;
+
+static wifi_sta_stats_t stats;
+
+/* ---------------- Cache ---------------- */
+static bool cache_load(void)
+{
+    nvs_handle_t h;
+    if (nvs_open(CACHE_NAMESPACE, NVS_READONLY, &h) != ESP_OK) return false;
+
+    size_t len = sizeof(cache);
+    esp_err_t err = nvs_get_blob(h, CACHE_KEY, &cache, &len);
+    nvs_close(h);
+
+    if (err != ESP_OK || len != sizeof(cache) || cache.version != CACHE_VERSION ||
+        strncmp(cache.ssid, WIFI_SSID, sizeof(cache.ssid)) != 0) {
+        memset(&cache, 0, sizeof(cache));
+        return false;
+    }
+    return true;
+}
+
+static void cache_store(void)
+{
+    if (memcmp(&cache, &cur, sizeof(cache)) == 0) return;   // spare the flash
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, CACHE_KEY, &cur, sizeof(cur));
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Caching link failed: %s", esp_err_to_name(err));
+        return;
+    }
+    cache = cur;
+    ESP_LOGI(TAG, "Cached AP ch %u, IP " IPSTR, cur.channel, IP2STR(&cur.ip.ip));
+}
+
+esp_err_t wifi_sta_forget(void)
+{
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &h);
+    if (err != ESP_OK) return err;
+
+    err = nvs_erase_key(h, CACHE_KEY);
+    if (err == ESP_OK) err = nvs_commit(h);
+    nvs_close(h);
+    memset(&cache, 0, sizeof(cache));
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+/* ---------------- Connect / Reconnect ---------------- */
+static void start_connect(void)
+{
+    wifi_config_t cfg = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASS,
+            .threshold.authmode = WIFI_AUTH_OPEN,
+        },
+    };
+
+    // Pinning BSSID + channel skips the all-channel scan
+    hinted = hint_valid && attempts < WIFI_HINT_ATTEMPTS;
+    if (hinted) {
+        cfg.sta.bssid_set = true;
+        memcpy(cfg.sta.bssid, cur.bssid, sizeof(cfg.sta.bssid));
+        cfg.sta.channel = cur.channel;
+    }
+
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    esp_wifi_connect();
+}
+
+static void retry_cb(void *arg)
+{
+    start_connect();
+}
+
+static void schedule_retry(void)
+{
+    ESP_LOGI(TAG, "Retry %lu in %lu ms%s", (unsigned long)attempts,
+             (unsigned long)retry_ms, hint_valid && attempts < WIFI_HINT_ATTEMPTS ? "" : " (full scan)");
+    esp_timer_start_once(retry_timer, (uint64_t)retry_ms * 1000);
+
+    retry_ms *= 2;
+    if (retry_ms > WIFI_RETRY_MAX_MS) retry_ms = WIFI_RETRY_MAX_MS;
+}
+
+static void use_dhcp(void)
+{
+    cached_ip = false;
+    esp_err_t err = esp_netif_dhcpc_start(netif);
+    if (err != ESP_OK) ESP_LOGW(TAG, "DHCP start failed: %s", esp_err_to_name(err));
+}
+
+void wifi_sta_note_request(bool ok)
+{
+    if (!cached_ip || cached_ip_ok) return;
+
+    if (ok) {
+        cached_ip_ok = true;
+    } else if (++cached_ip_fails >= WIFI_CACHED_IP_FAILS) {
+        ESP_LOGW(TAG, "Cached IP " IPSTR " not working, switching to DHCP",
+                 IP2STR(&cache.ip.ip));
+        use_dhcp();
+    }
+}
+
+bool wifi_sta_lease_unverified(void)
+{
+    return cached_ip && !cached_ip_ok;
+}
+
+/* ---------------- Events ---------------- */
+static void event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START) {
+        start_connect();
+
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_CONNECTED) {
+        const wifi_event_sta_connected_t *ev = data;
+        if (stats.connected_us == 0 && stats.reconnects == 0) stats.cached_ap = hinted;
+
+        memcpy(cur.bssid, ev->bssid, sizeof(cur.bssid));
+        cur.channel = ev->channel;
+        hint_valid = true;
+        attempts = 0;
+
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        const wifi_event_sta_disconnected_t *ev = data;
+        xEventGroupClearBits(group, CONNECTED_BIT);
+        if (connected) {
+            connected = false;
+            stats.reconnects++;
+            retry_ms = WIFI_RETRY_MIN_MS;
+            ESP_LOGW(TAG, "Link lost (reason %u)", ev ? ev->reason : 0);
+            TRACE_INSTANT("wifi_lost", ev ? ev->reason : 0);
+        }
+        attempts++;
+        schedule_retry();
+
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t *ev = data;
+        int64_t now = esp_timer_get_time();
+
+        connected = true;
+        retry_ms = WIFI_RETRY_MIN_MS;
+        cur.ip = ev->ip_info;
+        if (stats.connected_us == 0) {
+            stats.connected_us = now;
+            stats.cached_ip = cached_ip;
+            TRACE_COMPLETE("wifi_connect", stats.start_us, now - stats.start_us);
+            ESP_LOGI(TAG, "Got IP " IPSTR " in %lld ms (%s AP, %s)", IP2STR(&ev->ip_info.ip),
+                     (long long)(now - stats.start_us) / 1000,
+                     stats.cached_ap ? "cached" : "scanned", cached_ip ? "cached lease" : "DHCP");
+        } else {
+            ESP_LOGI(TAG, "Got IP " IPSTR, IP2STR(&ev->ip_info.ip));
+        }
+        cache_store();
+        xEventGroupSetBits(group, CONNECTED_BIT);
+    }
+}
+
+/* ---------------- Public API ---------------- */
+esp_err_t wifi_sta_start(void)
+{
+    stats.start_us = esp_timer_get_time();
+    group = xEventGroupCreateStatic(&group_buf);
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    // The config is rewritten on every hinted retry; keep it out of flash
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
+
+    const esp_timer_create_args_t targs = { .callback = retry_cb, .name = "wifi_retry" };
+    ESP_ERROR_CHECK(esp_timer_create(&targs, &retry_timer));
+
+    memset(&cur, 0, sizeof(cur));
+    cur.version = CACHE_VERSION;
+    strncpy(cur.ssid, WIFI_SSID, sizeof(cur.ssid));
+
+    if (cache_load()) {
+        memcpy(cur.bssid, cache.bssid, sizeof(cur.bssid));
+        cur.channel = cache.channel;
+        hint_valid = true;
+
+        // Reuse the lease: no DHCP round trips before the first request
+        if (cache.ip.ip.addr != 0 && esp_netif_dhcpc_stop(netif) == ESP_OK &&
+            esp_netif_set_ip_info(netif, &cache.ip) == ESP_OK) {
+            cached_ip = true;
+        }
+        ESP_LOGI(TAG, "Cached AP ch %u%s", cache.channel, cached_ip ? " and lease" : "");
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    return ESP_OK;
+}
+
+esp_err_t wifi_sta_wait(uint32_t timeout_ms)
+{
+    EventBits_t bits = xEventGroupWaitBits(group, CONNECTED_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    return (bits & CONNECTED_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void wifi_sta_get_stats(wifi_sta_stats_t *out)
+{
+    *out = stats;
+}
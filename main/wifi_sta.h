@@ -0,0 +1,84 @@
+#ifndef WIFI_STA_H
+#define WIFI_STA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// =============================================================
+// Wi-Fi station
+// The last good BSSID, channel and IP lease are cached in NVS
+// (namespace "wifi"), so a reboot after a power blip associates
+// without a full scan and comes up without a DHCP exchange. Lost
+// links are retried with a bounded backoff, hinted with the last
+// AP's BSSID and channel.
+// =============================================================
+
+// sdkconfig pins the Wi-Fi and lwIP tasks here; tasks that talk to the
+// network join them, leaving the other core to the actuator
+#define NETWORK_CORE           0
+
+// Reconnect backoff after a disconnect: first retry, then doubling up to the cap
+#ifndef WIFI_RETRY_MIN_MS
+#define WIFI_RETRY_MIN_MS      100
+#endif
+#ifndef WIFI_RETRY_MAX_MS
+#define WIFI_RETRY_MAX_MS      5000
+#endif
+
+// Hinted attempts before falling back to a full scan (the AP may have moved)
+#define WIFI_HINT_ATTEMPTS     3
+
+// Failed requests on a cached IP, before any success, that force DHCP
+#define WIFI_CACHED_IP_FAILS   1
+
+typedef struct {
+    int64_t  start_us;       // wifi_sta_start() called
+    int64_t  connected_us;   // first IP (0 while waiting)
+    bool     cached_ap;      // first association used the cached BSSID/channel
+    bool     cached_ip;      // first IP came from the cached lease
+    uint32_t reconnects;     // links lost since boot
+} wifi_sta_stats_t;
+
+/**
+ * @brief Start the station and return without waiting for a link.
+ *
+ * Requires nvs_flash_init(). Association and DHCP proceed in the
+ * Wi-Fi/event tasks, so the caller can bring up hardware meanwhile.
+ */
+esp_err_t wifi_sta_start(void);
+
+/**
+ * @brief Wait until the station has an IP address.
+ *
+ * @return ESP_OK once connected, ESP_ERR_TIMEOUT otherwise (the station
+ *         keeps retrying in the background).
+ */
+esp_err_t wifi_sta_wait(uint32_t timeout_ms);
+
+/**
+ * @brief Report the outcome of a request to the network.
+ *
+ * A cached lease the router has since given away fails silently, so
+ * WIFI_CACHED_IP_FAILS failures before the first success drop it and
+ * restart DHCP.
+ */
+void wifi_sta_note_request(bool ok);
+
+/**
+ * @brief True while the IP in use is a cached lease no request has
+ *        confirmed yet; callers should use a short timeout meanwhile.
+ */
+bool wifi_sta_lease_unverified(void);
+
+/**
+ * @brief Boot and reconnect statistics.
+ */
+void wifi_sta_get_stats(wifi_sta_stats_t *out);
+
+/**
+ * @brief Forget the cached AP and lease (next boot scans and uses DHCP).
+ */
+esp_err_t wifi_sta_forget(void);
+
+#endif /* WIFI_STA_H */
@@ -0,0 +1,82 @@
+// Host simulation shim: i2c_master bus/device API backed by the PCA9685 emulator
+#ifndef SIM_DRIVER_I2C_MASTER_H
+#define SIM_DRIVER_I2C_MASTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int i2c_port_num_t;
+typedef int gpio_num_t;
+typedef int i2c_clock_source_t;
+
+#define I2C_NUM_0            0
+#define I2C_NUM_1            1
+#define I2C_CLK_SRC_DEFAULT  0
+
+typedef enum {
+    I2C_ADDR_BIT_LEN_7 = 0,
+    I2C_ADDR_BIT_LEN_10 = 1,
+} i2c_addr_bit_len_t;
+
+typedef struct i2c_master_bus_t *i2c_master_bus_handle_t;
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
+
+typedef struct {
+    i2c_port_num_t     i2c_port;
+    gpio_num_t         sda_io_num;
+    gpio_num_t         scl_io_num;
+    i2c_clock_source_t clk_source;
+    uint8_t            glitch_ignore_cnt;
+    int                intr_priority;
+    size_t             trans_queue_depth;   // 0: synchronous transmit
+    struct {
+        uint32_t enable_internal_pullup : 1;
+    } flags;
+} i2c_master_bus_config_t;
+
+typedef struct {
+    i2c_addr_bit_len_t dev_addr_length;
+    uint16_t           device_address;
+    uint32_t           scl_speed_hz;
+    uint32_t           scl_wait_us;
+    struct {
+        uint32_t disable_ack_check : 1;
+    } flags;
+} i2c_device_config_t;
+
+typedef enum {
+    I2C_EVENT_ALIVE,
+    I2C_EVENT_DONE,
+    I2C_EVENT_NACK,
+    I2C_EVENT_TIMEOUT,
+} i2c_master_event_t;
+
+typedef struct {
+    i2c_master_event_t event;
+} i2c_master_event_data_t;
+
+typedef bool (*i2c_master_callback_t)(i2c_master_dev_handle_t dev,
+                                      const i2c_master_event_data_t *evt, void *arg);
+
+typedef struct {
+    i2c_master_callback_t on_trans_done;
+} i2c_master_event_callbacks_t;
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *conf, i2c_master_bus_handle_t *out);
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus);
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus, const i2c_device_config_t *conf,
+                                    i2c_master_dev_handle_t *out);
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t dev);
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t dev,
+                                              const i2c_master_event_callbacks_t *cbs,
+                                              void *arg);
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *data, size_t len,
+                              int timeout_ms);
+esp_err_t i2c_master_probe(i2c_master_bus_handle_t bus, uint16_t address, int timeout_ms);
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus, int timeout_ms);
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus);
+
+#endif // SIM_DRIVER_I2C_MASTER_H
@@ -0,0 +1,30 @@
+// Host simulation shim: the capability heap and its allocation hooks
+#ifndef SIM_ESP_HEAP_CAPS_H
+#define SIM_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+// The simulated device heap: shims allocate what ESP-IDF would allocate
+// from here, so the hooks see the same calls as on the device
+void  *heap_caps_malloc(size_t size, uint32_t caps);
+void  *heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void  *heap_caps_realloc(void *ptr, size_t size, uint32_t caps);
+void   heap_caps_free(void *ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+// Firmware sources are built with malloc() and friends renamed to these
+void *sim_malloc(size_t size);
+void *sim_calloc(size_t n, size_t size);
+void *sim_realloc(void *ptr, size_t size);
+void  sim_free(void *ptr);
+
+// CONFIG_HEAP_USE_HOOKS: defined by the application if it wants them
+__attribute__((weak)) void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps);
+__attribute__((weak)) void esp_heap_trace_free_hook(void *ptr);
+
+#endif // SIM_ESP_HEAP_CAPS_H
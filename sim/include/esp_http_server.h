@@ -0,0 +1,58 @@
+// Host simulation shim: esp_http_server; handlers are invoked with sim_httpd_get()
+#ifndef SIM_ESP_HTTP_SERVER_H
+#define SIM_ESP_HTTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef void *httpd_handle_t;
+typedef struct httpd_req httpd_req_t;
+
+typedef enum {
+    HTTP_GET,
+    HTTP_POST,
+} httpd_method_t;
+
+typedef struct {
+    unsigned   task_priority;
+    size_t     stack_size;
+    BaseType_t core_id;
+    uint16_t   server_port;
+    uint16_t   max_uri_handlers;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() {    \
+    .task_priority    = 5,          \
+    .stack_size       = 4096,       \
+    .core_id          = tskNO_AFFINITY, \
+    .server_port      = 80,         \
+    .max_uri_handlers = 8,          \
+}
+
+typedef struct {
+    const char     *uri;
+    httpd_method_t  method;
+    esp_err_t     (*handler)(httpd_req_t *req);
+    void           *user_ctx;
+} httpd_uri_t;
+
+struct httpd_req {
+    const char *uri;
+    void       *user_ctx;
+    char       *resp;
+    size_t      resp_len;
+    size_t      resp_cap;
+};
+
+#define HTTPD_RESP_USE_STRLEN  -1
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len);
+
+#endif // SIM_ESP_HTTP_SERVER_H
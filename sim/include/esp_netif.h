@@ -0,0 +1,39 @@
+// Host simulation shim: network interface
+#ifndef SIM_ESP_NETIF_H
+#define SIM_ESP_NETIF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+typedef struct sim_netif esp_netif_t;
+
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    esp_netif_t         *esp_netif;
+    esp_netif_ip_info_t  ip_info;
+    bool                 ip_changed;
+} ip_event_got_ip_t;
+
+extern const esp_event_base_t IP_EVENT;
+enum { IP_EVENT_STA_GOT_IP, IP_EVENT_STA_LOST_IP };
+
+#define IP2STR(a) (int)((a)->addr & 0xff), (int)(((a)->addr >> 8) & 0xff), \
+                  (int)(((a)->addr >> 16) & 0xff), (int)(((a)->addr >> 24) & 0xff)
+#define IPSTR "%d.%d.%d.%d"
+
+esp_err_t    esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+esp_err_t    esp_netif_dhcpc_start(esp_netif_t *netif);
+esp_err_t    esp_netif_dhcpc_stop(esp_netif_t *netif);
+esp_err_t    esp_netif_set_ip_info(esp_netif_t *netif, const esp_netif_ip_info_t *ip_info);
+
+#endif // SIM_ESP_NETIF_H
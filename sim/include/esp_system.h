@@ -0,0 +1,10 @@
+// Host simulation shim: heap figures come from the simulated heap (sim_heap.c)
+#ifndef SIM_ESP_SYSTEM_H
+#define SIM_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif // SIM_ESP_SYSTEM_H
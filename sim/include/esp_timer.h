@@ -0,0 +1,42 @@
+// Host simulation shim: esp_timer on the virtual clock
+#ifndef SIM_ESP_TIMER_H
+#define SIM_ESP_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum {
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t       callback;
+    void                *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char          *name;
+    bool                 skip_unhandled_events;
+} esp_timer_create_args_t;
+
+// Microseconds of virtual time since boot
+int64_t esp_timer_get_time(void);
+
+// Callbacks run one at a time in an "esp_timer" task pinned to core 0 at
+// priority 22, as on the device; ESP_TIMER_ISR callbacks run from an
+// ISR-level task that network load never holds back
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+bool      esp_timer_is_active(esp_timer_handle_t timer);
+
+// From an ESP_TIMER_ISR callback: a task woken there should run on ISR exit.
+// The sim switches tasks at every wake-up anyway
+void esp_timer_isr_dispatch_need_yield(void);
+
+#endif // SIM_ESP_TIMER_H
@@ -0,0 +1,62 @@
+// Host simulation shim: FreeRTOS types and config (see sim/README.md)
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+typedef uint8_t      StackType_t;
+
+#define configTICK_RATE_HZ    100
+#define configMAX_PRIORITIES  25
+#define portTICK_PERIOD_MS    (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY         ((TickType_t)0xffffffffUL)
+
+#define pdMS_TO_TICKS(ms)     ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+#define pdTICKS_TO_MS(t)      ((TickType_t)(((uint64_t)(t) * 1000U) / configTICK_RATE_HZ))
+
+#define pdFALSE  0
+#define pdTRUE   1
+#define pdFAIL   0
+#define pdPASS   1
+
+#define tskNO_AFFINITY  0x7FFFFFFF
+
+// esp_bit_defs.h
+#define BIT(nr)  (1UL << (nr))
+#define BIT0     0x00000001
+#define BIT1     0x00000002
+#define BIT2     0x00000004
+#define BIT3     0x00000008
+#define BIT4     0x00000010
+#define BIT5     0x00000020
+#define BIT6     0x00000040
+#define BIT7     0x00000080
+
+#define IRAM_ATTR
+
+// All simulated tasks run under one lock, so critical sections are no-ops
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED        { 0 }
+#define portENTER_CRITICAL(mux)             ((void)(mux))
+#define portEXIT_CRITICAL(mux)              ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)         ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)          ((void)(mux))
+#define portYIELD_FROM_ISR(woken)           ((void)(woken))
+#define xPortGetCoreID()                    sim_core_id()
+#define xPortInIsrContext()                 pdFALSE
+
+int sim_core_id(void);      // the calling task's core; 0 without affinity
+
+// Opaque storage for statically allocated kernel objects
+typedef union { uint8_t storage[128]; uint64_t align; } StaticQueue_t;
+typedef StaticQueue_t StaticSemaphore_t;
+typedef union { uint8_t storage[16];  uint64_t align; } StaticEventGroup_t;
+typedef union { uint8_t storage[256]; uint64_t align; } StaticTask_t;
+
+#endif // SIM_FREERTOS_H
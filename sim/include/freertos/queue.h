@@ -0,0 +1,22 @@
+// Host simulation shim: FreeRTOS queues
+#ifndef SIM_QUEUE_H
+#define SIM_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size,
+                                 uint8_t *storage, StaticQueue_t *buf);
+BaseType_t    xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks);
+BaseType_t    xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *woken);
+BaseType_t    xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks);
+BaseType_t    xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t q);
+UBaseType_t   uxQueueSpacesAvailable(QueueHandle_t q);
+void          vQueueDelete(QueueHandle_t q);
+
+#define xQueueSendToBack(q, item, ticks)  xQueueSend((q), (item), (ticks))
+
+#endif // SIM_QUEUE_H
@@ -0,0 +1,22 @@
+// Host simulation shim: FreeRTOS semaphores (queues with no payload)
+#ifndef SIM_SEMPHR_H
+#define SIM_SEMPHR_H
+
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max, UBaseType_t initial,
+                                                 StaticSemaphore_t *buf);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buf);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t        xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+
+#define vSemaphoreDelete(sem)  vQueueDelete(sem)
+
+#endif // SIM_SEMPHR_H
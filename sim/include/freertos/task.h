@@ -0,0 +1,38 @@
+// Host simulation shim: FreeRTOS tasks on the virtual clock
+#ifndef SIM_TASK_H
+#define SIM_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct sim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *out);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *out,
+                                   BaseType_t core);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                               void *arg, UBaseType_t priority, StackType_t *stack,
+                               StaticTask_t *buf);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name,
+                                           uint32_t stack_depth, void *arg,
+                                           UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *buf, BaseType_t core);
+void         vTaskDelete(TaskHandle_t task);
+void         vTaskDelay(TickType_t ticks);
+void         sim_task_yield(void);
+BaseType_t   xTaskDelayUntil(TickType_t *prev_wake, TickType_t increment);
+TickType_t   xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t  uxTaskGetStackHighWaterMark(TaskHandle_t task);
+char        *pcTaskGetName(TaskHandle_t task);
+
+BaseType_t   xTaskNotifyGive(TaskHandle_t task);
+uint32_t     ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+void         vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+
+#define vTaskDelayUntil(prev, inc)  ((void)xTaskDelayUntil((prev), (inc)))
+#define taskYIELD()                 sim_task_yield()
+
+#endif // SIM_TASK_H
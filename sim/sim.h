@@ -0,0 +1,263 @@
+#ifndef SIM_H
+#define SIM_H
+
+// =============================================================
+// Host simulation core
+// Every FreeRTOS task is a pthread, but only one runs at a time
+// (all of them hold sim_lock while running). When every task is
+// blocked, the virtual clock jumps to the earliest deadline, so
+// a day of orders replays in seconds.
+// =============================================================
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_TICK_US     (1000000 / configTICK_RATE_HZ)
+#define SIM_FOREVER     INT64_MAX
+
+/* ---------------- Virtual Clock ---------------- */
+int64_t sim_now_us(void);
+
+// Block the calling task until the virtual clock reaches t_us
+void sim_sleep_until(int64_t t_us);
+
+// Block until ready(arg) holds or the clock reaches deadline_us.
+// ready() is re-checked whenever another task calls sim_notify().
+bool sim_wait(bool (*ready)(void *), void *arg, int64_t deadline_us);
+
+// Wake waiters so they re-check their condition
+void sim_notify(void);
+
+// Deadline for a FreeRTOS timeout expressed in ticks
+int64_t sim_ticks_deadline(uint32_t ticks);
+
+/* ---------------- CPU Load ---------------- */
+// Cores only matter for when a woken task gets to run. Network load is
+// modelled as bursts of Wi-Fi/lwIP work on core 0 (where sdkconfig pins
+// them) at the Wi-Fi task's priority: a task pinned to core 0 below that
+// priority that becomes ready during a burst runs when the burst ends.
+// Tasks without affinity run on core 1 meanwhile; ISRs are never held.
+#define SIM_NET_PRIORITY      23
+#define SIM_NET_BURST_MIN_US  100
+#define SIM_NET_BURST_MAX_US  1500
+
+typedef struct {
+    int      net_load_pct;
+    uint32_t delayed;        // wake-ups that waited for a burst to end
+    int64_t  max_delay_us;
+} sim_cpu_stats_t;
+
+// Share of core 0 the network stack takes, 0 .. 90 %
+void sim_cpu_set_net_load(int pct);
+void sim_cpu_get_stats(sim_cpu_stats_t *out);
+
+/* ---------------- Run Control ---------------- */
+// Stop the run once the clock passes t_us
+void sim_set_end(int64_t t_us);
+
+// Called once at the end of the run, with the clock stopped; returns the exit status
+typedef int (*sim_finish_fn)(void);
+void sim_on_finish(sim_finish_fn fn);
+
+// Start app_main() as the first task and hand the process over to the scheduler
+void sim_run(void (*entry)(void));
+
+/* ---------------- Logging ---------------- */
+extern bool sim_quiet;
+
+/* ---------------- PCA9685 Emulator ---------------- */
+// Boards answering at 0x40 .. 0x40 + SIM_PCA9685_DEVICES - 1
+#define SIM_PCA9685_DEVICES 4
+
+typedef struct {
+    int64_t  t_us;
+    uint8_t  channel;
+    uint16_t on;
+    uint16_t off;        // 0x1000 = full off, on 0x1000 = full on
+    float    duty;       // 0..1
+} sim_pwm_event_t;
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t nacks;
+    int64_t  busy_us;
+    uint32_t glitches;       // injected: writes lost on the wire
+    uint32_t hangs;          // ... of which left SDA held low
+    uint32_t hung_txns;      // transactions that timed out on the held bus
+    uint32_t resets;         // i2c_master_bus_reset() calls
+} sim_i2c_stats_t;
+
+// Lose about one transaction in sim_i2c_glitch_every (0: never); one
+// glitch in four leaves SDA held low until i2c_master_bus_reset()
+extern int sim_i2c_glitch_every;
+
+const sim_pwm_event_t *sim_pca9685_timeline(int *count);
+void sim_i2c_get_stats(sim_i2c_stats_t *out);
+float sim_pca9685_freq(int index);      // output frequency from the board's PRESCALE
+int sim_pca9685_most_high(int index);   // most outputs high at the same step of a period
+uint32_t sim_i2c_clock_hz(void);
+
+/* ---------------- Liquid ---------------- */
+extern bool sim_flow_calibrate;     // fit the firmware's flow calibration at boot
+
+// Millilitres a solenoid open for open_ms pours on a port
+double sim_flow_ml(int port, double open_ms);
+
+/* ---------------- Simulated /mix Server ---------------- */
+// Station 0 is the device; 1 .. sim_peers are modelled (sim_stations.c)
+#define SIM_STATIONS_MAX  16
+
+typedef struct {
+    int64_t  avail_us;       // when the order appears on the server
+    int64_t  dispatch_us;    // when it was first handed out, -1 if never
+    long     eta_ms;         // ETA the device reported via /eta, -1 if none
+    char    *recipe_json;    // JSON array
+    int      station;        // holder, or who poured it; -1 for nobody
+    int64_t  lease_until_us; // the holder's claim runs out
+    int64_t  done_us;        // acknowledged as poured, -1 if not
+    int      claims;         // dispatches, re-dispatches included
+} sim_order_t;
+
+typedef struct {
+    uint32_t renewals;
+    uint32_t expired;        // leases that ran out: the order went out again
+    uint32_t handed_back;    // acknowledged as not poured
+    uint32_t late_acks;      // poured after the lease had gone elsewhere
+    uint32_t ack_requests;   // /ack and /acks requests from the device
+    uint32_t acks;           // ... and the completions they carried
+} sim_lease_stats_t;
+
+extern int  sim_rtt_ms;
+extern bool sim_http_json_only;     // ignore Accept: always answer JSON
+extern bool sim_http_mix_acks;      // take completions on /mix (else /acks only)
+extern int  sim_lease_ms;           // claim lease, 0: orders go out once, never expire
+
+void sim_http_add_order(int64_t avail_us, const char *recipe_json);
+const sim_order_t *sim_http_orders(int *count);
+int sim_http_connections(void);
+int sim_http_requests(void);
+int64_t sim_http_body_bytes(void);     // /mix response bodies
+void sim_http_get_lease_stats(sim_lease_stats_t *out);
+// Name the device sent as "station", and the highest load it reported
+const char *sim_http_device_station(uint32_t *max_load);
+
+// Wait until station may claim an order, until_us, or stop(arg) (may be
+// NULL; re-checked on sim_notify()); returns the order's index or -1
+int sim_http_claim(int station, uint32_t busy_ms, int64_t until_us, bool (*stop)(void *), void *arg);
+// HTTP status the server answers: 200, or 409 when station no longer holds it
+int sim_http_renew(int idx, int station);
+int sim_http_ack(int idx, int station, bool poured);
+// The device's /eta, /lease, /ack or /acks request (path names which); returns the status
+int sim_http_control(const char *path, const char *body);
+// Station name and load from a /mix body, for sim_http_device_station()
+void sim_http_note_station(const char *body);
+// JSON dispatching order idx now, as /mix answers it
+int sim_http_order_json(int idx, char *body, int cap);
+
+/* ---------------- Simulated MQTT Broker ---------------- */
+// esp-mqtt against an in-process broker that is also the dispatcher: an
+// offer on <prefix>/<station>/ready lets the device claim the next order
+// as a held long-poll would, and the order is pushed on .../orders. Acks,
+// renewals and ETAs published on their topics are handled like the HTTP
+// requests; a renewal the server would answer 409 is answered on
+// .../revoked instead. Messages take half an RTT each way, an idle
+// connection pings at half the keepalive, and a lost link is noticed at
+// once (the last will voids the offer). QoS 1 publishes sit in a heap
+// outbox until their PUBACK, as in esp-mqtt.
+typedef struct {
+    uint32_t connects;
+    uint32_t publishes;      // from the device
+    uint32_t pushed;         // orders delivered to the device
+    int64_t  pushed_bytes;
+    uint32_t pings;
+} sim_mqtt_stats_t;
+
+void sim_mqtt_get_stats(sim_mqtt_stats_t *out);
+
+/* ---------------- Modelled Peer Stations ---------------- */
+extern int sim_peers;               // stations sharing the queue besides the device
+extern int sim_peer_fail_pct;       // chance a peer drops an order mid-drink
+
+// Start the peer tasks; call from a task before app_main()
+void sim_stations_start(void);
+
+typedef struct {
+    uint32_t poured;
+    uint32_t dropped;        // claimed, then abandoned without renewing
+} sim_peer_stats_t;
+
+void sim_stations_get_stats(int peer, sim_peer_stats_t *out);
+
+/* ---------------- Simulated HTTP Server ---------------- */
+// Call a handler registered with httpd_register_uri_handler(); -1 if none
+int sim_httpd_get(const char *uri, char *buf, size_t size);
+
+/* ---------------- Simulated Wi-Fi ---------------- */
+extern int sim_wifi_scan_ms;
+extern int sim_wifi_assoc_ms;
+extern int sim_wifi_dhcp_ms;
+
+// AP outage: the link drops at drop_at (-1 for never) and the AP is
+// unreachable for outage_ms. The DHCP server always leases lease_ip.
+extern int64_t  sim_wifi_drop_at_us;
+extern int      sim_wifi_outage_ms;
+extern uint32_t sim_wifi_lease_ip;
+
+typedef struct {
+    int64_t  first_ip_us;    // -1 if never connected
+    bool     dhcp_skipped;   // first IP was a static (cached) address
+    uint32_t attempts;       // esp_wifi_connect() attempts
+    uint32_t scans;          // ... that needed an all-channel scan
+    uint32_t link_losses;
+    int64_t  recovered_us;   // IP again after the outage, -1 if not
+} sim_wifi_stats_t;
+
+// Whether requests get through; *timeout when they would hang (stale IP)
+bool sim_wifi_link_ok(bool *timeout);
+void sim_wifi_get_stats(sim_wifi_stats_t *out);
+
+// Radio-on time: an exchange keeps the radio up from its first packet
+// until SIM_RADIO_TAIL_MS after its last, when modem sleep resumes;
+// overlapping exchanges share one wake-up. Beacon (DTIM) wake-ups are
+// the same whatever the traffic and are left out.
+#define SIM_RADIO_TAIL_MS  50
+
+typedef struct {
+    int64_t  on_us;
+    uint32_t wakeups;
+} sim_radio_stats_t;
+
+// The radio carries traffic from now for span_us
+void sim_radio_busy(int64_t span_us);
+void sim_radio_get_stats(sim_radio_stats_t *out);
+
+/* ---------------- Simulated NVS ---------------- */
+// Backing file for NVS, so a second run sees what the first one stored
+extern const char *sim_nvs_path;
+
+/* ---------------- Simulated Flash ---------------- */
+// Backing file for the journal partition, likewise
+extern const char *sim_flash_path;
+// Partition size in KB: a multiple of 4, 8 to 64
+extern int sim_flash_kb;
+
+typedef struct {
+    uint32_t writes;
+    uint32_t pages;              // 256-byte pages programmed
+    uint64_t bytes;
+    uint32_t erases;
+    uint32_t max_sector_erases;  // wear on the busiest sector
+    uint32_t bad_bits;           // writes that needed a 0 turned back into 1
+    int64_t  busy_us;            // program and erase time
+} sim_flash_stats_t;
+
+void sim_flash_get_stats(sim_flash_stats_t *out);
+
+/* ---------------- Scenarios ---------------- */
+// Run a built-in check in place of app_main: its exit status, or -1 for
+// a name it does not know
+int sim_scenario_run(const char *name);
+
+#endif // SIM_H
@@ -0,0 +1,139 @@
+// esp_timer on the virtual clock: one task per dispatch method fires callbacks at their deadlines
+#include "sim.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    bool                    armed;
+    int64_t                 alarm_us;
+    uint64_t                period_us;    // 0 for one-shot
+    struct esp_timer       *next;
+};
+
+// Above every task: the ISR is only modelled as a task so it has a clock
+#define ISR_PRIORITY  (configMAX_PRIORITIES + 1)
+
+static struct esp_timer *timers;
+static bool              changed[2];
+static bool              task_started[2];
+
+static bool timers_changed(void *arg)
+{
+    return changed[(intptr_t)arg];
+}
+
+static struct esp_timer *earliest(esp_timer_dispatch_t method)
+{
+    struct esp_timer *best = NULL;
+    for (struct esp_timer *t = timers; t; t = t->next) {
+        if (t->args.dispatch_method != method) continue;
+        if (t->armed && (!best || t->alarm_us < best->alarm_us)) best = t;
+    }
+    return best;
+}
+
+static void timer_task(void *arg)
+{
+    esp_timer_dispatch_t method = (esp_timer_dispatch_t)(intptr_t)arg;
+
+    while (1) {
+        struct esp_timer *t = earliest(method);
+
+        if (t && t->alarm_us <= sim_now_us()) {
+            if (t->period_us) t->alarm_us += t->period_us;
+            else t->armed = false;
+            t->args.callback(t->args.arg);
+            continue;
+        }
+
+        changed[method] = false;
+        sim_wait(timers_changed, arg, t ? t->alarm_us : SIM_FOREVER);
+    }
+}
+
+static void rearm(const struct esp_timer *t)
+{
+    changed[t->args.dispatch_method] = true;
+    sim_notify();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out)
+{
+    if (!args || !args->callback || !out) return ESP_ERR_INVALID_ARG;
+    if (args->dispatch_method != ESP_TIMER_TASK && args->dispatch_method != ESP_TIMER_ISR) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct esp_timer *t = heap_caps_calloc(1, sizeof(*t), MALLOC_CAP_DEFAULT);
+    if (!t) return ESP_ERR_NO_MEM;
+    t->args = *args;
+    t->next = timers;
+    timers = t;
+
+    esp_timer_dispatch_t method = args->dispatch_method;
+    if (!task_started[method]) {
+        bool isr = method == ESP_TIMER_ISR;
+        if (xTaskCreatePinnedToCore(timer_task, isr ? "esp_timer_isr" : "esp_timer", 4096,
+                                    (void *)(intptr_t)method, isr ? ISR_PRIORITY : 22, NULL,
+                                    isr ? tskNO_AFFINITY : 0) != pdPASS) {
+            return ESP_ERR_NO_MEM;
+        }
+        task_started[method] = true;
+    }
+    *out = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeout_us)
+{
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+    t->armed = true;
+    t->alarm_us = sim_now_us() + (int64_t)timeout_us;
+    t->period_us = 0;
+    rearm(t);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t period_us)
+{
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+    t->armed = true;
+    t->alarm_us = sim_now_us() + (int64_t)period_us;
+    t->period_us = period_us;
+    rearm(t);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+    if (!t->armed) return ESP_ERR_INVALID_STATE;
+    t->armed = false;
+    rearm(t);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+    for (struct esp_timer **pp = &timers; *pp; pp = &(*pp)->next) {
+        if (*pp == t) {
+            *pp = t->next;
+            break;
+        }
+    }
+    heap_caps_free(t);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t)
+{
+    return t->armed;
+}
+
+void esp_timer_isr_dispatch_need_yield(void)
+{
+}
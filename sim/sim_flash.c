@@ -0,0 +1,128 @@
+// NOR flash behind the partition API, holding the "journal" data
+// partition from partitions.csv. A write can only clear bits (bits it
+// would have to set are counted and left as they are, like the chip),
+// an erase sets a 4 KB sector back to 0xFF, and both cost the calling
+// task the chip's typical page-program and sector-erase times. With
+// --flash FILE the partition is loaded at the first lookup and written
+// back after every change, so consecutive runs behave like reboots;
+// --journal-kb shrinks it so the ring wraps within a short run.
+#include "sim.h"
+#include "esp_partition.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SECTOR_SIZE       4096
+#define PAGE_SIZE         256
+#define PAGE_PROGRAM_US   700
+#define SECTOR_ERASE_US   45000
+#define JOURNAL_SIZE      (64 * 1024)       // as in partitions.csv
+#define JOURNAL_SECTORS   (JOURNAL_SIZE / SECTOR_SIZE)
+
+const char *sim_flash_path;
+int sim_flash_kb = JOURNAL_SIZE / 1024;
+
+static esp_partition_t journal = {
+    .type       = ESP_PARTITION_TYPE_DATA,
+    .subtype    = (esp_partition_subtype_t)0x40,
+    .address    = 0x1D0000,
+    .size       = JOURNAL_SIZE,
+    .erase_size = SECTOR_SIZE,
+    .label      = "journal",
+};
+
+static uint8_t  flash[JOURNAL_SIZE];
+static bool     loaded;
+static uint32_t sector_erases[JOURNAL_SECTORS];
+static sim_flash_stats_t stats;
+
+/* ---------------- Backing File ---------------- */
+static void load(void)
+{
+    loaded = true;
+    memset(flash, 0xFF, sizeof(flash));     // factory-fresh: erased
+    if (!sim_flash_path) return;
+
+    FILE *f = fopen(sim_flash_path, "rb");
+    if (!f) return;
+    if (fread(flash, 1, sizeof(flash), f) != sizeof(flash)) memset(flash, 0xFF, sizeof(flash));
+    fclose(f);
+}
+
+static void save(void)
+{
+    if (!sim_flash_path) return;
+
+    FILE *f = fopen(sim_flash_path, "wb");
+    if (!f) {
+        perror(sim_flash_path);
+        return;
+    }
+    fwrite(flash, 1, sizeof(flash), f);
+    fclose(f);
+}
+
+static void busy(int64_t us)
+{
+    stats.busy_us += us;
+    sim_sleep_until(sim_now_us() + us);
+}
+
+/* ---------------- Partition API ---------------- */
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    if (type != ESP_PARTITION_TYPE_ANY && type != journal.type) return NULL;
+    if (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != journal.subtype) return NULL;
+    if (label && strcmp(label, journal.label) != 0) return NULL;
+    if (!loaded) load();
+    journal.size = sim_flash_kb * 1024;
+    return &journal;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size)
+{
+    if (p != &journal || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+    memcpy(dst, flash + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size)
+{
+    if (p != &journal || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+
+    const uint8_t *s = src;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t want = s[i], have = flash[offset + i];
+        stats.bad_bits += __builtin_popcount(want & ~have);
+        flash[offset + i] = have & want;
+    }
+    uint32_t pages = (offset + size - 1) / PAGE_SIZE - offset / PAGE_SIZE + 1;
+    stats.writes++;
+    stats.pages += pages;
+    stats.bytes += size;
+    busy(pages * PAGE_PROGRAM_US);
+    save();
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+    if (p != &journal || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+    if (offset % SECTOR_SIZE || size % SECTOR_SIZE) return ESP_ERR_INVALID_ARG;
+
+    memset(flash + offset, 0xFF, size);
+    for (size_t s = offset / SECTOR_SIZE; s < (offset + size) / SECTOR_SIZE; s++) {
+        sector_erases[s]++;
+        stats.erases++;
+        if (sector_erases[s] > stats.max_sector_erases) stats.max_sector_erases = sector_erases[s];
+    }
+    busy(size / SECTOR_SIZE * SECTOR_ERASE_US);
+    save();
+    return ESP_OK;
+}
+
+void sim_flash_get_stats(sim_flash_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,618 @@
+// Virtual-clock scheduler and the FreeRTOS API on top of it
+#include "sim.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct sim_task {
+    pthread_t        thread;
+    pthread_cond_t   cv;
+    char             name[16];
+    TaskFunction_t   fn;
+    void            *arg;
+    bool             is_static;
+    UBaseType_t      priority;
+    int              core;          // 0 or 1, -1 for no affinity
+    bool             blocked;
+    bool             held;          // ready, waiting for its core
+    bool             wake_on_event;
+    int64_t          deadline;
+    uint32_t         notify_count;
+    struct sim_task *next;
+};
+
+struct sim_queue {
+    uint8_t     *storage;
+    bool         owns_storage;
+    bool         is_static;
+    UBaseType_t  item_size;
+    UBaseType_t  length;
+    UBaseType_t  count;
+    UBaseType_t  head;
+};
+
+struct sim_event_group {
+    EventBits_t bits;
+};
+
+_Static_assert(sizeof(struct sim_task) <= sizeof(StaticTask_t), "StaticTask_t too small");
+_Static_assert(sizeof(struct sim_queue) <= sizeof(StaticQueue_t), "StaticQueue_t too small");
+_Static_assert(sizeof(struct sim_event_group) <= sizeof(StaticEventGroup_t),
+               "StaticEventGroup_t too small");
+
+static pthread_mutex_t   sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t           now_us;
+static int64_t           end_us = SIM_FOREVER;
+static struct sim_task  *tasks;
+static int               n_running;
+static sim_finish_fn     finish_fn;
+static __thread struct sim_task *self;
+
+/* ---------------- CPU Load ---------------- */
+// Bursts are drawn lazily as the clock passes them, so an idle
+// stretch costs nothing and runs stay reproducible
+static int             net_load_pct;
+static int64_t         burst_start, burst_end;     // current or next burst
+static uint32_t        burst_rng = 0x2545F491;
+static sim_cpu_stats_t cpu_stats;
+
+static uint32_t burst_rand(uint32_t n)
+{
+    burst_rng ^= burst_rng << 13;
+    burst_rng ^= burst_rng >> 17;
+    burst_rng ^= burst_rng << 5;
+    return burst_rng % n;
+}
+
+static void next_burst(void)
+{
+    int64_t len = SIM_NET_BURST_MIN_US + burst_rand(SIM_NET_BURST_MAX_US - SIM_NET_BURST_MIN_US);
+    int64_t gap = len * (100 - net_load_pct) / net_load_pct;
+    gap = gap / 2 + burst_rand((uint32_t)gap + 1);      // 0.5x .. 1.5x, same mean
+    if (burst_end < now_us) burst_end = now_us;         // nothing was asked for a while
+    burst_start = burst_end + gap;
+    burst_end = burst_start + len;
+}
+
+// When t can run if it became ready now: the end of the burst holding its core
+static int64_t runnable_at(const struct sim_task *t)
+{
+    if (!net_load_pct || t->core != 0 || t->priority >= SIM_NET_PRIORITY) return now_us;
+    while (burst_end <= now_us) next_burst();
+    return burst_start <= now_us ? burst_end : now_us;
+}
+
+void sim_cpu_set_net_load(int pct)
+{
+    net_load_pct = pct < 0 ? 0 : pct > 90 ? 90 : pct;
+}
+
+void sim_cpu_get_stats(sim_cpu_stats_t *out)
+{
+    *out = cpu_stats;
+    out->net_load_pct = net_load_pct;
+}
+
+int sim_core_id(void)
+{
+    return self && self->core > 0 ? self->core : 0;
+}
+
+/* ---------------- Virtual Clock ---------------- */
+static void finish(const char *why)
+{
+    if (why) fprintf(stderr, "sim: %s\n", why);
+    int status = finish_fn ? finish_fn() : 0;
+    fflush(stdout);
+    exit(status);
+}
+
+static void wake(struct sim_task *t)
+{
+    // Ready, but its core is busy: it runs once the burst is over
+    int64_t at = runnable_at(t);
+    if (at > now_us) {
+        if (!t->held) cpu_stats.delayed++;
+        if (at - now_us > cpu_stats.max_delay_us) cpu_stats.max_delay_us = at - now_us;
+        t->held = true;
+        t->deadline = at;
+        t->wake_on_event = false;
+        return;
+    }
+    t->held = false;
+    t->blocked = false;
+    n_running++;
+    pthread_cond_signal(&t->cv);
+}
+
+// Called with no runnable task: jump to the earliest deadline
+static void advance(void)
+{
+    // A task woken onto a busy core stays blocked, so go round until one runs
+    while (n_running == 0) {
+        int64_t next = SIM_FOREVER;
+        for (struct sim_task *t = tasks; t; t = t->next) {
+            if (t->blocked && t->deadline < next) next = t->deadline;
+        }
+
+        if (next == SIM_FOREVER) finish("all tasks blocked forever");
+        if (next > end_us) {
+            now_us = end_us;
+            finish(NULL);
+        }
+        if (next > now_us) now_us = next;
+
+        for (struct sim_task *t = tasks; t; t = t->next) {
+            if (t->blocked && t->deadline <= now_us) wake(t);
+        }
+    }
+}
+
+static void block(int64_t deadline, bool on_event)
+{
+    self->blocked = true;
+    self->deadline = deadline;
+    self->wake_on_event = on_event;
+    if (--n_running == 0) advance();
+    while (self->blocked) pthread_cond_wait(&self->cv, &sim_lock);
+}
+
+int64_t sim_now_us(void)
+{
+    return now_us;
+}
+
+void sim_sleep_until(int64_t t_us)
+{
+    while (now_us < t_us) block(t_us, false);
+}
+
+bool sim_wait(bool (*ready)(void *), void *arg, int64_t deadline_us)
+{
+    while (!ready(arg)) {
+        if (now_us >= deadline_us) return false;
+        block(deadline_us, true);
+    }
+    return true;
+}
+
+void sim_notify(void)
+{
+    for (struct sim_task *t = tasks; t; t = t->next) {
+        if (t->blocked && t->wake_on_event) wake(t);
+    }
+}
+
+int64_t sim_ticks_deadline(uint32_t ticks)
+{
+    if (ticks == portMAX_DELAY) return SIM_FOREVER;
+    return (now_us / SIM_TICK_US + ticks) * SIM_TICK_US;
+}
+
+void sim_set_end(int64_t t_us)
+{
+    end_us = t_us;
+}
+
+void sim_on_finish(sim_finish_fn fn)
+{
+    finish_fn = fn;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+/* ---------------- Tasks ---------------- */
+static void unlink_task(struct sim_task *t)
+{
+    for (struct sim_task **pp = &tasks; *pp; pp = &(*pp)->next) {
+        if (*pp == t) { *pp = t->next; return; }
+    }
+}
+
+static void exit_self(void)
+{
+    struct sim_task *t = self;
+    unlink_task(t);
+    if (--n_running == 0 && tasks) advance();
+    if (!tasks) finish("all tasks exited");
+    pthread_mutex_unlock(&sim_lock);
+    pthread_cond_destroy(&t->cv);
+    if (!t->is_static) heap_caps_free(t);
+    pthread_exit(NULL);
+}
+
+static void *trampoline(void *p)
+{
+    pthread_mutex_lock(&sim_lock);
+    self = p;
+    self->fn(self->arg);
+    exit_self();
+    return NULL;
+}
+
+static TaskHandle_t spawn(struct sim_task *t, bool is_static, TaskFunction_t fn,
+                          const char *name, void *arg, UBaseType_t priority, BaseType_t core)
+{
+    memset(t, 0, sizeof(*t));
+    t->is_static = is_static;
+    t->priority = priority;
+    t->core = (core == 0 || core == 1) ? core : -1;
+    t->fn = fn;
+    t->arg = arg;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    pthread_cond_init(&t->cv, NULL);
+
+    t->next = tasks;
+    tasks = t;
+    n_running++;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t->thread, &attr, trampoline, t) != 0) {
+        unlink_task(t);
+        n_running--;
+        pthread_attr_destroy(&attr);
+        return NULL;
+    }
+    pthread_attr_destroy(&attr);
+    return t;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *out,
+                                   BaseType_t core)
+{
+    struct sim_task *t = heap_caps_malloc(sizeof(*t), MALLOC_CAP_DEFAULT);
+    if (!t) return pdFAIL;
+    TaskHandle_t h = spawn(t, false, fn, name, arg, priority, core);
+    if (!h) {
+        heap_caps_free(t);
+        return pdFAIL;
+    }
+    if (out) *out = h;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *out)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, out, tskNO_AFFINITY);
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name,
+                                           uint32_t stack_depth, void *arg,
+                                           UBaseType_t priority, StackType_t *stack,
+                                           StaticTask_t *buf, BaseType_t core)
+{
+    return spawn((struct sim_task *)buf, true, fn, name, arg, priority, core);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                               void *arg, UBaseType_t priority, StackType_t *stack,
+                               StaticTask_t *buf)
+{
+    return xTaskCreateStaticPinnedToCore(fn, name, stack_depth, arg, priority, stack, buf,
+                                         tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task && task != self) {
+        fprintf(stderr, "sim: deleting another task is not supported\n");
+        abort();
+    }
+    exit_self();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) return;
+    sim_sleep_until(sim_ticks_deadline(ticks));
+}
+
+// A no-op: handing sim_lock to whichever thread the host schedules would
+// make runs irreproducible. Woken tasks run at the caller's next block.
+void sim_task_yield(void)
+{
+}
+
+BaseType_t xTaskDelayUntil(TickType_t *prev_wake, TickType_t increment)
+{
+    TickType_t target = *prev_wake + increment;
+    *prev_wake = target;
+
+    int64_t t = (int64_t)target * SIM_TICK_US;
+    if (t <= now_us) return pdFALSE;
+    sim_sleep_until(t);
+    return pdTRUE;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now_us / SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return self;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+    return (task ? task : self)->name;
+}
+
+static bool notified(void *arg)
+{
+    return self->notify_count > 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notify_count++;
+    sim_notify();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    if (woken) *woken = pdFALSE;
+    xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    if (!sim_wait(notified, NULL, sim_ticks_deadline(ticks))) return 0;
+
+    uint32_t count = self->notify_count;
+    self->notify_count = clear_on_exit ? 0 : count - 1;
+    return count;
+}
+
+static void (*app_entry)(void);
+
+static void main_task_fn(void *arg)
+{
+    app_entry();
+}
+
+void sim_run(void (*entry)(void))
+{
+    static StaticTask_t main_task;
+
+    app_entry = entry;
+    pthread_mutex_lock(&sim_lock);
+    // CONFIG_ESP_MAIN_TASK_AFFINITY_CPU0, priority 1
+    spawn((struct sim_task *)&main_task, true, main_task_fn, "main", NULL, 1, 0);
+    pthread_mutex_unlock(&sim_lock);
+    pthread_exit(NULL);
+}
+
+/* ---------------- Queues ---------------- */
+static void queue_setup(struct sim_queue *q, UBaseType_t length, UBaseType_t item_size,
+                        uint8_t *storage, bool is_static)
+{
+    memset(q, 0, sizeof(*q));
+    q->length = length;
+    q->item_size = item_size;
+    q->storage = storage;
+    q->is_static = is_static;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *q = heap_caps_malloc(sizeof(*q), MALLOC_CAP_DEFAULT);
+    uint8_t *storage = item_size ? heap_caps_malloc((size_t)length * item_size, MALLOC_CAP_DEFAULT) : NULL;
+    if (!q || (item_size && !storage)) {
+        heap_caps_free(q);
+        heap_caps_free(storage);
+        return NULL;
+    }
+    queue_setup(q, length, item_size, storage, false);
+    q->owns_storage = true;
+    return q;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size,
+                                 uint8_t *storage, StaticQueue_t *buf)
+{
+    struct sim_queue *q = (struct sim_queue *)buf;
+    queue_setup(q, length, item_size, storage, true);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q->owns_storage) heap_caps_free(q->storage);
+    if (!q->is_static) heap_caps_free(q);
+}
+
+static bool queue_has_space(void *arg)
+{
+    struct sim_queue *q = arg;
+    return q->count < q->length;
+}
+
+static bool queue_has_item(void *arg)
+{
+    struct sim_queue *q = arg;
+    return q->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    if (!sim_wait(queue_has_space, q, sim_ticks_deadline(ticks))) return pdFALSE;
+
+    if (q->item_size) {
+        UBaseType_t tail = (q->head + q->count) % q->length;
+        memcpy(q->storage + (size_t)tail * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    sim_notify();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *woken)
+{
+    if (woken) *woken = pdFALSE;
+    return xQueueSend(q, item, 0);
+}
+
+static BaseType_t queue_take(QueueHandle_t q, void *item, TickType_t ticks, bool remove)
+{
+    if (!sim_wait(queue_has_item, q, sim_ticks_deadline(ticks))) return pdFALSE;
+
+    if (q->item_size && item) {
+        memcpy(item, q->storage + (size_t)q->head * q->item_size, q->item_size);
+    }
+    if (remove) {
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        sim_notify();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    return queue_take(q, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    return queue_take(q, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    return q->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    return q->length - q->count;
+}
+
+/* ---------------- Semaphores ---------------- */
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    QueueHandle_t q = xQueueCreate(max, 0);
+    if (q) q->count = initial;
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max, UBaseType_t initial,
+                                                 StaticSemaphore_t *buf)
+{
+    QueueHandle_t q = xQueueCreateStatic(max, 0, NULL, buf);
+    q->count = initial;
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buf)
+{
+    return xSemaphoreCreateCountingStatic(1, 0, buf);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf)
+{
+    return xSemaphoreCreateCountingStatic(1, 1, buf);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return xQueueReceive(sem, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return xQueueSend(sem, NULL, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    if (woken) *woken = pdFALSE;
+    return xSemaphoreGive(sem);
+}
+
+/* ---------------- Event Groups ---------------- */
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return heap_caps_calloc(1, sizeof(struct sim_event_group), MALLOC_CAP_DEFAULT);
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buf)
+{
+    struct sim_event_group *g = (struct sim_event_group *)buf;
+    g->bits = 0;
+    return g;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    g->bits |= bits;
+    sim_notify();
+    return g->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    EventBits_t old = g->bits;
+    g->bits &= ~bits;
+    return old;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g)
+{
+    return g->bits;
+}
+
+typedef struct {
+    struct sim_event_group *g;
+    EventBits_t bits;
+    bool all;
+} bits_wait_t;
+
+static bool bits_ready(void *arg)
+{
+    bits_wait_t *w = arg;
+    EventBits_t set = w->g->bits & w->bits;
+    return w->all ? set == w->bits : set != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits,
+                                BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t ticks)
+{
+    bits_wait_t w = { .g = g, .bits = bits, .all = wait_for_all };
+    bool ok = sim_wait(bits_ready, &w, sim_ticks_deadline(ticks));
+    EventBits_t value = g->bits;
+    if (ok && clear_on_exit) g->bits &= ~bits;
+    return value;
+}
@@ -0,0 +1,105 @@
+// The device heap: a size header in front of each block, and the allocation hooks
+#include "sim.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Free heap the firmware sees with nothing allocated
+#define SIM_HEAP_SIZE  (200 * 1024)
+
+typedef union {
+    size_t   size;
+    max_align_t align;
+} block_t;
+
+static size_t live_bytes;
+static size_t peak_bytes;
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    if (live_bytes + size > SIM_HEAP_SIZE) return NULL;
+
+    block_t *b = malloc(sizeof(*b) + size);
+    if (!b) return NULL;
+    b->size = size;
+    live_bytes += size;
+    if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+
+    if (esp_heap_trace_alloc_hook) esp_heap_trace_alloc_hook(b + 1, size, caps);
+    return b + 1;
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    void *p = heap_caps_malloc(n * size, caps);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+void heap_caps_free(void *ptr)
+{
+    if (!ptr) return;
+    if (esp_heap_trace_free_hook) esp_heap_trace_free_hook(ptr);
+
+    block_t *b = (block_t *)ptr - 1;
+    live_bytes -= b->size;
+    free(b);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    if (!ptr) return heap_caps_malloc(size, caps);
+    if (size == 0) {
+        heap_caps_free(ptr);
+        return NULL;
+    }
+
+    // Always moves, so a caller relying on in-place growth shows up
+    void *p = heap_caps_malloc(size, caps);
+    if (!p) return NULL;
+    size_t old = ((block_t *)ptr - 1)->size;
+    memcpy(p, ptr, old < size ? old : size);
+    heap_caps_free(ptr);
+    return p;
+}
+
+void *sim_malloc(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+}
+
+void *sim_calloc(size_t n, size_t size)
+{
+    return heap_caps_calloc(n, size, MALLOC_CAP_DEFAULT);
+}
+
+void *sim_realloc(void *ptr, size_t size)
+{
+    return heap_caps_realloc(ptr, size, MALLOC_CAP_DEFAULT);
+}
+
+void sim_free(void *ptr)
+{
+    heap_caps_free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return SIM_HEAP_SIZE - live_bytes;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return SIM_HEAP_SIZE - peak_bytes;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
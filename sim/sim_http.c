@@ -0,0 +1,488 @@
+// esp_http_client backed by an in-process /mix server.
+// Orders become visible at their scheduled virtual time. A request costs
+// one RTT, plus one more when the connection has to be (re)opened;
+// ?wait=N holds the request until an order appears or N seconds pass.
+// The body is delivered through HTTP_EVENT_ON_DATA in buffer-sized pieces.
+// Without a Wi-Fi link requests fail at once; from a stale IP they time out.
+// POST /eta records the device's drink ETA against the order.
+// A request whose Accept header names the binary recipe layout gets it,
+// unless sim_http_json_only is set.
+//
+// Orders are claimed under a sim_lease_ms lease, shared with the
+// modelled peer stations (sim_stations.c): /lease extends it, /ack
+// finishes the order or hands it back (/acks takes a list of them, as
+// does the /mix body, answered with X-Acks), and an order whose lease
+// runs out is dispatched again. Among the stations waiting for an order,
+// the least busy one (by the eta_ms it sent) gets it.
+#include "sim.h"
+#include "esp_http_client.h"
+#include "esp_heap_caps.h"
+#include "recipe_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define DEFAULT_BUFFER_SIZE  512
+#define BODY_MAX             8192
+
+int  sim_rtt_ms = 30;
+bool sim_http_json_only;
+bool sim_http_mix_acks = true;
+int  sim_lease_ms = 30000;
+
+struct esp_http_client {
+    esp_http_client_config_t cfg;
+    char     url[256];
+    bool     connected;
+    int      status;
+    int64_t  content_length;
+    const char *post;
+    bool     accept_binary;
+};
+
+static sim_order_t *orders;
+static int          n_orders;
+static int          first_open;     // orders before this one are finished
+static int          connections;
+static int          requests;
+static int64_t      body_bytes;
+
+// Stations holding a request open, and how busy they said they were
+static struct {
+    bool     waiting;
+    uint32_t busy_ms;
+} stations[SIM_STATIONS_MAX];
+
+static sim_lease_stats_t lease_stats;
+static char              device_station[32];
+static uint32_t          device_max_load;
+
+/* ---------------- Orders ---------------- */
+void sim_http_add_order(int64_t avail_us, const char *recipe_json)
+{
+    orders = realloc(orders, (n_orders + 1) * sizeof(*orders));
+    if (!orders) abort();
+
+    // Keep the list sorted by arrival; the server hands orders out in sequence
+    int i = n_orders++;
+    for (; i > 0 && orders[i - 1].avail_us > avail_us; i--) orders[i] = orders[i - 1];
+    orders[i] = (sim_order_t) {
+        .avail_us = avail_us, .dispatch_us = -1, .eta_ms = -1, .recipe_json = strdup(recipe_json),
+        .station = -1, .done_us = -1,
+    };
+}
+
+const sim_order_t *sim_http_orders(int *count)
+{
+    *count = n_orders;
+    return orders;
+}
+
+int sim_http_connections(void)
+{
+    return connections;
+}
+
+int sim_http_requests(void)
+{
+    return requests;
+}
+
+int64_t sim_http_body_bytes(void)
+{
+    return body_bytes;
+}
+
+void sim_http_get_lease_stats(sim_lease_stats_t *out)
+{
+    *out = lease_stats;
+}
+
+const char *sim_http_device_station(uint32_t *max_load)
+{
+    *max_load = device_max_load;
+    return device_station;
+}
+
+/* ---------------- Claims and Leases ---------------- */
+static bool claimable(const sim_order_t *o, int64_t now)
+{
+    if (o->avail_us > now || o->done_us >= 0) return false;
+    return o->station < 0 || o->lease_until_us <= now;
+}
+
+static int find_claimable(int64_t now)
+{
+    while (first_open < n_orders && orders[first_open].done_us >= 0) first_open++;
+    for (int i = first_open; i < n_orders && orders[i].avail_us <= now; i++) {
+        if (claimable(&orders[i], now)) return i;
+    }
+    return -1;
+}
+
+// Next time after now an order appears or a lease runs out
+static int64_t next_event_us(int64_t now)
+{
+    int64_t t = SIM_FOREVER;
+    for (int i = first_open; i < n_orders; i++) {
+        const sim_order_t *o = &orders[i];
+        if (o->done_us >= 0) continue;
+        if (o->station < 0 && o->avail_us > now && o->avail_us < t) t = o->avail_us;
+        if (o->station >= 0 && o->lease_until_us > now && o->lease_until_us < t) t = o->lease_until_us;
+        if (o->avail_us > t) break;
+    }
+    return t;
+}
+
+// No other waiting station is less busy (ties go to the lower number)
+static bool least_busy(int station)
+{
+    for (int s = 0; s < SIM_STATIONS_MAX; s++) {
+        if (s == station || !stations[s].waiting) continue;
+        if (stations[s].busy_ms < stations[station].busy_ms ||
+            (stations[s].busy_ms == stations[station].busy_ms && s < station)) return false;
+    }
+    return true;
+}
+
+static bool can_claim(int station)
+{
+    return find_claimable(sim_now_us()) >= 0 && least_busy(station);
+}
+
+struct claim_wait {
+    int    station;
+    bool (*stop)(void *);
+    void  *arg;
+};
+
+static bool claim_ready(void *p)
+{
+    const struct claim_wait *w = p;
+    return can_claim(w->station) || (w->stop && w->stop(w->arg));
+}
+
+int sim_http_claim(int station, uint32_t busy_ms, int64_t until_us, bool (*stop)(void *), void *arg)
+{
+    struct claim_wait w = { .station = station, .stop = stop, .arg = arg };
+    stations[station].waiting = true;
+    stations[station].busy_ms = busy_ms;
+
+    int idx = -1;
+    while (1) {
+        int64_t now = sim_now_us();
+        if (can_claim(station)) {
+            idx = find_claimable(now);
+            break;
+        }
+        if (stop && stop(arg)) break;
+        int64_t deadline = next_event_us(now);
+        if (deadline > until_us) deadline = until_us;
+        if (deadline <= now) break;
+        sim_wait(claim_ready, &w, deadline);
+    }
+    stations[station].waiting = false;
+    sim_notify();       // someone else may be least busy now
+    if (idx < 0) return -1;
+
+    sim_order_t *o = &orders[idx];
+    int64_t now = sim_now_us();
+    if (o->station >= 0) lease_stats.expired++;
+    if (o->dispatch_us < 0) o->dispatch_us = now;
+    o->station = station;
+    o->claims++;
+    o->lease_until_us = sim_lease_ms > 0 ? now + sim_lease_ms * 1000LL : SIM_FOREVER;
+    return idx;
+}
+
+int sim_http_renew(int idx, int station)
+{
+    sim_order_t *o = &orders[idx];
+    int64_t now = sim_now_us();
+    if (o->station != station || o->done_us >= 0 || o->lease_until_us <= now) return 409;
+    o->lease_until_us = now + sim_lease_ms * 1000LL;
+    lease_stats.renewals++;
+    return 200;
+}
+
+int sim_http_ack(int idx, int station, bool poured)
+{
+    sim_order_t *o = &orders[idx];
+    if (o->station != station || o->done_us >= 0) {
+        if (poured) lease_stats.late_acks++;
+        return 409;
+    }
+    if (poured) {
+        o->done_us = sim_now_us();
+    } else {
+        o->station = -1;    // handed back
+        lease_stats.handed_back++;
+    }
+    sim_notify();
+    return 200;
+}
+
+static int json_int(const char *body, const char *key, int dflt)
+{
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *q = body ? strstr(body, pat) : NULL;
+    return q ? atoi(q + strlen(pat)) : dflt;
+}
+
+int sim_http_control(const char *path, const char *body)
+{
+    int id = json_int(body, "id", 0);
+    sim_order_t *o = (id >= 1 && id <= n_orders) ? &orders[id - 1] : NULL;
+
+    if (strstr(path, "/acks")) {
+        // Every completion is taken; ones no longer ours count as late
+        lease_stats.ack_requests++;
+        for (const char *a = body ? strstr(body, "\"acks\"") : NULL; a && (a = strchr(a, '{')); a++) {
+            int aid = json_int(a, "id", 0);
+            lease_stats.acks++;
+            if (aid >= 1 && aid <= n_orders) sim_http_ack(aid - 1, 0, json_int(a, "ok", 1) != 0);
+        }
+        return 200;
+    }
+    if (strstr(path, "/eta")) {
+        if (o) o->eta_ms = json_int(body, "eta_ms", -1);
+        return 200;
+    }
+    if (sim_lease_ms == 0 && strstr(path, "/lease")) return 404;
+    if (!o) return 409;
+    if (strstr(path, "/lease")) return sim_http_renew(id - 1, 0);
+    lease_stats.ack_requests++;
+    lease_stats.acks++;
+    return sim_http_ack(id - 1, 0, json_int(body, "ok", 1) != 0);
+}
+
+void sim_http_note_station(const char *body)
+{
+    const char *st = body ? strstr(body, "\"station\":\"") : NULL;
+    if (st) sscanf(st + strlen("\"station\":\""), "%31[^\"]", device_station);
+    uint32_t load = json_int(body, "load", 0);
+    if (load > device_max_load) device_max_load = load;
+}
+
+int sim_http_order_json(int idx, char *body, int cap)
+{
+    const sim_order_t *o = &orders[idx];
+    int age_ms = (int)((sim_now_us() - o->avail_us) / 1000);
+    return snprintf(body, cap, "{\"status\":1,\"id\":%d,\"age_ms\":%d,\"lease_ms\":%d,\"recipe\":%s}",
+                    idx + 1, age_ms, sim_lease_ms, o->recipe_json);
+}
+
+static void put_le32(char *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) b[i] = (char)(v >> (8 * i));
+}
+
+// Binary response body: header, then one record per {"port":..,"volume_ml":..} object
+static int encode_binary(char *body, int cap, int status, int id, int age_ms, int lease_s,
+                         const char *recipe)
+{
+    int len = RECIPE_BIN_HEADER_LEN, n = 0;
+    for (const char *o = recipe; o && (o = strchr(o, '{')); o++) {
+        const char *end = strchr(o, '}');
+        const char *port = strstr(o, "\"port\":");
+        const char *vol = strstr(o, "\"volume_ml\":");
+        if (!end || !port || !vol || port > end || vol > end) continue;
+        if (len + RECIPE_BIN_ITEM_LEN > cap || n == 255) break;
+        int v = atoi(vol + strlen("\"volume_ml\":"));
+        body[len]     = (char)atoi(port + strlen("\"port\":"));
+        body[len + 1] = 0;
+        body[len + 2] = (char)(v & 0xff);
+        body[len + 3] = (char)(v >> 8);
+        len += RECIPE_BIN_ITEM_LEN;
+        n++;
+    }
+    body[0] = RECIPE_BIN_VERSION;
+    body[1] = (char)status;
+    body[2] = (char)n;
+    body[3] = (char)lease_s;
+    put_le32(body + 4, id);
+    put_le32(body + 8, age_ms);
+    return len;
+}
+
+static int wait_seconds(const char *url)
+{
+    const char *q = strstr(url, "wait=");
+    return q ? atoi(q + 5) : 0;
+}
+
+/* ---------------- Client API ---------------- */
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t c = heap_caps_calloc(1, sizeof(*c), MALLOC_CAP_DEFAULT);
+    if (!c) return NULL;
+    c->cfg = *config;
+    snprintf(c->url, sizeof(c->url), "%s", config->url);
+    return c;
+}
+
+static void emit(esp_http_client_handle_t c, esp_http_client_event_id_t id,
+                 char *data, int data_len)
+{
+    if (!c->cfg.event_handler) return;
+
+    esp_http_client_event_t evt = {
+        .event_id = id, .client = c, .user_data = c->cfg.user_data,
+        .data = data, .data_len = data_len,
+    };
+    c->cfg.event_handler(&evt);
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t c)
+{
+    int64_t rtt_us = sim_rtt_ms * 1000LL;
+
+    requests++;
+    bool hang;
+    if (!sim_wifi_link_ok(&hang)) {
+        sim_radio_busy(0);
+        if (hang) sim_sleep_until(sim_now_us() + c->cfg.timeout_ms * 1000LL);
+        c->connected = false;
+        emit(c, HTTP_EVENT_ERROR, NULL, 0);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    sim_radio_busy((c->connected ? 0 : rtt_us) + rtt_us / 2);
+    if (!c->connected) {
+        sim_sleep_until(sim_now_us() + rtt_us);    // TCP handshake
+        c->connected = true;
+        connections++;
+        emit(c, HTTP_EVENT_ON_CONNECTED, NULL, 0);
+    }
+    emit(c, HTTP_EVENT_HEADERS_SENT, NULL, 0);
+    sim_sleep_until(sim_now_us() + rtt_us / 2);    // request upstream
+
+    // Control requests: answered after the other half of the round trip
+    if (strstr(c->url, "/eta") || strstr(c->url, "/lease") || strstr(c->url, "/ack")) {
+        c->status = sim_http_control(c->url, c->post);
+        sim_radio_busy(rtt_us / 2);
+        sim_sleep_until(sim_now_us() + rtt_us / 2);
+        c->content_length = 0;
+        emit(c, HTTP_EVENT_ON_FINISH, NULL, 0);
+        return ESP_OK;
+    }
+
+    // Completions riding along: taken on arrival, even if the request is then held
+    static char acks_taken[12];
+    int n_acks = 0;
+    const char *acks = sim_http_mix_acks && c->post ? strstr(c->post, "\"acks\"") : NULL;
+    for (const char *a = acks; a && (a = strchr(a, '{')); a++) {
+        int aid = json_int(a, "id", 0);
+        n_acks++;
+        if (aid >= 1 && aid <= n_orders) sim_http_ack(aid - 1, 0, json_int(a, "ok", 1) != 0);
+    }
+    lease_stats.acks += n_acks;
+    snprintf(acks_taken, sizeof(acks_taken), "%d", n_acks);
+
+    // Station identity and load from the /mix body
+    sim_http_note_station(c->post);
+
+    // Long-poll: hold until this station may claim an order or the wait expires
+    int idx = sim_http_claim(0, json_int(c->post, "eta_ms", 0),
+                             sim_now_us() + wait_seconds(c->url) * 1000000LL, NULL, NULL);
+
+    static char body[BODY_MAX];
+    bool binary = c->accept_binary && !sim_http_json_only;
+    // The binary header carries whole seconds: round down, so renewals come early
+    int lease_s = sim_lease_ms <= 0 ? 0 : sim_lease_ms < 1000 ? 1
+                : sim_lease_ms / 1000 > 255 ? 255 : sim_lease_ms / 1000;
+    int len;
+    if (idx >= 0) {
+        const sim_order_t *o = &orders[idx];
+        int age_ms = (int)((sim_now_us() - o->avail_us) / 1000);
+        if (binary) {
+            len = encode_binary(body, sizeof(body), 1, idx + 1, age_ms, lease_s, o->recipe_json);
+        } else {
+            len = sim_http_order_json(idx, body, sizeof(body));
+        }
+    } else if (binary) {
+        len = encode_binary(body, sizeof(body), 2, 0, 0, 0, NULL);
+    } else {
+        len = snprintf(body, sizeof(body), "{\"status\":2}");
+    }
+    if (len >= (int)sizeof(body)) len = sizeof(body) - 1;
+    body_bytes += len;
+
+    sim_radio_busy(rtt_us / 2);
+    sim_sleep_until(sim_now_us() + rtt_us / 2);    // response downstream
+
+    c->status = 200;
+    c->content_length = len;
+
+    esp_http_client_event_t hdr = {
+        .event_id = HTTP_EVENT_ON_HEADER, .client = c, .user_data = c->cfg.user_data,
+        .header_key = "Content-Type",
+        .header_value = binary ? RECIPE_BIN_CONTENT_TYPE : "application/json",
+    };
+    if (c->cfg.event_handler) c->cfg.event_handler(&hdr);
+    hdr.header_key = "X-Acks";
+    hdr.header_value = acks_taken;
+    if (c->cfg.event_handler && sim_http_mix_acks) c->cfg.event_handler(&hdr);
+
+    int chunk = c->cfg.buffer_size > 0 ? c->cfg.buffer_size : DEFAULT_BUFFER_SIZE;
+    for (int off = 0; off < len; off += chunk) {
+        emit(c, HTTP_EVENT_ON_DATA, body + off, (len - off < chunk) ? len - off : chunk);
+    }
+    emit(c, HTTP_EVENT_ON_FINISH, NULL, 0);
+
+    if (!c->cfg.keep_alive_enable) c->connected = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t c, const char *url)
+{
+    snprintf(c->url, sizeof(c->url), "%s", url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c, const char *key,
+                                     const char *value)
+{
+    if (strcasecmp(key, "Accept") == 0) c->accept_binary = strstr(value, RECIPE_BIN_CONTENT_TYPE) != NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t c, const char *data, int len)
+{
+    c->post = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t c, int timeout_ms)
+{
+    c->cfg.timeout_ms = timeout_ms;
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c)
+{
+    return c->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t c)
+{
+    return c->content_length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t c)
+{
+    return false;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c)
+{
+    c->connected = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c)
+{
+    heap_caps_free(c);
+    return ESP_OK;
+}
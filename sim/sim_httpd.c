@@ -0,0 +1,63 @@
+// esp_http_server without sockets: registered handlers are called directly
+#include "sim.h"
+#include "esp_http_server.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_HANDLERS  8
+
+static httpd_uri_t handlers[MAX_HANDLERS];
+static int         n_handlers;
+static int         running;
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    *handle = &running;
+    running = 1;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    running = 0;
+    n_handlers = 0;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri)
+{
+    if (n_handlers == MAX_HANDLERS) return ESP_ERR_NO_MEM;
+    handlers[n_handlers++] = *uri;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    if (len == HTTPD_RESP_USE_STRLEN) len = strlen(buf);
+    size_t n = (size_t)len < req->resp_cap ? (size_t)len : req->resp_cap - 1;
+    memcpy(req->resp, buf, n);
+    req->resp[n] = '\0';
+    req->resp_len = n;
+    return ESP_OK;
+}
+
+int sim_httpd_get(const char *uri, char *buf, size_t size)
+{
+    for (int i = 0; running && i < n_handlers; i++) {
+        if (handlers[i].method != HTTP_GET || strcmp(handlers[i].uri, uri) != 0) continue;
+
+        httpd_req_t req = {
+            .uri = uri, .user_ctx = handlers[i].user_ctx,
+            .resp = buf, .resp_cap = size,
+        };
+        buf[0] = '\0';
+        if (handlers[i].handler(&req) != ESP_OK) return -1;
+        return (int)req.resp_len;
+    }
+    return -1;
+}
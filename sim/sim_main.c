@@ -0,0 +1,647 @@
+// pour_sim: runs app_main() on the virtual clock and reports the
+// per-channel actuation timeline once the replay is over.
+#include "sim.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_http_client.h"
+#include "nvs_flash.h"
+#include "pca9685.h"
+#include "actuator.h"
+#include "pour_scheduler.h"
+#include "order_pipeline.h"
+#include "trace.h"
+#include "flow_cal.h"
+#include "http_client.h"
+#include "journal.h"
+#include "metrics.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LINE_MAX_LEN   4096
+#define DRAIN_US       (300 * 1000000LL)   // keep running after the last order
+
+extern void app_main(void);
+
+bool sim_quiet;
+
+static const char *timeline_path;
+static const char *trace_path;
+static bool        show_metrics;
+static const char *scenario;
+static struct timespec wall_start;
+
+/* ---------------- ESP-IDF Odds and Ends ---------------- */
+void sim_log(char level, const char *tag, const char *fmt, ...)
+{
+    if (sim_quiet && level != 'E') return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    printf("%c (%lld) %s: ", level, (long long)(sim_now_us() / 1000), tag);
+    vprintf(fmt, ap);
+    putchar('\n');
+    va_end(ap);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:                   return "ESP_OK";
+    case ESP_FAIL:                 return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:           return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:    return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:     return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:    return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:          return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_HTTP_CONNECT:     return "ESP_ERR_HTTP_CONNECT";
+    case ESP_ERR_NVS_NOT_FOUND:    return "ESP_ERR_NVS_NOT_FOUND";
+    default:                       return "UNKNOWN_ERROR";
+    }
+}
+
+/* ---------------- Orders ---------------- */
+// One order per line: "<seconds> <recipe JSON array>", '#' starts a comment
+static int load_orders(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[LINE_MAX_LEN];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        char *rest;
+        double t = strtod(p, &rest);
+        while (*rest == ' ' || *rest == '\t') rest++;
+        rest[strcspn(rest, "\r\n")] = '\0';
+        if (rest == p || *rest != '[') {
+            fprintf(stderr, "%s: bad order line: %s\n", path, line);
+            fclose(f);
+            return -1;
+        }
+        sim_http_add_order((int64_t)(t * 1e6), rest);
+    }
+    fclose(f);
+    return 0;
+}
+
+static void generate_orders(int n, double mean_interval_s, int ports, unsigned seed)
+{
+    srand(seed);
+    double t = 0;
+
+    for (int i = 0; i < n; i++) {
+        double u = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+        t += -mean_interval_s * log1p(-u);
+
+        unsigned used = 0;
+        int n_items = 1 + rand() % (ports < 4 ? ports : 4);
+        char recipe[LINE_MAX_LEN];
+        int len = snprintf(recipe, sizeof(recipe), "[");
+        for (int k = 0; k < n_items; k++) {
+            int port;
+            do port = rand() % ports; while (used & (1u << port));
+            used |= 1u << port;
+            len += snprintf(recipe + len, sizeof(recipe) - len, "%s{\"port\":%d,\"volume_ml\":%d}",
+                            k ? "," : "", port, 2 + rand() % 9);
+        }
+        snprintf(recipe + len, sizeof(recipe) - len, "]");
+        sim_http_add_order((int64_t)(t * 1e6), recipe);
+    }
+}
+
+/* ---------------- Drink Boundaries ---------------- */
+// Linked with --wrap=pour_sched_run so every drink is timed exactly,
+// and --wrap=mix_pour so it is matched to its order
+typedef struct {
+    int64_t start_us;
+    int64_t first_pour_us;
+    int64_t end_us;
+    uint32_t late_max_us;
+    int      order;          // index into the server's orders, -1 if unknown
+} drink_t;
+
+static drink_t *drinks;
+static int      n_drinks;
+static int      pouring_order = -1;
+
+esp_err_t __real_mix_pour(const mix_order_t *order, pour_report_t *report);
+
+esp_err_t __wrap_mix_pour(const mix_order_t *order, pour_report_t *report)
+{
+    pouring_order = order->id - 1;
+    esp_err_t err = __real_mix_pour(order, report);
+    pouring_order = -1;
+    return err;
+}
+
+esp_err_t __real_pour_sched_run(const pour_item_t *items, int count, pour_report_t *report);
+
+esp_err_t __wrap_pour_sched_run(const pour_item_t *items, int count, pour_report_t *report)
+{
+    pour_report_t local;
+    if (!report) report = &local;
+
+    int64_t start = sim_now_us();
+    esp_err_t err = __real_pour_sched_run(items, count, report);
+
+    drinks = realloc(drinks, (n_drinks + 1) * sizeof(*drinks));
+    if (!drinks) abort();
+    drinks[n_drinks++] = (drink_t) {
+        .start_us      = start,
+        .first_pour_us = start + (int64_t)report->first_pour_ms * 1000,
+        .end_us        = sim_now_us(),
+        .late_max_us   = report->late_max_us,
+        .order         = pouring_order,
+    };
+    return err;
+}
+
+/* ---------------- Report ---------------- */
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void write_timeline(const sim_pwm_event_t *ev, int n)
+{
+    FILE *f = fopen(timeline_path, "w");
+    if (!f) {
+        perror(timeline_path);
+        return;
+    }
+    fprintf(f, "time_ms,channel,on,off,duty\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%.3f,%u,%u,%u,%.4f\n", ev[i].t_us / 1000.0, ev[i].channel,
+                ev[i].on, ev[i].off, ev[i].duty);
+    }
+    fclose(f);
+    printf("timeline: %d events written to %s\n", n, timeline_path);
+}
+
+// Exit status 3 if the order path touched the heap after warm-up, 4 if the
+// journal kept an order whose settled record had already gone out
+static int report(void)
+{
+    struct timespec wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_s = (wall_end.tv_sec - wall_start.tv_sec) +
+                    (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    double sim_s = sim_now_us() / 1e6;
+
+    int n_ev, n_orders;
+    const sim_pwm_event_t *ev = sim_pca9685_timeline(&n_ev);
+    const sim_order_t *orders = sim_http_orders(&n_orders);
+
+    printf("\n==== pour_sim report ====\n");
+    printf("virtual time %.1f s in %.2f s wall (%.0fx)\n", sim_s, wall_s,
+           wall_s > 0 ? sim_s / wall_s : 0);
+
+    int served = 0;
+    for (int i = 0; i < n_orders; i++) {
+        if (orders[i].dispatch_us >= 0) served++;
+    }
+    // Drinks the device poured for an order it was given (all of them, normally)
+    drink_t *timed_drinks = calloc(n_drinks + 1, sizeof(drink_t));
+    int timed = 0;
+    for (int i = 0; i < n_drinks; i++) {
+        if (drinks[i].order >= 0 && drinks[i].order < n_orders) timed_drinks[timed++] = drinks[i];
+    }
+    int64_t *to_pour = calloc(timed + 1, sizeof(int64_t));
+    int64_t sum_pour = 0, sum_cycle = 0, sum_gap = 0;
+    int n_cycle = 0;
+
+    for (int i = 0; i < timed; i++) {
+        const drink_t *d = &timed_drinks[i];
+        to_pour[i] = d->first_pour_us - orders[d->order].avail_us;
+        sum_pour += to_pour[i];
+
+        // Back-to-back: the order was on the server before the previous drink finished
+        if (i > 0 && orders[d->order].avail_us <= timed_drinks[i - 1].end_us) {
+            sum_cycle += d->end_us - timed_drinks[i - 1].end_us;
+            sum_gap += d->start_us - timed_drinks[i - 1].end_us;
+            n_cycle++;
+        }
+    }
+
+    printf("orders: %d scheduled, %d dispatched, %d poured\n", n_orders, served, n_drinks);
+
+    // Every station's share of the queue, from the orders acknowledged as poured
+    int per_station[SIM_STATIONS_MAX] = { 0 }, done = 0;
+    int64_t first_avail = -1, last_done = 0;
+    for (int i = 0; i < n_orders; i++) {
+        if (orders[i].done_us < 0) continue;
+        per_station[orders[i].station]++;
+        done++;
+        if (first_avail < 0 || orders[i].avail_us < first_avail) first_avail = orders[i].avail_us;
+        if (orders[i].done_us > last_done) last_done = orders[i].done_us;
+    }
+    uint32_t max_load;
+    const char *station = sim_http_device_station(&max_load);
+    printf("stations: %s %d (max load %u)", station[0] ? station : "device", per_station[0], max_load);
+    for (int p = 1; p <= sim_peers; p++) {
+        sim_peer_stats_t ps;
+        sim_stations_get_stats(p, &ps);
+        printf(", peer%d %d", p, per_station[p]);
+        if (ps.dropped) printf(" (%u dropped)", ps.dropped);
+    }
+    if (done > 0 && last_done > first_avail) {
+        printf("; %d acknowledged -> %.0f drinks/hour aggregate", done,
+               done * 3600e6 / (last_done - first_avail));
+    }
+    printf("\n");
+
+    sim_lease_stats_t ls;
+    sim_http_get_lease_stats(&ls);
+    order_pipeline_stats_t ps;
+    order_pipeline_get_stats(&ps);
+    printf("leases: %d ms, %u renewals, %u expired and re-dispatched, %u handed back, "
+           "%u late acks; device dropped %u lost while queued\n", sim_lease_ms, ls.renewals,
+           ls.expired, ls.handed_back, ls.late_acks, ps.lost);
+
+    journal_stats_t js;
+    journal_get_stats(&js);
+    sim_flash_stats_t fs;
+    sim_flash_get_stats(&fs);
+    printf("journal: %u records (%u copied forward) in %u writes, %u sector erases "
+           "(busiest sector %u), %u changes coalesced, flash busy %.0f ms",
+           js.records, js.copies, js.batches, js.erases, fs.max_sector_erases, js.coalesced,
+           fs.busy_us / 1e3);
+    if (fs.bad_bits) printf(", %u BITS NOT PROGRAMMABLE", fs.bad_bits);
+    if (js.recovered) printf(", %u interrupted at boot", js.recovered);
+    printf("; %u completions in %u ack requests", ls.acks, ls.ack_requests);
+    if (js.undelivered) printf(", %u undelivered at the end", js.undelivered);
+    if (js.leaked) printf(", %u SETTLED ORDERS NEVER FREED", js.leaked);
+    printf("\n");
+    if (timed > 0) {
+        qsort(to_pour, timed, sizeof(int64_t), cmp_i64);
+        printf("order-to-first-pour: mean %.0f ms, p50 %.0f ms, p95 %.0f ms, max %.0f ms\n",
+               sum_pour / 1e3 / timed, to_pour[timed / 2] / 1e3,
+               to_pour[(int)(timed * 0.95)] / 1e3, to_pour[timed - 1] / 1e3);
+    }
+    if (n_cycle > 0) {
+        double cycle_s = sum_cycle / 1e6 / n_cycle;
+        printf("back-to-back drinks: %d, gap mean %.0f ms, cycle mean %.2f s -> capacity %.0f drinks/hour\n",
+               n_cycle, sum_gap / 1e3 / n_cycle, cycle_s, 3600.0 / cycle_s);
+    }
+    free(to_pour);
+
+    // Last ETA the device reported vs how long the drink took. A nozzle
+    // kept out for an order fetched mid-drink skips its retract, and the
+    // device then reports the earlier end.
+    int n_eta = 0, n_exact = 0;
+    int64_t min_eta_err = 0, max_eta_err = 0;
+    uint32_t late_max_us = 0;
+    for (int i = 0; i < timed; i++) {
+        const drink_t *d = &timed_drinks[i];
+        if (d->late_max_us > late_max_us) late_max_us = d->late_max_us;
+        if (orders[d->order].eta_ms < 0) continue;
+        int64_t err = (d->end_us - d->start_us) - orders[d->order].eta_ms * 1000LL;
+        if (n_eta == 0 || err < min_eta_err) min_eta_err = err;
+        if (n_eta == 0 || err > max_eta_err) max_eta_err = err;
+        if (llabs(err) < 1000) n_exact++;
+        n_eta++;
+    }
+    printf("eta: %d reported, %d within 1 ms, actual - ETA %+.1f .. %+.1f ms; "
+           "timeline writes at most %u us late\n",
+           n_eta, n_exact, min_eta_err / 1e3, max_eta_err / 1e3, late_max_us);
+
+    // Liquid: what was asked for against what the model says the solenoids let through
+    double asked_ml = 0, poured_ml = 0, open_s = 0;
+    for (int i = 0; i < timed; i++) {
+        const char *recipe = orders[timed_drinks[i].order].recipe_json;
+        for (const char *q = recipe; (q = strstr(q, "\"volume_ml\":")); q++) {
+            asked_ml += atoi(q + strlen("\"volume_ml\":"));
+        }
+    }
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        int64_t since = -1;
+        for (int e = 0; e < n_ev; e++) {
+            if (ev[e].channel != p + POUR_SOLENOID_OFFSET) continue;
+            if (ev[e].duty > 0 && since < 0) {
+                since = ev[e].t_us;
+            } else if (ev[e].duty == 0 && since >= 0) {
+                poured_ml += sim_flow_ml(p, (ev[e].t_us - since) / 1e3);
+                open_s += (ev[e].t_us - since) / 1e6;
+                since = -1;
+            }
+        }
+    }
+    int calibrated = 0;
+    for (int p = 0; p < POUR_MAX_PORTS; p++) {
+        flow_curve_t curve;
+        flow_cal_get(p, &curve);
+        calibrated += curve.n_points > 0;
+    }
+    printf("flow: %d/%d ports calibrated, %.0f ml ordered, %.0f ml poured (%+.1f%%), "
+           "solenoids open %.1f s\n", calibrated, POUR_MAX_PORTS, asked_ml, poured_ml,
+           asked_ml > 0 ? 100.0 * (poured_ml - asked_ml) / asked_ml : 0, open_s);
+    free(timed_drinks);
+
+    pour_nozzle_stats_t nz;
+    pour_sched_get_nozzle_stats(&nz);
+    printf("nozzles: %u extends, %u retracts, %u / %u saved, servo travel %.1f s (%.0f ms per drink)\n",
+           nz.extends, nz.retracts, nz.extends_saved, nz.retracts_saved, nz.travel_ms / 1e3,
+           n_drinks ? (double)nz.travel_ms / n_drinks : 0);
+
+    printf("http: %d requests over %d connections, %lld bytes of %s /mix bodies\n",
+           sim_http_requests(), sim_http_connections(), (long long)sim_http_body_bytes(),
+           sim_http_json_only ? "JSON" : "negotiated");
+
+    sim_wifi_stats_t wifi;
+    sim_wifi_get_stats(&wifi);
+    printf("wifi: first IP at %.0f ms (%s), %u attempts, %u full scans, %u link losses",
+           wifi.first_ip_us / 1e3, wifi.dhcp_skipped ? "cached lease" : "DHCP",
+           wifi.attempts, wifi.scans, wifi.link_losses);
+    if (wifi.recovered_us >= 0) {
+        printf(", IP back %.0f ms after the AP returned",
+               (wifi.recovered_us - sim_wifi_drop_at_us) / 1e3 - sim_wifi_outage_ms);
+    }
+    printf("\n");
+
+    sim_mqtt_stats_t mq;
+    sim_mqtt_get_stats(&mq);
+    if (mq.connects) {
+        printf("mqtt: %u connects, %u publishes, %u orders pushed (%lld bytes), %u pings\n",
+               mq.connects, mq.publishes, mq.pushed, (long long)mq.pushed_bytes, mq.pings);
+    }
+    sim_radio_stats_t radio;
+    sim_radio_get_stats(&radio);
+    printf("radio (%s): on %.1f s (%.1f%% of the run) in %u wake-ups, %.0f ms per drink\n",
+           MIX_TRANSPORT == MIX_TRANSPORT_MQTT ? "MQTT" : "HTTP", radio.on_us / 1e6,
+           sim_s > 0 ? 100.0 * radio.on_us / 1e6 / sim_s : 0, radio.wakeups,
+           n_drinks ? radio.on_us / 1e3 / n_drinks : 0);
+
+    sim_cpu_stats_t cpu;
+    sim_cpu_get_stats(&cpu);
+    if (cpu.net_load_pct) {
+        printf("cpu: network bursts take %d%% of core 0, %u wake-ups delayed, by at most %lld us\n",
+               cpu.net_load_pct, cpu.delayed, (long long)cpu.max_delay_us);
+    }
+
+    sim_i2c_stats_t bus;
+    sim_i2c_get_stats(&bus);
+    printf("i2c: %u kHz, %u transactions, %u bytes, %u nacks, busy %.3f s (%.3f%%)\n",
+           sim_i2c_clock_hz() / 1000, bus.transactions, bus.bytes, bus.nacks, bus.busy_us / 1e6,
+           sim_s > 0 ? 100.0 * bus.busy_us / 1e6 / sim_s : 0);
+    pca9685_stats_t drv;
+    pca9685_get_stats(&drv);
+    printf("i2c driver: %.1f ms in bus calls (%.0f us per drink), %u errors\n",
+           drv.call_us / 1e3, n_drinks ? (double)drv.call_us / n_drinks : 0, drv.errors);
+    if (sim_i2c_glitch_every) {
+        printf("i2c faults: %u glitches (%u held the bus, %u transactions timed out), %u bus resets; "
+               "driver rewrote %u channels, %u recoveries, %u unrecovered, longest repair %u us\n",
+               bus.glitches, bus.hangs, bus.hung_txns, bus.resets, drv.retries, drv.recoveries,
+               drv.unrecovered, drv.repair_max_us);
+    }
+    int most_high = 0;
+    for (int d = 0; d < POUR_BOARDS; d++) most_high += sim_pca9685_most_high(d);
+    printf("pwm: at most %d outputs high at once (boards summed), driver peak %u, %u with every "
+           "pulse starting at step 0\n", most_high, drv.concurrent_peak, drv.aligned_peak);
+    metrics_heap_t heap;
+    metrics_get_heap(&heap);
+    printf("heap: %u allocations (%u blocks live, peak %u, %u by the order path), "
+           "%u after warm-up over %u drinks (%u drinks allocated), min free %u bytes\n",
+           heap.allocs, heap.allocs - heap.frees, heap.peak_blocks, heap.task_allocs,
+           heap.steady_allocs, heap.steady_drinks, heap.dirty_drinks,
+           esp_get_minimum_free_heap_size());
+    printf("boards:");
+    for (int d = 0; d < POUR_BOARDS; d++) {
+        printf(" 0x%02x %.1f Hz%s", 0x40 + d, sim_pca9685_freq(d), d + 1 < POUR_BOARDS ? "," : "");
+    }
+    printf("\n");
+
+    printf("%-8s %12s %12s\n", "channel", "activations", "on_time_s");
+    for (int ch = 0; ch < PCA9685_MAX_CHANNELS; ch++) {
+        int activations = 0;
+        int64_t on_us = 0, since = -1;
+        for (int e = 0; e < n_ev; e++) {
+            if (ev[e].channel != ch) continue;
+            if (ev[e].duty > 0 && since < 0) {
+                since = ev[e].t_us;
+                activations++;
+            } else if (ev[e].duty == 0 && since >= 0) {
+                on_us += ev[e].t_us - since;
+                since = -1;
+            }
+        }
+        if (since >= 0) on_us += sim_now_us() - since;
+        if (activations) printf("%-8d %12d %12.2f\n", ch, activations, on_us / 1e6);
+    }
+
+    static const char *timing_names[ACT_PULSE_SOURCES] = { "tick", "precise", "timeline" };
+    for (int t = 0; t < ACT_PULSE_SOURCES; t++) {
+        actuator_pulse_stats_t st;
+        actuator_pulse_stats_get(t, &st);
+        if (st.count == 0) continue;
+        printf("pulses [%s]: %u, open-time error mean %+.0f us, min %+d us, max %+d us\n",
+               timing_names[t], st.count, (double)st.sum_err_us / st.count,
+               st.min_err_us, st.max_err_us);
+        for (int b = 0; b < ACTUATOR_HIST_BINS; b++) {
+            if (!st.early[b] && !st.late[b]) continue;
+            printf("  |err| %s %6u us: %6u early %6u late\n",
+                   b < ACTUATOR_HIST_BINS - 1 ? "< " : ">=",
+                   ACTUATOR_HIST_BASE_US << (b < ACTUATOR_HIST_BINS - 1 ? b : b - 1),
+                   st.early[b], st.late[b]);
+        }
+    }
+
+    if (show_metrics) {
+        static char text[8192];
+        if (sim_httpd_get("/metrics", text, sizeof(text)) >= 0) printf("\n---- /metrics ----\n%s", text);
+        else printf("/metrics: not registered\n");
+    }
+
+    if (timeline_path) write_timeline(ev, n_ev);
+#if TRACE_ENABLED
+    if (trace_path) {
+        FILE *f = fopen(trace_path, "w");
+        if (f) {
+            trace_dump(f);
+            fclose(f);
+            printf("trace: written to %s\n", trace_path);
+        } else {
+            perror(trace_path);
+        }
+    }
+#endif
+    if (heap.steady_allocs) return 3;
+    return js.leaked ? 4 : 0;
+}
+
+/* ---------------- Entry ---------------- */
+// First task: the modelled stations start polling alongside the firmware
+static void sim_entry(void)
+{
+    if (scenario) {
+        int status = sim_scenario_run(scenario);
+        if (status < 0) {
+            fprintf(stderr, "unknown scenario \"%s\"\n", scenario);
+            status = 2;
+        }
+        fflush(stdout);
+        exit(status);
+    }
+    sim_stations_start();
+    app_main();
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -o, --orders FILE      replay orders (\"<seconds> <recipe JSON array>\" per line)\n"
+            "  -g, --generate N       generate N random orders\n"
+            "  -i, --interval SEC     mean gap between generated orders (default 60)\n"
+            "  -p, --ports N          ports used by generated orders (default 4)\n"
+            "  -s, --seed N           random seed (default 1)\n"
+            "  -r, --rtt MS           network round trip (default %d)\n"
+            "  -u, --until SEC        stop at this virtual time (default: last order + 300 s)\n"
+            "  -d, --prefetch N       orders prefetched while pouring (default %d)\n"
+            "  -t, --timeline FILE    write the per-channel actuation timeline as CSV\n"
+            "  -T, --trace FILE       write the Chrome trace (needs SIM_TRACE)\n"
+            "  -m, --metrics          print a /metrics scrape at the end\n"
+            "  -n, --nvs FILE         keep NVS in FILE across runs (a second run is a reboot)\n"
+            "  -f, --flash FILE       keep the journal partition in FILE across runs\n"
+            "  -J, --journal-kb N     journal partition size, 8..64 in 4 KB sectors (default 64)\n"
+            "  -w, --wifi-drop SEC    take the AP away at this virtual time\n"
+            "  -W, --wifi-outage SEC  how long the AP stays away (default 10)\n"
+            "  -N, --net-load PCT     share of core 0 taken by Wi-Fi/lwIP bursts (default 0)\n"
+            "  -l, --lease N          last octet of the IP the DHCP server hands out (default 100)\n"
+            "  -R, --residency MS     nozzle residency window, 0 to retract after every drink (default %d)\n"
+            "  -C, --calibrate        fit every port's flow calibration to the liquid model at boot\n"
+            "  -j, --json             server ignores Accept and always answers JSON\n"
+            "  -A, --no-mix-acks      server ignores completions on /mix: they all go to /acks\n"
+            "  -L, --claim-lease MS   order lease the server grants, 0 for none (default %d)\n"
+            "  -S, --stations N       stations sharing the queue: the device + N-1 modelled (default 1)\n"
+            "  -F, --peer-fail PCT    chance a modelled station drops an order mid-drink (default 0)\n"
+            "  -G, --i2c-glitch N     lose about one I2C write in N; one in four of those hangs the bus\n"
+            "  -x, --scenario NAME    run a built-in check instead of orders: journal-wrap,\n"
+            "                         recipe-numbers, servo-profiles\n"
+            "  -q, --quiet            only print errors and the final report\n",
+            argv0, sim_rtt_ms, ORDER_QUEUE_DEPTH, POUR_RESIDENCY_MS, sim_lease_ms);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        { "orders",      required_argument, NULL, 'o' },
+        { "generate",    required_argument, NULL, 'g' },
+        { "interval",    required_argument, NULL, 'i' },
+        { "ports",       required_argument, NULL, 'p' },
+        { "seed",        required_argument, NULL, 's' },
+        { "rtt",         required_argument, NULL, 'r' },
+        { "until",       required_argument, NULL, 'u' },
+        { "prefetch",    required_argument, NULL, 'd' },
+        { "timeline",    required_argument, NULL, 't' },
+        { "trace",       required_argument, NULL, 'T' },
+        { "metrics",     no_argument,       NULL, 'm' },
+        { "nvs",         required_argument, NULL, 'n' },
+        { "flash",       required_argument, NULL, 'f' },
+        { "journal-kb",  required_argument, NULL, 'J' },
+        { "wifi-drop",   required_argument, NULL, 'w' },
+        { "wifi-outage", required_argument, NULL, 'W' },
+        { "net-load",    required_argument, NULL, 'N' },
+        { "lease",       required_argument, NULL, 'l' },
+        { "residency",   required_argument, NULL, 'R' },
+        { "calibrate",   no_argument,       NULL, 'C' },
+        { "json",        no_argument,       NULL, 'j' },
+        { "no-mix-acks", no_argument,       NULL, 'A' },
+        { "claim-lease", required_argument, NULL, 'L' },
+        { "stations",    required_argument, NULL, 'S' },
+        { "peer-fail",   required_argument, NULL, 'F' },
+        { "i2c-glitch",  required_argument, NULL, 'G' },
+        { "scenario",    required_argument, NULL, 'x' },
+        { "quiet",       no_argument,       NULL, 'q' },
+        { "help",        no_argument,       NULL, 'h' },
+        { 0 },
+    };
+
+    const char *orders_path = NULL;
+    int generate = 0, ports = 4;
+    unsigned seed = 1;
+    double interval_s = 60, until_s = -1, wifi_drop_s = -1;
+    int lease_octet = 100;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "o:g:i:p:s:r:u:d:t:T:mn:f:J:w:W:N:l:R:CjAL:S:F:G:x:qh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'o': orders_path = optarg;                     break;
+        case 'g': generate = atoi(optarg);                  break;
+        case 'i': interval_s = atof(optarg);                break;
+        case 'p': ports = atoi(optarg);                     break;
+        case 's': seed = strtoul(optarg, NULL, 0);          break;
+        case 'r': sim_rtt_ms = atoi(optarg);                break;
+        case 'u': until_s = atof(optarg);                   break;
+        case 'd': order_pipeline_set_depth(atoi(optarg));   break;
+        case 't': timeline_path = optarg;                   break;
+        case 'T': trace_path = optarg;                      break;
+        case 'm': show_metrics = true;                      break;
+        case 'n': sim_nvs_path = optarg;                    break;
+        case 'f': sim_flash_path = optarg;                  break;
+        case 'J': sim_flash_kb = atoi(optarg);              break;
+        case 'w': wifi_drop_s = atof(optarg);               break;
+        case 'W': sim_wifi_outage_ms = atof(optarg) * 1e3;  break;
+        case 'N': sim_cpu_set_net_load(atoi(optarg));       break;
+        case 'l': lease_octet = atoi(optarg);               break;
+        case 'R': pour_sched_set_residency(atoi(optarg));   break;
+        case 'C': sim_flow_calibrate = true;                break;
+        case 'j': sim_http_json_only = true;                break;
+        case 'A': sim_http_mix_acks = false;                break;
+        case 'L': sim_lease_ms = atoi(optarg);              break;
+        case 'S': sim_peers = atoi(optarg) - 1;             break;
+        case 'F': sim_peer_fail_pct = atoi(optarg);         break;
+        case 'G': sim_i2c_glitch_every = atoi(optarg);      break;
+        case 'x': scenario = optarg;                        break;
+        case 'q': sim_quiet = true;                         break;
+        default:  usage(argv[0]);                          return c == 'h' ? 0 : 2;
+        }
+    }
+    if (wifi_drop_s >= 0) sim_wifi_drop_at_us = (int64_t)(wifi_drop_s * 1e6);
+    sim_wifi_lease_ip = (sim_wifi_lease_ip & 0x00ffffff) | (uint32_t)(lease_octet & 0xff) << 24;
+
+    if (sim_peers < 0 || sim_peers > SIM_STATIONS_MAX - 1) {
+        fprintf(stderr, "--stations must be 1..%d\n", SIM_STATIONS_MAX);
+        return 2;
+    }
+    if (sim_flash_kb < 8 || sim_flash_kb > 64 || sim_flash_kb % 4) {
+        fprintf(stderr, "--journal-kb must be a multiple of 4 in 8..64\n");
+        return 2;
+    }
+    if (ports < 1 || ports > POUR_MAX_PORTS) {
+        fprintf(stderr, "--ports must be 1..%d\n", POUR_MAX_PORTS);
+        return 2;
+    }
+
+    if (orders_path && load_orders(orders_path) != 0) return 1;
+    if (generate > 0) generate_orders(generate, interval_s, ports, seed);
+
+    int n_orders;
+    const sim_order_t *orders = sim_http_orders(&n_orders);
+    int64_t last = 0;
+    for (int i = 0; i < n_orders; i++) {
+        if (orders[i].avail_us > last) last = orders[i].avail_us;
+    }
+    sim_set_end(until_s >= 0 ? (int64_t)(until_s * 1e6) : last + DRAIN_US);
+
+    actuator_pulse_stats_enable(true);
+    sim_on_finish(report);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    sim_run(sim_entry);
+    return 0;
+}
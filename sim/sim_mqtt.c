@@ -0,0 +1,338 @@
+// esp-mqtt client against an in-process broker that doubles as the
+// dispatcher (see sim.h). The broker runs as the client's "mqtt_task":
+// a device publish reaches it half an RTT after it is sent, and PUBACKs
+// and pushed messages reach the device half an RTT after that, as
+// MQTT_EVENT_PUBLISHED and MQTT_EVENT_DATA (in buffer-sized pieces).
+// While the link is down nothing moves; what was in flight arrives once
+// the client has reconnected, as a resumed session would resend it.
+#include "sim.h"
+#include "mqtt_client.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MQTT_TASK_STACK      6144
+#define MQTT_TASK_PRIORITY   5           // esp-mqtt's default
+#define MQTT_TASK_CORE       0           // sdkconfig: CONFIG_MQTT_USE_CORE_0
+#define DEFAULT_BUFFER_SIZE  1024
+#define DEFAULT_KEEPALIVE_S  120
+#define DEFAULT_RECONNECT_MS 10000
+#define INFLIGHT_MAX         16
+#define TOPIC_MAX            64
+#define BODY_MAX             8192
+#define SUBS_MAX             4
+
+typedef enum {
+    AT_BROKER,          // a device publish arrives
+    AT_DEVICE_PUBACK,   // the broker's PUBACK reaches the device
+    AT_DEVICE_DATA,     // a pushed message reaches the device
+} hop_t;
+
+typedef struct {
+    bool    used;
+    int64_t t_us;
+    uint8_t hop;
+    uint8_t qos;
+    bool    dup;        // resent after a reconnect
+    int     msg_id;
+    void   *outbox;     // the client's copy of a QoS 1 publish, freed on PUBACK
+    char    topic[TOPIC_MAX];
+    int     len;
+    char    body[BODY_MAX];
+} inflight_t;
+
+struct esp_mqtt_client {
+    esp_mqtt_client_config_t cfg;
+    char                client_id[32];
+    esp_event_handler_t handler;
+    void               *handler_arg;
+    bool                connected;
+    bool                ever_connected;
+    int                 next_msg_id;
+    char                subs[SUBS_MAX][TOPIC_MAX];
+    int                 n_subs;
+    uint32_t            posted;         // device publishes: wake the broker
+    bool                offer;          // the dispatcher may push one order
+    uint32_t            offer_busy_ms;
+    char                offer_to[TOPIC_MAX];
+};
+
+static esp_mqtt_client_handle_t the_client;
+static inflight_t               inflight[INFLIGHT_MAX];
+static sim_mqtt_stats_t         stats;
+
+static int64_t rtt_us(void)
+{
+    return sim_rtt_ms * 1000LL;
+}
+
+static void emit(esp_mqtt_client_handle_t c, esp_mqtt_event_t *ev)
+{
+    ev->client = c;
+    if (c->handler) c->handler(c->handler_arg, "MQTT_EVENTS", ev->event_id, ev);
+}
+
+static inflight_t *hop_new(int64_t t_us, hop_t hop, const char *topic, const char *data, int len)
+{
+    for (int i = 0; i < INFLIGHT_MAX; i++) {
+        inflight_t *m = &inflight[i];
+        if (m->used) continue;
+        *m = (inflight_t) { .used = true, .t_us = t_us, .hop = hop, .len = len };
+        snprintf(m->topic, sizeof(m->topic), "%s", topic);
+        memcpy(m->body, data, len);
+        m->body[len] = '\0';
+        return m;
+    }
+    fprintf(stderr, "sim_mqtt: more than %d messages in flight\n", INFLIGHT_MAX);
+    abort();
+}
+
+static inflight_t *hop_next(int64_t *t_us)
+{
+    inflight_t *next = NULL;
+    for (int i = 0; i < INFLIGHT_MAX; i++) {
+        if (inflight[i].used && (!next || inflight[i].t_us < next->t_us)) next = &inflight[i];
+    }
+    *t_us = next ? next->t_us : SIM_FOREVER;
+    return next;
+}
+
+static bool subscribed(esp_mqtt_client_handle_t c, const char *topic)
+{
+    for (int i = 0; i < c->n_subs; i++) {
+        if (strcmp(c->subs[i], topic) == 0) return true;
+    }
+    return false;
+}
+
+/* ---------------- Broker and Dispatcher ---------------- */
+// <prefix>/<station>/<name> -> <prefix>/<station>/<other>
+static void sibling_topic(char *out, size_t size, const char *topic, const char *other)
+{
+    const char *slash = strrchr(topic, '/');
+    int stem = slash ? (int)(slash - topic) : 0;
+    snprintf(out, size, "%.*s/%s", stem, topic, other);
+}
+
+static void push(const char *topic, const char *body, int len)
+{
+    hop_new(sim_now_us() + rtt_us() / 2, AT_DEVICE_DATA, topic, body, len)->qos = 1;
+}
+
+static void broker_receive(esp_mqtt_client_handle_t c, const inflight_t *m)
+{
+    const char *slash = strrchr(m->topic, '/');
+    const char *name = slash ? slash + 1 : m->topic;
+
+    if (strcmp(name, "ready") == 0) {
+        sim_http_note_station(m->body);
+        const char *eta = strstr(m->body, "\"eta_ms\":");
+        c->offer = true;
+        sibling_topic(c->offer_to, sizeof(c->offer_to), m->topic, "orders");
+        c->offer_busy_ms = eta ? strtoul(eta + strlen("\"eta_ms\":"), NULL, 10) : 0;
+    } else if (strcmp(name, "acks") == 0 || strcmp(name, "lease") == 0 || strcmp(name, "eta") == 0) {
+        char path[TOPIC_MAX + 1];
+        snprintf(path, sizeof(path), "/%s", name);
+        if (sim_http_control(path, m->body) == 409 && strcmp(name, "lease") == 0) {
+            const char *id = strstr(m->body, "\"id\":");
+            char topic[TOPIC_MAX], note[32];
+            sibling_topic(topic, sizeof(topic), m->topic, "revoked");
+            push(topic, note, snprintf(note, sizeof(note), "{\"id\":%d}",
+                                       id ? atoi(id + strlen("\"id\":")) : 0));
+        }
+    }
+    // "online" is for the dispatcher's dashboard
+}
+
+static void deliver(esp_mqtt_client_handle_t c, inflight_t *m)
+{
+    switch (m->hop) {
+    case AT_BROKER:
+        broker_receive(c, m);
+        if (m->qos) {
+            inflight_t *ack = hop_new(sim_now_us() + rtt_us() / 2, AT_DEVICE_PUBACK, m->topic, "", 0);
+            ack->msg_id = m->msg_id;
+            ack->outbox = m->outbox;
+        }
+        break;
+
+    case AT_DEVICE_PUBACK: {
+        heap_caps_free(m->outbox);
+        esp_mqtt_event_t ev = { .event_id = MQTT_EVENT_PUBLISHED, .msg_id = m->msg_id };
+        emit(c, &ev);
+        break;
+    }
+
+    case AT_DEVICE_DATA: {
+        if (!subscribed(c, m->topic)) break;
+        sim_radio_busy(0);              // the message, and our PUBACK straight back
+        int chunk = c->cfg.buffer.size > 0 ? c->cfg.buffer.size : DEFAULT_BUFFER_SIZE;
+        int off = 0;
+        do {
+            esp_mqtt_event_t ev = {
+                .event_id = MQTT_EVENT_DATA, .qos = m->qos, .dup = m->dup,
+                .data = m->body + off, .data_len = m->len - off < chunk ? m->len - off : chunk,
+                .total_data_len = m->len, .current_data_offset = off,
+            };
+            if (off == 0) {
+                ev.topic = m->topic;
+                ev.topic_len = strlen(m->topic);
+            }
+            emit(c, &ev);
+            off += chunk;
+        } while (off < m->len);
+        break;
+    }
+    }
+    m->used = false;
+}
+
+// Ends the broker's wait: a new publish from the device, or a lost link
+static bool broker_woken(void *arg)
+{
+    bool hang;
+    return the_client->posted != *(uint32_t *)arg || !sim_wifi_link_ok(&hang);
+}
+
+static void mqtt_task(void *arg)
+{
+    esp_mqtt_client_handle_t c = arg;
+    int keepalive_s = c->cfg.session.keepalive > 0 ? c->cfg.session.keepalive : DEFAULT_KEEPALIVE_S;
+    int64_t ping_us = keepalive_s * 1000000LL / 2;
+    int64_t reconnect_us = (c->cfg.network.reconnect_timeout_ms > 0
+                            ? c->cfg.network.reconnect_timeout_ms : DEFAULT_RECONNECT_MS) * 1000LL;
+    int64_t last_ping = 0;
+    bool hang;
+
+    while (1) {
+        int64_t now = sim_now_us();
+        if (!c->connected) {
+            if (!sim_wifi_link_ok(&hang)) {
+                sim_sleep_until(now + reconnect_us);
+                continue;
+            }
+            // TCP handshake, then CONNECT / CONNACK
+            sim_radio_busy(2 * rtt_us());
+            sim_sleep_until(now + 2 * rtt_us());
+            bool resumed = c->ever_connected && c->cfg.session.disable_clean_session;
+            if (!resumed) c->n_subs = 0;
+            c->connected = c->ever_connected = true;
+            stats.connects++;
+            last_ping = sim_now_us();
+            esp_mqtt_event_t ev = { .event_id = MQTT_EVENT_CONNECTED, .session_present = resumed };
+            emit(c, &ev);
+            continue;
+        }
+        if (!sim_wifi_link_ok(&hang)) {
+            // The broker publishes the last will: the offer goes with the station
+            c->connected = false;
+            c->offer = false;
+            for (int i = 0; i < INFLIGHT_MAX; i++) {
+                if (inflight[i].used && inflight[i].hop == AT_DEVICE_DATA) inflight[i].dup = true;
+            }
+            esp_mqtt_event_t ev = { .event_id = MQTT_EVENT_DISCONNECTED };
+            emit(c, &ev);
+            continue;
+        }
+
+        int64_t due;
+        inflight_t *m = hop_next(&due);
+        if (m && due <= now) {
+            deliver(c, m);
+            continue;
+        }
+        int64_t next = last_ping + ping_us;
+        if (next <= now) {
+            sim_radio_busy(rtt_us());
+            stats.pings++;
+            last_ping = now;
+            continue;
+        }
+        if (due < next) next = due;
+
+        uint32_t posted = c->posted;
+        if (c->offer) {
+            int idx = sim_http_claim(0, c->offer_busy_ms, next, broker_woken, &posted);
+            if (idx >= 0) {
+                static char body[BODY_MAX];
+                c->offer = false;
+                int len = sim_http_order_json(idx, body, sizeof(body));
+                if (len >= (int)sizeof(body)) len = sizeof(body) - 1;
+                push(c->offer_to, body, len);
+                stats.pushed++;
+                stats.pushed_bytes += len;
+            }
+            continue;
+        }
+        sim_wait(broker_woken, &posted, next);
+    }
+}
+
+/* ---------------- Client API ---------------- */
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client_handle_t c = heap_caps_calloc(1, sizeof(*c), MALLOC_CAP_DEFAULT);
+    if (!c) return NULL;
+    c->cfg = *config;
+    snprintf(c->client_id, sizeof(c->client_id), "%s",
+             config->credentials.client_id ? config->credentials.client_id : "");
+    c->cfg.credentials.client_id = c->client_id;
+    the_client = c;
+    return c;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t c, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    c->handler = event_handler;
+    c->handler_arg = event_handler_arg;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t c)
+{
+    if (xTaskCreatePinnedToCore(mqtt_task, "mqtt_task", MQTT_TASK_STACK, c, MQTT_TASK_PRIORITY,
+                                NULL, MQTT_TASK_CORE) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe_single(esp_mqtt_client_handle_t c, const char *topic, int qos)
+{
+    if (!c->connected) return -1;
+    if (!subscribed(c, topic) && c->n_subs < SUBS_MAX) {
+        snprintf(c->subs[c->n_subs++], TOPIC_MAX, "%s", topic);
+    }
+    sim_radio_busy(rtt_us());           // SUBSCRIBE / SUBACK
+    return ++c->next_msg_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t c, const char *topic, const char *data,
+                            int len, int qos, int retain)
+{
+    if (!c->connected) return -1;
+    if (len <= 0 && data) len = strlen(data);      // 0: data is a string
+    if (len >= BODY_MAX) return -1;
+
+    inflight_t *m = hop_new(sim_now_us() + rtt_us() / 2, AT_BROKER, topic, data ? data : "", len);
+    m->qos = qos;
+    if (qos) {
+        m->msg_id = ++c->next_msg_id;
+        m->outbox = heap_caps_malloc(len + 1, MALLOC_CAP_DEFAULT);
+        if (m->outbox) memcpy(m->outbox, m->body, len + 1);
+    }
+    sim_radio_busy(qos ? rtt_us() : rtt_us() / 2);
+    stats.publishes++;
+    c->posted++;
+    sim_notify();
+    return m->msg_id;
+}
+
+void sim_mqtt_get_stats(sim_mqtt_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,175 @@
+// NVS in memory. With --nvs FILE the store is loaded at nvs_flash_init()
+// and written back on every nvs_commit(), so consecutive runs behave like
+// reboots of the same board.
+#include "sim.h"
+#include "nvs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES   32
+#define MAX_HANDLES   8
+#define NAME_LEN      16    // 15 characters + NUL, as on the device
+#define BLOB_MAX      512
+
+const char *sim_nvs_path;
+
+typedef struct {
+    char    ns[NAME_LEN];
+    char    key[NAME_LEN];
+    size_t  len;
+    uint8_t data[BLOB_MAX];
+} entry_t;
+
+typedef struct {
+    bool            open;
+    char            ns[NAME_LEN];
+    nvs_open_mode_t mode;
+} handle_t;
+
+static entry_t  entries[MAX_ENTRIES];
+static int      n_entries;
+static handle_t handles[MAX_HANDLES];
+
+/* ---------------- Backing File ---------------- */
+// One "<namespace> <key> <hex>" line per entry
+static void load(void)
+{
+    FILE *f = fopen(sim_nvs_path, "r");
+    if (!f) return;    // first boot: empty flash
+
+    char ns[NAME_LEN], key[NAME_LEN], hex[2 * BLOB_MAX + 1];
+    while (n_entries < MAX_ENTRIES && fscanf(f, "%15s %15s %1024s", ns, key, hex) == 3) {
+        entry_t *e = &entries[n_entries++];
+        snprintf(e->ns, sizeof(e->ns), "%s", ns);
+        snprintf(e->key, sizeof(e->key), "%s", key);
+        e->len = strlen(hex) / 2;
+        for (size_t i = 0; i < e->len; i++) sscanf(hex + 2 * i, "%2hhx", &e->data[i]);
+    }
+    fclose(f);
+}
+
+static void save(void)
+{
+    if (!sim_nvs_path) return;
+
+    FILE *f = fopen(sim_nvs_path, "w");
+    if (!f) {
+        perror(sim_nvs_path);
+        return;
+    }
+    for (int i = 0; i < n_entries; i++) {
+        fprintf(f, "%s %s ", entries[i].ns, entries[i].key);
+        for (size_t j = 0; j < entries[i].len; j++) fprintf(f, "%02x", entries[i].data[j]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    if (sim_nvs_path) load();
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    n_entries = 0;
+    save();
+    return ESP_OK;
+}
+
+/* ---------------- Key/Value API ---------------- */
+static handle_t *lookup_handle(nvs_handle_t h)
+{
+    return (h >= 1 && h <= MAX_HANDLES && handles[h - 1].open) ? &handles[h - 1] : NULL;
+}
+
+static entry_t *find(const char *ns, const char *key)
+{
+    for (int i = 0; i < n_entries; i++) {
+        if (strcmp(entries[i].ns, ns) == 0 && strcmp(entries[i].key, key) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out)
+{
+    if (strlen(name) >= NAME_LEN) return ESP_ERR_INVALID_ARG;
+
+    // Like the device, a read-only open of a namespace never written fails
+    bool exists = false;
+    for (int i = 0; i < n_entries; i++) exists |= strcmp(entries[i].ns, name) == 0;
+    if (mode == NVS_READONLY && !exists) return ESP_ERR_NVS_NOT_FOUND;
+
+    for (int i = 0; i < MAX_HANDLES; i++) {
+        if (!handles[i].open) {
+            handles[i] = (handle_t) { .open = true, .mode = mode };
+            snprintf(handles[i].ns, sizeof(handles[i].ns), "%s", name);
+            *out = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t h)
+{
+    handle_t *hd = lookup_handle(h);
+    if (hd) hd->open = false;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *length)
+{
+    handle_t *hd = lookup_handle(h);
+    if (!hd) return ESP_ERR_NVS_INVALID_HANDLE;
+
+    entry_t *e = find(hd->ns, key);
+    if (!e) return ESP_ERR_NVS_NOT_FOUND;
+    if (!out) {
+        *length = e->len;
+        return ESP_OK;
+    }
+    if (*length < e->len) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out, e->data, e->len);
+    *length = e->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *value, size_t length)
+{
+    handle_t *hd = lookup_handle(h);
+    if (!hd) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (hd->mode != NVS_READWRITE) return ESP_ERR_NVS_READ_ONLY;
+    if (strlen(key) >= NAME_LEN || length > BLOB_MAX) return ESP_ERR_INVALID_ARG;
+
+    entry_t *e = find(hd->ns, key);
+    if (!e) {
+        if (n_entries == MAX_ENTRIES) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        e = &entries[n_entries++];
+        snprintf(e->ns, sizeof(e->ns), "%s", hd->ns);
+        snprintf(e->key, sizeof(e->key), "%s", key);
+    }
+    memcpy(e->data, value, length);
+    e->len = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+    handle_t *hd = lookup_handle(h);
+    if (!hd) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (hd->mode != NVS_READWRITE) return ESP_ERR_NVS_READ_ONLY;
+
+    entry_t *e = find(hd->ns, key);
+    if (!e) return ESP_ERR_NVS_NOT_FOUND;
+    *e = entries[--n_entries];
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t h)
+{
+    if (!lookup_handle(h)) return ESP_ERR_NVS_INVALID_HANDLE;
+    save();
+    return ESP_OK;
+}
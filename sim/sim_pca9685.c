@@ -0,0 +1,372 @@
+// i2c_master driver backed by emulated PCA9685 register files, one per
+// address from 0x40 up to SIM_PCA9685_DEVICES boards.
+// Each transaction occupies the bus for its real wire time at the
+// device's SCL rate. With a transaction queue, transmit returns at once
+// and a bus task runs the queue in order and calls on_trans_done, as the
+// ISR does on the device; without one, callers queue behind each other.
+// Glitches can be injected: a write lost on the wire, or SDA held low
+// so every transaction times out until the bus is reset.
+#include "sim.h"
+#include "driver/i2c_master.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include <stdlib.h>
+
+#define PCA9685_SIM_ADDR   0x40
+#define OSC_HZ             25000000.0
+
+#define REG_MODE1          0x00
+#define REG_LED0_ON_L      0x06
+#define REG_ALL_LED_ON_L   0xFA
+#define REG_PRESCALE       0xFE
+
+#define MODE1_AI           0x20
+#define MODE1_SLEEP        0x10
+#define LED_FULL           0x10    // bit 4 of ON_H / OFF_H
+
+#define N_CHANNELS         16
+#define MAX_QUEUE          64
+#define MAX_I2C_DEVICES    8
+
+typedef struct {
+    uint8_t regs[256];
+    float   duty_now[N_CHANNELS];
+    int     most_high;       // outputs high at the same step, the most seen
+} device_t;
+
+struct i2c_master_dev_t {
+    uint16_t              addr;
+    uint32_t              clk_hz;
+    i2c_master_callback_t on_done;
+    void                 *arg;
+};
+
+struct i2c_master_bus_t {
+    size_t depth;
+};
+
+typedef struct {
+    i2c_master_dev_handle_t dev;
+    const uint8_t          *data;    // read when the transfer runs, as by the hardware
+    size_t                  len;
+} txn_t;
+
+static struct i2c_master_bus_t bus;
+static bool                    bus_created;
+static struct i2c_master_dev_t i2c_devs[MAX_I2C_DEVICES];
+static int                     n_i2c_devs;
+
+static txn_t    queue[MAX_QUEUE];
+static int      q_head, q_count;     // an entry leaves once its callback has run
+
+static StaticTask_t bus_task_buf;
+
+static uint32_t        clk_hz = 100000;
+static int64_t         bus_free_us;
+static bool            sda_held;
+static uint32_t        glitch_rng = 0x9E3779B9u;
+static device_t        devices[SIM_PCA9685_DEVICES];
+static sim_i2c_stats_t stats;
+
+int sim_i2c_glitch_every;
+
+static sim_pwm_event_t *timeline;
+static int              timeline_len;
+static int              timeline_cap;
+
+/* ---------------- Register File ---------------- */
+static float channel_duty(const uint8_t *regs, int ch, uint16_t *on_out, uint16_t *off_out)
+{
+    const uint8_t *r = &regs[REG_LED0_ON_L + 4 * ch];
+    uint16_t on  = r[0] | (r[1] & 0x1F) << 8;
+    uint16_t off = r[2] | (r[3] & 0x1F) << 8;
+
+    *on_out = on;
+    *off_out = off;
+
+    if (regs[REG_MODE1] & MODE1_SLEEP) return 0.0f;
+    if (off & 0x1000) return 0.0f;
+    if (on & 0x1000) return 1.0f;
+    return (float)(((off & 0xFFF) - (on & 0xFFF)) & 0xFFF) / 4096.0f;
+}
+
+// Outputs high at the busiest step of the period; a count of
+// high outputs only rises at some channel's ON step
+static int outputs_high(const uint8_t *regs)
+{
+    uint16_t start[N_CHANNELS], len[N_CHANNELS];
+    int n = 0, most = 0;
+
+    if (regs[REG_MODE1] & MODE1_SLEEP) return 0;
+    for (int ch = 0; ch < N_CHANNELS; ch++) {
+        const uint8_t *r = &regs[REG_LED0_ON_L + 4 * ch];
+        uint16_t on  = r[0] | (r[1] & 0x1F) << 8;
+        uint16_t off = r[2] | (r[3] & 0x1F) << 8;
+        if (off & 0x1000) continue;
+        start[n] = on & 0x1000 ? 0 : on & 0xFFF;
+        len[n] = on & 0x1000 ? 4096 : ((off & 0xFFF) - (on & 0xFFF)) & 0xFFF;
+        if (len[n]) n++;
+    }
+    for (int i = 0; i < n; i++) {
+        int high = 0;
+        for (int j = 0; j < n; j++) {
+            if (((start[i] - start[j]) & 0xFFF) < len[j]) high++;
+        }
+        if (high > most) most = high;
+    }
+    return most;
+}
+
+// Timeline channels are global: board n reports 16 * n .. 16 * n + 15
+static void record_outputs(int index)
+{
+    device_t *dev = &devices[index];
+
+    int high = outputs_high(dev->regs);
+    if (high > dev->most_high) dev->most_high = high;
+
+    for (int ch = 0; ch < N_CHANNELS; ch++) {
+        uint16_t on, off;
+        float duty = channel_duty(dev->regs, ch, &on, &off);
+        if (duty == dev->duty_now[ch]) continue;
+        dev->duty_now[ch] = duty;
+
+        if (timeline_len == timeline_cap) {
+            timeline_cap = timeline_cap ? timeline_cap * 2 : 1024;
+            timeline = realloc(timeline, timeline_cap * sizeof(*timeline));
+            if (!timeline) abort();
+        }
+        timeline[timeline_len++] = (sim_pwm_event_t) {
+            .t_us = sim_now_us(), .channel = index * N_CHANNELS + ch, .on = on, .off = off, .duty = duty,
+        };
+    }
+}
+
+static void write_regs(int index, const uint8_t *data, size_t len)
+{
+    uint8_t *regs = devices[index].regs;
+    uint8_t reg = data[0];
+
+    for (size_t i = 1; i < len; i++) {
+        regs[reg] = data[i];
+
+        // ALL_LED_* fan out to every channel
+        if (reg >= REG_ALL_LED_ON_L && reg < REG_ALL_LED_ON_L + 4) {
+            for (int ch = 0; ch < N_CHANNELS; ch++) {
+                regs[REG_LED0_ON_L + 4 * ch + (reg - REG_ALL_LED_ON_L)] = data[i];
+            }
+        }
+        if (regs[REG_MODE1] & MODE1_AI) reg++;
+    }
+    record_outputs(index);
+}
+
+/* ---------------- Bus Model ---------------- */
+// Own generator, so injecting glitches leaves the order stream alone
+static uint32_t glitch_next(void)
+{
+    glitch_rng ^= glitch_rng << 13;
+    glitch_rng ^= glitch_rng >> 17;
+    glitch_rng ^= glitch_rng << 5;
+    return glitch_rng;
+}
+
+static void occupy_bus(int64_t bits, uint32_t scl_hz)
+{
+    int64_t wire_us = (bits * 1000000 + scl_hz - 1) / scl_hz;
+    int64_t start = sim_now_us() > bus_free_us ? sim_now_us() : bus_free_us;
+    bus_free_us = start + wire_us;
+    stats.busy_us += wire_us;
+    sim_sleep_until(bus_free_us);
+}
+
+// START + address byte + data bytes (9 clocks each, incl. ACK) + STOP.
+// A held bus fails at the address byte; a glitched write is not
+// acknowledged, and the board keeps what it had.
+static i2c_master_event_t transfer(uint16_t addr, uint32_t scl_hz, const uint8_t *data, size_t len)
+{
+    if (sda_held) {
+        occupy_bus(1 + 9, scl_hz);
+        stats.hung_txns++;
+        return I2C_EVENT_TIMEOUT;
+    }
+
+    occupy_bus(1 + 9 * (int64_t)(1 + len) + 1, scl_hz);
+    stats.transactions++;
+    stats.bytes += 1 + len;
+
+    int index = addr - PCA9685_SIM_ADDR;
+    if (index < 0 || index >= SIM_PCA9685_DEVICES) {
+        stats.nacks++;
+        return I2C_EVENT_NACK;
+    }
+    if (len > 0 && sim_i2c_glitch_every > 0 && glitch_next() % sim_i2c_glitch_every == 0) {
+        stats.glitches++;
+        if (glitch_next() % 4 == 0) {
+            stats.hangs++;
+            sda_held = true;
+            return I2C_EVENT_TIMEOUT;
+        }
+        return I2C_EVENT_NACK;
+    }
+    if (len > 0) write_regs(index, data, len);
+    return I2C_EVENT_DONE;
+}
+
+static bool have_txn(void *arg)
+{
+    return q_count > 0;
+}
+
+static bool queue_idle(void *arg)
+{
+    return q_count == 0;
+}
+
+static bool queue_space(void *arg)
+{
+    return q_count < (int)bus.depth;
+}
+
+static void bus_task(void *arg)
+{
+    while (1) {
+        sim_wait(have_txn, NULL, SIM_FOREVER);
+
+        txn_t *t = &queue[q_head];
+        i2c_master_event_data_t ev = { .event = transfer(t->dev->addr, t->dev->clk_hz, t->data, t->len) };
+        if (t->dev->on_done) t->dev->on_done(t->dev, &ev, t->dev->arg);
+
+        q_head = (q_head + 1) % MAX_QUEUE;
+        q_count--;
+        sim_notify();
+    }
+}
+
+static int64_t timeout_deadline(int timeout_ms)
+{
+    return timeout_ms < 0 ? SIM_FOREVER : sim_now_us() + (int64_t)timeout_ms * 1000;
+}
+
+/* ---------------- Driver API ---------------- */
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t *conf, i2c_master_bus_handle_t *out)
+{
+    if (bus_created) return ESP_ERR_INVALID_STATE;
+    if (conf->trans_queue_depth > MAX_QUEUE) return ESP_ERR_INVALID_ARG;
+
+    // Power-on register state: asleep, every output full-off
+    for (int d = 0; d < SIM_PCA9685_DEVICES; d++) {
+        uint8_t *regs = devices[d].regs;
+        regs[REG_MODE1] = MODE1_SLEEP | 0x01;
+        regs[REG_PRESCALE] = 0x1E;
+        for (int ch = 0; ch < N_CHANNELS; ch++) {
+            regs[REG_LED0_ON_L + 4 * ch + 3] = LED_FULL;
+        }
+    }
+
+    bus.depth = conf->trans_queue_depth;
+    if (bus.depth > 0) {
+        xTaskCreateStatic(bus_task, "i2c_bus", 0, NULL, configMAX_PRIORITIES - 1, NULL,
+                          &bus_task_buf);
+    }
+    bus_created = true;
+    *out = &bus;
+    return ESP_OK;
+}
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t handle, const i2c_device_config_t *conf,
+                                    i2c_master_dev_handle_t *out)
+{
+    if (n_i2c_devs == MAX_I2C_DEVICES) return ESP_ERR_NO_MEM;
+
+    i2c_master_dev_handle_t dev = &i2c_devs[n_i2c_devs++];
+    *dev = (struct i2c_master_dev_t) { .addr = conf->device_address, .clk_hz = conf->scl_speed_hz };
+    clk_hz = conf->scl_speed_hz;
+    *out = dev;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t dev)
+{
+    // Handles are never reused, so a removed one just goes quiet
+    dev->on_done = NULL;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t dev,
+                                              const i2c_master_event_callbacks_t *cbs,
+                                              void *arg)
+{
+    dev->on_done = cbs->on_trans_done;
+    dev->arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *data, size_t len,
+                              int timeout_ms)
+{
+    if (len == 0) return ESP_ERR_INVALID_ARG;
+
+    // Synchronous unless the bus has a queue and the device a callback
+    if (bus.depth == 0 || !dev->on_done) {
+        return transfer(dev->addr, dev->clk_hz, data, len) == I2C_EVENT_DONE ? ESP_OK : ESP_FAIL;
+    }
+
+    if (!sim_wait(queue_space, NULL, timeout_deadline(timeout_ms))) return ESP_ERR_TIMEOUT;
+    queue[(q_head + q_count) % MAX_QUEUE] = (txn_t) { .dev = dev, .data = data, .len = len };
+    q_count++;
+    sim_notify();
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_probe(i2c_master_bus_handle_t handle, uint16_t address, int timeout_ms)
+{
+    if (!sim_wait(queue_idle, NULL, timeout_deadline(timeout_ms))) return ESP_ERR_TIMEOUT;
+    return transfer(address, clk_hz, NULL, 0) == I2C_EVENT_DONE ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t handle, int timeout_ms)
+{
+    return sim_wait(queue_idle, NULL, timeout_deadline(timeout_ms)) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Nine SCL pulses free a slave stuck mid-byte, then STOP
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t handle)
+{
+    occupy_bus(9 + 1, clk_hz);
+    sda_held = false;
+    stats.resets++;
+    return ESP_OK;
+}
+
+/* ---------------- Sim Access ---------------- */
+const sim_pwm_event_t *sim_pca9685_timeline(int *count)
+{
+    *count = timeline_len;
+    return timeline;
+}
+
+int sim_pca9685_most_high(int index)
+{
+    return devices[index].most_high;
+}
+
+float sim_pca9685_freq(int index)
+{
+    return (float)(OSC_HZ / (4096.0 * (devices[index].regs[REG_PRESCALE] + 1)));
+}
+
+uint32_t sim_i2c_clock_hz(void)
+{
+    return clk_hz;
+}
+
+void sim_i2c_get_stats(sim_i2c_stats_t *out)
+{
+    *out = stats;
+}
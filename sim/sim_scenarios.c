@@ -0,0 +1,292 @@
+// Built-in checks that drive one firmware module directly, in place of
+// app_main, for paths a run of orders reaches too rarely to rely on.
+// Each prints one line and returns the exit status.
+//
+// journal-wrap: on a two-sector journal, an order settles while its held
+// record sits in the sector the next write erases. It must be freed with
+// that sector, not copied forward and then kept forever.
+//
+// recipe-numbers: the /mix parser against what cJSON makes of the same
+// numbers and literals, fed whole and a byte at a time, in a body and bare.
+//
+// servo-profiles: servo_sweep(), servo_move_to() and servo_rotate_smooth()
+// on one 50 Hz board. Each must take at most one batched write per PWM
+// frame, with the channels that move together sharing it, and stop where
+// it was sent. The sweep is set against the stepped loop it replaced.
+#include "sim.h"
+#include "actuator.h"
+#include "journal.h"
+#include "pca9685.h"
+#include "recipe_parser.h"
+#include "servo_control.h"
+#include "trajectory.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ---------------- journal-wrap ---------------- */
+static int journal_wrap(void)
+{
+    sim_flash_kb = 8;                       // 2 sectors of 256 records
+    if (journal_init() != ESP_OK) return 1;
+
+    // Order 1 stays owed throughout; order 2 settles as the ring wraps
+    journal_accepted(1);
+    journal_accepted(2);
+    journal_flush(true);
+
+    // Short-lived orders, two records each, until head is back at slot 0
+    journal_stats_t js;
+    journal_get_stats(&js);
+    for (int id = 3; js.records < 512; id++) {
+        journal_accepted(id);
+        journal_flush(true);
+        journal_finished(id, true);
+        journal_settled(id);
+        journal_flush(true);
+        journal_get_stats(&js);
+    }
+
+    // Order 1's record is the one that erases sector 0 and both records in it
+    journal_finished(1, true);
+    journal_finished(2, true);
+    journal_settled(2);
+    journal_flush(true);
+
+    journal_get_stats(&js);
+    bool ok = js.tracked == 1 && js.undelivered == 1 && !js.leaked;
+    printf("journal-wrap: %u records (%u copied forward), %u erases, %u tracked "
+           "(%u owed, %u leaked): %s\n", js.records, js.copies, js.erases, js.tracked,
+           js.undelivered, js.leaked, ok ? "ok" : "FAILED");
+    return ok ? 0 : 4;
+}
+
+/* ---------------- recipe-numbers ---------------- */
+static const struct {
+    const char *text;
+    bool        ok;
+    int         value;      // cJSON's valueint; an id that is no number stays 0
+} numbers[] = {
+    { "0",                 true,  0 },
+    { "-0",                true,  0 },
+    { "250",               true,  250 },
+    { "-1.5",              true,  -1 },
+    { "2.9e2",             true,  290 },
+    { "2.9E+2",            true,  290 },
+    { "1e-1",              true,  0 },
+    { "12.5e-1",           true,  1 },
+    { "2147483647",        true,  INT_MAX },
+    { "2147483648",        true,  INT_MAX },
+    { "-2147483648",       true,  INT_MIN },
+    { "99999999999",       true,  INT_MAX },
+    { "-99999999999",      true,  INT_MIN },
+    { "1e400",             true,  INT_MAX },
+    { "1e-400",            true,  0 },
+    { "123456789012345678901234e-20", true, 1234 },
+    { "0.000000000000000000000123e25", true, 1230 },
+    { "-1-2",              false, 0 },
+    { "01",                false, 0 },
+    { "1.",                false, 0 },
+    { ".5",                false, 0 },
+    { "1.e3",              false, 0 },
+    { "1e",                false, 0 },
+    { "1e+",               false, 0 },
+    { "-",                 false, 0 },
+    { "--1",               false, 0 },
+    { "+1",                false, 0 },
+    { "true",              true,  0 },
+    { "false",             true,  0 },
+    { "null",              true,  0 },
+    { "trxx",              false, 0 },
+    { "nope",              false, 0 },
+    { "fals",              false, 0 },
+    { "nulll",             false, 0 },
+    { "True",              false, 0 },
+};
+
+// The whole body, as the clients feed it: bytes after a complete value count
+static recipe_parse_result_t parse_in(recipe_parser_t *p, const char *body, int step)
+{
+    int len = strlen(body);
+    recipe_parse_result_t r = RECIPE_PARSE_MORE;
+
+    recipe_parser_init(p);
+    for (int at = 0; at < len && r != RECIPE_PARSE_ERROR; at += step) {
+        r = recipe_parser_feed(p, body + at, at + step < len ? step : len - at);
+    }
+    return r == RECIPE_PARSE_ERROR ? r : recipe_parser_finish(p);
+}
+
+static int recipe_numbers(void)
+{
+    static recipe_parser_t p;
+    int n = sizeof(numbers) / sizeof(numbers[0]), failed = 0;
+
+    for (int i = 0; i < n; i++) {
+        char body[96];
+        snprintf(body, sizeof(body), "{\"id\":%s,\"recipe\":[]}", numbers[i].text);
+
+        for (int step = 1; step <= 96; step += 95) {
+            bool bare = parse_in(&p, numbers[i].text, step) == RECIPE_PARSE_DONE;
+            bool ok = parse_in(&p, body, step) == RECIPE_PARSE_DONE;
+            int got = ok ? p.id : 0;
+            if (ok != numbers[i].ok || bare != numbers[i].ok || got != numbers[i].value) {
+                printf("  %s (%s): parsed %s, bare %s, id %d; expected %s, %d\n", numbers[i].text,
+                       step == 1 ? "a byte at a time" : "whole", ok ? "ok" : "error",
+                       bare ? "ok" : "error", got, numbers[i].ok ? "ok" : "error",
+                       numbers[i].value);
+                failed++;
+            }
+        }
+    }
+    int literals = 0;
+    for (int i = 0; i < n; i++) literals += numbers[i].text[0] >= 'A';
+    printf("recipe-numbers: %d numbers and %d literals, whole and a byte at a time: %s\n",
+           n - literals, literals, failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+
+/* ---------------- servo-profiles ---------------- */
+typedef struct {
+    uint32_t writes;        // I2C transactions; unchanged registers are not sent
+    int      changes;       // timeline events on the channel
+    int64_t  min_gap_us;    // closest two of them
+    uint16_t last;          // pulse width it stopped at, PCA9685_FULL_OFF if off
+    uint16_t peak;          // widest pulse it reached
+    bool     monotonic;     // never turned back (positional moves)
+} servo_moved_t;
+
+// Pulse width in counts; the driver moves ON to stagger channels
+static uint16_t servo_width(const sim_pwm_event_t *ev)
+{
+    if (ev->off & PCA9685_FULL_OFF) return PCA9685_FULL_OFF;
+    return (ev->off - ev->on) & (PCA9685_FULL_OFF - 1);
+}
+
+static void servo_mark(uint32_t *txns, int *events)
+{
+    sim_i2c_stats_t io;
+    sim_i2c_get_stats(&io);
+    *txns = io.transactions;
+    sim_pca9685_timeline(events);
+}
+
+// What a channel did since servo_mark(); rising is the way it should go
+static servo_moved_t servo_moved(uint8_t ch, uint32_t txns, int from, bool rising)
+{
+    sim_i2c_stats_t io;
+    sim_i2c_get_stats(&io);
+    servo_moved_t m = { .writes = io.transactions - txns, .min_gap_us = INT64_MAX, .monotonic = true };
+
+    int n;
+    const sim_pwm_event_t *ev = sim_pca9685_timeline(&n);
+    int64_t last_us = -1;
+    for (int i = from; i < n; i++) {
+        if (ev[i].channel != ch) continue;
+        uint16_t w = servo_width(&ev[i]);
+        if (last_us >= 0 && ev[i].t_us - last_us < m.min_gap_us) m.min_gap_us = ev[i].t_us - last_us;
+        if (m.changes && w != PCA9685_FULL_OFF && (w < m.last) == rising) m.monotonic = false;
+        if (w != PCA9685_FULL_OFF && w > m.peak) m.peak = w;
+        last_us = ev[i].t_us;
+        m.last = w;
+        m.changes++;
+    }
+    return m;
+}
+
+// A frame later than the last one, less the I2C and wake-up jitter
+static bool servo_spaced(const servo_moved_t *m)
+{
+    return m->changes < 2 || m->min_gap_us >= TRAJ_FRAME_US - 2000;
+}
+
+static int servo_profiles(void)
+{
+    pca9685_config_t board = { .addr = PCA9685_BASE_ADDR, .freq_hz = 50 };
+    if (pca9685_add(&board, NULL) != ESP_OK || actuator_init() != ESP_OK) return 1;
+
+    const uint16_t at0 = PCA9685_US_TO_COUNTS(1000), at90 = PCA9685_US_TO_COUNTS(1500);
+    const uint16_t at180 = PCA9685_US_TO_COUNTS(2000);
+    uint32_t txns;
+    int events;
+    bool ok = true;
+
+    // The loop servo_sweep() used to be: a write held delay_ms per degree
+    servo_set_angle(0, 0);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    servo_mark(&txns, &events);
+    int64_t t0 = sim_now_us();
+    for (int deg = 0; deg <= 180; deg++) {
+        actuator_cmd_t step = {
+            .channel = 0,
+            .off     = PCA9685_US_TO_COUNTS(1000 + deg * 1000 / 180),
+            .hold_ms = 5,
+            .end     = ACT_END_HOLD,
+        };
+        actuator_run(&step);
+    }
+    int64_t stepped_ms = (sim_now_us() - t0) / 1000;
+    servo_moved_t stepped = servo_moved(0, txns, events, true);
+
+    // 0 -> 180 at 1 degree per 5 ms: 900 ms, so 45 frames and the end
+    // point, 46 samples at most
+    servo_set_angle(0, 0);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    servo_mark(&txns, &events);
+    t0 = sim_now_us();
+    servo_sweep(0, 0, 180, 1, 5);
+    int64_t took_ms = (sim_now_us() - t0) / 1000;
+    servo_moved_t sweep = servo_moved(0, txns, events, true);
+    bool sweep_ok = sweep.writes <= 46 && sweep.last == at180 && sweep.monotonic &&
+                    servo_spaced(&sweep);
+    printf("servo-profiles: sweep 0-180 at 1 deg/5 ms: %u writes in %lld ms (stepped: %u in "
+           "%lld ms), %lld ms apart or more, stopped at %u (want %u): %s\n", sweep.writes,
+           (long long)took_ms, stepped.writes, (long long)stepped_ms,
+           (long long)sweep.min_gap_us / 1000,
+           sweep.last, at180, sweep_ok ? "ok" : "FAILED");
+    ok &= sweep_ok;
+
+    // Two channels moving together share every frame's write: channel 1
+    // queued raw, channel 0 through servo_move_to(), both 600 ms
+    servo_set_angle(1, 0);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    servo_mark(&txns, &events);
+    actuator_cmd_t cmd = { .channel = 1, .end = ACT_END_HOLD };
+    trajectory_plan(&cmd.motion, TRAJ_POSITION, TRAJ_TRAPEZOID, at0, at180, 600);
+    actuator_submit(&cmd);
+    servo_move_to(0, 90, 600, TRAJ_SCURVE);
+    vTaskDelay(pdMS_TO_TICKS(2 * TRAJ_FRAME_US / 1000));
+    servo_moved_t back = servo_moved(0, txns, events, false);
+    servo_moved_t up = servo_moved(1, txns, events, true);
+    bool pair_ok = back.writes <= 31 && back.last == at90 && up.last == at180 &&
+                   back.monotonic && up.monotonic && servo_spaced(&back) && servo_spaced(&up);
+    printf("servo-profiles: 180-90 s-curve with 0-180 trapezoid, 600 ms: %u writes for "
+           "%d + %d changes, stopped at %u and %u (want %u and %u): %s\n", back.writes,
+           back.changes, up.changes, back.last, up.last, at90, at180, pair_ok ? "ok" : "FAILED");
+    ok &= pair_ok;
+
+    // Continuous servo: up to full speed and back down, then off
+    servo_mark(&txns, &events);
+    servo_rotate_smooth(2, true, 0.5f);
+    vTaskDelay(pdMS_TO_TICKS(2 * TRAJ_FRAME_US / 1000));
+    servo_moved_t spin = servo_moved(2, txns, events, true);
+    bool spin_ok = spin.writes <= 31 && spin.peak == SERVO_FORWARD_COUNTS &&
+                   spin.last == PCA9685_FULL_OFF && servo_spaced(&spin);
+    printf("servo-profiles: smooth cw 0.5 s: %u writes, peak %u (want %u), ended %s: %s\n",
+           spin.writes, spin.peak, SERVO_FORWARD_COUNTS,
+           spin.last == PCA9685_FULL_OFF ? "full off" : "on", spin_ok ? "ok" : "FAILED");
+    ok &= spin_ok;
+
+    return ok ? 0 : 1;
+}
+
+/* ---------------- Dispatch ---------------- */
+int sim_scenario_run(const char *name)
+{
+    if (strcmp(name, "journal-wrap") == 0) return journal_wrap();
+    if (strcmp(name, "recipe-numbers") == 0) return recipe_numbers();
+    if (strcmp(name, "servo-profiles") == 0) return servo_profiles();
+    return -1;
+}
@@ -0,0 +1,90 @@
+// Modelled peer stations sharing the simulated /mix queue with the device.
+// A peer long-polls like the firmware, pours each order for the makespan
+// the firmware's own model predicts at POUR_MS_PER_ML (no prefetch, no
+// residency), renews its lease a third of the way through, and
+// acknowledges it. With sim_peer_fail_pct a peer sometimes drops an order
+// mid-drink without renewing or acknowledging, so the lease runs out and
+// the server dispatches it again.
+#include "sim.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "recipe_parser.h"
+#include "pour_scheduler.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PEER_STACK     4096
+#define PEER_PRIORITY  4
+
+int sim_peers;
+int sim_peer_fail_pct;
+
+static sim_peer_stats_t peer_stats[SIM_STATIONS_MAX];
+
+// Same parser as the firmware, on the body the server would send
+static uint32_t drink_ms(const char *recipe_json)
+{
+    static char body[8192];
+    static recipe_parser_t p;
+    pour_item_t items[POUR_MAX_ITEMS];
+    int n = 0;
+
+    int len = snprintf(body, sizeof(body), "{\"status\":1,\"recipe\":%s}", recipe_json);
+    recipe_parser_init(&p);
+    recipe_parser_feed(&p, body, len);
+    recipe_parser_finish(&p);
+    for (int i = 0; i < p.n_items && n < POUR_MAX_ITEMS; i++) {
+        if (p.items[i].port < 0 || p.items[i].port >= POUR_MAX_PORTS) continue;
+        items[n].port = p.items[i].port;
+        items[n].pour_ms = p.items[i].volume_ml > 0 ? p.items[i].volume_ml * POUR_MS_PER_ML : 0;
+        n++;
+    }
+    return pour_sched_predict(items, n, POUR_DEFAULT_MAX_SERVOS, POUR_DEFAULT_MAX_SOLENOIDS);
+}
+
+static void peer_task(void *arg)
+{
+    int station = (int)(intptr_t)arg;
+    sim_peer_stats_t *st = &peer_stats[station];
+    unsigned seed = station;
+    int64_t rtt_us = sim_rtt_ms * 1000LL;
+    int n_orders;
+    const sim_order_t *orders = sim_http_orders(&n_orders);
+
+    while (1) {
+        int idx = sim_http_claim(station, 0, SIM_FOREVER, NULL, NULL);
+        if (idx < 0) continue;
+        sim_sleep_until(sim_now_us() + rtt_us / 2);     // response downstream
+
+        int64_t end = sim_now_us() + drink_ms(orders[idx].recipe_json) * 1000LL;
+        if ((int)(rand_r(&seed) % 100) < sim_peer_fail_pct) {
+            st->dropped++;
+            sim_sleep_until(end);
+            continue;
+        }
+
+        int64_t renew_us = sim_lease_ms * 1000LL / 3;
+        while (renew_us > 0 && sim_now_us() + renew_us < end) {
+            sim_sleep_until(sim_now_us() + renew_us);
+            sim_http_renew(idx, station);
+        }
+        sim_sleep_until(end + rtt_us / 2);              // ack upstream
+        if (sim_http_ack(idx, station, true) == 200) st->poured++;
+    }
+}
+
+void sim_stations_start(void)
+{
+    if (sim_peers > SIM_STATIONS_MAX - 1) sim_peers = SIM_STATIONS_MAX - 1;
+    for (int s = 1; s <= sim_peers; s++) {
+        char name[16];
+        snprintf(name, sizeof(name), "peer%d", s);
+        xTaskCreate(peer_task, name, PEER_STACK, (void *)(intptr_t)s, PEER_PRIORITY, NULL);
+    }
+}
+
+void sim_stations_get_stats(int peer, sim_peer_stats_t *out)
+{
+    *out = peer_stats[peer];
+}
@@ -0,0 +1,275 @@
+// Wi-Fi station, netif and default event loop.
+// Connecting costs a scan (skipped when a BSSID and channel are pinned),
+// association, and DHCP (skipped when a static IP is set); events are
+// delivered from a "wifi" task. The AP can be taken away for an outage,
+// and the DHCP server's lease for this station can differ from a stale
+// static IP, in which case requests time out (see sim_wifi_link_ok()).
+// Radio-on time is tallied from the exchanges the transports report,
+// each holding the radio up for a short tail after its last packet.
+#include "sim.h"
+#include "esp_mac.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define MAX_HANDLERS  8
+
+int sim_wifi_scan_ms  = 1200;
+int sim_wifi_assoc_ms = 300;
+int sim_wifi_dhcp_ms  = 800;
+int64_t  sim_wifi_drop_at_us = -1;
+int      sim_wifi_outage_ms  = 10000;
+uint32_t sim_wifi_lease_ip   = 0x6401A8C0;   // 192.168.1.100
+
+static const uint8_t factory_mac[6] = { 0x7c, 0xdf, 0xa1, 0x0b, 0x5e, 0x42 };
+
+const esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+const esp_event_base_t IP_EVENT   = "IP_EVENT";
+
+typedef struct {
+    esp_event_base_t    base;
+    int32_t             id;
+    esp_event_handler_t fn;
+    void               *arg;
+} handler_t;
+
+static handler_t handlers[MAX_HANDLERS];
+static int n_handlers;
+
+static wifi_config_t sta_config;
+static bool          connect_requested;
+static bool          dhcp_requested;
+static StaticTask_t  wifi_task_buf;
+
+static bool          dhcp_running = true;
+static uint32_t      ip;                   // 0 until the interface has an address
+static bool          associated;
+static sim_wifi_stats_t stats;
+
+static struct sim_netif { int unused; } sta_netif;
+
+/* ---------------- Event Loop ---------------- */
+static void post(esp_event_base_t base, int32_t id, void *data)
+{
+    for (int i = 0; i < n_handlers; i++) {
+        if (handlers[i].base == base &&
+            (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == id)) {
+            handlers[i].fn(handlers[i].arg, base, id, data);
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id,
+                                     esp_event_handler_t handler, void *arg)
+{
+    if (n_handlers == MAX_HANDLERS) return ESP_ERR_NO_MEM;
+    handlers[n_handlers++] = (handler_t) {
+        .base = base, .id = id, .fn = handler, .arg = arg,
+    };
+    return ESP_OK;
+}
+
+/* ---------------- Station ---------------- */
+static bool ap_up(void)
+{
+    return sim_wifi_drop_at_us < 0 || sim_now_us() < sim_wifi_drop_at_us ||
+           sim_now_us() >= sim_wifi_drop_at_us + sim_wifi_outage_ms * 1000LL;
+}
+
+static bool wifi_pending(void *arg)
+{
+    return connect_requested || dhcp_requested;
+}
+
+static void got_ip(void)
+{
+    if (dhcp_running) {
+        sim_sleep_until(sim_now_us() + sim_wifi_dhcp_ms * 1000LL);
+        ip = sim_wifi_lease_ip;
+    }
+    if (!associated) return;    // lost the link meanwhile
+
+    if (stats.first_ip_us < 0) {
+        stats.first_ip_us = sim_now_us();
+        stats.dhcp_skipped = !dhcp_running;
+    }
+    if (sim_wifi_drop_at_us >= 0 && stats.recovered_us < 0 && sim_now_us() > sim_wifi_drop_at_us) {
+        stats.recovered_us = sim_now_us();
+    }
+
+    ip_event_got_ip_t got = {
+        .esp_netif = &sta_netif,
+        .ip_info = { .ip = { ip } },
+    };
+    post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got);
+}
+
+static void wifi_task(void *arg)
+{
+    post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL);
+
+    while (1) {
+        int64_t drop = (associated && sim_wifi_drop_at_us > sim_now_us()) ? sim_wifi_drop_at_us
+                                                                          : SIM_FOREVER;
+        sim_wait(wifi_pending, NULL, drop);
+
+        if (associated && !ap_up()) {
+            associated = false;
+            stats.link_losses++;
+            wifi_event_sta_disconnected_t ev = { .reason = WIFI_REASON_BEACON_TIMEOUT };
+            post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &ev);
+            continue;
+        }
+        if (dhcp_requested) {
+            dhcp_requested = false;
+            if (associated) got_ip();
+            continue;
+        }
+        connect_requested = false;
+        stats.attempts++;
+
+        int64_t t = sim_now_us();
+        bool pinned = sta_config.sta.bssid_set && sta_config.sta.channel != 0;
+        if (!pinned) {
+            t += sim_wifi_scan_ms * 1000LL;
+            stats.scans++;
+        }
+        t += sim_wifi_assoc_ms * 1000LL;
+        sim_sleep_until(t);
+
+        if (!ap_up()) {
+            wifi_event_sta_disconnected_t ev = { .reason = WIFI_REASON_NO_AP_FOUND };
+            post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &ev);
+            continue;
+        }
+
+        associated = true;
+        wifi_event_sta_connected_t conn = {
+            .channel = 6,
+            .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+        };
+        post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &conn);
+        got_ip();
+    }
+}
+
+bool sim_wifi_link_ok(bool *timeout)
+{
+    *timeout = associated && ip != 0 && ip != sim_wifi_lease_ip;
+    return associated && ip == sim_wifi_lease_ip;
+}
+
+void sim_wifi_get_stats(sim_wifi_stats_t *out)
+{
+    *out = stats;
+}
+
+/* ---------------- Radio ---------------- */
+static sim_radio_stats_t radio;
+static int64_t           radio_until;       // end of the current wake-up
+
+void sim_radio_busy(int64_t span_us)
+{
+    int64_t now = sim_now_us();
+    int64_t until = now + span_us + SIM_RADIO_TAIL_MS * 1000LL;
+
+    if (until <= radio_until) return;
+    if (now >= radio_until) {
+        radio.wakeups++;
+        radio.on_us += until - now;
+    } else {
+        radio.on_us += until - radio_until;
+    }
+    radio_until = until;
+}
+
+void sim_radio_get_stats(sim_radio_stats_t *out)
+{
+    *out = radio;
+    // A wake-up still in its tail counts up to now
+    int64_t now = sim_now_us();
+    if (radio_until > now) out->on_us -= radio_until - now;
+}
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    return &sta_netif;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *netif)
+{
+    if (dhcp_running) return ESP_OK;
+    dhcp_running = true;
+    ip = 0;
+    dhcp_requested = true;
+    sim_notify();
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif)
+{
+    dhcp_running = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t *netif, const esp_netif_ip_info_t *ip_info)
+{
+    if (dhcp_running) return ESP_ERR_INVALID_STATE;
+    ip = ip_info->ip.addr;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t iface, wifi_config_t *conf)
+{
+    sta_config = *conf;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    stats.first_ip_us = -1;
+    stats.recovered_us = -1;
+    xTaskCreateStaticPinnedToCore(wifi_task, "wifi", 4096, NULL, 23, NULL, &wifi_task_buf, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    connect_requested = true;
+    sim_notify();
+    return ESP_OK;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    for (int i = 0; i < 6; i++) mac[i] = factory_mac[i];
+    mac[5] += type;     // consecutive addresses per interface, like the eFuse base MAC
+    return ESP_OK;
+}
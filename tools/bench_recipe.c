@@ -0,0 +1,170 @@
+/*
+ * Host benchmark: streaming recipe_parser vs. the cJSON path it replaced,
+ * and the binary recipe layout vs. JSON.
+ *
+ *   cc -O2 -Imain -I$IDF_PATH/components/json/cJSON \
+ *      tools/bench_recipe.c main/recipe_parser.c \
+ *      $IDF_PATH/components/json/cJSON/cJSON.c \
+ *      -Wl,--wrap=malloc,--wrap=free -o bench_recipe
+ *   ./bench_recipe
+ *
+ * For recipes of 1..64 items, reports parse time per response and the
+ * peak heap held during the parse. malloc/free are wrapped at link time
+ * so every allocation on either path is counted. The body is fed to the
+ * streaming parser in 512-byte fragments, matching esp_http_client's
+ * default receive buffer. The binary body carries the same order and is
+ * decoded the same way; it is also checked fed 5 bytes at a time, so
+ * records split across fragments are exercised.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cJSON.h"
+#include "recipe_parser.h"
+
+#define ITERATIONS  20000
+#define FRAGMENT    512
+
+/* ---------------- Counting allocator ---------------- */
+void *__real_malloc(size_t n);
+void  __real_free(void *ptr);
+
+static size_t heap_now, heap_peak;
+
+void *__wrap_malloc(size_t n)
+{
+    size_t *p = __real_malloc(n + sizeof(size_t));
+    if (!p) return NULL;
+    *p = n;
+    heap_now += n;
+    if (heap_now > heap_peak) heap_peak = heap_now;
+    return p + 1;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (!ptr) return;
+    size_t *p = (size_t *)ptr - 1;
+    heap_now -= *p;
+    __real_free(p);
+}
+
+/* ---------------- Parse paths ---------------- */
+// Same lookups call_mix_endpoint() used to do
+static int parse_cjson(const char *body)
+{
+    int sum = 0;
+    cJSON *root = cJSON_Parse(body);
+    if (!root) return -1;
+
+    cJSON *status = cJSON_GetObjectItem(root, "status");
+    cJSON *recipe = cJSON_GetObjectItem(root, "recipe");
+    if (cJSON_IsNumber(status) && cJSON_IsArray(recipe)) {
+        int count = cJSON_GetArraySize(recipe);
+        for (int i = 0; i < count; i++) {
+            cJSON *item = cJSON_GetArrayItem(recipe, i);
+            cJSON *port = cJSON_GetObjectItem(item, "port");
+            cJSON *vol  = cJSON_GetObjectItem(item, "volume_ml");
+            if (cJSON_IsNumber(port) && cJSON_IsNumber(vol)) sum += port->valueint + vol->valueint;
+        }
+    }
+    cJSON_Delete(root);
+    return sum;
+}
+
+static int parse_stream(const char *body, size_t len, recipe_format_t format, size_t fragment)
+{
+    static recipe_parser_t p;
+    int sum = 0;
+
+    recipe_parser_init(&p);
+    recipe_parser_set_format(&p, format);
+    for (size_t off = 0; off < len; off += fragment) {
+        size_t n = (len - off < fragment) ? len - off : fragment;
+        recipe_parser_feed(&p, body + off, n);
+    }
+    if (recipe_parser_finish(&p) != RECIPE_PARSE_DONE) return -1;
+
+    for (int i = 0; i < p.n_items; i++) sum += p.items[i].port + p.items[i].volume_ml;
+    return sum;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static size_t make_body(char *buf, size_t cap, int items)
+{
+    size_t n = snprintf(buf, cap, "{\"status\":1,\"age_ms\":37,\"recipe\":[");
+    for (int i = 0; i < items; i++) {
+        n += snprintf(buf + n, cap - n, "%s{\"port\":%d,\"volume_ml\":%d}",
+                      i ? "," : "", i % 8, 5 + i);
+    }
+    n += snprintf(buf + n, cap - n, "]}");
+    return n;
+}
+
+// Same order in the binary layout (see recipe_parser.h)
+static size_t make_binary(char *buf, int items)
+{
+    uint8_t *b = (uint8_t *)buf;
+    memset(b, 0, RECIPE_BIN_HEADER_LEN);
+    b[0] = RECIPE_BIN_VERSION;
+    b[1] = 1;
+    b[2] = items;
+    b[8] = 37;                          // age_ms
+    for (int i = 0; i < items; i++) {
+        uint8_t *r = b + RECIPE_BIN_HEADER_LEN + i * RECIPE_BIN_ITEM_LEN;
+        r[0] = i % 8;
+        r[1] = 0;
+        r[2] = (5 + i) & 0xff;
+        r[3] = (5 + i) >> 8;
+    }
+    return RECIPE_BIN_HEADER_LEN + items * RECIPE_BIN_ITEM_LEN;
+}
+
+int main(void)
+{
+    static char body[8192];
+    static char bin[8192];
+
+    printf("%5s %7s %7s %12s %12s %12s %12s %12s\n", "items", "bytes", "bin_b",
+           "cjson_us", "stream_us", "binary_us", "cjson_peak", "stream_peak");
+
+    for (int items = 1; items <= 64; items *= 2) {
+        size_t len = make_body(body, sizeof(body), items);
+        size_t bin_len = make_binary(bin, items);
+
+        int expect = parse_cjson(body);
+        if (expect != parse_stream(body, len, RECIPE_FORMAT_JSON, FRAGMENT) ||
+            expect != parse_stream(bin, bin_len, RECIPE_FORMAT_BINARY, FRAGMENT) ||
+            expect != parse_stream(bin, bin_len, RECIPE_FORMAT_BINARY, 5)) {
+            fprintf(stderr, "mismatch at %d items\n", items);
+            return 1;
+        }
+
+        heap_peak = heap_now = 0;
+        double t0 = now_us();
+        for (int i = 0; i < ITERATIONS; i++) parse_cjson(body);
+        double cjson_us = (now_us() - t0) / ITERATIONS;
+        size_t cjson_peak = heap_peak;
+
+        heap_peak = heap_now = 0;
+        t0 = now_us();
+        for (int i = 0; i < ITERATIONS; i++) parse_stream(body, len, RECIPE_FORMAT_JSON, FRAGMENT);
+        double stream_us = (now_us() - t0) / ITERATIONS;
+
+        t0 = now_us();
+        for (int i = 0; i < ITERATIONS; i++) parse_stream(bin, bin_len, RECIPE_FORMAT_BINARY, FRAGMENT);
+        double binary_us = (now_us() - t0) / ITERATIONS;
+
+        printf("%5d %7zu %7zu %12.2f %12.2f %12.2f %12zu %12zu\n",
+               items, len, bin_len, cjson_us, stream_us, binary_us, cjson_peak, heap_peak);
+    }
+    return 0;
+}
@@ -0,0 +1,489 @@
+#!/usr/bin/env python3
+"""Local stand-in for the /mix order server.
+
+Serves the same JSON the device expects from POST /mix, keeps HTTP/1.1
+connections alive, and supports long-poll via ?wait=<seconds>.
+
+    python3 tools/mix_server.py --port 8081 --auto 10
+    python3 tools/mix_server.py --auto 1 --stations 3       # 3 simulated stations
+    curl -X POST localhost:8081/order -d '{"recipe":[{"port":1,"volume_ml":5}]}'
+
+Point MIX_SERVER in main/http_client.c at this machine. Each dispatched order
+carries "age_ms" (time queued on the server); the device adds its own share
+and logs order-to-first-pour latency. The server prints queue-wait stats
+per mode so poll and long-poll runs can be compared.
+
+Several stations can share the queue. Every /mix request names its station
+and load ({"station":..,"load":N,"eta_ms":M}); among the stations waiting
+for an order, the least busy one gets it. An order is claimed under a lease
+("lease_ms"): the station renews it with POST /lease {"station","id"} and
+finishes it with POST /ack {"station","id","ok"}. A lease that runs out
+puts the order back at the head of the queue; renewing or acknowledging an
+order the station no longer holds answers 409. Completions can also go
+in bulk: POST /acks {"station","acks":[{"id","ok"},..]}, or an "acks" list
+in the /mix body itself, which the reply's X-Acks header counts as taken.
+--stations N adds N
+simulated stations that pour each order for a modelled drink time, so
+aggregate drinks/hour can be measured with or without real devices.
+
+When the request's Accept header names application/x-pour-recipe, /mix
+answers in the fixed binary layout documented in main/recipe_parser.h
+instead of JSON; --json-only ignores Accept.
+
+Before pouring, the device posts {"station","id","eta_ms"} to /eta with
+the compiled drink duration; the server logs it against the dispatch time.
+
+--mqtt HOST[:PORT] also dispatches through an MQTT broker (e.g. a local
+mosquitto) for devices built with MIX_TRANSPORT_MQTT; it needs paho-mqtt.
+Under pour/<station>/ a device publishes "ready" ({"station","load",
+"eta_ms"}, room for one order), and the server pushes one order to
+"orders" at QoS 1 once it is the least busy waiter. "acks", "lease" and
+"eta" take the bodies of /ack(s), /lease and /eta; a renewal of an order
+the station no longer holds is answered on "revoked" with {"id"}. The
+retained "online" topic going to "0" (the device's last will) withdraws
+its offer. Push dispatches are reported as their own mode.
+
+    mosquitto -v &
+    python3 tools/mix_server.py --auto 10 --mqtt localhost
+"""
+
+import argparse
+import http.client
+import json
+import random
+import statistics
+import struct
+import threading
+import time
+from collections import defaultdict, deque
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+pending = deque()   # order ids waiting for a station, oldest first
+orders = {}         # order id -> order dict
+waiters = {}        # station -> eta_ms it reported, while its /mix is open
+cond = threading.Condition()
+ages = {"poll": [], "long-poll": [], "push": []}
+counters = {"requests": 0, "connections": 0, "body_bytes": 0,
+            "renewals": 0, "expired": 0, "late_acks": 0,
+            "acks": 0, "ack_requests": 0}
+poured = defaultdict(int)   # station -> orders acknowledged as poured
+first_order = None
+next_id = 1
+lease_ms = 30000
+
+BIN_CONTENT_TYPE = "application/x-pour-recipe"
+BIN_VERSION = 1
+
+# Modelled drink time for simulated stations (see pour_scheduler.h)
+EXTEND_S, RETRACT_S, SETTLE_S, S_PER_ML, SOLENOIDS = 0.9, 0.75, 0.2, 0.4, 2
+
+
+def enqueue(recipe):
+    global next_id, first_order
+    with cond:
+        order = {"id": next_id, "created": time.monotonic(), "recipe": recipe,
+                 "station": None, "lease_until": 0.0, "done": False, "claims": 0}
+        next_id += 1
+        orders[order["id"]] = order
+        pending.append(order["id"])
+        if first_order is None:
+            first_order = order["created"]
+        cond.notify_all()
+        return order["id"]
+
+
+def reap_expired(now):
+    """Call with cond held: orders whose lease ran out go back to the head."""
+    for order in orders.values():
+        if order["station"] and not order["done"] and order["lease_until"] <= now:
+            print(f"order {order['id']}: lease of {order['station']} expired, dispatching again")
+            order["station"] = None
+            pending.appendleft(order["id"])
+            counters["expired"] += 1
+
+
+def next_expiry():
+    held = [o["lease_until"] for o in orders.values() if o["station"] and not o["done"]]
+    return min(held) if held else None
+
+
+def least_busy(station):
+    mine = waiters[station]
+    return all(eta > mine or (eta == mine and other > station)
+               for other, eta in waiters.items() if other != station)
+
+
+def take(station, eta_ms, wait_s):
+    deadline = time.monotonic() + wait_s
+    with cond:
+        waiters[station] = eta_ms
+        try:
+            while True:
+                now = time.monotonic()
+                if lease_ms:
+                    reap_expired(now)
+                if pending and least_busy(station):
+                    order = orders[pending.popleft()]
+                    order["station"] = station
+                    order["claims"] += 1
+                    order["lease_until"] = now + lease_ms / 1000 if lease_ms else float("inf")
+                    return order
+                left = deadline - now
+                if left <= 0:
+                    return None
+                expiry = next_expiry() if lease_ms else None
+                cond.wait(min(left, expiry - now) if expiry else left)
+        finally:
+            del waiters[station]
+            cond.notify_all()
+
+
+def renew(station, order_id):
+    with cond:
+        order = orders.get(order_id)
+        now = time.monotonic()
+        if not order or order["station"] != station or order["done"] or order["lease_until"] <= now:
+            return False
+        order["lease_until"] = now + lease_ms / 1000
+        counters["renewals"] += 1
+        return True
+
+
+def ack(station, order_id, ok):
+    with cond:
+        order = orders.get(order_id)
+        if not order or order["station"] != station or order["done"]:
+            if ok:
+                counters["late_acks"] += 1
+            return False
+        if ok:
+            order["done"] = True
+            poured[station] += 1
+        else:
+            order["station"] = None
+            pending.appendleft(order_id)
+        cond.notify_all()
+    if ok:
+        report_stations()
+    return True
+
+
+def report(mode, age_ms):
+    ages[mode].append(age_ms)
+    a = sorted(ages[mode])
+    p95 = a[min(len(a) - 1, int(len(a) * 0.95))]
+    print(f"[{mode}] dispatched after {age_ms} ms queued "
+          f"(n={len(a)} mean={statistics.mean(a):.0f} p50={a[len(a) // 2]} p95={p95}); "
+          f"{counters['requests']} requests over {counters['connections']} connections, "
+          f"{counters['body_bytes']} body bytes")
+
+
+def report_stations():
+    total = sum(poured.values())
+    hours = (time.monotonic() - first_order) / 3600
+    shares = ", ".join(f"{s} {n}" for s, n in sorted(poured.items()))
+    print(f"{total} poured ({shares}) -> {total / hours:.0f} drinks/hour aggregate; "
+          f"{counters['renewals']} renewals, {counters['expired']} expired, "
+          f"{counters['late_acks']} late acks, "
+          f"{counters['acks']} acks in {counters['ack_requests']} ack requests")
+
+
+def encode_binary(status, order_id=0, age_ms=0, recipe=()):
+    lease_s = min(255, max(1, lease_ms // 1000)) if lease_ms else 0
+    body = struct.pack("<BBBBII", BIN_VERSION, status, len(recipe), lease_s, order_id, age_ms)
+    for item in recipe:
+        body += struct.pack("<BBH", item["port"], 0, item["volume_ml"])
+    return body
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep-alive by default
+
+    def setup(self):
+        super().setup()
+        counters["connections"] += 1
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def send_body(self, body, content_type, code=200, headers=None):
+        counters["body_bytes"] += len(body)
+        self.send_response(code)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def send_json(self, obj, code=200, headers=None):
+        self.send_body(json.dumps(obj).encode(), "application/json", code, headers)
+
+    def send_order(self, status, order_id=0, age_ms=0, recipe=(), acks_taken=0):
+        headers = {"X-Acks": str(acks_taken)}
+        binary = (not self.server.json_only and
+                  BIN_CONTENT_TYPE in self.headers.get("Accept", ""))
+        if binary:
+            self.send_body(encode_binary(status, order_id, age_ms, recipe), BIN_CONTENT_TYPE,
+                           headers=headers)
+        elif status == 1:
+            self.send_json({"status": status, "id": order_id, "age_ms": age_ms,
+                            "lease_ms": lease_ms, "recipe": list(recipe)}, headers=headers)
+        else:
+            self.send_json({"status": status}, headers=headers)
+
+    def take_acks(self, station, req):
+        """Apply a request's "acks" list; late ones are counted, not refused."""
+        acks = req.get("acks") or []
+        counters["acks"] += len(acks)
+        for a in acks:
+            ack(station, a.get("id"), bool(a.get("ok", 1)))
+        return len(acks)
+
+    def read_body(self):
+        n = int(self.headers.get("Content-Length", 0))
+        return self.rfile.read(n) if n else b""
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        body = self.read_body()
+        counters["requests"] += 1
+        try:
+            req = json.loads(body or b"{}")
+        except ValueError:
+            req = {}
+        station = str(req.get("station") or self.client_address[0])
+
+        if url.path == "/order":
+            self.send_json({"id": enqueue(req.get("recipe", []))})
+            return
+
+        if url.path == "/eta":
+            order = orders.get(req.get("id"))
+            since = ""
+            if order and order["station"] == station and "sent" in order:
+                since = f", {(time.monotonic() - order['sent']) * 1000:.0f} ms after dispatch"
+            print(f"order {req.get('id')} on {station}: ETA {req.get('eta_ms')} ms{since}")
+            self.send_json({"status": 0})
+            return
+
+        if url.path == "/lease":
+            if not lease_ms:
+                self.send_error(404)
+            elif renew(station, req.get("id")):
+                self.send_json({"lease_ms": lease_ms})
+            else:
+                self.send_json({"status": "not held"}, 409)
+            return
+
+        if url.path == "/acks":
+            counters["ack_requests"] += 1
+            self.take_acks(station, req)
+            self.send_json({"status": 0})
+            return
+
+        if url.path == "/ack":
+            counters["ack_requests"] += 1
+            counters["acks"] += 1
+            if ack(station, req.get("id"), bool(req.get("ok", 1))):
+                self.send_json({"status": 0})
+            else:
+                self.send_json({"status": "not held"}, 409)
+            return
+
+        if url.path != "/mix":
+            self.send_error(404)
+            return
+
+        acks_taken = self.take_acks(station, req)
+        wait_s = 0.0
+        if self.server.long_poll:
+            wait_s = float(parse_qs(url.query).get("wait", ["0"])[0])
+        order = take(station, int(req.get("eta_ms", 0)), min(wait_s, 60.0))
+        if order is None:
+            self.send_order(2, acks_taken=acks_taken)
+            return
+
+        order["sent"] = time.monotonic()
+        age_ms = int((order["sent"] - order["created"]) * 1000)
+        report("long-poll" if wait_s > 0 else "poll", age_ms)
+        self.send_order(1, order["id"], age_ms, order["recipe"], acks_taken=acks_taken)
+
+
+def auto_orders(period_s, ports):
+    while True:
+        time.sleep(random.expovariate(1.0 / period_s))
+        n = random.randint(1, min(4, ports))
+        recipe = [{"port": p, "volume_ml": random.randint(2, 10)}
+                  for p in random.sample(range(ports), n)]
+        enqueue(recipe)
+
+
+def drink_s(recipe):
+    """Rough makespan: one extend and retract, solenoids shared across ports."""
+    pours = [item["volume_ml"] * S_PER_ML + SETTLE_S for item in recipe]
+    if not pours:
+        return 0.0
+    return EXTEND_S + max(max(pours), sum(pours) / SOLENOIDS) + RETRACT_S
+
+
+def simulated_station(name, port, fail_pct):
+    conn = http.client.HTTPConnection("localhost", port)
+
+    def post(path, obj):
+        conn.request("POST", path, json.dumps(obj), {"Content-Type": "application/json"})
+        resp = conn.getresponse()
+        return resp.status, resp.read()
+
+    acks = []   # ride along with the next /mix, as the device sends them
+    while True:
+        status, body = post("/mix?wait=25", {"station": name, "load": 0, "eta_ms": 0,
+                                             "acks": acks})
+        acks = []
+        resp = json.loads(body)
+        if status != 200 or resp.get("status") != 1:
+            continue
+        order_id = resp["id"]
+        end = time.monotonic() + drink_s(resp["recipe"])
+        if random.random() * 100 < fail_pct:
+            time.sleep(end - time.monotonic())      # drops it: no renewals, no ack
+            continue
+        renew_s = resp.get("lease_ms", 0) / 3000
+        while renew_s and time.monotonic() + renew_s < end:
+            time.sleep(renew_s)
+            post("/lease", {"station": name, "id": order_id})
+        time.sleep(max(0.0, end - time.monotonic()))
+        acks.append({"id": order_id, "ok": 1})
+
+
+class MqttDispatcher:
+    """Pushes orders to stations that offered room on pour/<station>/ready."""
+
+    def __init__(self, host, port, prefix="pour"):
+        try:
+            import paho.mqtt.client as mqtt
+        except ImportError:
+            raise SystemExit("--mqtt needs paho-mqtt: pip install paho-mqtt")
+        self.prefix = prefix
+        self.offers = {}        # station -> Event that withdraws its offer
+        self.lock = threading.Lock()
+        if hasattr(mqtt, "CallbackAPIVersion"):     # paho-mqtt 2.x
+            self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, "pour-dispatcher")
+        else:
+            self.client = mqtt.Client("pour-dispatcher")
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.client.connect(host, port, keepalive=60)
+        self.client.loop_start()
+
+    def on_connect(self, client, userdata, flags, *rest):
+        for name in ("ready", "acks", "lease", "eta", "online"):
+            client.subscribe(f"{self.prefix}/+/{name}", qos=1)
+
+    def publish(self, station, name, obj):
+        self.client.publish(f"{self.prefix}/{station}/{name}", json.dumps(obj), qos=1)
+
+    def on_message(self, client, userdata, msg):
+        parts = msg.topic.split("/")
+        if len(parts) != 3:
+            return
+        station, name = parts[1], parts[2]
+        if name == "online":
+            if msg.payload == b"0":
+                self.withdraw(station)
+            return
+        try:
+            req = json.loads(msg.payload or b"{}")
+        except ValueError:
+            req = {}
+
+        if name == "ready":
+            with self.lock:
+                if station in self.offers:
+                    return      # the offer already stands
+                withdrawn = self.offers[station] = threading.Event()
+            threading.Thread(target=self.dispatch,
+                             args=(station, int(req.get("eta_ms", 0)), withdrawn),
+                             daemon=True).start()
+        elif name == "lease":
+            if lease_ms and not renew(station, req.get("id")):
+                self.publish(station, "revoked", {"id": req.get("id")})
+        elif name == "acks":
+            counters["ack_requests"] += 1
+            acks = req["acks"] if "acks" in req else [req]
+            counters["acks"] += len(acks)
+            for a in acks:
+                ack(station, a.get("id"), bool(a.get("ok", 1)))
+        elif name == "eta":
+            print(f"order {req.get('id')} on {station}: ETA {req.get('eta_ms')} ms (push)")
+
+    def withdraw(self, station):
+        with self.lock:
+            withdrawn = self.offers.pop(station, None)
+        if withdrawn:
+            withdrawn.set()
+            print(f"{station} went offline, offer withdrawn")
+
+    def dispatch(self, station, eta_ms, withdrawn):
+        # Short waits, so a withdrawn offer stops taking orders within a second
+        order = None
+        while order is None and not withdrawn.is_set():
+            order = take(station, eta_ms, 1.0)
+        with self.lock:
+            if self.offers.get(station) is withdrawn:
+                del self.offers[station]
+        if order is None:
+            return
+        order["sent"] = time.monotonic()
+        age_ms = int((order["sent"] - order["created"]) * 1000)
+        report("push", age_ms)
+        self.publish(station, "orders", {"status": 1, "id": order["id"], "age_ms": age_ms,
+                                         "lease_ms": lease_ms, "recipe": order["recipe"]})
+
+
+def main():
+    global lease_ms
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--port", type=int, default=8081)
+    ap.add_argument("--auto", type=float, metavar="SECONDS",
+                    help="generate random orders with this mean interval")
+    ap.add_argument("--ports", type=int, default=4, help="ports used by --auto")
+    ap.add_argument("--no-long-poll", action="store_true",
+                    help="ignore ?wait= to exercise the device's fallback")
+    ap.add_argument("--json-only", action="store_true",
+                    help="always answer /mix in JSON, whatever Accept says")
+    ap.add_argument("--lease", type=float, default=30, metavar="SECONDS",
+                    help="order lease granted with each dispatch, 0 for none (default 30)")
+    ap.add_argument("--stations", type=int, default=0,
+                    help="simulated stations sharing the queue with real devices")
+    ap.add_argument("--station-fail", type=float, default=0, metavar="PCT",
+                    help="chance a simulated station drops an order mid-drink")
+    ap.add_argument("--mqtt", metavar="HOST[:PORT]",
+                    help="also push orders through this MQTT broker (needs paho-mqtt)")
+    args = ap.parse_args()
+    lease_ms = int(args.lease * 1000)
+
+    if args.auto:
+        threading.Thread(target=auto_orders, args=(args.auto, args.ports),
+                         daemon=True).start()
+
+    if args.mqtt:
+        host, _, port = args.mqtt.partition(":")
+        MqttDispatcher(host, int(port or 1883))
+
+    srv = ThreadingHTTPServer(("", args.port), Handler)
+    srv.long_poll = not args.no_long_poll
+    srv.json_only = args.json_only
+    for i in range(args.stations):
+        threading.Thread(target=simulated_station,
+                         args=(f"sim-{i + 1}", args.port, args.station_fail),
+                         daemon=True).start()
+    print(f"mix server on :{args.port} (long-poll {'on' if srv.long_poll else 'off'}, "
+          f"lease {lease_ms} ms, {args.stations} simulated stations"
+          f"{', orders pushed via ' + args.mqtt if args.mqtt else ''})")
+    srv.serve_forever()
+
+
+if __name__ == "__main__":
+    main()